@@ -0,0 +1,117 @@
+// Synthetic OBJ meshes and images
+
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include "assetgen.h"
+
+using namespace std;
+
+unsigned long long write_synthetic_obj(const char *path, unsigned long long triangles, bool uvs, bool normals) {
+    // Grid of gx x gy quads, two triangles each
+    unsigned long long quads = triangles/2 > 0 ? triangles/2 : 1;
+    unsigned long long gx = (unsigned long long)ceil(sqrt((double)quads));
+    unsigned long long gy = (quads + gx - 1)/gx;
+
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "ERROR: could not write %s\n", path);
+        return 0;
+    }
+    // Large stdio buffer, the output runs to hundreds of MB at the top sizes
+    vector<char> buffer(1 << 20);
+    setvbuf(file, buffer.data(), _IOFBF, buffer.size());
+    fprintf(file, "# synthetic grid %llux%llu\n", gx, gy);
+
+    // Rippled height field y = a sin(kx) cos(kz) over [-1,1]^2
+    const double a = 0.05, k = 12.0;
+    for (unsigned long long j = 0; j <= gy; j++) {
+        for (unsigned long long i = 0; i <= gx; i++) {
+            double x = -1.0 + 2.0*i/gx, z = -1.0 + 2.0*j/gy;
+            fprintf(file, "v %.6f %.6f %.6f\n", x, a*sin(k*x)*cos(k*z), z);
+        }
+    }
+    if (uvs) {
+        for (unsigned long long j = 0; j <= gy; j++) {
+            for (unsigned long long i = 0; i <= gx; i++) {
+                fprintf(file, "vt %.6f %.6f\n", (double)i/gx, (double)j/gy);
+            }
+        }
+    }
+    if (normals) {
+        for (unsigned long long j = 0; j <= gy; j++) {
+            for (unsigned long long i = 0; i <= gx; i++) {
+                double x = -1.0 + 2.0*i/gx, z = -1.0 + 2.0*j/gy;
+                double dx = a*k*cos(k*x)*cos(k*z), dz = -a*k*sin(k*x)*sin(k*z);
+                double len = sqrt(dx*dx + 1.0 + dz*dz);
+                fprintf(file, "vn %.6f %.6f %.6f\n", -dx/len, 1.0/len, -dz/len);
+            }
+        }
+    }
+
+    // Same index for every stream of a corner (1-based)
+    const char *corner = uvs ? (normals ? " %llu/%llu/%llu" : " %llu/%llu") : (normals ? " %llu//%llu" : " %llu");
+    unsigned long long written = 0;
+    for (unsigned long long j = 0; j < gy && written < triangles; j++) {
+        for (unsigned long long i = 0; i < gx && written < triangles; i++) {
+            unsigned long long v00 = j*(gx + 1) + i + 1, v10 = v00 + 1, v01 = v00 + gx + 1, v11 = v01 + 1;
+            unsigned long long tris[2][3] = {{v00, v01, v11}, {v00, v11, v10}};
+            for (int t = 0; t < 2; t++) {
+                fputc('f', file);
+                for (int c = 0; c < 3; c++) {
+                    unsigned long long v = tris[t][c];
+                    fprintf(file, corner, v, v, v);
+                }
+                fputc('\n', file);
+            }
+            written += 2;
+        }
+    }
+
+    bool ok = ferror(file) == 0;
+    ok = (fclose(file) == 0) && ok;
+    if (!ok) {
+        fprintf(stderr, "ERROR: could not write %s\n", path);
+        return 0;
+    }
+    return written;
+}
+
+bool write_synthetic_tga(const char *path, int w, int h) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "ERROR: could not write %s\n", path);
+        return false;
+    }
+
+    // Uncompressed true color, 32 bpp, 8 alpha bits, top-left origin
+    unsigned char header[18] = {0};
+    header[2] = 2;
+    header[12] = w & 0xff;
+    header[13] = (w >> 8) & 0xff;
+    header[14] = h & 0xff;
+    header[15] = (h >> 8) & 0xff;
+    header[16] = 32;
+    header[17] = 0x28;
+    fwrite(header, 1, sizeof(header), file);
+
+    // BGRA gradient with a little hashed noise
+    vector<unsigned char> row(w*4);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            unsigned int hash = (unsigned int)x*73856093u ^ (unsigned int)y*19349663u;
+            row[4*x + 0] = (unsigned char)(255*y/h);
+            row[4*x + 1] = (unsigned char)((x ^ y) & 0xff);
+            row[4*x + 2] = (unsigned char)(255*x/w) ^ (unsigned char)(hash & 0x0f);
+            row[4*x + 3] = 255;
+        }
+        fwrite(row.data(), 1, row.size(), file);
+    }
+
+    bool ok = ferror(file) == 0;
+    ok = (fclose(file) == 0) && ok;
+    if (!ok) {
+        fprintf(stderr, "ERROR: could not write %s\n", path);
+    }
+    return ok;
+}
@@ -0,0 +1,14 @@
+#ifndef ASSETGEN_H
+#define ASSETGEN_H
+
+// Synthetic assets for load scaling tests (independent of the bundled models/textures)
+
+// Write a rippled grid as an indexed OBJ with triangles triangles (rounded up to even).
+// uvs/normals select the vt/vn streams, faces use v, v/vt, v//vn or v/vt/vn.
+// Returns the number of triangles written, 0 if the file could not be written.
+unsigned long long write_synthetic_obj(const char *path, unsigned long long triangles, bool uvs, bool normals);
+
+// Write a w x h 32-bit uncompressed TGA (top row first) with a gradient/noise pattern
+bool write_synthetic_tga(const char *path, int w, int h);
+
+#endif
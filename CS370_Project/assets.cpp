@@ -0,0 +1,247 @@
+// Lazy texture assets (background decoding, reference counts and eviction)
+
+#include <stdio.h>
+#include <algorithm>
+#include "../common/stb_image.h"
+#include "imageutils.h"
+#include "assets.h"
+
+using namespace std;
+
+void AssetManager::start(unsigned int num_threads) {
+    if (num_threads == 0) {
+        // Leave a core for the render thread
+        num_threads = thread::hardware_concurrency();
+        num_threads = (num_threads > 2) ? 2 : 1;
+    }
+    stopping = false;
+    for (unsigned int i = 0; i < num_threads; i++) {
+        workers.push_back(thread(&AssetManager::run, this));
+    }
+}
+
+void AssetManager::finish() {
+    if (workers.empty()) {
+        return;
+    }
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+        jobs.clear();
+    }
+    ready.notify_all();
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+    workers.clear();
+    done.clear();
+}
+
+int AssetManager::add(const char *path) {
+    TextureAsset asset;
+    asset.path = path;
+    asset.state = AssetUnloaded;
+    asset.refs = 0;
+    asset.last_used = 0;
+    asset.width = asset.height = 0;
+    asset.reload_level = -1;
+    asset.image.w = asset.image.h = 0;
+    asset.image.level = 0;
+    assets.push_back(asset);
+    return (int)assets.size() - 1;
+}
+
+void AssetManager::acquire(int handle) {
+    assets[handle].refs++;
+}
+
+void AssetManager::release(int handle) {
+    if (assets[handle].refs > 0) {
+        assets[handle].refs--;
+    }
+}
+
+bool AssetManager::use(int handle, unsigned int frame) {
+    TextureAsset &asset = assets[handle];
+    asset.last_used = frame;
+    if (asset.state == AssetResident) {
+        return true;
+    }
+    if (asset.state == AssetUnloaded) {
+        asset.state = AssetLoading;
+        DecodeJob job;
+        job.handle = handle;
+        job.path = asset.path;
+        job.level = 0;
+        job.reload = false;
+        job.ok = false;
+        {
+            lock_guard<mutex> guard(lock);
+            jobs.push_back(job);
+        }
+        ready.notify_one();
+    }
+    return false;
+}
+
+bool AssetManager::reload(int handle, int level) {
+    TextureAsset &asset = assets[handle];
+    if (asset.state != AssetResident) {
+        return false;
+    }
+    if (asset.reload_level >= 0) {
+        return true;
+    }
+    asset.reload_level = level;
+    DecodeJob job;
+    job.handle = handle;
+    job.path = asset.path;
+    job.level = level;
+    job.reload = true;
+    job.ok = false;
+    {
+        lock_guard<mutex> guard(lock);
+        jobs.push_back(job);
+    }
+    ready.notify_one();
+    return true;
+}
+
+void AssetManager::collect(vector<int> &ready_handles, size_t max_count) {
+    ready_handles.clear();
+    lock_guard<mutex> guard(lock);
+    while (!done.empty() && ready_handles.size() < max_count) {
+        DecodeJob &job = done.front();
+        TextureAsset &asset = assets[job.handle];
+        if (job.reload) {
+            // Kept only if the storage it replaces is still resident and drawn
+            asset.reload_level = -1;
+            if (!job.ok) {
+                fprintf(stderr, "ERROR: could not reload %s\n", job.path.c_str());
+            } else if (asset.state == AssetResident && asset.refs > 0) {
+                asset.state = AssetDecoded;
+                asset.image.w = job.image.w;
+                asset.image.h = job.image.h;
+                asset.image.level = job.level;
+                asset.image.pixels.swap(job.image.pixels);
+                ready_handles.push_back(job.handle);
+            }
+        } else if (!job.ok) {
+            fprintf(stderr, "ERROR: could not load %s\n", job.path.c_str());
+            asset.state = AssetFailed;
+        } else if (asset.refs == 0) {
+            // Nothing draws with it anymore
+            asset.state = AssetUnloaded;
+        } else {
+            asset.state = AssetDecoded;
+            asset.width = job.image.w;
+            asset.height = job.image.h;
+            asset.image.w = job.image.w;
+            asset.image.h = job.image.h;
+            asset.image.level = 0;
+            asset.image.pixels.swap(job.image.pixels);
+            ready_handles.push_back(job.handle);
+        }
+        done.pop_front();
+    }
+}
+
+void AssetManager::uploaded(int handle) {
+    TextureAsset &asset = assets[handle];
+    asset.state = AssetResident;
+    vector<unsigned char>().swap(asset.image.pixels);
+}
+
+void AssetManager::evictions(unsigned int frame, vector<int> &evict) {
+    evict.clear();
+    for (size_t i = 0; i < assets.size(); i++) {
+        TextureAsset &asset = assets[i];
+        if (asset.state != AssetResident) {
+            continue;
+        }
+        bool unused = (evict_frames > 0 && frame - asset.last_used > evict_frames);
+        if (asset.refs == 0 || unused) {
+            asset.state = AssetUnloaded;
+            evict.push_back((int)i);
+        }
+    }
+}
+
+void AssetManager::wait() {
+    unique_lock<mutex> guard(lock);
+    idle.wait(guard, [this] { return jobs.empty() && busy == 0; });
+}
+
+size_t AssetManager::count(int state) const {
+    size_t n = 0;
+    for (size_t i = 0; i < assets.size(); i++) {
+        if (assets[i].state == state) {
+            n++;
+        }
+    }
+    return n;
+}
+
+size_t AssetManager::resident_bytes() const {
+    size_t bytes = 0;
+    for (size_t i = 0; i < assets.size(); i++) {
+        if (assets[i].state != AssetResident) {
+            continue;
+        }
+        for (int level = 0; (assets[i].width >> level) > 0 || (assets[i].height >> level) > 0; level++) {
+            bytes += (size_t)max(assets[i].width >> level, 1)*max(assets[i].height >> level, 1)*4;
+        }
+    }
+    return bytes;
+}
+
+void AssetManager::run() {
+    DecodeJob job;
+    for (;;) {
+        {
+            unique_lock<mutex> guard(lock);
+            ready.wait(guard, [this] { return stopping || !jobs.empty(); });
+            if (stopping) {
+                return;
+            }
+            job.handle = jobs.front().handle;
+            job.path.swap(jobs.front().path);
+            job.level = jobs.front().level;
+            job.reload = jobs.front().reload;
+            jobs.pop_front();
+            busy++;
+        }
+
+        // Decode as RGBA, flip to GL row order and filter down to the base level
+        int w = 0, h = 0, n = 0;
+        unsigned char *data = stbi_load(job.path.c_str(), &w, &h, &n, 4);
+        job.ok = (data != NULL);
+        job.image.pixels.clear();
+        if (data) {
+            flip_image_rows(data, w, h);
+            for (int level = 0; level < job.level; level++) {
+                downsample_image_half(data, w, h);
+            }
+            job.image.pixels.assign(data, data + (size_t)w*h*4);
+            stbi_image_free(data);
+        }
+        job.image.w = w;
+        job.image.h = h;
+
+        {
+            lock_guard<mutex> guard(lock);
+            done.push_back(DecodeJob());
+            DecodeJob &finished = done.back();
+            finished.handle = job.handle;
+            finished.path.swap(job.path);
+            finished.level = job.level;
+            finished.reload = job.reload;
+            finished.image.w = job.image.w;
+            finished.image.h = job.image.h;
+            finished.image.pixels.swap(job.image.pixels);
+            finished.ok = job.ok;
+            busy--;
+        }
+        idle.notify_all();
+    }
+}
@@ -0,0 +1,97 @@
+#ifndef ASSETS_H
+#define ASSETS_H
+
+#include <stddef.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Lazy texture assets. Textures are registered by path and load the first time a draw uses them:
+// background threads decode the file (RGBA, bottom row first as GL expects) and the renderer
+// uploads finished images, drawing with a placeholder until then. Handles are reference counted
+// by what draws with them (scene instances). Resident assets with no references, or not used for
+// evict_frames frames, are handed back for eviction and load again on their next use. Frames are
+// the caller's count of drawn frames, so idle time (nothing redrawn) does not age textures.
+// Resident assets can be decoded again at a smaller base level (for the texture budget), they
+// keep drawing with their current storage until the new image is uploaded.
+// Everything but the decoding runs on the render thread.
+
+enum AssetState {AssetUnloaded, AssetLoading, AssetDecoded, AssetResident, AssetFailed, NumAssetStates};
+
+struct AssetImage {
+    int w, h;
+    int level;                  // base level of the source the pixels are (0 = full size)
+    std::vector<unsigned char> pixels;
+};
+
+struct TextureAsset {
+    std::string path;
+    int state;
+    int refs;
+    unsigned int last_used;     // frame last drawn (0 = never)
+    int width, height;          // source size (set by each full load)
+    int reload_level;           // base level of a queued re-decode (-1 = none)
+    AssetImage image;           // decoded image waiting for upload
+};
+
+struct AssetManager {
+    unsigned int evict_frames;  // 0 = referenced assets stay resident once loaded
+
+    std::vector<TextureAsset> assets;
+
+    AssetManager() : evict_frames(600), busy(0), stopping(false) {}
+    ~AssetManager() { finish(); }
+
+    // Decode on num_threads threads (0 = two, fewer on small machines)
+    void start(unsigned int num_threads);
+    // Drop queued decodes and stop the threads
+    void finish();
+
+    // Register a texture file (not loaded), returns its handle
+    int add(const char *path);
+    void acquire(int handle);
+    void release(int handle);
+    // A draw uses the asset this frame, true when it is resident (first use queues the decode)
+    bool use(int handle, unsigned int frame);
+    // Decode a resident asset again, box filtered down to a base level (false if not resident,
+    // true while one is already queued)
+    bool reload(int handle, int level);
+    // Move finished decodes in (at most max_count), ready gets the ones to upload now
+    void collect(std::vector<int> &ready, size_t max_count);
+    // Upload done, the decoded pixels are released
+    void uploaded(int handle);
+    // Resident assets to evict this frame (marked unloaded)
+    void evictions(unsigned int frame, std::vector<int> &evict);
+    // Block until every queued decode has finished
+    void wait();
+
+    size_t count(int state) const;
+    // Resident bytes with full mip chains (4 bytes per texel)
+    size_t resident_bytes() const;
+
+private:
+    struct DecodeJob {
+        int handle;
+        std::string path;
+        int level;
+        bool reload;
+        AssetImage image;
+        bool ok;
+    };
+
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable ready;
+    std::condition_variable idle;
+    std::deque<DecodeJob> jobs;
+    std::deque<DecodeJob> done;
+    unsigned int busy;
+    bool stopping;
+
+    void run();
+};
+
+#endif
@@ -0,0 +1,33 @@
+#version 400 core
+// One layer per scene light, already multiplied by the instance material
+uniform sampler2DArray lightmaps;
+
+// Array sizes follow the loaded scene (defined by house before compiling)
+#ifndef MAX_LIGHTS
+#define MAX_LIGHTS 16
+#endif
+const int MaxLights = MAX_LIGHTS;
+uniform int NumLights;
+uniform int LightOn[MaxLights];
+
+// Material ambient alpha (as in the lighting shader)
+uniform float Alpha;
+
+out vec4 fragColor;
+
+in VertexData {
+     vec2 lightmapCoord;
+};
+
+void main()
+{
+     vec3 rgb = vec3(0.0f);
+     for (int i = 0; i < NumLights; i++) {
+          // Sum the baked contribution of each light that is on
+          if (LightOn[i] != 0) {
+               rgb += texture(lightmaps, vec3(lightmapCoord, float(i))).rgb;
+          }
+     }
+
+     fragColor = vec4(min(rgb,vec3(1.0)), Alpha);
+}
@@ -0,0 +1,20 @@
+#version 400 core
+uniform mat4 proj_matrix;
+uniform mat4 camera_matrix;
+uniform mat4 model_matrix;
+
+layout(location = 0) in vec4 vPosition;
+layout(location = 1) in vec2 vLightmapCoord;
+
+out VertexData {
+    vec2 lightmapCoord;
+};
+
+void main( )
+{
+    // Compute transformed vertex position in view space
+    gl_Position = proj_matrix*(camera_matrix*(model_matrix*vPosition));
+
+    // Pass lightmap coordinate to frag shader
+    lightmapCoord = vLightmapCoord;
+}
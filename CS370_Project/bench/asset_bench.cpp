@@ -0,0 +1,253 @@
+// Asset size scaling benchmark: synthetic OBJ meshes and images through the house loading path
+// (loaders, tangent generation, stbi_load + row flip and the GL buffer/texture uploads).
+// Files are generated into --work (default: current directory) and removed after each size.
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../../common/stb_image.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "../../common/vgl.h"
+#include "../../common/objloader.h"
+#include "../../common/tangentspace.h"
+#include "../../common/vmath.h"
+#include "../meshtools.h"
+#include "../objparser.h"
+#include "../imageutils.h"
+#include "../assetgen.h"
+#include "../transforms.h"
+#include "benchmark.h"
+
+using namespace vmath;
+using namespace std;
+
+// Size sweeps (default run stops at 1M triangles and 4K images, see --max-triangles/--max-image)
+const unsigned long long triangleCounts[] = {1000, 10000, 100000, 1000000, 10000000};
+const int imageSizes[] = {256, 1024, 2048, 4096, 8192};
+
+// Attribute streams in the generated OBJ
+struct ObjVariant {
+    const char *name;
+    bool uvs;
+    bool normals;
+};
+const ObjVariant objVariants[] = {{"v_vt_vn", true, true}, {"v_vn", false, true}, {"v_vt", true, false}, {"v", false, false}};
+
+static long file_size(const string &path) {
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) {
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+    return size;
+}
+
+static string size_label(unsigned long long n) {
+    if (n >= 1000000 && n % 1000000 == 0) return to_string(n/1000000) + "M";
+    if (n >= 1000 && n % 1000 == 0) return to_string(n/1000) + "k";
+    return to_string(n);
+}
+
+static void report_peak_rss(const string &after) {
+    fprintf(stderr, "%-48s %12.1f MB peak RSS\n", after.c_str(), peak_rss_bytes()/(1024.0*1024.0));
+}
+
+// Hidden window for the GL upload paths (NULL if no context could be created)
+static GLFWwindow *create_gl_context() {
+    if (!glfwInit()) {
+        return NULL;
+    }
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow *window = glfwCreateWindow(64, 64, "asset_bench", NULL, NULL);
+    if (!window) {
+        glfwTerminate();
+        return NULL;
+    }
+    glfwMakeContextCurrent(window);
+    glewExperimental = GL_TRUE;
+    if (glewInit() != GLEW_OK) {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        return NULL;
+    }
+    return window;
+}
+
+static void bench_meshes(BenchSuite &suite, const string &work_dir, unsigned long long max_triangles, bool gl) {
+    for (size_t s = 0; s < sizeof(triangleCounts)/sizeof(triangleCounts[0]) && triangleCounts[s] <= max_triangles; s++) {
+        string label = size_label(triangleCounts[s]);
+        for (size_t k = 0; k < sizeof(objVariants)/sizeof(objVariants[0]); k++) {
+            const ObjVariant &variant = objVariants[k];
+            string suffix = "/" + label + "/" + variant.name;
+            string path = work_dir + "/synthetic_" + label + "_" + variant.name + ".obj";
+            unsigned long long triangles = write_synthetic_obj(path.c_str(), triangleCounts[s], variant.uvs, variant.normals);
+            long bytes = file_size(path);
+            if (!triangles || bytes < 0) {
+                suite.skip("synthetic_obj" + suffix, "could not write file");
+                continue;
+            }
+
+            // Course loader only reads faces with all three streams
+            if (variant.uvs && variant.normals) {
+                suite.run("loadOBJ" + suffix, (double)bytes, (double)triangles, [&]() {
+                    vector<vec4> v;
+                    vector<vec2> uv;
+                    vector<vec3> n;
+                    loadOBJ(path.c_str(), v, uv, n);
+                    do_not_optimize(v);
+                });
+            }
+
+            suite.run("load_obj_fast" + suffix, (double)bytes, (double)triangles, [&]() {
+                vector<vec4> v;
+                vector<vec2> uv;
+                vector<vec3> n;
+                load_obj_fast(path.c_str(), v, uv, n);
+                do_not_optimize(v);
+            });
+
+            // Tangents and uploads of the full mesh (the other variants expand to the same arrays)
+            if (variant.uvs && variant.normals) {
+                vector<vec4> vertices;
+                vector<vec2> uvs;
+                vector<vec3> normals;
+                load_obj_fast(path.c_str(), vertices, uvs, normals);
+                double attrib_bytes = (double)vertices.size()*(sizeof(vec4) + sizeof(vec2) + sizeof(vec3));
+
+                suite.run("computeTangentBasis" + suffix, attrib_bytes, (double)triangles, [&]() {
+                    vector<vec3> tangents;
+                    vector<vec3> bitangents;
+                    computeTangentBasis(vertices, uvs, normals, tangents, bitangents);
+                    do_not_optimize(tangents);
+                });
+
+                suite.run("generate_tangents" + suffix, attrib_bytes, (double)triangles, [&]() {
+                    vector<vec4> tangents;
+                    generate_tangents(vertices, uvs, normals, tangents);
+                    do_not_optimize(tangents);
+                });
+
+                // Same buffers as load_object(), finished before the clock stops
+                if (gl) {
+                    GLuint buffers[3];
+                    glGenBuffers(3, buffers);
+                    suite.run("gl_buffer_upload" + suffix, attrib_bytes, (double)triangles, [&]() {
+                        glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+                        glBufferData(GL_ARRAY_BUFFER, sizeof(vec4)*vertices.size(), vertices.data(), GL_STATIC_DRAW);
+                        glBindBuffer(GL_ARRAY_BUFFER, buffers[1]);
+                        glBufferData(GL_ARRAY_BUFFER, sizeof(vec3)*normals.size(), normals.data(), GL_STATIC_DRAW);
+                        glBindBuffer(GL_ARRAY_BUFFER, buffers[2]);
+                        glBufferData(GL_ARRAY_BUFFER, sizeof(vec2)*uvs.size(), uvs.data(), GL_STATIC_DRAW);
+                        glFinish();
+                    });
+                    glBindBuffer(GL_ARRAY_BUFFER, 0);
+                    glDeleteBuffers(3, buffers);
+                }
+            }
+            remove(path.c_str());
+        }
+        report_peak_rss("after " + label + " triangles");
+    }
+}
+
+static void bench_images(BenchSuite &suite, const string &work_dir, int max_image, bool gl) {
+    for (size_t s = 0; s < sizeof(imageSizes)/sizeof(imageSizes[0]) && imageSizes[s] <= max_image; s++) {
+        int size = imageSizes[s];
+        string suffix = "/" + to_string(size);
+        string path = work_dir + "/synthetic_" + to_string(size) + ".tga";
+        long bytes = write_synthetic_tga(path.c_str(), size, size) ? file_size(path) : -1;
+        int w, h, n;
+        unsigned char *image_data = bytes < 0 ? NULL : stbi_load(path.c_str(), &w, &h, &n, 4);
+        if (!image_data) {
+            suite.skip("stbi_load" + suffix, "could not write or load image");
+            remove(path.c_str());
+            continue;
+        }
+        double pixels = (double)w*h;
+
+        suite.run("stbi_load" + suffix, (double)bytes, pixels, [&]() {
+            int tw, th, tn;
+            unsigned char *data = stbi_load(path.c_str(), &tw, &th, &tn, 4);
+            stbi_image_free(data);
+        });
+
+        suite.run("flip_image_rows" + suffix, pixels*4, pixels, [&]() {
+            flip_image_rows(image_data, w, h);
+            do_not_optimize(image_data[0]);
+        });
+
+        // Same upload as build_textures() (level 0 + mipmaps), finished before the clock stops
+        if (gl) {
+            GLuint texture;
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            suite.run("gl_texture_upload" + suffix, pixels*4, pixels, [&]() {
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, image_data);
+                glGenerateMipmap(GL_TEXTURE_2D);
+                glFinish();
+            });
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glDeleteTextures(1, &texture);
+        }
+
+        stbi_image_free(image_data);
+        remove(path.c_str());
+        report_peak_rss("after " + to_string(size) + "^2 image");
+    }
+}
+
+int main(int argc, char **argv) {
+    BenchSuite suite("asset_bench");
+    string work_dir = ".";
+    unsigned long long max_triangles = 1000000;
+    int max_image = 4096;
+    bool gl = true;
+
+    // Parse command line options
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--work") == 0 && i + 1 < argc) {
+            work_dir = argv[++i];
+        } else if (strcmp(argv[i], "--max-triangles") == 0 && i + 1 < argc) {
+            max_triangles = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--max-image") == 0 && i + 1 < argc) {
+            max_image = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--no-gl") == 0) {
+            gl = false;
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            suite.options.filter = argv[++i];
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            suite.options.out = argv[++i];
+        } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            suite.options.min_time = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--work dir] [--max-triangles n] [--max-image n] [--no-gl] [--filter name]"
+                            " [--out file.json] [--min-time seconds]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // Uploads need a context, CPU paths still run without one
+    GLFWwindow *window = gl ? create_gl_context() : NULL;
+    if (gl && !window) {
+        fprintf(stderr, "WARNING: no OpenGL context, skipping upload benchmarks\n");
+        suite.skip("gl_upload", "no OpenGL context");
+        gl = false;
+    }
+
+    bench_meshes(suite, work_dir, max_triangles, gl);
+    bench_images(suite, work_dir, max_image, gl);
+
+    if (window) {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
+    return suite.write_json(transform_simd_path()) ? 0 : 1;
+}
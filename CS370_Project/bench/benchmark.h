@@ -0,0 +1,171 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+// Minimal self-contained benchmark harness with JSON output
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#if defined(_MSC_VER)
+#pragma comment(lib, "psapi.lib")
+#endif
+#else
+#include <sys/resource.h>
+#endif
+
+// Peak resident set size of the process so far (bytes, 0 if unknown)
+inline double peak_rss_bytes() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+        return (double)pmc.PeakWorkingSetSize;
+    }
+    return 0.0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0.0;
+    }
+#if defined(__APPLE__)
+    return (double)usage.ru_maxrss;         // bytes on macOS
+#else
+    return (double)usage.ru_maxrss*1024.0;  // kilobytes on Linux
+#endif
+#endif
+}
+
+struct BenchResult {
+    std::string name;
+    unsigned long long iterations;
+    double ns_per_op;
+    double bytes_per_op;    // input bytes processed per op (0 if not meaningful)
+    double items_per_op;    // vertices/pixels/matrices per op (0 if not meaningful)
+    double peak_rss;        // process peak resident size after the run (bytes)
+};
+
+struct BenchOptions {
+    double min_time = 0.25;     // seconds per benchmark
+    const char *filter = NULL;  // run only names containing this substring
+    const char *out = NULL;     // JSON output file (stdout if NULL)
+};
+
+class BenchSuite {
+public:
+    explicit BenchSuite(const char *name) : suite_name(name) {}
+
+    BenchOptions options;
+
+    // Time fn until it has run for at least options.min_time
+    void run(const std::string &name, double bytes_per_op, double items_per_op, const std::function<void()> &fn) {
+        if (options.filter && name.find(options.filter) == std::string::npos) {
+            return;
+        }
+
+        // Warm up, then double the iteration count until the run is long enough
+        fn();
+        unsigned long long iters = 1;
+        double elapsed = 0.0;
+        for (;;) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (unsigned long long i = 0; i < iters; i++) {
+                fn();
+            }
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (elapsed >= options.min_time || iters >= (1ull << 40)) {
+                break;
+            }
+            iters *= 2;
+        }
+
+        BenchResult r;
+        r.name = name;
+        r.iterations = iters;
+        r.ns_per_op = elapsed*1.0e9/(double)iters;
+        r.bytes_per_op = bytes_per_op;
+        r.items_per_op = items_per_op;
+        r.peak_rss = peak_rss_bytes();
+        results.push_back(r);
+
+        fprintf(stderr, "%-48s %12.1f ns/op", name.c_str(), r.ns_per_op);
+        if (bytes_per_op > 0.0) {
+            fprintf(stderr, " %10.2f MB/s", mb_per_s(r));
+        }
+        fprintf(stderr, "\n");
+    }
+
+    // Record a benchmark that could not run (missing file etc.)
+    void skip(const std::string &name, const char *reason) {
+        if (options.filter && name.find(options.filter) == std::string::npos) {
+            return;
+        }
+        fprintf(stderr, "%-48s skipped: %s\n", name.c_str(), reason);
+        skipped.push_back(name + ": " + reason);
+    }
+
+    static double mb_per_s(const BenchResult &r) {
+        return (r.bytes_per_op/(1024.0*1024.0))/(r.ns_per_op*1.0e-9);
+    }
+
+    // Write all results as JSON
+    bool write_json(const char *simd_path) const {
+        FILE *f = options.out ? fopen(options.out, "w") : stdout;
+        if (!f) {
+            fprintf(stderr, "ERROR: could not open %s\n", options.out);
+            return false;
+        }
+        fprintf(f, "{\n  \"suite\": \"%s\",\n  \"timestamp\": %lld,\n  \"simd\": \"%s\",\n  \"benchmarks\": [\n",
+                suite_name.c_str(), (long long)time(NULL), simd_path);
+        for (size_t i = 0; i < results.size(); i++) {
+            const BenchResult &r = results[i];
+            fprintf(f, "    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.3f",
+                    r.name.c_str(), r.iterations, r.ns_per_op);
+            if (r.bytes_per_op > 0.0) {
+                fprintf(f, ", \"bytes_per_op\": %.0f, \"mb_per_s\": %.3f", r.bytes_per_op, mb_per_s(r));
+            }
+            if (r.items_per_op > 0.0) {
+                fprintf(f, ", \"items_per_op\": %.0f, \"items_per_s\": %.1f", r.items_per_op, r.items_per_op/(r.ns_per_op*1.0e-9));
+            }
+            if (r.peak_rss > 0.0) {
+                fprintf(f, ", \"peak_rss_mb\": %.1f", r.peak_rss/(1024.0*1024.0));
+            }
+            fprintf(f, "}%s\n", (i + 1 < results.size()) ? "," : "");
+        }
+        fprintf(f, "  ],\n  \"skipped\": [");
+        for (size_t i = 0; i < skipped.size(); i++) {
+            fprintf(f, "%s\"%s\"", i ? ", " : "", skipped[i].c_str());
+        }
+        fprintf(f, "]\n}\n");
+        if (f != stdout) {
+            fclose(f);
+        }
+        return true;
+    }
+
+private:
+    std::string suite_name;
+    std::vector<BenchResult> results;
+    std::vector<std::string> skipped;
+};
+
+// Keep the optimizer from discarding benchmark results
+template <class T>
+inline void do_not_optimize(const T &value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "g"(&value) : "memory");
+#else
+    static volatile const void *sink;
+    sink = &value;
+#endif
+}
+
+#endif
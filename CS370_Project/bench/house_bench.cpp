@@ -0,0 +1,184 @@
+// CPU microbenchmarks for the house loading and transform paths
+// Run from the bin directory (like house) or pass --data <project dir>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../../common/stb_image.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "../../common/objloader.h"
+#include "../../common/tangentspace.h"
+#include "../../common/vmath.h"
+#include "../meshtools.h"
+#include "../objparser.h"
+#include "../transforms.h"
+#include "../imageutils.h"
+#include "benchmark.h"
+
+using namespace vmath;
+using namespace std;
+
+// Bundled assets
+const char *modelFiles[] = {"unitcube.obj", "table.obj", "chair.obj", "door.obj", "cup.obj", "cylinder.obj", "circle.obj",
+                            "bowl.obj", "sphere.obj", "blinds.obj", "fan.obj", "frame.obj", "drawer.obj", "tv.obj", "plane.obj"};
+const char *largeTextureFiles[] = {"carpet.jpg", "popeye.png", "splatoon.jpg", "wednesday.jpg"};
+
+static long file_size(const string &path) {
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) {
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+    return size;
+}
+
+static void bench_models(BenchSuite &suite, const string &data_dir) {
+    for (size_t i = 0; i < sizeof(modelFiles)/sizeof(modelFiles[0]); i++) {
+        string path = data_dir + "/models/" + modelFiles[i];
+        long bytes = file_size(path);
+        if (bytes < 0) {
+            suite.skip(string("loadOBJ/") + modelFiles[i], "file not found");
+            continue;
+        }
+
+        // Vertex count for items/s
+        vector<vec4> vertices;
+        vector<vec2> uvs;
+        vector<vec3> normals;
+        loadOBJ(path.c_str(), vertices, uvs, normals);
+
+        suite.run(string("loadOBJ/") + modelFiles[i], (double)bytes, (double)vertices.size(), [&]() {
+            vector<vec4> v;
+            vector<vec2> uv;
+            vector<vec3> n;
+            loadOBJ(path.c_str(), v, uv, n);
+            do_not_optimize(v);
+        });
+
+        suite.run(string("load_obj_fast/") + modelFiles[i], (double)bytes, (double)vertices.size(), [&]() {
+            vector<vec4> v;
+            vector<vec2> uv;
+            vector<vec3> n;
+            load_obj_fast(path.c_str(), v, uv, n);
+            do_not_optimize(v);
+        });
+
+        suite.run(string("load_obj_fast_1thread/") + modelFiles[i], (double)bytes, (double)vertices.size(), [&]() {
+            vector<vec4> v;
+            vector<vec2> uv;
+            vector<vec3> n;
+            load_obj_fast(path.c_str(), v, uv, n, 1);
+            do_not_optimize(v);
+        });
+
+        suite.run(string("computeTangentBasis/") + modelFiles[i],
+                  (double)(vertices.size()*(sizeof(vec4) + sizeof(vec2) + sizeof(vec3))), (double)vertices.size(), [&]() {
+            vector<vec3> tangents;
+            vector<vec3> bitangents;
+            computeTangentBasis(vertices, uvs, normals, tangents, bitangents);
+            do_not_optimize(tangents);
+        });
+
+        suite.run(string("generate_tangents/") + modelFiles[i],
+                  (double)(vertices.size()*(sizeof(vec4) + sizeof(vec2) + sizeof(vec3))), (double)vertices.size(), [&]() {
+            vector<vec4> tangents;
+            generate_tangents(vertices, uvs, normals, tangents);
+            do_not_optimize(tangents);
+        });
+    }
+}
+
+static void bench_textures(BenchSuite &suite, const string &data_dir) {
+    for (size_t i = 0; i < sizeof(largeTextureFiles)/sizeof(largeTextureFiles[0]); i++) {
+        string path = data_dir + "/textures/" + largeTextureFiles[i];
+        long bytes = file_size(path);
+        int w, h, n;
+        unsigned char *image_data = stbi_load(path.c_str(), &w, &h, &n, 4);
+        if (bytes < 0 || !image_data) {
+            suite.skip(string("stbi_load/") + largeTextureFiles[i], "could not load image");
+            continue;
+        }
+
+        suite.run(string("stbi_load/") + largeTextureFiles[i], (double)bytes, (double)w*h, [&]() {
+            int tw, th, tn;
+            unsigned char *data = stbi_load(path.c_str(), &tw, &th, &tn, 4);
+            stbi_image_free(data);
+        });
+
+        suite.run(string("flip_image_rows/") + largeTextureFiles[i], (double)w*h*4, (double)w*h, [&]() {
+            flip_image_rows(image_data, w, h);
+            do_not_optimize(image_data[0]);
+        });
+
+        stbi_image_free(image_data);
+    }
+}
+
+static void bench_matrices(BenchSuite &suite) {
+    // Same shape as a render_scene() object transform
+    vec3 t = vec3(-2.45f, -1.48f, -3.39f);
+    vec3 axis = vec3(0.0f, 0.0f, 1.0f);
+
+    suite.run("vmath/compose_trs", 0.0, 1.0, [&]() {
+        mat4 model_matrix = translate(t)*rotate(90.0f, axis)*scale(0.666f, 0.666f, 1.0f);
+        do_not_optimize(model_matrix);
+    });
+
+    mat4 model_matrix = translate(t)*rotate(90.0f, axis)*scale(0.666f, 0.666f, 1.0f);
+    suite.run("vmath/inverse_transpose", 0.0, 1.0, [&]() {
+        mat4 normal_matrix = model_matrix.inverse().transpose();
+        do_not_optimize(normal_matrix);
+    });
+
+    suite.run("transforms/affine_normal_matrix", 0.0, 1.0, [&]() {
+        mat4 normal_matrix = affine_normal_matrix(model_matrix);
+        do_not_optimize(normal_matrix);
+    });
+
+    // Batched kernel over a scene-sized, a stress-sized and a large instance count
+    const size_t counts[] = {10, 1000, 100000};
+    for (size_t c = 0; c < sizeof(counts)/sizeof(counts[0]); c++) {
+        size_t n = counts[c];
+        TRSBatch trs;
+        trs.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            trs.set(i, t, (float)(i % 360), axis, vec3(0.666f, 0.666f, 1.0f));
+        }
+        MatrixBatch model, normal;
+        suite.run("transforms/compose_trs_batch/" + to_string(n), 0.0, (double)n, [&]() {
+            compose_trs(trs, model, normal);
+            do_not_optimize(model.m[0][0]);
+        });
+    }
+}
+
+int main(int argc, char **argv) {
+    BenchSuite suite("house_bench");
+    string data_dir = "..";
+
+    // Parse command line options
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--data") == 0 && i + 1 < argc) {
+            data_dir = argv[++i];
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            suite.options.filter = argv[++i];
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            suite.options.out = argv[++i];
+        } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            suite.options.min_time = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--data dir] [--filter name] [--out file.json] [--min-time seconds]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    bench_models(suite, data_dir);
+    bench_textures(suite, data_dir);
+    bench_matrices(suite);
+
+    return suite.write_json(transform_simd_path()) ? 0 : 1;
+}
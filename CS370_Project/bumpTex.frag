@@ -14,7 +14,11 @@ struct LightProperties {
     float spotExponent;
 };
 
-const int MaxLights = 8;
+// Array sizes follow the loaded scene (defined by house before compiling)
+#ifndef MAX_LIGHTS
+#define MAX_LIGHTS 16
+#endif
+const int MaxLights = MAX_LIGHTS;
 layout (std140) uniform LightBuffer {
     LightProperties Lights[MaxLights];
 };
@@ -24,12 +28,14 @@ uniform int LightOn[MaxLights];
 
 out vec4 fragColor;
 
-in vec4 Position;
-in vec3 Normal;
-in vec3 Tangent;
-in vec3 BiTangent;
-in vec2 texCoord;
-in vec3 View;
+in VertexData {
+    vec4 Position;
+    vec2 texCoord;
+    vec3 Normal;
+    vec3 Tangent;
+    vec3 BiTangent;
+    vec3 View;
+};
 
 void main()
 {
@@ -7,17 +7,18 @@ uniform mat4 model_matrix;
 layout(location = 0) in vec4 vPosition;
 layout(location = 1) in vec3 vNormal;
 layout(location = 2) in vec2 vTexCoord;
-layout(location = 3) in vec3 vTangent;
-layout(location = 4) in vec3 vBiTangent;
+layout(location = 3) in vec4 vTangent;
 
 uniform vec3 EyePosition;
 
-out vec4 Position;
-out vec2 texCoord;
-out vec3 Normal;
-out vec3 Tangent;
-out vec3 BiTangent;
-out vec3 View;
+out VertexData {
+    vec4 Position;
+    vec2 texCoord;
+    vec3 Normal;
+    vec3 Tangent;
+    vec3 BiTangent;
+    vec3 View;
+};
 
 void main( )
 {
@@ -35,6 +36,7 @@ void main( )
 
     // Compute tangent space vectors
     Normal = vec3(normalize(normal_matrix*normalize(vec4(vNormal, 0.0))));
-    Tangent = vec3(normalize(normal_matrix*normalize(vec4(vTangent, 0.0))));
-    BiTangent = cross(Normal, Tangent);
+    // Bitangent is rebuilt from the tangent handedness (w)
+    Tangent = vec3(normalize(normal_matrix*normalize(vec4(vTangent.xyz, 0.0))));
+    BiTangent = cross(Normal, Tangent)*vTangent.w;
 }
@@ -0,0 +1,465 @@
+// Triangle and instance BVHs (binned SAH) for the lightmap baker's rays and scene queries
+
+#include <float.h>
+#include <math.h>
+#include <vector>
+#include "bvh.h"
+
+using namespace vmath;
+using namespace std;
+
+#define BVH_BINS 12
+#define BVH_LEAF_SIZE 4
+#define BVH_STACK 64
+
+// Axis aligned box helper for the build
+struct Box {
+    float min[3];
+    float max[3];
+
+    Box() { clear(); }
+    void clear() {
+        for (int k = 0; k < 3; k++) {
+            min[k] = FLT_MAX;
+            max[k] = -FLT_MAX;
+        }
+    }
+    void grow(const float p[3]) {
+        for (int k = 0; k < 3; k++) {
+            min[k] = fminf(min[k], p[k]);
+            max[k] = fmaxf(max[k], p[k]);
+        }
+    }
+    void grow(const Box &b) {
+        for (int k = 0; k < 3; k++) {
+            min[k] = fminf(min[k], b.min[k]);
+            max[k] = fmaxf(max[k], b.max[k]);
+        }
+    }
+    float area() const {
+        if (min[0] > max[0]) {
+            return 0.0f;
+        }
+        float dx = max[0] - min[0], dy = max[1] - min[1], dz = max[2] - min[2];
+        return 2.0f*(dx*dy + dy*dz + dz*dx);
+    }
+};
+
+// Triangle or instance being sorted into the tree
+struct BuildPrimitive {
+    Box bounds;
+    float centroid[3];
+};
+
+static void build_node(vector<BvhNode> &nodes, vector<unsigned int> &order, const vector<BuildPrimitive> &prims,
+                       unsigned int start, unsigned int end) {
+    unsigned int node_index = nodes.size();
+    nodes.push_back(BvhNode());
+
+    Box bounds, centroids;
+    for (unsigned int i = start; i < end; i++) {
+        const BuildPrimitive &t = prims[order[i]];
+        bounds.grow(t.bounds);
+        centroids.grow(t.centroid);
+    }
+    for (int k = 0; k < 3; k++) {
+        nodes[node_index].min[k] = bounds.min[k];
+        nodes[node_index].max[k] = bounds.max[k];
+    }
+
+    // Split along the longest centroid extent
+    unsigned int count = end - start;
+    int axis = 0;
+    for (int k = 1; k < 3; k++) {
+        if (centroids.max[k] - centroids.min[k] > centroids.max[axis] - centroids.min[axis]) {
+            axis = k;
+        }
+    }
+    float extent = centroids.max[axis] - centroids.min[axis];
+    if (count <= BVH_LEAF_SIZE || extent <= 0.0f) {
+        nodes[node_index].first = start;
+        nodes[node_index].count = count;
+        return;
+    }
+
+    // Bin centroids and evaluate the surface area heuristic at each bin boundary
+    Box bin_bounds[BVH_BINS];
+    unsigned int bin_counts[BVH_BINS] = {0};
+    float bin_scale = BVH_BINS/extent;
+    for (unsigned int i = start; i < end; i++) {
+        const BuildPrimitive &t = prims[order[i]];
+        int b = (int)((t.centroid[axis] - centroids.min[axis])*bin_scale);
+        if (b >= BVH_BINS) b = BVH_BINS - 1;
+        bin_bounds[b].grow(t.bounds);
+        bin_counts[b]++;
+    }
+    float right_area[BVH_BINS];
+    unsigned int right_count[BVH_BINS];
+    Box acc;
+    unsigned int n = 0;
+    for (int b = BVH_BINS - 1; b > 0; b--) {
+        acc.grow(bin_bounds[b]);
+        n += bin_counts[b];
+        right_area[b] = acc.area();
+        right_count[b] = n;
+    }
+    float best_cost = FLT_MAX;
+    int best_split = -1;
+    acc.clear();
+    n = 0;
+    for (int b = 1; b < BVH_BINS; b++) {
+        acc.grow(bin_bounds[b - 1]);
+        n += bin_counts[b - 1];
+        if (n == 0 || right_count[b] == 0) {
+            continue;
+        }
+        float cost = acc.area()*n + right_area[b]*right_count[b];
+        if (cost < best_cost) {
+            best_cost = cost;
+            best_split = b;
+        }
+    }
+
+    // Leaf when no split beats intersecting everything here
+    float leaf_cost = bounds.area()*count;
+    if (best_split < 0 || (count <= 2*BVH_LEAF_SIZE && best_cost >= leaf_cost)) {
+        nodes[node_index].first = start;
+        nodes[node_index].count = count;
+        return;
+    }
+
+    // Partition primitives by bin
+    unsigned int mid = start;
+    for (unsigned int i = start; i < end; i++) {
+        const BuildPrimitive &t = prims[order[i]];
+        int b = (int)((t.centroid[axis] - centroids.min[axis])*bin_scale);
+        if (b >= BVH_BINS) b = BVH_BINS - 1;
+        if (b < best_split) {
+            unsigned int tmp = order[i];
+            order[i] = order[mid];
+            order[mid++] = tmp;
+        }
+    }
+
+    build_node(nodes, order, prims, start, mid);
+    nodes[node_index].first = nodes.size();
+    nodes[node_index].count = 0;
+    build_node(nodes, order, prims, mid, end);
+}
+
+void Bvh::build(const vector<vec3> &triangle_corners) {
+    corners = triangle_corners;
+    unsigned int num_triangles = corners.size()/3;
+    nodes.clear();
+    order.resize(num_triangles);
+
+    vector<BuildPrimitive> tris(num_triangles);
+    for (unsigned int i = 0; i < num_triangles; i++) {
+        for (int c = 0; c < 3; c++) {
+            float p[3] = {corners[3*i + c][0], corners[3*i + c][1], corners[3*i + c][2]};
+            tris[i].bounds.grow(p);
+        }
+        for (int k = 0; k < 3; k++) {
+            tris[i].centroid[k] = 0.5f*(tris[i].bounds.min[k] + tris[i].bounds.max[k]);
+        }
+        order[i] = i;
+    }
+    if (num_triangles > 0) {
+        nodes.reserve(2*num_triangles/BVH_LEAF_SIZE + 1);
+        build_node(nodes, order, tris, 0, num_triangles);
+    }
+}
+
+// Slab test, returns the entry distance or FLT_MAX on a miss
+static inline float hit_box(const BvhNode &node, const float origin[3], const float inv_dir[3], float t_min, float t_max) {
+    for (int k = 0; k < 3; k++) {
+        float t0 = (node.min[k] - origin[k])*inv_dir[k];
+        float t1 = (node.max[k] - origin[k])*inv_dir[k];
+        if (t0 > t1) {
+            float tmp = t0;
+            t0 = t1;
+            t1 = tmp;
+        }
+        t_min = fmaxf(t_min, t0);
+        t_max = fminf(t_max, t1);
+        if (t_min > t_max) {
+            return FLT_MAX;
+        }
+    }
+    return t_min;
+}
+
+// Moller-Trumbore, two sided
+static inline bool hit_triangle(const vec3 &a, const vec3 &b, const vec3 &c, const vec3 &origin, const vec3 &dir,
+                                float t_min, float t_max, float &t, float &u, float &v) {
+    vec3 e1 = b - a;
+    vec3 e2 = c - a;
+    vec3 p = cross(dir, e2);
+    float det = dot(e1, p);
+    if (fabsf(det) < 1.0e-12f) {
+        return false;
+    }
+    float inv_det = 1.0f/det;
+    vec3 s = origin - a;
+    u = dot(s, p)*inv_det;
+    if (u < 0.0f || u > 1.0f) {
+        return false;
+    }
+    vec3 q = cross(s, e1);
+    v = dot(dir, q)*inv_det;
+    if (v < 0.0f || u + v > 1.0f) {
+        return false;
+    }
+    t = dot(e2, q)*inv_det;
+    return t > t_min && t < t_max;
+}
+
+// Traversal stack: fixed storage covers the usual depths, deeper (degenerate) trees spill to the heap
+// rather than dropping nodes
+struct NodeStack {
+    unsigned int fixed[BVH_STACK];
+    vector<unsigned int> spill;
+    int top;
+
+    NodeStack() : top(0) {}
+    void push(unsigned int index) {
+        if (top < BVH_STACK) {
+            fixed[top] = index;
+        } else {
+            spill.push_back(index);
+        }
+        top++;
+    }
+    unsigned int pop() {
+        top--;
+        if (top < BVH_STACK) {
+            return fixed[top];
+        }
+        unsigned int index = spill.back();
+        spill.pop_back();
+        return index;
+    }
+    bool empty() const { return top == 0; }
+};
+
+bool Bvh::intersect(const vec3 &origin, const vec3 &dir, float t_min, float t_max, BvhHit &hit) const {
+    if (nodes.empty()) {
+        return false;
+    }
+    float o[3] = {origin[0], origin[1], origin[2]};
+    float inv_dir[3] = {1.0f/dir[0], 1.0f/dir[1], 1.0f/dir[2]};
+    bool found = false;
+    NodeStack stack;
+    stack.push(0);
+    while (!stack.empty()) {
+        unsigned int index = stack.pop();
+        const BvhNode &node = nodes[index];
+        if (hit_box(node, o, inv_dir, t_min, t_max) == FLT_MAX) {
+            continue;
+        }
+        if (node.count > 0) {
+            for (unsigned int i = node.first; i < node.first + node.count; i++) {
+                unsigned int tri = order[i];
+                float t, u, v;
+                if (hit_triangle(corners[3*tri], corners[3*tri + 1], corners[3*tri + 2], origin, dir, t_min, t_max, t, u, v)) {
+                    // Later candidates must be closer
+                    t_max = t;
+                    hit.triangle = tri;
+                    hit.t = t;
+                    hit.u = u;
+                    hit.v = v;
+                    found = true;
+                }
+            }
+        } else {
+            // Visit the nearer child first
+            unsigned int left = index + 1;
+            unsigned int right = node.first;
+            float t_left = hit_box(nodes[left], o, inv_dir, t_min, t_max);
+            float t_right = hit_box(nodes[right], o, inv_dir, t_min, t_max);
+            if (t_left <= t_right) {
+                if (t_right != FLT_MAX) stack.push(right);
+                if (t_left != FLT_MAX) stack.push(left);
+            } else {
+                if (t_left != FLT_MAX) stack.push(left);
+                stack.push(right);
+            }
+        }
+    }
+    return found;
+}
+
+bool Bvh::occluded(const vec3 &origin, const vec3 &dir, float t_min, float t_max) const {
+    if (nodes.empty()) {
+        return false;
+    }
+    float o[3] = {origin[0], origin[1], origin[2]};
+    float inv_dir[3] = {1.0f/dir[0], 1.0f/dir[1], 1.0f/dir[2]};
+    NodeStack stack;
+    stack.push(0);
+    while (!stack.empty()) {
+        unsigned int index = stack.pop();
+        const BvhNode &node = nodes[index];
+        if (hit_box(node, o, inv_dir, t_min, t_max) == FLT_MAX) {
+            continue;
+        }
+        if (node.count > 0) {
+            for (unsigned int i = node.first; i < node.first + node.count; i++) {
+                unsigned int tri = order[i];
+                float t, u, v;
+                if (hit_triangle(corners[3*tri], corners[3*tri + 1], corners[3*tri + 2], origin, dir, t_min, t_max, t, u, v)) {
+                    return true;
+                }
+            }
+        } else {
+            stack.push(node.first);
+            stack.push(index + 1);
+        }
+    }
+    return false;
+}
+
+// World box of a mesh tree's root under a transform (all 8 corners)
+static BvhBox transformed_bounds(const BvhNode &root, const mat4 &model) {
+    Box box;
+    for (int c = 0; c < 8; c++) {
+        vec4 p = model*vec4((c & 1) ? root.max[0] : root.min[0], (c & 2) ? root.max[1] : root.min[1],
+                            (c & 4) ? root.max[2] : root.min[2], 1.0f);
+        float q[3] = {p[0], p[1], p[2]};
+        box.grow(q);
+    }
+    BvhBox b;
+    for (int k = 0; k < 3; k++) {
+        b.min[k] = box.min[k];
+        b.max[k] = box.max[k];
+    }
+    return b;
+}
+
+void InstanceBvh::build(const vector<const Bvh *> &instance_meshes, const vector<mat4> &instance_models) {
+    meshes = instance_meshes;
+    models = instance_models;
+    unsigned int num_instances = meshes.size();
+    inverses.resize(num_instances);
+    bounds.resize(num_instances);
+    nodes.clear();
+    order.clear();
+
+    vector<BuildPrimitive> prims(num_instances);
+    for (unsigned int i = 0; i < num_instances; i++) {
+        inverses[i] = models[i].inverse();
+        if (!meshes[i] || meshes[i]->nodes.empty()) {
+            continue;
+        }
+        bounds[i] = transformed_bounds(meshes[i]->nodes[0], models[i]);
+        for (int k = 0; k < 3; k++) {
+            prims[i].bounds.min[k] = bounds[i].min[k];
+            prims[i].bounds.max[k] = bounds[i].max[k];
+            prims[i].centroid[k] = 0.5f*(bounds[i].min[k] + bounds[i].max[k]);
+        }
+        order.push_back(i);
+    }
+    if (!order.empty()) {
+        nodes.reserve(2*order.size()/BVH_LEAF_SIZE + 1);
+        build_node(nodes, order, prims, 0, order.size());
+    }
+}
+
+void InstanceBvh::move(unsigned int instance, const mat4 &model) {
+    models[instance] = model;
+    inverses[instance] = model.inverse();
+    if (meshes[instance] && !meshes[instance]->nodes.empty()) {
+        bounds[instance] = transformed_bounds(meshes[instance]->nodes[0], model);
+    }
+}
+
+void InstanceBvh::refit() {
+    // Children always follow their parent, so a reverse sweep sees them first
+    for (size_t n = nodes.size(); n-- > 0;) {
+        BvhNode &node = nodes[n];
+        Box box;
+        if (node.count > 0) {
+            for (unsigned int i = node.first; i < node.first + node.count; i++) {
+                box.grow(bounds[order[i]].min);
+                box.grow(bounds[order[i]].max);
+            }
+        } else {
+            box.grow(nodes[n + 1].min);
+            box.grow(nodes[n + 1].max);
+            box.grow(nodes[node.first].min);
+            box.grow(nodes[node.first].max);
+        }
+        for (int k = 0; k < 3; k++) {
+            node.min[k] = box.min[k];
+            node.max[k] = box.max[k];
+        }
+    }
+}
+
+// Shared traversal for intersect() and occluded() (any = stop at the first hit)
+static bool trace_instances(const InstanceBvh &bvh, const vec3 &origin, const vec3 &dir, float t_min, float t_max,
+                            bool any, InstanceHit &hit) {
+    if (bvh.nodes.empty()) {
+        return false;
+    }
+    float o[3] = {origin[0], origin[1], origin[2]};
+    float inv_dir[3] = {1.0f/dir[0], 1.0f/dir[1], 1.0f/dir[2]};
+    bool found = false;
+    NodeStack stack;
+    stack.push(0);
+    while (!stack.empty()) {
+        unsigned int index = stack.pop();
+        const BvhNode &node = bvh.nodes[index];
+        if (hit_box(node, o, inv_dir, t_min, t_max) == FLT_MAX) {
+            continue;
+        }
+        if (node.count > 0) {
+            for (unsigned int i = node.first; i < node.first + node.count; i++) {
+                // Object space ray keeps the world t (direction is not renormalized)
+                unsigned int inst = bvh.order[i];
+                const mat4 &inverse = bvh.inverses[inst];
+                vec4 local_origin = inverse*vec4(origin[0], origin[1], origin[2], 1.0f);
+                vec4 local_dir = inverse*vec4(dir[0], dir[1], dir[2], 0.0f);
+                vec3 lo(local_origin[0], local_origin[1], local_origin[2]);
+                vec3 ld(local_dir[0], local_dir[1], local_dir[2]);
+                if (any) {
+                    if (bvh.meshes[inst]->occluded(lo, ld, t_min, t_max)) {
+                        return true;
+                    }
+                    continue;
+                }
+                BvhHit mesh_hit;
+                if (bvh.meshes[inst]->intersect(lo, ld, t_min, t_max, mesh_hit)) {
+                    t_max = mesh_hit.t;
+                    hit.instance = inst;
+                    hit.triangle = mesh_hit.triangle;
+                    hit.t = mesh_hit.t;
+                    found = true;
+                }
+            }
+        } else {
+            // Visit the nearer child first
+            unsigned int left = index + 1;
+            unsigned int right = node.first;
+            float t_left = hit_box(bvh.nodes[left], o, inv_dir, t_min, t_max);
+            float t_right = hit_box(bvh.nodes[right], o, inv_dir, t_min, t_max);
+            if (t_left <= t_right) {
+                if (t_right != FLT_MAX) stack.push(right);
+                if (t_left != FLT_MAX) stack.push(left);
+            } else {
+                if (t_left != FLT_MAX) stack.push(left);
+                stack.push(right);
+            }
+        }
+    }
+    return found;
+}
+
+bool InstanceBvh::intersect(const vec3 &origin, const vec3 &dir, float t_min, float t_max, InstanceHit &hit) const {
+    return trace_instances(*this, origin, dir, t_min, t_max, false, hit);
+}
+
+bool InstanceBvh::occluded(const vec3 &origin, const vec3 &dir, float t_min, float t_max) const {
+    InstanceHit hit;
+    return trace_instances(*this, origin, dir, t_min, t_max, true, hit);
+}
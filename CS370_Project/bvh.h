@@ -0,0 +1,69 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+#include "../common/vmath.h"
+
+// Bounding volume hierarchy over a triangle soup (binned SAH build, nodes in depth first order)
+
+struct BvhNode {
+    float min[3];
+    float max[3];
+    unsigned int first;     // leaf: first entry in order, inner: index of the right child (left is next)
+    unsigned int count;     // triangles in a leaf, 0 for inner nodes
+};
+
+struct BvhHit {
+    unsigned int triangle;  // index into the triangles given to build()
+    float t;
+    float u, v;             // barycentrics of corners 1 and 2
+};
+
+struct Bvh {
+    std::vector<BvhNode> nodes;
+    std::vector<unsigned int> order;        // triangle indices in leaf order
+    std::vector<vmath::vec3> corners;       // 3 per triangle, in input order
+
+    // Build over triangles (3 consecutive corners each)
+    void build(const std::vector<vmath::vec3> &triangle_corners);
+    // Closest hit with t in (t_min, t_max)
+    bool intersect(const vmath::vec3 &origin, const vmath::vec3 &dir, float t_min, float t_max, BvhHit &hit) const;
+    // Any hit with t in (t_min, t_max), for shadow rays
+    bool occluded(const vmath::vec3 &origin, const vmath::vec3 &dir, float t_min, float t_max) const;
+};
+
+// World space box of an instance
+struct BvhBox {
+    float min[3];
+    float max[3];
+};
+
+struct InstanceHit {
+    unsigned int instance;  // index into the instances given to build()
+    unsigned int triangle;  // triangle of that instance's mesh tree
+    float t;
+};
+
+// Two level hierarchy: a box tree over instance bounds (binned SAH) whose leaves hold instances of
+// triangle trees kept in object space. Rays are moved into object space at each instance, so meshes
+// are shared between instances, and animated instances only need move() and refit(), not a rebuild.
+struct InstanceBvh {
+    std::vector<BvhNode> nodes;
+    std::vector<unsigned int> order;        // instance indices in leaf order (instances with empty meshes left out)
+    std::vector<const Bvh *> meshes;        // triangle tree of each instance, owned by the caller
+    std::vector<vmath::mat4> models;        // object to world
+    std::vector<vmath::mat4> inverses;      // world to object
+    std::vector<BvhBox> bounds;
+
+    void build(const std::vector<const Bvh *> &instance_meshes, const std::vector<vmath::mat4> &instance_models);
+    // Give an instance a new transform (node bounds are stale until refit())
+    void move(unsigned int instance, const vmath::mat4 &model);
+    // Recompute node bounds bottom up, keeping the tree's shape
+    void refit();
+    // Closest hit with t in (t_min, t_max), t in units of dir
+    bool intersect(const vmath::vec3 &origin, const vmath::vec3 &dir, float t_min, float t_max, InstanceHit &hit) const;
+    // Any hit with t in (t_min, t_max)
+    bool occluded(const vmath::vec3 &origin, const vmath::vec3 &dir, float t_min, float t_max) const;
+};
+
+#endif
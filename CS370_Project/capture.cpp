@@ -0,0 +1,388 @@
+// Background frame writers and a small PNG encoder (filtered rows, fixed Huffman deflate)
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "capture.h"
+
+using namespace std;
+
+// Deflate window and longest match
+#define DEFLATE_WINDOW 32768
+#define DEFLATE_MAX_MATCH 258
+#define DEFLATE_HASH_BITS 15
+
+static const unsigned short length_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+                                               67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const unsigned char length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4,
+                                               5, 5, 5, 5, 0};
+static const unsigned short dist_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513,
+                                             769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const unsigned char dist_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10,
+                                             11, 11, 12, 12, 13, 13};
+
+// Deflate bit stream (least significant bit first, Huffman codes most significant bit first)
+struct BitWriter {
+    vector<unsigned char> &out;
+    uint32_t bits;
+    int count;
+
+    BitWriter(vector<unsigned char> &o) : out(o), bits(0), count(0) {}
+    void put(uint32_t value, int n) {
+        bits |= value << count;
+        count += n;
+        while (count >= 8) {
+            out.push_back((unsigned char)bits);
+            bits >>= 8;
+            count -= 8;
+        }
+    }
+    void put_code(uint32_t code, int n) {
+        uint32_t reversed = 0;
+        for (int i = 0; i < n; i++) {
+            reversed = (reversed << 1) | ((code >> i) & 1);
+        }
+        put(reversed, n);
+    }
+    void flush() {
+        if (count > 0) {
+            out.push_back((unsigned char)bits);
+        }
+        bits = 0;
+        count = 0;
+    }
+};
+
+// Fixed Huffman literal/length code
+static void put_symbol(BitWriter &bw, unsigned int symbol) {
+    if (symbol < 144) {
+        bw.put_code(0x30 + symbol, 8);
+    } else if (symbol < 256) {
+        bw.put_code(0x190 + symbol - 144, 9);
+    } else if (symbol < 280) {
+        bw.put_code(symbol - 256, 7);
+    } else {
+        bw.put_code(0xc0 + symbol - 280, 8);
+    }
+}
+
+static void put_match(BitWriter &bw, unsigned int length, unsigned int distance) {
+    int l = 28;
+    while (length_base[l] > length) l--;
+    put_symbol(bw, 257 + l);
+    bw.put(length - length_base[l], length_extra[l]);
+    int d = 29;
+    while (dist_base[d] > distance) d--;
+    bw.put_code(d, 5);
+    bw.put(distance - dist_base[d], dist_extra[d]);
+}
+
+// zlib stream of one fixed Huffman block, greedy matching against the most recent position per hash
+static void zlib_compress(const vector<unsigned char> &in, vector<unsigned char> &out) {
+    out.push_back(0x78);
+    out.push_back(0x01);
+    BitWriter bw(out);
+    bw.put(1, 1);   // final block
+    bw.put(1, 2);   // fixed Huffman codes
+
+    size_t n = in.size();
+    vector<int> head(1 << DEFLATE_HASH_BITS, -1);
+    size_t i = 0;
+    while (i < n) {
+        unsigned int best = 0;
+        size_t best_pos = 0;
+        if (i + 3 <= n) {
+            uint32_t h = ((uint32_t)in[i] << 16 | (uint32_t)in[i + 1] << 8 | in[i + 2])*2654435761u >> (32 - DEFLATE_HASH_BITS);
+            int candidate = head[h];
+            head[h] = (int)i;
+            if (candidate >= 0 && i - candidate <= DEFLATE_WINDOW) {
+                size_t limit = min((size_t)DEFLATE_MAX_MATCH, n - i);
+                unsigned int len = 0;
+                while (len < limit && in[candidate + len] == in[i + len]) len++;
+                if (len >= 3) {
+                    best = len;
+                    best_pos = candidate;
+                }
+            }
+        }
+        if (best == 0) {
+            put_symbol(bw, in[i]);
+            i++;
+            continue;
+        }
+        put_match(bw, best, (unsigned int)(i - best_pos));
+        // Index the positions the match covered so later matches can start inside it
+        size_t end = i + best;
+        for (i++; i < end; i++) {
+            if (i + 3 <= n) {
+                head[((uint32_t)in[i] << 16 | (uint32_t)in[i + 1] << 8 | in[i + 2])*2654435761u >> (32 - DEFLATE_HASH_BITS)] = (int)i;
+            }
+        }
+    }
+    put_symbol(bw, 256);
+    bw.flush();
+
+    // Adler-32 of the uncompressed data
+    uint32_t a = 1, b = 0;
+    for (size_t k = 0; k < n; k++) {
+        a = (a + in[k]) % 65521;
+        b = (b + a) % 65521;
+    }
+    uint32_t adler = (b << 16) | a;
+    for (int k = 3; k >= 0; k--) {
+        out.push_back((unsigned char)(adler >> (8*k)));
+    }
+}
+
+struct CrcTable {
+    uint32_t entries[256];
+
+    CrcTable() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            entries[i] = c;
+        }
+    }
+};
+
+static uint32_t crc32(uint32_t crc, const unsigned char *data, size_t n) {
+    // Function statics are initialized once even with several writer threads
+    static const CrcTable table;
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++) {
+        crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void put_chunk(vector<unsigned char> &png, const char *type, const vector<unsigned char> &data) {
+    uint32_t len = data.size();
+    for (int k = 3; k >= 0; k--) {
+        png.push_back((unsigned char)(len >> (8*k)));
+    }
+    size_t start = png.size();
+    png.insert(png.end(), type, type + 4);
+    png.insert(png.end(), data.begin(), data.end());
+    uint32_t crc = crc32(0, &png[start], png.size() - start);
+    for (int k = 3; k >= 0; k--) {
+        png.push_back((unsigned char)(crc >> (8*k)));
+    }
+}
+
+static inline unsigned char paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return (unsigned char)a;
+    return (unsigned char)((pb <= pc) ? b : c);
+}
+
+bool write_png(const char *path, int w, int h, const unsigned char *rgba) {
+    // Filter each row with whichever of the five PNG filters has the smallest sum of residuals
+    size_t stride = (size_t)w*4;
+    vector<unsigned char> filtered((stride + 1)*h);
+    vector<unsigned char> candidate[5];
+    for (int f = 0; f < 5; f++) {
+        candidate[f].resize(stride);
+    }
+    for (int y = 0; y < h; y++) {
+        const unsigned char *row = rgba + y*stride;
+        const unsigned char *above = (y > 0) ? row - stride : NULL;
+        int best = 0;
+        long best_sum = -1;
+        for (int f = 0; f < 5; f++) {
+            long sum = 0;
+            for (size_t x = 0; x < stride; x++) {
+                int a = (x >= 4) ? row[x - 4] : 0;
+                int b = above ? above[x] : 0;
+                int c = (above && x >= 4) ? above[x - 4] : 0;
+                unsigned char v = row[x];
+                switch (f) {
+                    case 1: v -= a; break;
+                    case 2: v -= b; break;
+                    case 3: v -= (a + b)/2; break;
+                    case 4: v -= paeth(a, b, c); break;
+                }
+                candidate[f][x] = v;
+                sum += (v < 128) ? v : 256 - v;
+            }
+            if (best_sum < 0 || sum < best_sum) {
+                best_sum = sum;
+                best = f;
+            }
+        }
+        filtered[y*(stride + 1)] = (unsigned char)best;
+        memcpy(&filtered[y*(stride + 1) + 1], candidate[best].data(), stride);
+    }
+
+    static const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    vector<unsigned char> png(signature, signature + 8);
+    vector<unsigned char> header(13, 0);
+    for (int k = 0; k < 4; k++) {
+        header[k] = (unsigned char)((uint32_t)w >> (24 - 8*k));
+        header[4 + k] = (unsigned char)((uint32_t)h >> (24 - 8*k));
+    }
+    header[8] = 8;      // bits per channel
+    header[9] = 6;      // RGBA
+    put_chunk(png, "IHDR", header);
+    vector<unsigned char> compressed;
+    compressed.reserve(filtered.size()/2);
+    zlib_compress(filtered, compressed);
+    put_chunk(png, "IDAT", compressed);
+    put_chunk(png, "IEND", vector<unsigned char>());
+
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+    bool ok = fwrite(png.data(), 1, png.size(), file) == png.size();
+    return (fclose(file) == 0) && ok;
+}
+
+bool CaptureWriter::start(const char *directory, CaptureFormat capture_format, unsigned int num_threads, size_t queue_frames) {
+    dir = directory;
+    if (!dir.empty() && dir[dir.size() - 1] != '/' && dir[dir.size() - 1] != '\\') {
+        dir += '/';
+    }
+    format = capture_format;
+    max_queued = (queue_frames > 0) ? queue_frames : 1;
+    written = dropped = failed = 0;
+    bytes = 0;
+    stopping = false;
+
+    // Raw frames form one stream, so they are written in order by a single thread
+    if (format == CaptureRaw) {
+        string path = dir + "capture.rgba";
+        raw_file = fopen(path.c_str(), "wb");
+        if (!raw_file) {
+            fprintf(stderr, "ERROR: could not create %s\n", path.c_str());
+            return false;
+        }
+        raw_w = raw_h = 0;
+        num_threads = 1;
+    } else if (num_threads == 0) {
+        // Leave a core for the render thread
+        num_threads = thread::hardware_concurrency();
+        num_threads = (num_threads > 1) ? num_threads - 1 : 1;
+    }
+    for (unsigned int i = 0; i < num_threads; i++) {
+        workers.push_back(thread(&CaptureWriter::run, this));
+    }
+    return true;
+}
+
+void CaptureWriter::acquire(CaptureFrame &frame, int w, int h) {
+    frame.w = w;
+    frame.h = h;
+    {
+        lock_guard<mutex> guard(lock);
+        if (!spare.empty()) {
+            frame.pixels.swap(spare.back());
+            spare.pop_back();
+        }
+    }
+    frame.pixels.resize((size_t)w*h*4);
+}
+
+bool CaptureWriter::submit(CaptureFrame &frame) {
+    {
+        lock_guard<mutex> guard(lock);
+        if (queue.size() >= max_queued) {
+            dropped++;
+            spare.push_back(vector<unsigned char>());
+            spare.back().swap(frame.pixels);
+            return false;
+        }
+        queue.push_back(CaptureFrame());
+        CaptureFrame &queued = queue.back();
+        queued.index = frame.index;
+        queued.w = frame.w;
+        queued.h = frame.h;
+        queued.pixels.swap(frame.pixels);
+    }
+    ready.notify_one();
+    return true;
+}
+
+void CaptureWriter::finish() {
+    if (workers.empty()) {
+        return;
+    }
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    ready.notify_all();
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+    workers.clear();
+    spare.clear();
+    if (raw_file) {
+        if (fclose(raw_file) != 0) {
+            failed++;
+        }
+        raw_file = NULL;
+    }
+}
+
+void CaptureWriter::run() {
+    CaptureFrame frame;
+    for (;;) {
+        {
+            unique_lock<mutex> guard(lock);
+            ready.wait(guard, [this] { return stopping || !queue.empty(); });
+            if (queue.empty()) {
+                return;
+            }
+            frame.index = queue.front().index;
+            frame.w = queue.front().w;
+            frame.h = queue.front().h;
+            frame.pixels.swap(queue.front().pixels);
+            queue.pop_front();
+        }
+
+        bool ok = write(frame);
+
+        lock_guard<mutex> guard(lock);
+        if (ok) {
+            written++;
+            bytes += frame.pixels.size();
+        } else {
+            failed++;
+        }
+        spare.push_back(vector<unsigned char>());
+        spare.back().swap(frame.pixels);
+    }
+}
+
+bool CaptureWriter::write(CaptureFrame &frame) {
+    // GL rows are bottom first, image files top first
+    size_t stride = (size_t)frame.w*4;
+    vector<unsigned char> row(stride);
+    for (int y = 0; y < frame.h/2; y++) {
+        unsigned char *top = &frame.pixels[y*stride];
+        unsigned char *bottom = &frame.pixels[(frame.h - 1 - y)*stride];
+        memcpy(row.data(), top, stride);
+        memcpy(top, bottom, stride);
+        memcpy(bottom, row.data(), stride);
+    }
+
+    if (format == CaptureRaw) {
+        // Stream keeps the first frame's size, resized frames are skipped
+        if (raw_w == 0) {
+            raw_w = frame.w;
+            raw_h = frame.h;
+        }
+        if (frame.w != raw_w || frame.h != raw_h) {
+            return false;
+        }
+        return fwrite(frame.pixels.data(), 1, frame.pixels.size(), raw_file) == frame.pixels.size();
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "frame_%06u.png", frame.index);
+    return write_png((dir + name).c_str(), frame.w, frame.h, frame.pixels.data());
+}
@@ -0,0 +1,67 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Frame capture to disk. The renderer hands over frames it has already read back (RGBA, bottom row
+// first as glReadPixels returns them) and background threads encode and write them, so the render
+// loop never waits on disk. Frames are dropped, not queued without bound, when the writers fall behind.
+
+enum CaptureFormat {CapturePng, CaptureRaw};
+
+struct CaptureFrame {
+    unsigned int index;
+    int w, h;
+    std::vector<unsigned char> pixels;
+};
+
+struct CaptureWriter {
+    std::string dir;
+    CaptureFormat format;
+    size_t max_queued;
+
+    // Counters (read after finish, or approximately while running)
+    unsigned int written;
+    unsigned int dropped;
+    unsigned int failed;
+    size_t bytes;               // image bytes before encoding
+    int raw_w, raw_h;           // size of the raw stream (first raw frame)
+
+    CaptureWriter() : format(CapturePng), max_queued(0), written(0), dropped(0), failed(0), bytes(0), raw_w(0), raw_h(0),
+                      raw_file(NULL), stopping(false) {}
+
+    // PNG frames go to <dir>/frame_NNNNNN.png on num_threads writers (0 = hardware threads - 1),
+    // raw frames are appended top row first to <dir>/capture.rgba by a single writer
+    bool start(const char *directory, CaptureFormat capture_format, unsigned int num_threads, size_t queue_frames);
+    // Get storage for a w x h frame (reuses the buffers of written frames)
+    void acquire(CaptureFrame &frame, int w, int h);
+    // Queue a filled frame, false if it was dropped because the queue is full
+    bool submit(CaptureFrame &frame);
+    // Write everything still queued and stop the writers
+    void finish();
+    bool running() const { return !workers.empty(); }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable ready;
+    std::deque<CaptureFrame> queue;
+    std::vector<std::vector<unsigned char> > spare;
+    FILE *raw_file;
+    bool stopping;
+
+    void run();
+    bool write(CaptureFrame &frame);
+};
+
+// Write an RGBA image (rows top first) as an 8 bit RGBA PNG
+bool write_png(const char *path, int w, int h, const unsigned char *rgba);
+
+#endif
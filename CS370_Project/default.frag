@@ -1,7 +1,9 @@
 #version 400 core
 out vec4 fragColor;
 
-in vec4 oColor;
+in VertexData {
+    vec4 oColor;
+};
 
 void main()
 {
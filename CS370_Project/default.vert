@@ -6,7 +6,9 @@ uniform mat4 model_matrix;
 layout(location = 0) in vec4 vPosition;
 layout(location = 1) in vec4 vColor;
 
-out vec4 oColor;
+out VertexData {
+    vec4 oColor;
+};
 
 void main()
 {
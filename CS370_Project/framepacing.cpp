@@ -0,0 +1,78 @@
+// Frame rate limiting and latency reporting
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include "framepacing.h"
+
+using namespace std;
+
+const char *present_mode_name(int mode) {
+    switch (mode) {
+        case PresentVsync: return "vsync";
+        case PresentImmediate: return "immediate";
+        case PresentAdaptive: return "adaptive vsync";
+    }
+    return "unknown";
+}
+
+int parse_present_mode(const char *name) {
+    if (strcmp(name, "on") == 0) return PresentVsync;
+    if (strcmp(name, "off") == 0) return PresentImmediate;
+    if (strcmp(name, "adaptive") == 0) return PresentAdaptive;
+    return -1;
+}
+
+double pacing_time() {
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void FrameLimiter::set_fps(double fps) {
+    period = (fps > 0.0) ? 1.0/fps : 0.0;
+    next = 0.0;
+}
+
+void FrameLimiter::wait() {
+    if (period <= 0.0) {
+        return;
+    }
+    double now = pacing_time();
+    // First frame, or more than a frame late: restart the schedule rather than rushing to catch up
+    if (next == 0.0 || now - next > period) {
+        next = now + period;
+        return;
+    }
+
+    // Sleep most of the way, learning how late the OS wakes us
+    double wake = next - spin;
+    if (wake > now) {
+        this_thread::sleep_for(chrono::duration<double>(wake - now));
+        double late = pacing_time() - wake;
+        spin = min(max(0.9*spin + 0.1*(late + 0.0005), 0.0005), 0.5*period);
+    }
+    while (pacing_time() < next) {
+        // Spin out the rest
+    }
+    next += period;
+}
+
+void report_percentiles(const char *label, const char *count_name, vector<double> times) {
+    if (times.empty()) {
+        return;
+    }
+    double total = 0.0;
+    for (size_t i = 0; i < times.size(); i++) {
+        total += times[i];
+    }
+    sort(times.begin(), times.end());
+    size_t n = times.size();
+    printf("%s (ms) over %u %s: mean %.3f  p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n", label, (unsigned int)n,
+           count_name, 1000.0*total/n, 1000.0*times[n*50/100], 1000.0*times[n*90/100], 1000.0*times[n*99/100],
+           1000.0*times[n - 1]);
+}
+
+void report_latency(const char *label, const vector<double> &latencies) {
+    report_percentiles(label, "inputs", latencies);
+}
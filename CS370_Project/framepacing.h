@@ -0,0 +1,35 @@
+#ifndef FRAMEPACING_H
+#define FRAMEPACING_H
+
+#include <vector>
+
+// Swap interval choices (adaptive tears late frames instead of waiting a whole refresh)
+enum PresentMode {PresentVsync, PresentImmediate, PresentAdaptive, NumPresentModes};
+
+const char *present_mode_name(int mode);
+// Parse "on", "off" or "adaptive", -1 if unknown
+int parse_present_mode(const char *name);
+
+// Frame rate limiter: sleeps for most of the time left, then spins to the deadline. The spin margin
+// follows how late sleeps wake up, so coarse OS timers still hit the target.
+struct FrameLimiter {
+    double period;      // seconds per frame, 0 = off
+    double next;        // deadline of the frame being waited for (steady clock seconds)
+    double spin;        // time before the deadline when sleeping stops
+
+    FrameLimiter() : period(0.0), next(0.0), spin(0.002) {}
+
+    void set_fps(double fps);
+    // Wait until the next frame may start
+    void wait();
+};
+
+// Seconds on a monotonic clock
+double pacing_time();
+
+// Print count, mean and p50/p90/p99/max in ms of times (seconds), e.g. "Label (ms) over 10 frames: ..."
+void report_percentiles(const char *label, const char *count_name, std::vector<double> times);
+// Input latencies (seconds) under a label
+void report_latency(const char *label, const std::vector<double> &latencies);
+
+#endif
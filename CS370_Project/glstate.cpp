@@ -0,0 +1,386 @@
+// Redundant GL state filtering
+
+#include <string.h>
+#include <array>
+#include <map>
+#include <vector>
+#include "glstate.h"
+
+using namespace std;
+
+#define GL_STATE_UNITS 16
+#define GL_STATE_BUFFER_INDICES 16
+#define GL_STATE_ATTRIBS 16
+#define GL_STATE_CAPS 24
+#define GL_STATE_UNIFORMS 256
+#define GL_STATE_UNIFORM_BYTES 64
+#define UNKNOWN (~0u)
+
+// Texture targets and indexed binding points followed per unit/index, other targets are always issued
+enum CachedTextureTargets {Cached2D, Cached2DArray, NumCachedTextureTargets};
+enum CachedBufferTargets {CachedArray, CachedUniform, CachedPixelPack, CachedPixelUnpack, NumCachedBufferTargets};
+
+struct IndexedBinding {
+    GLuint buffer;
+    GLintptr offset;
+    GLsizeiptr size;
+};
+
+struct AttribState {
+    GLuint buffer;
+    GLint components;
+    GLsizei stride;
+    size_t offset;
+};
+
+struct UniformValue {
+    GLsizei bytes;      // 0 = not written through the cache yet
+    unsigned char data[GL_STATE_UNIFORM_BYTES];
+
+    UniformValue() : bytes(0) {}
+};
+
+struct CapState {
+    GLenum cap;
+    GLuint enabled;     // 0, 1 or UNKNOWN
+};
+
+static GlCallCounts counts;
+
+static GLuint program = UNKNOWN;
+static GLuint vao = UNKNOWN;
+static GLuint active_unit = UNKNOWN;
+static GLuint textures[GL_STATE_UNITS][NumCachedTextureTargets];
+static GLuint buffers[NumCachedBufferTargets];
+static IndexedBinding uniform_bindings[GL_STATE_BUFFER_INDICES];
+static GLuint draw_framebuffer = UNKNOWN;
+static GLuint read_framebuffer = UNKNOWN;
+static CapState caps[GL_STATE_CAPS];
+static int num_caps = 0;
+static GLuint depth_mask = UNKNOWN;
+static GLuint color_mask = UNKNOWN;
+static GLint viewport[4];
+static GLboolean viewport_known = GL_FALSE;
+
+// Attribute pointers are vertex array state (indexed by vertex array name)
+static vector<array<AttribState, GL_STATE_ATTRIBS> > vao_attribs;
+static map<GLuint, vector<UniformValue> > program_uniforms;
+static vector<UniformValue> *uniforms = NULL;
+
+unsigned int GlCallCounts::total_issued() const {
+    unsigned int total = 0;
+    for (int k = 0; k < NumGlCallKinds; k++) {
+        total += issued[k];
+    }
+    return total;
+}
+
+unsigned int GlCallCounts::total_filtered() const {
+    unsigned int total = 0;
+    for (int k = 0; k < NumGlCallKinds; k++) {
+        total += filtered[k];
+    }
+    return total;
+}
+
+const GlCallCounts &gl_call_counts() {
+    return counts;
+}
+
+void reset_gl_call_counts() {
+    memset(&counts, 0, sizeof(counts));
+}
+
+const char *gl_call_kind_name(int kind) {
+    static const char *names[NumGlCallKinds] = {"program", "vertex array", "buffer", "texture", "framebuffer",
+                                                "fixed state", "attribute", "uniform"};
+    return (kind >= 0 && kind < NumGlCallKinds) ? names[kind] : "unknown";
+}
+
+// Count a call and report whether it has to be issued
+static inline bool changed(int kind, bool differs) {
+    if (differs) {
+        counts.issued[kind]++;
+    } else {
+        counts.filtered[kind]++;
+    }
+    return differs;
+}
+
+void gl_state_reset() {
+    program = vao = active_unit = UNKNOWN;
+    for (int u = 0; u < GL_STATE_UNITS; u++) {
+        for (int t = 0; t < NumCachedTextureTargets; t++) {
+            textures[u][t] = UNKNOWN;
+        }
+    }
+    for (int t = 0; t < NumCachedBufferTargets; t++) {
+        buffers[t] = UNKNOWN;
+    }
+    for (int i = 0; i < GL_STATE_BUFFER_INDICES; i++) {
+        uniform_bindings[i].buffer = UNKNOWN;
+    }
+    draw_framebuffer = read_framebuffer = UNKNOWN;
+    num_caps = 0;
+    depth_mask = color_mask = UNKNOWN;
+    viewport_known = GL_FALSE;
+    vao_attribs.clear();
+    uniforms = NULL;
+}
+
+void gl_forget_program(GLuint name) {
+    program_uniforms.erase(name);
+    if (program == name) {
+        program = UNKNOWN;
+        uniforms = NULL;
+    }
+}
+
+void gl_use_program(GLuint name) {
+    if (changed(GlProgramCalls, name != program)) {
+        glUseProgram(name);
+        program = name;
+        uniforms = &program_uniforms[name];
+    }
+}
+
+void gl_bind_vertex_array(GLuint name) {
+    if (changed(GlVertexArrayCalls, name != vao)) {
+        glBindVertexArray(name);
+        vao = name;
+    }
+}
+
+static int buffer_slot(GLenum target) {
+    switch (target) {
+        case GL_ARRAY_BUFFER: return CachedArray;
+        case GL_UNIFORM_BUFFER: return CachedUniform;
+        case GL_PIXEL_PACK_BUFFER: return CachedPixelPack;
+        case GL_PIXEL_UNPACK_BUFFER: return CachedPixelUnpack;
+    }
+    // Element array binding belongs to the vertex array, others are not followed
+    return -1;
+}
+
+void gl_bind_buffer(GLenum target, GLuint buffer) {
+    int slot = buffer_slot(target);
+    if (changed(GlBufferCalls, slot < 0 || buffers[slot] != buffer)) {
+        glBindBuffer(target, buffer);
+        if (slot >= 0) {
+            buffers[slot] = buffer;
+        }
+    }
+}
+
+void gl_bind_buffer_range(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+    bool cached = target == GL_UNIFORM_BUFFER && index < GL_STATE_BUFFER_INDICES;
+    if (cached) {
+        IndexedBinding &b = uniform_bindings[index];
+        if (!changed(GlBufferCalls, b.buffer != buffer || b.offset != offset || b.size != size)) {
+            return;
+        }
+        b.buffer = buffer;
+        b.offset = offset;
+        b.size = size;
+    } else {
+        changed(GlBufferCalls, true);
+    }
+    glBindBufferRange(target, index, buffer, offset, size);
+    // Also binds the generic target
+    int slot = buffer_slot(target);
+    if (slot >= 0) {
+        buffers[slot] = buffer;
+    }
+}
+
+static void bind_texture(GLuint unit, GLenum target, GLuint texture, bool activate) {
+    int t = (target == GL_TEXTURE_2D) ? Cached2D : (target == GL_TEXTURE_2D_ARRAY) ? Cached2DArray : -1;
+    bool cached = t >= 0 && unit < GL_STATE_UNITS;
+    bool differs = !cached || textures[unit][t] != texture;
+    // Unit switches are counted with the binds
+    if ((differs || activate) && unit != active_unit) {
+        counts.issued[GlTextureCalls]++;
+        glActiveTexture(GL_TEXTURE0 + unit);
+        active_unit = unit;
+    }
+    if (changed(GlTextureCalls, differs)) {
+        glBindTexture(target, texture);
+        if (cached) {
+            textures[unit][t] = texture;
+        }
+    }
+}
+
+void gl_bind_texture(GLuint unit, GLenum target, GLuint texture) {
+    bind_texture(unit, target, texture, false);
+}
+
+void gl_edit_texture(GLenum target, GLuint texture) {
+    bind_texture(0, target, texture, true);
+}
+
+void gl_bind_framebuffer(GLenum target, GLuint framebuffer) {
+    bool draw = target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER;
+    bool read = target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER;
+    bool differs = (draw && draw_framebuffer != framebuffer) || (read && read_framebuffer != framebuffer);
+    if (changed(GlFramebufferCalls, differs)) {
+        glBindFramebuffer(target, framebuffer);
+        if (draw) {
+            draw_framebuffer = framebuffer;
+        }
+        if (read) {
+            read_framebuffer = framebuffer;
+        }
+    }
+}
+
+static void set_cap(GLenum cap, GLuint enabled) {
+    CapState *state = NULL;
+    for (int i = 0; i < num_caps; i++) {
+        if (caps[i].cap == cap) {
+            state = &caps[i];
+            break;
+        }
+    }
+    if (!state && num_caps < GL_STATE_CAPS) {
+        state = &caps[num_caps++];
+        state->cap = cap;
+        state->enabled = UNKNOWN;
+    }
+    if (changed(GlFixedStateCalls, !state || state->enabled != enabled)) {
+        if (enabled) {
+            glEnable(cap);
+        } else {
+            glDisable(cap);
+        }
+        if (state) {
+            state->enabled = enabled;
+        }
+    }
+}
+
+void gl_enable(GLenum cap) {
+    set_cap(cap, 1);
+}
+
+void gl_disable(GLenum cap) {
+    set_cap(cap, 0);
+}
+
+void gl_depth_mask(GLboolean flag) {
+    if (changed(GlFixedStateCalls, depth_mask != (GLuint)flag)) {
+        glDepthMask(flag);
+        depth_mask = flag;
+    }
+}
+
+void gl_color_mask(GLboolean r, GLboolean g, GLboolean b, GLboolean a) {
+    GLuint mask = (r ? 1 : 0) | (g ? 2 : 0) | (b ? 4 : 0) | (a ? 8 : 0);
+    if (changed(GlFixedStateCalls, color_mask != mask)) {
+        glColorMask(r, g, b, a);
+        color_mask = mask;
+    }
+}
+
+void gl_viewport(GLint x, GLint y, GLsizei w, GLsizei h) {
+    bool differs = !viewport_known || viewport[0] != x || viewport[1] != y || viewport[2] != w || viewport[3] != h;
+    if (changed(GlFixedStateCalls, differs)) {
+        glViewport(x, y, w, h);
+        viewport[0] = x;
+        viewport[1] = y;
+        viewport[2] = w;
+        viewport[3] = h;
+        viewport_known = GL_TRUE;
+    }
+}
+
+void gl_vertex_attrib(GLuint index, GLuint buffer, GLint components, GLsizei stride, size_t offset) {
+    // Attributes a shader doesn't use have location -1
+    if (index >= GL_STATE_ATTRIBS) {
+        return;
+    }
+    AttribState *state = NULL;
+    if (vao != UNKNOWN) {
+        if (vao >= vao_attribs.size()) {
+            array<AttribState, GL_STATE_ATTRIBS> unset;
+            for (int i = 0; i < GL_STATE_ATTRIBS; i++) {
+                unset[i].buffer = UNKNOWN;
+            }
+            vao_attribs.resize(vao + 1, unset);
+        }
+        state = &vao_attribs[vao][index];
+    }
+    bool differs = !state || state->buffer != buffer || state->components != components || state->stride != stride ||
+                   state->offset != offset;
+    if (changed(GlAttribCalls, differs)) {
+        gl_bind_buffer(GL_ARRAY_BUFFER, buffer);
+        glVertexAttribPointer(index, components, GL_FLOAT, GL_FALSE, stride, (const void *)offset);
+        glEnableVertexAttribArray(index);
+        if (state) {
+            state->buffer = buffer;
+            state->components = components;
+            state->stride = stride;
+            state->offset = offset;
+        }
+    }
+}
+
+// Compare a write with the program's last value, false when it can be dropped
+static bool uniform_changed(GLint location, const void *data, GLsizei bytes) {
+    // Writes to location -1 are ignored by GL anyway
+    if (location < 0) {
+        counts.filtered[GlUniformCalls]++;
+        return false;
+    }
+    if (!uniforms || location >= GL_STATE_UNIFORMS || bytes > GL_STATE_UNIFORM_BYTES) {
+        counts.issued[GlUniformCalls]++;
+        return true;
+    }
+    if ((size_t)location >= uniforms->size()) {
+        uniforms->resize(location + 1);
+    }
+    UniformValue &value = (*uniforms)[location];
+    if (!changed(GlUniformCalls, value.bytes != bytes || memcmp(value.data, data, bytes) != 0)) {
+        return false;
+    }
+    value.bytes = bytes;
+    memcpy(value.data, data, bytes);
+    return true;
+}
+
+void gl_uniform_1i(GLint location, GLint value) {
+    if (uniform_changed(location, &value, sizeof(value))) {
+        glUniform1i(location, value);
+    }
+}
+
+void gl_uniform_1f(GLint location, GLfloat value) {
+    if (uniform_changed(location, &value, sizeof(value))) {
+        glUniform1f(location, value);
+    }
+}
+
+void gl_uniform_2f(GLint location, GLfloat x, GLfloat y) {
+    GLfloat values[2] = {x, y};
+    if (uniform_changed(location, values, sizeof(values))) {
+        glUniform2f(location, x, y);
+    }
+}
+
+void gl_uniform_1iv(GLint location, GLsizei count, const GLint *values) {
+    if (uniform_changed(location, values, count*sizeof(GLint))) {
+        glUniform1iv(location, count, values);
+    }
+}
+
+void gl_uniform_3fv(GLint location, GLsizei count, const GLfloat *values) {
+    if (uniform_changed(location, values, 3*count*sizeof(GLfloat))) {
+        glUniform3fv(location, count, values);
+    }
+}
+
+void gl_uniform_matrix4fv(GLint location, GLsizei count, const GLfloat *values) {
+    if (uniform_changed(location, values, 16*count*sizeof(GLfloat))) {
+        glUniformMatrix4fv(location, count, GL_FALSE, values);
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include <stddef.h>
+#include "../common/vgl.h"
+
+// Cached GL state. Binds, capability switches and uniform writes go through these wrappers, which
+// drop calls that would not change anything and count issued and filtered calls. Code that changes
+// state behind their back (e.g. a library binding objects) must call gl_state_reset() afterwards.
+// Uniform values are cached per program, so a relinked program must be passed to gl_forget_program().
+
+enum GlCallKind {GlProgramCalls, GlVertexArrayCalls, GlBufferCalls, GlTextureCalls, GlFramebufferCalls,
+                 GlFixedStateCalls, GlAttribCalls, GlUniformCalls, NumGlCallKinds};
+
+struct GlCallCounts {
+    unsigned int issued[NumGlCallKinds];
+    unsigned int filtered[NumGlCallKinds];
+
+    unsigned int total_issued() const;
+    unsigned int total_filtered() const;
+};
+
+// Counts since the last reset (reset at the start of each rendered frame)
+const GlCallCounts &gl_call_counts();
+void reset_gl_call_counts();
+const char *gl_call_kind_name(int kind);
+
+// Forget all cached bindings (uniform values are kept)
+void gl_state_reset();
+void gl_forget_program(GLuint program);
+
+void gl_use_program(GLuint program);
+void gl_bind_vertex_array(GLuint vao);
+void gl_bind_buffer(GLenum target, GLuint buffer);
+void gl_bind_buffer_range(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+// Bind for drawing (the active unit only changes when the bind is issued)
+void gl_bind_texture(GLuint unit, GLenum target, GLuint texture);
+// Bind to unit 0 and make it active, for glTex* calls that follow
+void gl_edit_texture(GLenum target, GLuint texture);
+void gl_bind_framebuffer(GLenum target, GLuint framebuffer);
+void gl_enable(GLenum cap);
+void gl_disable(GLenum cap);
+void gl_depth_mask(GLboolean flag);
+void gl_color_mask(GLboolean r, GLboolean g, GLboolean b, GLboolean a);
+void gl_viewport(GLint x, GLint y, GLsizei w, GLsizei h);
+
+// Point (and enable) a float attribute of the bound vertex array at a buffer
+void gl_vertex_attrib(GLuint index, GLuint buffer, GLint components, GLsizei stride = 0, size_t offset = 0);
+
+// Uniforms of the program in use
+void gl_uniform_1i(GLint location, GLint value);
+void gl_uniform_1f(GLint location, GLfloat value);
+void gl_uniform_2f(GLint location, GLfloat x, GLfloat y);
+void gl_uniform_1iv(GLint location, GLsizei count, const GLint *values);
+void gl_uniform_3fv(GLint location, GLsizei count, const GLfloat *values);
+void gl_uniform_matrix4fv(GLint location, GLsizei count, const GLfloat *values);
+
+#endif
@@ -3,62 +3,112 @@
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "../common/stb_image.h"	// Sean Barrett's image loader - http://nothings.org/
+#include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 #include <vector>
+#include <array>
+#include <algorithm>
+#include <string>
 #include "../common/vgl.h"
 #include "../common/objloader.h"
+#include "objparser.h"
 #include "../common/utils.h"
 #include "../common/vmath.h"
 #include "lighting.h"
-#include "../common/tangentspace.h"
+#include "meshtools.h"
+#include "meshlod.h"
+#include "transforms.h"
+#include "imageutils.h"
+#include "inputlog.h"
+#include "perfstats.h"
+#include "scene.h"
+#include "scenestress.h"
+#include "mappedfile.h"
+#include "resources.h"
+#include "hud.h"
+#include "lightmap.h"
+#include "capture.h"
+#include "framepacing.h"
+#include "bvh.h"
+#include "glstate.h"
+#include "texbudget.h"
+#include "assets.h"
+#include "rendergraph.h"
 
 #define DEG2RAD (M_PI/180.0)
 
 using namespace vmath;
 using namespace std;
 
-// Vertex array and buffer names
-enum VAO_IDs {Cube, Table, Chair, Door, Cup, Soda, Circle, Bowl, Sphere, Blinds, Fan, Frame, Drawer, TV, Plane, Painting, NumVAOs};
-enum ObjBuffer_IDs {PosBuffer, NormBuffer, TexBuffer, TangBuffer, BiTangBuffer, NumObjBuffers};
+// Vertex array and buffer names (meshes, textures and materials are indexed as in the scene file)
+enum ObjBuffer_IDs {PosBuffer, NormBuffer, TexBuffer, TangBuffer, NumObjBuffers};
 enum Color_Buffer_IDs {RedCube, BlueCube, GreenCube, NumColorBuffers};
 enum LightBuffer_IDs {LightBuffer, NumLightBuffers};
 enum MaterialBuffer_IDs {MaterialBuffer, NumMaterialBuffers};
-enum MaterialNames {Walls, CupMaterial, WhiteMaterial, SodaMaterial, TVMaterial, DresserMaterial};
-enum Textures {Wood, Carpet, Apple, Popeye, Window, SodaTex, SodaTop, Wednesday, Splatoon, Coyote, FruitNorm, WoodNorm, MirrorTex, NumTextures};
+enum Framebuffer_IDs {SceneFramebuffer, MultiviewFramebuffer, MultiviewLayerFramebuffer, BudgetFramebuffer, NumFramebuffers};
 
 
-// Vertex array and buffer objects
-GLuint VAOs[NumVAOs];
-GLuint ObjBuffers[NumVAOs][NumObjBuffers];
+// Vertex array and buffer objects (one per scene mesh)
+vector<GLuint> VAOs;
+vector<array<GLuint, NumObjBuffers> > ObjBuffers;
 GLuint ColorBuffers[NumColorBuffers];
+vec4 solidColors[NumColorBuffers] = {vec4(1.0f, 0.0f, 0.0f, 1.0f), vec4(0.0f, 0.0f, 1.0f, 1.0f), vec4(0.0f, 1.0f, 0.0f, 1.0f)};
 GLuint LightBuffers[NumLightBuffers];
 GLuint MaterialBuffers[NumMaterialBuffers];
-GLuint TextureIDs[NumTextures];
+GLuint Framebuffers[NumFramebuffers];
+
+// Textures (scene textures, then the scene render target; MirrorTex is the scene's @mirror texture)
+vector<GLuint> TextureIDs;
+GLint MirrorTex = -1;
+GLint SceneTex = -1;
 
 
 // Number of vertices in each object
-GLint numVertices[NumVAOs];
+vector<GLint> numVertices;
+
+// Level of detail ranges in each object's buffers (level 0 is the full mesh)
+#define MAX_LODS 5
+vector<GLint> numLods;
+vector<array<GLint, MAX_LODS> > lodFirst;
+vector<array<GLint, MAX_LODS> > lodCount;
+
+// Object space bounds of each object
+vector<MeshBounds> objBounds;
+
+// Triangle tree of each object (object space) and the instance tree over them for collision and picking
+vector<Bvh> meshBvhs;
+InstanceBvh scene_bvh;
+vector<GLuint> animatedInstances;
+// Last left click pick (-1 = nothing under the cursor), shown on the HUD
+GLint selected_instance = -1;
+GLfloat selected_distance = 0.0f;
+GLfloat camera_radius = 0.25f;
+// Walking eye height and the floor (collision rays sweep the body between them)
+GLfloat camera_eye_height = -2.5f;
+GLfloat camera_floor_height = -4.0f;
+// Rows closer than the thinnest furniture slab (chair seats are about 0.07 thick)
+#define CAMERA_RAY_SPACING 0.05f
+
+// Screen diameter (pixels) where the first coarser level starts, and bias (+1 = one level coarser)
+GLfloat lod_pixels = 256.0f;
+GLfloat lod_bias = 0.0f;
 
 // Number of component coordinates
 GLint posCoords = 4;
 GLint normCoords = 3;
 GLint texCoords = 2;
 GLint colCoords = 4;
-GLint tangCoords = 3;
-GLint bitangCoords = 3;
-
-// Model files
-vector<const char *> objFiles = {"../models/unitcube.obj", "../models/table.obj", "../models/chair.obj", "../models/door.obj", "../models/cup.obj",
-                                 "../models/cylinder.obj", "../models/circle.obj", "../models/bowl.obj", "../models/sphere.obj", "../models/blinds.obj", "../models/fan.obj",
-                                 "../models/frame.obj", "../models/drawer.obj", "../models/tv.obj", "../models/plane.obj"};
-
-// Texture files
-vector<const char *> texFiles = {"../textures/wood.jpg", "../textures/carpet.jpg",  "../textures/apple.jpg", "../textures/popeye.png",
-                                 "../textures/snow.jpg", "../textures/sodatex.jpg", "../textures/sodatop.jpeg", "../textures/wednesday.jpg",
-                                 "../textures/splatoon.jpg", "../textures/wileecoyote.jpg", "../textures/fruitnorm.jpg", "../textures/woodnorm.jpg"};
-
-
+GLint tangCoords = 4;
 
+// Scene file (text scenes are cooked at load, .hscn images are mapped and used in place)
+const char *scene_path = "../scenes/house.scene";
+MappedFile scene_file;
+vector<char> scene_image;
+Scene scene;
+string scene_dir;
+// Instance drawn with the @mirror texture (-1 if the scene has no mirror)
+GLint mirror_instance = -1;
 
 
 vec3 mirror_eye = {0.0f, -0.50f, 3.94f};
@@ -89,6 +139,7 @@ GLuint default_cam_mat_loc;
 GLuint default_model_mat_loc;
 const char *default_vertex_shader = "../default.vert";
 const char *default_frag_shader = "../default.frag";
+const char *default_geom_shader = "../default.geom";
 
 // Lighting shader program reference
 GLuint lighting_program;
@@ -106,6 +157,7 @@ GLuint lighting_light_on_loc;
 GLuint lighting_eye_loc;
 const char *lighting_vertex_shader = "../lighting.vert";
 const char *lighting_frag_shader = "../lighting.frag";
+const char *lighting_geom_shader = "../lighting.geom";
 
 
 // Light shader program with shadows reference
@@ -141,6 +193,7 @@ GLuint multi_tex_base_loc;
 GLuint multi_tex_dirt_loc;
 const char *multi_tex_vertex_shader = "../multiTex.vert";
 const char *multi_tex_frag_shader = "../multiTex.frag";
+const char *multi_tex_geom_shader = "../texture.geom";
 
 // Bumpmapping shader program reference
 GLuint bump_program;
@@ -152,7 +205,6 @@ GLuint bump_vPos;
 GLuint bump_vNorm;
 GLuint bump_vTex;
 GLuint bump_vTang;
-GLuint bump_vBiTang;
 GLuint bump_lights_block_idx;
 GLuint bump_num_lights_loc;
 GLuint bump_light_on_loc;
@@ -161,12 +213,32 @@ GLuint bump_base_loc;
 GLuint bump_norm_loc;
 const char *bump_vertex_shader = "../bumpTex.vert";
 const char *bump_frag_shader = "../bumpTex.frag";
+const char *bump_geom_shader = "../bumpTex.geom";
 
 // Debug mirror shader
 GLuint debug_mirror_program;
 const char *debug_mirror_vertex_shader = "../debugMirror.vert";
 const char *debug_mirror_frag_shader = "../debugMirror.frag";
 
+// Upscale shader (scaled scene to window)
+GLuint upscale_program;
+GLuint upscale_scene_loc;
+GLuint upscale_uv_scale_loc;
+GLuint upscale_texel_size_loc;
+GLuint upscale_sharpness_loc;
+GLuint upscaleVAO;
+const char *upscale_vertex_shader = "../upscale.vert";
+const char *upscale_frag_shader = "../upscale.frag";
+
+// Occlusion query shader (bounding boxes)
+GLuint occlusion_program;
+GLuint occlusion_vPos;
+GLuint occlusion_mvp_loc;
+GLuint occlusionVAO;
+GLuint occlusionVBO;
+const char *occlusion_vertex_shader = "../occlusion.vert";
+const char *occlusion_frag_shader = "../occlusion.frag";
+
 // Texture shader program reference
 GLuint texture_program;
 GLuint texture_vPos;
@@ -176,6 +248,69 @@ GLuint texture_camera_mat_loc;
 GLuint texture_model_mat_loc;
 const char *texture_vertex_shader = "../texture.vert";
 const char *texture_frag_shader = "../texture.frag";
+const char *texture_geom_shader = "../texture.geom";
+
+// Baked lighting shader program reference (static instances lit from lightmaps)
+GLuint baked_program;
+GLuint baked_vPos;
+GLuint baked_vLightmap;
+GLuint baked_proj_mat_loc;
+GLuint baked_camera_mat_loc;
+GLuint baked_model_mat_loc;
+GLuint baked_lightmaps_loc;
+GLuint baked_num_lights_loc;
+GLuint baked_light_on_loc;
+GLuint baked_alpha_loc;
+const char *baked_vertex_shader = "../baked.vert";
+const char *baked_frag_shader = "../baked.frag";
+const char *baked_geom_shader = "../baked.geom";
+
+// Uber shader program reference (every surface type in one program, per draw records in a uniform
+// buffer so opaque instances with the same mesh and textures go out as one instanced draw)
+#define UBER_BINDING 3
+#define UBER_MAX_DRAWS 64
+enum Uber_Flags {UberBaseTex = 1, UberDetailTex = 2, UberNormalMap = 4, UberLit = 8};
+struct UberDraw {
+    GLfloat model[16];
+    GLfloat normal[16];
+    GLfloat color[4];
+    GLint flags;
+    GLint material;
+    GLint pad[2];
+};
+struct UberBatch {
+    GLuint obj;
+    GLint lod;
+    GLint flags;
+    GLint texture;
+    GLint texture2;
+    GLboolean depth_write;
+    GLint record;           // multiview record (-1 = none)
+    GLuint query;           // occlusion query the GPU tests the draw against (0 = none)
+    GLuint first;
+    GLuint count;
+};
+GLboolean uber = false;
+GLuint uber_program;
+GLuint uber_proj_mat_loc;
+GLuint uber_camera_mat_loc;
+GLuint uber_eye_loc;
+GLuint uber_draw_base_loc;
+GLuint uber_num_lights_loc;
+GLuint uber_light_on_loc;
+GLuint uber_base_loc;
+GLuint uber_detail_loc;
+GLuint uber_norm_loc;
+GLuint UberBuffer;
+GLint uber_chunk_size = 0;
+size_t uber_buffer_size = 0;
+vector<UberDraw> uberDraws;
+vector<UberBatch> uberBatches;
+vector<UberDraw> uberSortedDraws;
+vector<UberBatch> uberMergedBatches;
+const char *uber_vertex_shader = "../uber.vert";
+const char *uber_frag_shader = "../uber.frag";
+const char *uber_geom_shader = "../uber.geom";
 
 // Generic shader variables references
 GLuint vPos;
@@ -184,6 +319,12 @@ GLuint model_mat_loc;
 
 // Mirror flag
 GLboolean mirror = false;
+// Current mirror texture size
+GLint mirror_w = 0;
+GLint mirror_h = 0;
+// Whether the mirror is on screen this frame and the part of its texture that gets sampled
+GLboolean mirror_visible = false;
+vec4 mirror_uv;
 
 // Shadow flag
 GLuint shadow = false;
@@ -202,6 +343,211 @@ GLfloat rpm = 2.5f;
 
 GLint channel = 0;
 
+// On-demand rendering (redraw only when the scene is dirty, otherwise block on events)
+GLboolean on_demand = false;
+GLboolean scene_dirty = true;
+GLboolean scene_damaged = false;
+GLdouble idle_timeout = 0.25;
+
+// Input recording and replay (both step the simulation by a fixed dt so runs are repeatable)
+const char *record_file = NULL;
+const char *replay_file = NULL;
+const char *frame_times_file = NULL;
+InputLog input_log;
+size_t replay_next = 0;
+unsigned int frame_number = 0;
+// Frames actually drawn (texture use and eviction age count these, idle on demand waits don't)
+unsigned int rendered_frames = 0;
+vector<double> frame_times;
+
+// GPU frame timers (timestamps at frame start, after the mirror pass and after the main pass)
+#define GPU_TIMER_FRAMES 4
+enum Gpu_Timestamps {FrameStartStamp, MirrorDoneStamp, MainDoneStamp, NumGpuTimestamps};
+GLuint gpuTimerQueries[GPU_TIMER_FRAMES][NumGpuTimestamps];
+GLint gpu_timer_next = 0;
+GLint gpu_timer_pending = 0;
+GLboolean gpu_timer_active = false;
+
+// Dynamic resolution (scene renders at render_scale of the window, steered toward a GPU time budget)
+GLdouble gpu_budget_ms = 0.0;
+GLdouble gpu_time_ms = 0.0;
+GLfloat render_scale = 1.0f;
+GLfloat min_render_scale = 0.5f;
+GLfloat max_render_scale = 1.0f;
+GLfloat sharpness = 0.25f;
+
+// Occlusion culling (each drawn instance gets a bounding box query per pass, read one frame later)
+enum Occlusion_Passes {MirrorPass, MainPass, NumOcclusionPasses};
+struct OcclusionSlot {
+    GLuint obj;
+    mat4 model;
+    GLuint queries[2];
+    GLboolean issued[2];
+};
+vector<OcclusionSlot> occlusionSlots[NumOcclusionPasses];
+GLint occlusion_parity[NumOcclusionPasses] = {0, 0};
+GLint occlusion_pass = MainPass;
+GLint occlusion_next = 0;
+GLboolean occlusion = true;
+GLenum occlusion_target = GL_ANY_SAMPLES_PASSED;
+// Last frame's result for an instance (pending ones are left to conditional rendering)
+enum Occlusion_Verdicts {OcclusionVisible, OcclusionCulled, OcclusionPending};
+
+// Texture memory budget (scene textures give up mip levels, least recently used first, to fit --texture-budget)
+TextureBudget texture_budget;
+vector<GLint> budgetTextures;       // budget index of each scene texture (-1 = not tracked)
+vector<GLint> budgetOwners;         // scene texture of each budget index
+vector<int> budget_changed;
+GLuint budget_scratch_tex = 0;      // holds a shrinking texture's new base level while it is reallocated
+
+// Lazy scene textures (placeholder storage until a draw uses them, then decoded in the background;
+// each instance holds references to its textures, unused ones go back to the placeholder)
+#define ASSET_UPLOADS_PER_FRAME 2
+AssetManager asset_manager;
+vector<GLint> textureAssets;        // asset handle of each scene texture (-1 = rendered texture)
+vector<GLint> assetOwners;          // scene texture of each asset handle
+vector<GLboolean> normalMapTextures;
+GLboolean preload_textures = false;
+vector<int> assets_ready;
+vector<int> assets_evicted;
+
+// Frame passes (declared each frame, see build_frame_graph)
+RenderGraph render_graph;
+GLint graph_mirror_pass = -1;
+GLboolean debug_mirror = false;
+
+// Per-frame counters (printed once a second with --stats)
+FrameStats frame_stats;
+GLboolean print_stats = false;
+GLdouble stats_time = 0.0;
+
+// Performance overlay (H toggles, graphs CPU submit and GPU frame times)
+GLboolean hud = false;
+GLuint hud_program;
+GLuint hud_vPos;
+GLuint hud_vTex;
+GLuint hud_vCol;
+GLuint hud_screen_size_loc;
+GLuint hud_font_loc;
+GLuint hudVAO;
+GLuint hudVBO;
+GLuint HudFontTex;
+GLsizeiptr hud_vbo_size = 0;
+HudBatch hud_batch;
+HudHistory hud_cpu_history;
+HudHistory hud_gpu_history;
+HudHistory hud_interval_history;
+GLdouble hud_last_frame = 0.0;
+// Last frame's per pass times (GPU ones arrive a few frames late)
+GLdouble cpu_mirror_ms = 0.0;
+GLdouble cpu_main_ms = 0.0;
+GLdouble gpu_frame_ms = 0.0;
+GLdouble gpu_mirror_ms = 0.0;
+GLdouble gpu_main_ms = 0.0;
+const char *hud_vertex_shader = "../hud.vert";
+const char *hud_frag_shader = "../hud.frag";
+
+// Lightmaps for baked scene instances (cached next to the scene, baked on first run or with --rebake)
+GLboolean lightmaps_enabled = true;
+GLboolean rebake = false;
+LightmapSettings lightmap_settings;
+Lightmaps lightmaps;
+GLuint LightmapTex = 0;
+// Lightmap VAO of each instance (-1 = lit dynamically), position buffer shared with the mesh
+vector<GLint> instanceLightmap;
+vector<GLuint> lightmapVAOs;
+vector<GLuint> lightmapBuffers;
+
+// Frame capture (read back through a ring of pack buffers with fences, written on background threads)
+#define CAPTURE_PBOS 4
+#define CAPTURE_QUEUE 8
+struct CaptureSlot {
+    GLuint pbo;
+    GLsizeiptr size;
+    GLsync fence;
+    GLint w, h;
+    GLuint frame;
+};
+const char *capture_dir = NULL;
+CaptureFormat capture_format = CapturePng;
+GLint capture_every = 1;
+GLuint capture_threads = 0;
+CaptureWriter capture_writer;
+CaptureSlot captureSlots[CAPTURE_PBOS];
+GLint capture_next = 0;
+GLuint capture_count = 0;
+GLuint capture_ring_full = 0;
+GLboolean capture_this_frame = false;
+
+// Multiview (scene programs get a geometry shader that draws the main and mirror views in one traversal)
+#define MULTIVIEW_BINDING 2
+enum Multiview_Records {BothViewsRecord, MainViewRecord, MirrorViewRecord, NumMultiviewRecords};
+// Main view order is opaque instances, the mirror (once its layer is copied out), then transparent instances
+enum Multiview_Passes {MultiviewOff, MultiviewLayers, MultiviewOverlay};
+struct MultiviewRecord {
+    GLfloat mirror_from_main[16];
+    GLfloat mirror_bounds[4];
+    GLint view_mask;
+};
+GLboolean multiview = false;
+// Geometry stage of the scene programs (GL_NONE ends their shader lists before it)
+GLenum multiview_stage = GL_NONE;
+GLuint MultiviewBuffer;
+GLint multiview_record_size = 0;
+GLint multiview_record = -1;
+GLuint MultiviewTex;
+GLuint MultiviewDepthTex;
+GLint multiview_w = 0;
+GLint multiview_h = 0;
+GLint multiview_pass = MultiviewOff;
+
+// Frame pacing (-1 leaves the swap interval the window was created with)
+GLint present_mode = -1;
+FrameLimiter frame_limiter;
+
+// Input-to-present latency (inputs are stamped when handled and follow the frame that reflects them
+// to its swap and to a GPU timestamp behind it)
+#define LATENCY_FRAMES 8
+struct LatencySlot {
+    GLuint query;
+    GLsync fence;
+    vector<GLdouble> inputs;
+};
+GLboolean measure_latency = false;
+LatencySlot latencySlots[LATENCY_FRAMES];
+GLint latency_next = 0;
+GLuint latency_ring_full = 0;
+vector<GLdouble> pending_inputs;
+vector<GLdouble> frame_inputs;
+GLdouble gpu_clock_offset = 0.0;
+GLdouble gpu_clock_time = -1.0;
+vector<double> latency_to_frame;
+vector<double> latency_to_swap;
+vector<double> latency_to_gpu;
+
+// Stress mode (room furniture tiled over a grid, swept over object counts with per step averages)
+struct StressResult {
+    GLuint count;
+    GLboolean uber;
+    GLdouble cpu_ms;
+    GLdouble gpu_ms;
+    GLdouble draws;
+    GLdouble state_changes;
+    GLdouble culled;
+};
+GLboolean stress = false;
+GLboolean uber_bench = false;
+vector<GLuint> stress_counts = {100, 1000, 10000, 100000};
+GLint stress_frames = 120;
+GLint stress_warmup = 10;
+GLint stress_step = 0;
+GLint stress_frame = 0;
+GLint stress_gpu_samples = 0;
+StressResult stress_sum;
+vector<StressResult> stress_results;
+Scene base_scene;
+vector<char> stress_image;
+
 // Global state
 mat4 proj_matrix;
 mat4 camera_matrix;
@@ -213,24 +559,95 @@ mat4 shadow_camera_matrix;
 vector<LightProperties> Lights;
 vector<MaterialProperties> Materials;
 GLuint numLights = 0;
-GLint lightOn[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+vector<GLint> lightOn;
+// Light and material array sizes compiled into the shaders (the uniform blocks are bound at these sizes)
+GLint shader_max_lights = 1;
+GLint shader_max_materials = 1;
 
 // Global screen dimensions
 GLint ww,hh;
+// Scene render dimensions (window scaled by render_scale)
+GLint rw,rh;
 
 void display();
 void render_scene();
+void draw_instance(const SceneInstance &inst, GLint index);
+bool load_scene(const char *path);
+string scene_file_path(uint32_t path);
+mat4 instance_model_matrix(const SceneInstance &inst);
 void build_geometry();
 void build_solid_color_buffer(GLuint num_vertices, vec4 color, GLuint buffer);
 void build_materials( );
 void build_lights( );
+void update_materials( );
+void update_lights( );
+GLuint load_sized_shaders(ShaderInfo *shaders);
+void find_mirror_instance();
+void start_stress_step();
+void record_stress_frame(GLFWwindow *window, GLdouble cpu_ms);
+void report_stress();
+void report_memory();
 
 void build_textures();
+void apply_texture_budget();
+void upload_placeholder(GLint texture);
+void reference_scene_textures(GLboolean acquire);
+void update_assets(size_t max_uploads);
+void preload_scene_textures();
+void build_frame_graph();
 
 void build_mirror();
 void create_mirror();
-void build_painting();
+void main_view(mat4 &proj, mat4 &camera);
+mat4 mirror_model_matrix();
+GLboolean mirror_uv_bounds(vec4 &bounds);
+void build_scene_framebuffer();
+void resize_scene_framebuffer();
+void present_scene(GLFWwindow *window);
+void update_render_size();
+void begin_gpu_timer();
+void mark_gpu_timer(GLint stamp);
+void end_gpu_timer();
+void build_hud();
+void draw_hud();
+void build_lightmaps();
+void build_capture();
+void build_multiview();
+void display_multiview();
+void bind_multiview_record(GLint record);
+void mirror_view(mat4 &proj, mat4 &camera);
+void size_mirror_texture();
+void mirror_texel_rect(const vec4 &uv_bounds, GLint rect[4]);
+void capture_frame();
+void collect_captures(GLboolean wait);
+void finish_capture();
+void build_scene_bvh();
+void refit_scene_bvh();
+GLboolean camera_blocked(const vec3 &from, const vec3 &to);
+void pick_ray(GLdouble x, GLdouble y, vec3 &origin, vec3 &dir);
+void apply_present_mode();
+void build_latency();
+void mark_latency(GLdouble frame_start, GLdouble swap_end);
+void collect_latency(GLboolean wait);
+void adjust_render_scale(GLdouble frame_ms);
+void build_painting(GLuint obj);
 void load_bump_object(GLuint obj);
+void append_lods(GLuint obj, vector<vec4> &vertices, vector<vec2> &uvCoords, vector<vec3> &normals, vector<vec4> *tangents);
+GLint select_lod(GLuint obj);
+GLfloat screen_diameter(GLuint obj, GLint pixels_high);
+void register_mesh_buffers(GLuint obj, GLuint num_vertices, GLboolean tangents);
+void draw_object(GLuint obj);
+void draw_object_lod(GLuint obj, GLint lod);
+GLint occlusion_verdict(GLuint obj, GLuint &query);
+void build_uber();
+void queue_uber_draw(const SceneInstance &inst);
+bool uber_batch_less(const UberBatch &a, const UberBatch &b);
+void merge_uber_draws();
+void flush_uber_draws();
+void build_occlusion();
+void begin_occlusion_pass();
+void end_occlusion_pass();
+void invalidate_occlusion(GLint pass);
 void draw_bump_object(GLuint obj, GLuint base_texture, GLuint normal_map);
 void draw_multi_tex_object(GLuint obj, GLuint texture1, GLuint texture2);
 void renderQuad(GLuint shader, GLuint tex);
@@ -239,14 +656,136 @@ void load_object(GLuint obj);
 void draw_color_obj(GLuint obj, GLuint color);
 void draw_mat_object(GLuint obj, GLuint material);
 void draw_mat_shadow_object(GLuint obj, GLuint material);
+void draw_baked_object(GLuint obj, GLuint baked, GLuint material);
 void draw_tex_object(GLuint obj, GLuint texture);
 void draw_tex_object2(GLuint obj, GLuint texture);
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods);
+void apply_key(int key, int action);
+void window_refresh_callback(GLFWwindow *window);
 void mouse_callback(GLFWwindow *window, int button, int action, int mods);
 
 int main(int argc, char**argv)
 {
+    // Parse command line options
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--on-demand") == 0) {
+            on_demand = true;
+        } else if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc) {
+            scene_path = argv[++i];
+        } else if (strcmp(argv[i], "--lod-bias") == 0 && i + 1 < argc) {
+            lod_bias = (GLfloat)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_file = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_file = argv[++i];
+        } else if (strcmp(argv[i], "--frame-times") == 0 && i + 1 < argc) {
+            frame_times_file = argv[++i];
+        } else if (strcmp(argv[i], "--gpu-budget") == 0 && i + 1 < argc) {
+            gpu_budget_ms = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--render-scale") == 0 && i + 1 < argc) {
+            render_scale = (GLfloat)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--min-render-scale") == 0 && i + 1 < argc) {
+            min_render_scale = (GLfloat)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--sharpness") == 0 && i + 1 < argc) {
+            sharpness = (GLfloat)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--no-occlusion") == 0) {
+            occlusion = false;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            print_stats = true;
+        } else if (strcmp(argv[i], "--hud") == 0) {
+            hud = true;
+        } else if (strcmp(argv[i], "--stress") == 0) {
+            stress = true;
+        } else if (strcmp(argv[i], "--stress-counts") == 0 && i + 1 < argc) {
+            // Comma separated object counts, e.g. 100,1000,10000
+            stress = true;
+            stress_counts.clear();
+            for (char *tok = strtok(argv[++i], ","); tok; tok = strtok(NULL, ",")) {
+                stress_counts.push_back((GLuint)atoi(tok));
+            }
+        } else if (strcmp(argv[i], "--stress-frames") == 0 && i + 1 < argc) {
+            stress_frames = max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--no-lightmaps") == 0) {
+            lightmaps_enabled = false;
+        } else if (strcmp(argv[i], "--rebake") == 0) {
+            rebake = true;
+        } else if (strcmp(argv[i], "--bake-samples") == 0 && i + 1 < argc) {
+            lightmap_settings.samples = max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--multiview") == 0) {
+            multiview = true;
+        } else if (strcmp(argv[i], "--vsync") == 0 && i + 1 < argc) {
+            // on, off or adaptive
+            present_mode = parse_present_mode(argv[++i]);
+            if (present_mode < 0) {
+                fprintf(stderr, "ERROR: --vsync takes on, off or adaptive\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--fps-limit") == 0 && i + 1 < argc) {
+            frame_limiter.set_fps(atof(argv[++i]));
+        } else if (strcmp(argv[i], "--latency") == 0) {
+            measure_latency = true;
+        } else if (strcmp(argv[i], "--uber") == 0) {
+            uber = true;
+        } else if (strcmp(argv[i], "--uber-bench") == 0) {
+            // Stress sweep with the separate programs, then again with the uber program
+            uber_bench = true;
+            stress = true;
+        } else if (strcmp(argv[i], "--evict-frames") == 0 && i + 1 < argc) {
+            // Drawn frames an unused texture stays resident (0 = until nothing references it)
+            asset_manager.evict_frames = (GLuint)max(0, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--preload") == 0) {
+            preload_textures = true;
+        } else if (strcmp(argv[i], "--debug-mirror") == 0) {
+            // Show the mirror texture instead of the main view
+            debug_mirror = true;
+        } else if (strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc) {
+            // MB for scene textures (mip chains included)
+            texture_budget.budget = (size_t)(max(0.0, atof(argv[++i]))*1024.0*1024.0);
+        } else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            capture_dir = argv[++i];
+        } else if (strcmp(argv[i], "--capture-every") == 0 && i + 1 < argc) {
+            capture_every = max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--capture-format") == 0 && i + 1 < argc) {
+            capture_format = (strcmp(argv[++i], "raw") == 0) ? CaptureRaw : CapturePng;
+        } else if (strcmp(argv[i], "--capture-threads") == 0 && i + 1 < argc) {
+            capture_threads = (GLuint)max(0, atoi(argv[++i]));
+        }
+    }
+
+    // Recording/replay render every frame with a fixed simulation step
+    input_log.dt = 1.0/60.0;
+    input_log.end_frame = 0;
+    if (replay_file) {
+        if (!load_input_log(replay_file, input_log)) {
+            return 1;
+        }
+        record_file = NULL;
+    }
+    if (record_file || replay_file || stress) {
+        on_demand = false;
+    }
+    if (stress && stress_counts.empty()) {
+        stress = false;
+    }
+    // Multiview draws each instance once for both views, so a query from one view can't cull it
+    if (multiview) {
+        multiview_stage = GL_GEOMETRY_SHADER;
+        occlusion = false;
+    }
+    // Stress steps replace the instances the lightmaps were baked for
+    if (stress) {
+        lightmaps_enabled = false;
+    }
+    // Benchmark starts with the separate programs
+    if (uber_bench) {
+        uber = false;
+    }
+    // Timed, replayed and captured runs shouldn't see textures arrive part way through
+    if (stress || replay_file || capture_dir) {
+        preload_textures = true;
+    }
+
 	// Create OpenGL window
 	GLFWwindow* window = CreateWindow("Think Inside The Box");
     if (!window) {
@@ -257,29 +796,56 @@ int main(int argc, char**argv)
         printf("OpenGL window successfully created\n");
     }
 
+    // Swap interval from --vsync
+    if (present_mode >= 0) {
+        apply_present_mode();
+    }
+
     // Store initial window size
     glfwGetFramebufferSize(window, &ww, &hh);
+    update_render_size();
 
     // Register callbacks
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
     glfwSetKeyCallback(window,key_callback);
     glfwSetMouseButtonCallback(window, mouse_callback);
+    glfwSetWindowRefreshCallback(window, window_refresh_callback);
+
 
 
+    // Load scene description
+    if (!load_scene(scene_path)) {
+        glfwTerminate();
+        return 1;
+    }
+
+    // Shader arrays hold the scene's lights and materials (stress scenes add up to the format limits)
+    shader_max_lights = max(1, stress ? SCENE_MAX_LIGHTS : (GLint)scene.header->num_lights);
+    shader_max_materials = max(1, stress ? SCENE_MAX_MATERIALS : (GLint)scene.header->num_materials);
 
     // Create geometry buffers
     build_geometry();
+    // Instance tree for collision and picking
+    build_scene_bvh();
     // Create material buffers
     build_materials();
     // Create light buffers
     build_lights();
-    // Create textures
+    // Create textures (placeholders, files load on first use)
     build_textures();
+    reference_scene_textures(true);
+    asset_manager.start(0);
+    if (preload_textures) {
+        preload_scene_textures();
+    }
 
     build_mirror();
 
+    // Create offscreen scene framebuffer (previous frame is re-presented from it when idle)
+    build_scene_framebuffer();
+
     // Load shaders and associate variables
-    ShaderInfo default_shaders[] = { {GL_VERTEX_SHADER, default_vertex_shader},{GL_FRAGMENT_SHADER, default_frag_shader},{GL_NONE, NULL} };
+    ShaderInfo default_shaders[] = { {GL_VERTEX_SHADER, default_vertex_shader},{GL_FRAGMENT_SHADER, default_frag_shader},{multiview_stage, default_geom_shader},{GL_NONE, NULL} };
     default_program = LoadShaders(default_shaders);
     default_vPos = glGetAttribLocation(default_program, "vPosition");
     default_vCol = glGetAttribLocation(default_program, "vColor");
@@ -289,8 +855,8 @@ int main(int argc, char**argv)
 
     // Load shaders
     // Load light shader
-    ShaderInfo lighting_shaders[] = { {GL_VERTEX_SHADER, lighting_vertex_shader},{GL_FRAGMENT_SHADER, lighting_frag_shader},{GL_NONE, NULL} };
-    lighting_program = LoadShaders(lighting_shaders);
+    ShaderInfo lighting_shaders[] = { {GL_VERTEX_SHADER, lighting_vertex_shader},{GL_FRAGMENT_SHADER, lighting_frag_shader},{multiview_stage, lighting_geom_shader},{GL_NONE, NULL} };
+    lighting_program = load_sized_shaders(lighting_shaders);
     lighting_vPos = glGetAttribLocation(lighting_program, "vPosition");
     lighting_vNorm = glGetAttribLocation(lighting_program, "vNormal");
     lighting_proj_mat_loc = glGetUniformLocation(lighting_program, "proj_matrix");
@@ -303,12 +869,15 @@ int main(int argc, char**argv)
     lighting_num_lights_loc = glGetUniformLocation(lighting_program, "NumLights");
     lighting_light_on_loc = glGetUniformLocation(lighting_program, "LightOn");
     lighting_eye_loc = glGetUniformLocation(lighting_program, "EyePosition");
+    // Blocks keep their binding points, so they are assigned once at link time
+    glUniformBlockBinding(lighting_program, lighting_lights_block_idx, 0);
+    glUniformBlockBinding(lighting_program, lighting_materials_block_idx, 1);
 
 
     // Load shaders
     // Load light shader with shadows
     ShaderInfo phong_shadow_shaders[] = { {GL_VERTEX_SHADER, phong_shadow_vertex_shader},{GL_FRAGMENT_SHADER, phong_shadow_frag_shader},{GL_NONE, NULL} };
-    phong_shadow_program = LoadShaders(phong_shadow_shaders);
+    phong_shadow_program = load_sized_shaders(phong_shadow_shaders);
     phong_shadow_vPos = glGetAttribLocation(phong_shadow_program, "vPosition");
     phong_shadow_vNorm = glGetAttribLocation(phong_shadow_program, "vNormal");
     phong_shadow_camera_mat_loc = glGetUniformLocation(phong_shadow_program, "camera_matrix");
@@ -326,7 +895,7 @@ int main(int argc, char**argv)
 
 
     // Load texture shaders
-    ShaderInfo texture_shaders[] = { {GL_VERTEX_SHADER, texture_vertex_shader},{GL_FRAGMENT_SHADER, texture_frag_shader},{GL_NONE, NULL} };
+    ShaderInfo texture_shaders[] = { {GL_VERTEX_SHADER, texture_vertex_shader},{GL_FRAGMENT_SHADER, texture_frag_shader},{multiview_stage, texture_geom_shader},{GL_NONE, NULL} };
     texture_program = LoadShaders(texture_shaders);
     texture_vPos = glGetAttribLocation(texture_program, "vPosition");
     texture_vTex = glGetAttribLocation(texture_program, "vTexCoord");
@@ -335,7 +904,7 @@ int main(int argc, char**argv)
     texture_model_mat_loc = glGetUniformLocation(texture_program, "model_matrix");
 
     // Load texture shaders
-    ShaderInfo multi_tex_shaders[] = { {GL_VERTEX_SHADER, multi_tex_vertex_shader},{GL_FRAGMENT_SHADER, multi_tex_frag_shader},{GL_NONE, NULL} };
+    ShaderInfo multi_tex_shaders[] = { {GL_VERTEX_SHADER, multi_tex_vertex_shader},{GL_FRAGMENT_SHADER, multi_tex_frag_shader},{multiview_stage, multi_tex_geom_shader},{GL_NONE, NULL} };
     multi_tex_program = LoadShaders(multi_tex_shaders);
     multi_tex_vPos = glGetAttribLocation(multi_tex_program, "vPosition");
     multi_tex_vTex = glGetAttribLocation(multi_tex_program, "vTexCoord");
@@ -344,15 +913,18 @@ int main(int argc, char**argv)
     multi_tex_model_mat_loc = glGetUniformLocation(multi_tex_program, "model_matrix");
     multi_tex_base_loc = glGetUniformLocation(multi_tex_program, "baseMap");
     multi_tex_dirt_loc = glGetUniformLocation(multi_tex_program, "dirtMap");
+    // Sampler units never change either
+    gl_use_program(multi_tex_program);
+    gl_uniform_1i(multi_tex_base_loc, 0);
+    gl_uniform_1i(multi_tex_dirt_loc, 1);
 
     // Load bump shader
-    ShaderInfo bump_shaders[] = { {GL_VERTEX_SHADER, bump_vertex_shader},{GL_FRAGMENT_SHADER, bump_frag_shader},{GL_NONE, NULL} };
-    bump_program = LoadShaders(bump_shaders);
+    ShaderInfo bump_shaders[] = { {GL_VERTEX_SHADER, bump_vertex_shader},{GL_FRAGMENT_SHADER, bump_frag_shader},{multiview_stage, bump_geom_shader},{GL_NONE, NULL} };
+    bump_program = load_sized_shaders(bump_shaders);
     bump_vPos = glGetAttribLocation(bump_program, "vPosition");
     bump_vNorm = glGetAttribLocation(bump_program, "vNormal");
     bump_vTex = glGetAttribLocation(bump_program, "vTexCoord");
     bump_vTang = glGetAttribLocation(bump_program, "vTangent");
-    bump_vBiTang = glGetAttribLocation(bump_program, "vBiTangent");
     bump_proj_mat_loc = glGetUniformLocation(bump_program, "proj_matrix");
     bump_camera_mat_loc = glGetUniformLocation(bump_program, "camera_matrix");
     bump_norm_mat_loc = glGetUniformLocation(bump_program, "normal_matrix");
@@ -363,18 +935,116 @@ int main(int argc, char**argv)
     bump_eye_loc = glGetUniformLocation(bump_program, "EyePosition");
     bump_base_loc = glGetUniformLocation(bump_program, "baseMap");
     bump_norm_loc = glGetUniformLocation(bump_program, "normalMap");
+    glUniformBlockBinding(bump_program, bump_lights_block_idx, 0);
+    gl_use_program(bump_program);
+    gl_uniform_1i(bump_base_loc, 0);
+    gl_uniform_1i(bump_norm_loc, 1);
 
     // Load debug mirror shader
     ShaderInfo debug_mirror_shaders[] = { {GL_VERTEX_SHADER, debug_mirror_vertex_shader},{GL_FRAGMENT_SHADER, debug_mirror_frag_shader},{GL_NONE, NULL} };
     debug_mirror_program = LoadShaders(debug_mirror_shaders);
 
+    // Load upscale shader (draws a full screen triangle from an empty vertex array)
+    ShaderInfo upscale_shaders[] = { {GL_VERTEX_SHADER, upscale_vertex_shader},{GL_FRAGMENT_SHADER, upscale_frag_shader},{GL_NONE, NULL} };
+    upscale_program = LoadShaders(upscale_shaders);
+    upscale_scene_loc = glGetUniformLocation(upscale_program, "sceneTex");
+    upscale_uv_scale_loc = glGetUniformLocation(upscale_program, "uvScale");
+    upscale_texel_size_loc = glGetUniformLocation(upscale_program, "texelSize");
+    upscale_sharpness_loc = glGetUniformLocation(upscale_program, "sharpness");
+    gl_use_program(upscale_program);
+    gl_uniform_1i(upscale_scene_loc, 0);
+    glGenVertexArrays(1, &upscaleVAO);
+
+    // GPU frame timers
+    glGenQueries(GPU_TIMER_FRAMES*NumGpuTimestamps, gpuTimerQueries[0]);
+
+    // Load occlusion query shader and bounding box geometry
+    ShaderInfo occlusion_shaders[] = { {GL_VERTEX_SHADER, occlusion_vertex_shader},{GL_FRAGMENT_SHADER, occlusion_frag_shader},{GL_NONE, NULL} };
+    occlusion_program = LoadShaders(occlusion_shaders);
+    occlusion_vPos = glGetAttribLocation(occlusion_program, "vPosition");
+    occlusion_mvp_loc = glGetUniformLocation(occlusion_program, "mvp_matrix");
+    build_occlusion();
+
+    // Load overlay shader and font
+    ShaderInfo hud_shaders[] = { {GL_VERTEX_SHADER, hud_vertex_shader},{GL_FRAGMENT_SHADER, hud_frag_shader},{GL_NONE, NULL} };
+    hud_program = LoadShaders(hud_shaders);
+    hud_vPos = glGetAttribLocation(hud_program, "vPosition");
+    hud_vTex = glGetAttribLocation(hud_program, "vTexCoord");
+    hud_vCol = glGetAttribLocation(hud_program, "vColor");
+    hud_screen_size_loc = glGetUniformLocation(hud_program, "screenSize");
+    hud_font_loc = glGetUniformLocation(hud_program, "fontMap");
+    gl_use_program(hud_program);
+    gl_uniform_1i(hud_font_loc, 0);
+    build_hud();
+
+    // Load baked lighting shader and the scene's lightmaps
+    ShaderInfo baked_shaders[] = { {GL_VERTEX_SHADER, baked_vertex_shader},{GL_FRAGMENT_SHADER, baked_frag_shader},{multiview_stage, baked_geom_shader},{GL_NONE, NULL} };
+    baked_program = load_sized_shaders(baked_shaders);
+    baked_vPos = glGetAttribLocation(baked_program, "vPosition");
+    baked_vLightmap = glGetAttribLocation(baked_program, "vLightmapCoord");
+    baked_proj_mat_loc = glGetUniformLocation(baked_program, "proj_matrix");
+    baked_camera_mat_loc = glGetUniformLocation(baked_program, "camera_matrix");
+    baked_model_mat_loc = glGetUniformLocation(baked_program, "model_matrix");
+    baked_lightmaps_loc = glGetUniformLocation(baked_program, "lightmaps");
+    baked_num_lights_loc = glGetUniformLocation(baked_program, "NumLights");
+    baked_light_on_loc = glGetUniformLocation(baked_program, "LightOn");
+    baked_alpha_loc = glGetUniformLocation(baked_program, "Alpha");
+    gl_use_program(baked_program);
+    gl_uniform_1i(baked_lightmaps_loc, 0);
+    build_lightmaps();
+
+    // Load uber shader (all surface types, per draw records) and its draw buffer
+    ShaderInfo uber_shaders[] = { {GL_VERTEX_SHADER, uber_vertex_shader},{GL_FRAGMENT_SHADER, uber_frag_shader},{multiview_stage, uber_geom_shader},{GL_NONE, NULL} };
+    uber_program = load_sized_shaders(uber_shaders);
+    uber_proj_mat_loc = glGetUniformLocation(uber_program, "proj_matrix");
+    uber_camera_mat_loc = glGetUniformLocation(uber_program, "camera_matrix");
+    uber_eye_loc = glGetUniformLocation(uber_program, "EyePosition");
+    uber_draw_base_loc = glGetUniformLocation(uber_program, "DrawBase");
+    uber_num_lights_loc = glGetUniformLocation(uber_program, "NumLights");
+    uber_light_on_loc = glGetUniformLocation(uber_program, "LightOn");
+    uber_base_loc = glGetUniformLocation(uber_program, "baseMap");
+    uber_detail_loc = glGetUniformLocation(uber_program, "detailMap");
+    uber_norm_loc = glGetUniformLocation(uber_program, "normalMap");
+    glUniformBlockBinding(uber_program, glGetUniformBlockIndex(uber_program, "LightBuffer"), 0);
+    glUniformBlockBinding(uber_program, glGetUniformBlockIndex(uber_program, "MaterialBuffer"), 1);
+    glUniformBlockBinding(uber_program, glGetUniformBlockIndex(uber_program, "DrawBuffer"), UBER_BINDING);
+    gl_use_program(uber_program);
+    gl_uniform_1i(uber_base_loc, 0);
+    gl_uniform_1i(uber_detail_loc, 1);
+    gl_uniform_1i(uber_norm_loc, 1);
+    build_uber();
+
+    // Multiview layers and view buffer
+    if (multiview) {
+        build_multiview();
+    }
+
+    // Frame capture readback buffers and writer threads
+    if (capture_dir) {
+        build_capture();
+    }
+
+    // Latency timestamp queries
+    if (measure_latency) {
+        build_latency();
+    }
+
+    // Stress sweep replaces the loaded scene's instances, keeping its meshes and textures
+    if (stress) {
+        base_scene = scene;
+        start_stress_step();
+    }
+
+
+    // Shader and resource loading may have bound objects behind the state cache
+    gl_state_reset();
 
     // Enable depth test
-    glEnable(GL_CULL_FACE);
-    glEnable(GL_DEPTH_TEST);
+    gl_enable(GL_CULL_FACE);
+    gl_enable(GL_DEPTH_TEST);
 
 
-    glEnable(GL_BLEND);
+    gl_enable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 
@@ -386,15 +1056,92 @@ int main(int argc, char**argv)
     eye = vec3(x, y, z);
 
     // Start loop
+    GLdouble frameStart = glfwGetTime();
     while ( !glfwWindowShouldClose( window ) ) {
-    	// Draw graphics
-        create_mirror();
-        //renderQuad(debug_mirror_program, MirrorTex);
-        display();
+        // Upload textures decoded since the last pass and evict unused ones
+        update_assets(ASSET_UPLOADS_PER_FRAME);
+
+        GLboolean animating = fan || blinds;
+        if (scene_dirty || animating || !on_demand) {
+            // Draw graphics into offscreen scene framebuffer
+            frame_stats.reset();
+            reset_gl_call_counts();
+            begin_gpu_timer();
+            GLdouble submitStart = glfwGetTime();
+            // Input handled since the last frame shows up in this one
+            frame_inputs.swap(pending_inputs);
+            pending_inputs.clear();
+            build_frame_graph();
+            // Mirror pass stamps its own end (multiview draws the mirror view with the main view,
+            // counted as main pass time)
+            if (graph_mirror_pass < 0 || render_graph.culled(graph_mirror_pass)) {
+                mark_gpu_timer(MirrorDoneStamp);
+            }
+            render_graph.execute();
+            GLdouble submitEnd = glfwGetTime();
+            GLdouble submit_ms = (submitEnd - submitStart)*1000.0;
+            end_gpu_timer();
+            cpu_mirror_ms = (graph_mirror_pass >= 0) ? render_graph.passes[graph_mirror_pass].cpu_ms : 0.0;
+            cpu_main_ms = submit_ms - cpu_mirror_ms;
+            hud_cpu_history.push((GLfloat)submit_ms);
+            if (hud_last_frame > 0.0) {
+                hud_interval_history.push((GLfloat)((submitStart - hud_last_frame)*1000.0));
+            }
+            hud_last_frame = submitStart;
+            scene_dirty = false;
+            rendered_frames++;
+            if (print_stats && glfwGetTime() - stats_time >= 1.0) {
+                printf("draws %u  state changes %u  occlusion queries %u  culled %u  conditional %u\n", frame_stats.draws,
+                       frame_stats.state_changes, frame_stats.occlusion_queries, frame_stats.occlusion_culled,
+                       frame_stats.occlusion_conditional);
+                const GlCallCounts &calls = gl_call_counts();
+                printf("gl calls issued %u  filtered %u (", calls.total_issued(), calls.total_filtered());
+                for (int k = 0; k < NumGlCallKinds; k++) {
+                    printf("%s%s %u/%u", k ? ", " : "", gl_call_kind_name(k), calls.issued[k], calls.filtered[k]);
+                }
+                printf(")\n");
+                stats_time = glfwGetTime();
+            }
+            if (stress) {
+                record_stress_frame(window, submit_ms);
+            }
+            capture_this_frame = capture_writer.running() && (capture_count++ % capture_every == 0);
+            // Copy scene onto screen and swap
+            present_scene(window);
+            capture_this_frame = false;
+            if (measure_latency) {
+                mark_latency(submitStart, glfwGetTime());
+            }
+            // Resize textures to their wanted levels and the memory budget (seen from the next frame)
+            apply_texture_budget();
+            // Hold to the frame rate cap before sampling the next input
+            frame_limiter.wait();
+        } else if (scene_damaged) {
+            // Nothing changed, re-present previous frame
+            present_scene(window);
+        }
+
         // Update other events like input handling
-        glfwPollEvents();
+        if (on_demand && !animating) {
+            // Block until input arrives (or timeout) and restart animation clock
+            glfwWaitEventsTimeout(idle_timeout);
+            elTime = glfwGetTime();
+        } else {
+            glfwPollEvents();
+        }
         GLdouble curTime = glfwGetTime();
         double dT = (curTime-elTime);
+        if (record_file || replay_file) {
+            // Apply this frame's recorded input and step by the fixed timestep
+            while (replay_file && replay_next < input_log.events.size() &&
+                   input_log.events[replay_next].frame <= frame_number) {
+                apply_key(input_log.events[replay_next].key, input_log.events[replay_next].action);
+                replay_next++;
+            }
+            dT = input_log.dt;
+            frame_times.push_back(curTime - frameStart);
+            frameStart = curTime;
+        }
         if(fan){
             fan_angle += rpm * dT * 60.0f;
         }
@@ -415,26 +1162,125 @@ int main(int argc, char**argv)
             }
 
         }
+        // Animation changed the scene, draw at least one more frame
+        if (animating) {
+            refit_scene_bvh();
+            scene_dirty = true;
+        }
         elTime = curTime;
-        // Swap buffer onto screen
-        glfwSwapBuffers( window );
+
+        // Stop at the end of the recorded session
+        frame_number++;
+        if (replay_file && frame_number >= input_log.end_frame) {
+            glfwSetWindowShouldClose(window, true);
+        }
     }
 
+    // Save recorded session and report frame time distribution
+    if (record_file) {
+        input_log.end_frame = frame_number;
+        save_input_log(record_file, input_log);
+    }
+    if (record_file || replay_file) {
+        report_frame_times(frame_times, frame_times_file);
+    }
+
+    // Write out frames still being read back or encoded
+    finish_capture();
+    asset_manager.finish();
+
+    // Input-to-present latency distribution
+    if (measure_latency) {
+        collect_latency(true);
+        report_latency("input to frame start", latency_to_frame);
+        report_latency("input to swap", latency_to_swap);
+        report_latency("input to GPU done", latency_to_gpu);
+        if (latency_ring_full > 0) {
+            printf("latency: %u frames not timed with every slot in flight\n", latency_ring_full);
+        }
+    }
+
+    // Memory use at exit
+    report_memory();
+
     // Close window
     glfwTerminate();
     return 0;
 
 }
 
+void build_frame_graph( ) {
+    // Passes declare the textures they read and write; the graph orders them, skips passes whose
+    // results nothing uses, clears what they ask for and lets transient depth buffers share storage
+    render_graph.reset();
+    mirror_visible = mirror_uv_bounds(mirror_uv);
+    int scene_color = render_graph.import_texture("scene color", TextureIDs[SceneTex], GL_RGBA8, ww, hh);
+    int scene_depth = render_graph.create_texture("scene depth", GL_DEPTH_COMPONENT24, ww, hh);
+    render_graph.output(scene_color);
+    graph_mirror_pass = -1;
+
+    if (multiview) {
+        // Both views in one traversal into its own layered targets, the scene targets only need
+        // clearing when the main view is drawn straight into them
+        int pass = render_graph.add_pass("multiview", display_multiview);
+        render_graph.write(pass, scene_color, !mirror_visible);
+        render_graph.write(pass, scene_depth, !mirror_visible);
+        render_graph.viewport(pass, 0, 0, rw, rh);
+    } else {
+        // Mirror view straight into the mirror texture, limited to the texels the visible part of the
+        // mirror samples (its depth is the scene depth's size so the two share storage)
+        size_mirror_texture();
+        int mirror_color = render_graph.import_texture("mirror color", TextureIDs[MirrorTex], GL_RGBA8, rw, rh);
+        int mirror_depth = render_graph.create_texture("mirror depth", GL_DEPTH_COMPONENT24, ww, hh);
+        graph_mirror_pass = render_graph.add_pass("mirror", create_mirror);
+        render_graph.write(graph_mirror_pass, mirror_color, true);
+        render_graph.write(graph_mirror_pass, mirror_depth, true);
+        render_graph.viewport(graph_mirror_pass, 0, 0, rw, rh);
+        if (mirror_visible) {
+            GLint rect[4];
+            mirror_texel_rect(mirror_uv, rect);
+            render_graph.scissor(graph_mirror_pass, rect[0], rect[1], rect[2] - rect[0], rect[3] - rect[1]);
+        }
+
+        if (debug_mirror) {
+            int pass = render_graph.add_pass("debug mirror", [] { renderQuad(debug_mirror_program, MirrorTex); });
+            render_graph.read(pass, mirror_color);
+            render_graph.write(pass, scene_color, true);
+            render_graph.viewport(pass, 0, 0, rw, rh);
+        } else {
+            // Main view samples the mirror texture only when the mirror is on screen or seen from the
+            // front, otherwise nothing reads it and the mirror pass is culled
+            int pass = render_graph.add_pass("main", display);
+            if (mirror_visible) {
+                render_graph.read(pass, mirror_color);
+            }
+            render_graph.write(pass, scene_color, true);
+            render_graph.write(pass, scene_depth, true);
+            render_graph.viewport(pass, 0, 0, rw, rh);
+        }
+    }
+    render_graph.compile();
+
+    // Mirror queries from before a skipped frame no longer match what it would draw
+    if (graph_mirror_pass >= 0 && render_graph.culled(graph_mirror_pass)) {
+        invalidate_occlusion(MirrorPass);
+    }
+}
+
 void display( )
 {
     // Declare projection and camera matrices
     proj_matrix = mat4().identity();
     camera_matrix = mat4().identity();
 
-	// Clear window and depth buffer
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    // Set projection and camera for the viewer (targets are bound and cleared by the render graph)
+    main_view(proj_matrix, camera_matrix);
 
+    // Render objects
+	render_scene();
+}
+
+void main_view(mat4 &proj, mat4 &camera) {
     // Compute anisotropic scaling
     GLfloat xratio = 1.0f;
     GLfloat yratio = 1.0f;
@@ -453,590 +1299,1778 @@ void display( )
     //proj_matrix = ortho(-5.0f*xratio, 5.0f*xratio, -5.0f*yratio, 5.0f*yratio, -10.0f, 10.0f);
 
 
-    proj_matrix = frustum(-0.4f*xratio, 0.4f*xratio, -0.40f*yratio, 0.40f * yratio, 1.0f, 100.00f);
+    proj = frustum(-0.4f*xratio, 0.4f*xratio, -0.40f*yratio, 0.40f * yratio, 1.0f, 100.00f);
 
     // TODO: Set camera matrix
 
 
-    camera_matrix = lookat(eye, center, up);
-
-
-    // Render objects
-	render_scene();
-
-	// Flush pipeline
-	glFlush();
+    camera = lookat(eye, center, up);
 }
 
 void create_mirror( ){
-    // Clear framebuffer for mirror rendering pass
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    proj_matrix = frustum(-0.5f, 0.5f, -0.5f, 0.5f, 1.0f, 100.0f);
-
-    camera_matrix = lookat(mirror_eye, mirror_center, mirror_up);
+    // Render graph binds the mirror texture as the target, clears it and scissors to the sampled texels
+    mirror_view(proj_matrix, camera_matrix);
 
 // Render mirror scene (without mirror)
     mirror = true;
     render_scene();
-    glFlush();
     mirror = false;
-
-    // TODO: Activate texture unit 0
-    glActiveTexture(GL_TEXTURE0);
-    // TODO: Bind mirror texture
-    glBindTexture(GL_TEXTURE_2D, TextureIDs[MirrorTex]);
-    // TODO: Copy framebuffer into mirror texture
-    glCopyTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 0, 0, ww, hh, 0);
-}
-void build_mirror( ) {
-    // Generate mirror texture
-    glGenTextures(1, &TextureIDs[MirrorTex]);
-    // Bind mirror texture
-    glBindTexture(GL_TEXTURE_2D, TextureIDs[MirrorTex]);
-    // TODO: Create empty mirror texture
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, ww, hh, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    mark_gpu_timer(MirrorDoneStamp);
 }
 
-void render_scene( ) {
-    // Declare transformation matrices
-    model_matrix = mat4().identity();
-    mat4 scale_matrix = mat4().identity();
-    mat4 rot_matrix = mat4().identity();
-    mat4 rot2_matrix = mat4().identity();
-    mat4 trans_matrix = mat4().identity();
+void mirror_view(mat4 &proj, mat4 &camera) {
+    proj = frustum(-0.5f, 0.5f, -0.5f, 0.5f, 1.0f, 100.0f);
+
+    camera = lookat(mirror_eye, mirror_center, mirror_up);
 
+    // Clip geometry behind the mirror with an oblique near plane (only possible when the
+    // mirror camera sits behind the mirror plane, otherwise the regular near plane already does)
+    mat4 model = mirror_model_matrix();
+    vec4 p = camera*(model*vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    vec4 n = camera*(affine_normal_matrix(model)*vec4(0.0f, 1.0f, 0.0f, 0.0f));
+    vec4 plane = vec4(n[0], n[1], n[2], -(n[0]*p[0] + n[1]*p[1] + n[2]*p[2]));
+    if (plane[3] < -1.0e-4f) {
+        proj = oblique_near_plane(proj, plane);
+    }
+}
 
+void size_mirror_texture( ) {
+    gl_edit_texture(GL_TEXTURE_2D, TextureIDs[MirrorTex]);
+    if (mirror_w != rw || mirror_h != rh) {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, rw, rh, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        register_texture(TextureIDs[MirrorTex], ResRenderTargets, "mirror", rw, rh, "RGBA8", 4, 1);
+        mirror_w = rw;
+        mirror_h = rh;
+    }
+}
 
-    //floor
-    trans_matrix = translate(0.0f, -4.0f, 0.0f);
-    rot_matrix = rotate(0.0f, vec3(0.0f, 0.0f, 1.0f));
-    scale_matrix = scale(4.0f, 0.1f, 4.0f);
-	model_matrix = trans_matrix*rot_matrix*scale_matrix;
-    normal_matrix = model_matrix.inverse().transpose();
+void mirror_texel_rect(const vec4 &uv_bounds, GLint rect[4]) {
+    // Texels the visible part of the mirror samples (1 texel margin), x0, y0, x1, y1
+    rect[0] = max(0, (GLint)floor(uv_bounds[0]*rw) - 1);
+    rect[1] = max(0, (GLint)floor(uv_bounds[1]*rh) - 1);
+    rect[2] = min(rw, (GLint)ceil(uv_bounds[2]*rw) + 1);
+    rect[3] = min(rh, (GLint)ceil(uv_bounds[3]*rh) + 1);
+}
 
-    draw_tex_object(Painting, Carpet);
+mat4 mirror_model_matrix( ) {
+    return instance_model_matrix(scene.instances[mirror_instance]);
+}
 
-    //ceiling
-    trans_matrix = translate(0.0f, 3.0f, 0.0f);
-    rot_matrix = rotate(0.0f, vec3(0.0f, 0.0f, 1.0f));
-    scale_matrix = scale(8.0f, 0.1f, 8.0f);
-    model_matrix = trans_matrix*rot_matrix*scale_matrix;
-    normal_matrix = model_matrix.inverse().transpose();
+GLboolean mirror_uv_bounds(vec4 &bounds) {
+    // Scene without a mirror never needs the pass
+    if (mirror_instance < 0) {
+        return false;
+    }
+    mat4 model = mirror_model_matrix();
+    mat4 view_proj, view_cam;
+    main_view(view_proj, view_cam);
+
+    // Back-facing when the viewer is behind the mirror plane
+    vec4 p = model*vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    vec4 n = affine_normal_matrix(model)*vec4(0.0f, 1.0f, 0.0f, 0.0f);
+    if ((eye[0] - p[0])*n[0] + (eye[1] - p[1])*n[1] + (eye[2] - p[2])*n[2] <= 0.0f) {
+        return false;
+    }
 
-    draw_mat_object(Cube, Walls);
+    // Mirror quad corners (Plane model spans x,z in [-1,1] with u = (x+1)/2, v = (1-z)/2) in clip space
+    mat4 mvp = view_proj*view_cam*model;
+    vector<vec4> poly, clipped;
+    vector<vec2> uvs, clipped_uvs;
+    GLfloat corners[4][2] = {{-1.0f, -1.0f}, {1.0f, -1.0f}, {1.0f, 1.0f}, {-1.0f, 1.0f}};
+    for (int i = 0; i < 4; i++) {
+        poly.push_back(mvp*vec4(corners[i][0], 0.0f, corners[i][1], 1.0f));
+        uvs.push_back(vec2(0.5f*(corners[i][0] + 1.0f), 0.5f*(1.0f - corners[i][1])));
+    }
 
+    // Clip against the six frustum planes (w + x, w - x, w + y, ...), interpolating uvs
+    for (int plane = 0; plane < 6; plane++) {
+        int axis = plane/2;
+        GLfloat sign = (plane % 2 == 0) ? 1.0f : -1.0f;
+        clipped.clear();
+        clipped_uvs.clear();
+        for (int i = 0; i < poly.size(); i++) {
+            int j = (i + 1) % poly.size();
+            GLfloat di = poly[i][3] + sign*poly[i][axis];
+            GLfloat dj = poly[j][3] + sign*poly[j][axis];
+            if (di >= 0.0f) {
+                clipped.push_back(poly[i]);
+                clipped_uvs.push_back(uvs[i]);
+            }
+            if ((di >= 0.0f) != (dj >= 0.0f)) {
+                GLfloat t = di/(di - dj);
+                clipped.push_back(poly[i] + (poly[j] - poly[i])*t);
+                clipped_uvs.push_back(uvs[i] + (uvs[j] - uvs[i])*t);
+            }
+        }
+        poly.swap(clipped);
+        uvs.swap(clipped_uvs);
+        if (poly.empty()) {
+            return false;
+        }
+    }
 
-    //walls
-    trans_matrix = translate(-4.0f, 0.0f, 0.0f);
-    rot_matrix = rotate(0.0f, vec3(0.0f, 0.0f, 1.0f));
-    scale_matrix = scale(0.1f, 8.0f, 8.0f);
-    model_matrix = trans_matrix*rot_matrix*scale_matrix;
-    normal_matrix = model_matrix.inverse().transpose();
+    // Texture space rectangle of the visible part
+    bounds = vec4(1.0f, 1.0f, 0.0f, 0.0f);
+    for (int i = 0; i < uvs.size(); i++) {
+        bounds[0] = fmin(bounds[0], uvs[i][0]);
+        bounds[1] = fmin(bounds[1], uvs[i][1]);
+        bounds[2] = fmax(bounds[2], uvs[i][0]);
+        bounds[3] = fmax(bounds[3], uvs[i][1]);
+    }
+    return bounds[0] < bounds[2] && bounds[1] < bounds[3];
+}
 
-    draw_mat_object(Cube, Walls);
+void build_scene_framebuffer( ) {
+    // Generate scene framebuffer (color only, presenting reads it) and its color texture
+    glGenFramebuffers(NumFramebuffers, Framebuffers);
+    gl_edit_texture(GL_TEXTURE_2D, TextureIDs[SceneTex]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    resize_scene_framebuffer();
+
+    gl_bind_framebuffer(GL_FRAMEBUFFER, Framebuffers[SceneFramebuffer]);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, TextureIDs[SceneTex], 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "ERROR: scene framebuffer is incomplete\n");
+    }
+    gl_bind_framebuffer(GL_FRAMEBUFFER, 0);
+}
 
-    trans_matrix = translate(4.0f, 0.0f, 0.0f);
-    rot_matrix = rotate(0.0f, vec3(0.0f, 0.0f, 1.0f));
-    scale_matrix = scale(0.1f, 8.0f, 8.0f);
-    model_matrix = trans_matrix*rot_matrix*scale_matrix;
-    normal_matrix = model_matrix.inverse().transpose();
+void resize_scene_framebuffer( ) {
+    // (Re)allocate storage at full window size (scaled frames use the lower left rw x rh part,
+    // depth is a render graph transient of the same size)
+    gl_edit_texture(GL_TEXTURE_2D, TextureIDs[SceneTex]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, ww, hh, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    register_texture(TextureIDs[SceneTex], ResRenderTargets, "scene color", ww, hh, "RGBA8", 4, 1);
+}
 
-    draw_mat_object(Cube, Walls);
+void present_scene(GLFWwindow *window) {
+    gl_bind_framebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    if (rw == ww && rh == hh) {
+        // Full resolution, copy offscreen scene to the default framebuffer
+        gl_bind_framebuffer(GL_READ_FRAMEBUFFER, Framebuffers[SceneFramebuffer]);
+        glBlitFramebuffer(0, 0, ww, hh, 0, 0, ww, hh, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    } else {
+        // Upscale (bilinear + sharpen) scaled scene to the window
+        gl_viewport(0, 0, ww, hh);
+        gl_disable(GL_DEPTH_TEST);
+        gl_disable(GL_BLEND);
+        gl_use_program(upscale_program);
+        gl_bind_texture(0, GL_TEXTURE_2D, TextureIDs[SceneTex]);
+        gl_uniform_2f(upscale_uv_scale_loc, (GLfloat)rw/ww, (GLfloat)rh/hh);
+        gl_uniform_2f(upscale_texel_size_loc, 1.0f/ww, 1.0f/hh);
+        gl_uniform_1f(upscale_sharpness_loc, sharpness);
+        gl_bind_vertex_array(upscaleVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        gl_bind_vertex_array(0);
+        gl_enable(GL_BLEND);
+        gl_enable(GL_DEPTH_TEST);
+    }
+    gl_bind_framebuffer(GL_FRAMEBUFFER, 0);
+    scene_damaged = false;
+
+    // Capture the presented frame without the overlay (its timing text would differ every run)
+    if (capture_writer.running()) {
+        collect_captures(false);
+        if (capture_this_frame) {
+            capture_frame();
+        }
+    }
 
-    trans_matrix = translate(.0f, 0.0f, -4.0f);
-    rot_matrix = rotate(0.0f, vec3(0.0f, 0.0f, 1.0f));
-    scale_matrix = scale(8.0f, 8.0f, 0.1f);
-    model_matrix = trans_matrix*rot_matrix*scale_matrix;
-    normal_matrix = model_matrix.inverse().transpose();
+    // Overlay goes on top of the presented frame
+    if (hud) {
+        draw_hud();
+    }
 
-    draw_mat_object(Cube, Walls);
+    // Swap buffer onto screen
+    glfwSwapBuffers(window);
+}
 
+void update_render_size( ) {
+    // Scene resolution follows the window at the current scale
+    rw = (GLint)(ww*render_scale + 0.5f);
+    rh = (GLint)(hh*render_scale + 0.5f);
+    if (rw < 1) rw = 1;
+    if (rh < 1) rh = 1;
+    if (rw > ww) rw = ww;
+    if (rh > hh) rh = hh;
+}
 
-    trans_matrix = translate(.0f, 0.0f, 4.0f);
-    rot_matrix = rotate(0.0f, vec3(0.0f, 0.0f, 1.0f));
-    scale_matrix = scale(8.0f, 8.0f, 0.1f);
-    model_matrix = trans_matrix*rot_matrix*scale_matrix;
-    normal_matrix = model_matrix.inverse().transpose();
+void begin_gpu_timer( ) {
+    // Skip timing this frame if every query set is still in flight
+    gpu_timer_active = (gpu_budget_ms > 0.0 || stress || hud) && gpu_timer_pending < GPU_TIMER_FRAMES;
+    if (gpu_timer_active) {
+        glQueryCounter(gpuTimerQueries[gpu_timer_next][FrameStartStamp], GL_TIMESTAMP);
+    }
+}
 
-    draw_mat_object(Cube, Walls);
+void mark_gpu_timer(GLint stamp) {
+    if (gpu_timer_active) {
+        glQueryCounter(gpuTimerQueries[gpu_timer_next][stamp], GL_TIMESTAMP);
+    }
+}
 
+void end_gpu_timer( ) {
+    if (gpu_timer_active) {
+        glQueryCounter(gpuTimerQueries[gpu_timer_next][MainDoneStamp], GL_TIMESTAMP);
+        gpu_timer_next = (gpu_timer_next + 1) % GPU_TIMER_FRAMES;
+        gpu_timer_pending++;
+        gpu_timer_active = false;
+    }
 
+    // Read back finished frames (oldest first) without stalling
+    while (gpu_timer_pending > 0) {
+        GLuint *queries = gpuTimerQueries[(gpu_timer_next - gpu_timer_pending + GPU_TIMER_FRAMES) % GPU_TIMER_FRAMES];
+        GLint available = 0;
+        glGetQueryObjectiv(queries[MainDoneStamp], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            break;
+        }
+        // Earlier timestamps of the frame are done when the last one is
+        GLuint64 stamps[NumGpuTimestamps];
+        for (int i = 0; i < NumGpuTimestamps; i++) {
+            glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &stamps[i]);
+        }
+        gpu_timer_pending--;
+        GLdouble frame_ms = (stamps[MainDoneStamp] - stamps[FrameStartStamp])/1.0e6;
+        gpu_frame_ms = frame_ms;
+        gpu_mirror_ms = (stamps[MirrorDoneStamp] - stamps[FrameStartStamp])/1.0e6;
+        gpu_main_ms = (stamps[MainDoneStamp] - stamps[MirrorDoneStamp])/1.0e6;
+        hud_gpu_history.push((GLfloat)frame_ms);
+        if (stress && stress_frame >= stress_warmup) {
+            stress_sum.gpu_ms += frame_ms;
+            stress_gpu_samples++;
+        }
+        if (gpu_budget_ms > 0.0) {
+            adjust_render_scale(frame_ms);
+        }
+    }
+}
 
-    //Soda Can
-    trans_matrix = translate(-0.4f, -3.1f, 0.1f);
-    rot_matrix = rotate(0.0f, vec3(1.0f, 0.0f, 1.0f));
-    scale_matrix = scale(0.07f, 0.08f, 0.07f);
-    model_matrix = trans_matrix*rot_matrix*scale_matrix;
+void adjust_render_scale(GLdouble frame_ms) {
+    // Smooth GPU time so single spikes don't change resolution
+    if (gpu_time_ms == 0.0) {
+        gpu_time_ms = frame_ms;
+    } else {
+        gpu_time_ms = 0.9*gpu_time_ms + 0.1*frame_ms;
+    }
 
-    draw_tex_object(Soda, SodaTex);
+    // Cost is roughly proportional to pixel count, aim a bit under budget and move part way there
+    GLfloat target = render_scale*(GLfloat)sqrt(0.9*gpu_budget_ms/fmax(gpu_time_ms, 0.01));
+    GLfloat scale = render_scale + 0.25f*(target - render_scale);
+    scale = fmin(fmax(scale, min_render_scale), max_render_scale);
 
-    //Soda Can top
-    trans_matrix = translate(-0.40f, -3.01f, 0.095f);
-    rot_matrix = rotate(0.0f, vec3(0.0f, 0.0f, 1.0f));
-    scale_matrix = scale(0.07f, 0.07f, 0.07f);
-    model_matrix = trans_matrix*rot_matrix*scale_matrix;
+    // Only resize for changes of at least 1/64 to avoid resolution jitter
+    if (fabs(scale - render_scale) >= 1.0f/64.0f || (scale == max_render_scale && render_scale != scale)) {
+        render_scale = scale;
+        update_render_size();
+    }
+}
 
-    draw_tex_object(Circle, SodaTop);
+void build_hud( ) {
+    // Font atlas (nearest filtering keeps glyphs sharp at integer scales)
+    vector<unsigned char> pixels;
+    hud_font_atlas(pixels);
+    glGenTextures(1, &HudFontTex);
+    gl_edit_texture(GL_TEXTURE_2D, HudFontTex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, HUD_ATLAS_W, HUD_ATLAS_H, 0, GL_RED, GL_UNSIGNED_BYTE, pixels.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    register_texture(HudFontTex, ResTextures, "hud font", HUD_ATLAS_W, HUD_ATLAS_H, "R8", 1, 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // Interleaved vertex buffer, filled every drawn frame
+    glGenVertexArrays(1, &hudVAO);
+    glGenBuffers(1, &hudVBO);
+    gl_bind_vertex_array(hudVAO);
+    gl_vertex_attrib(hud_vPos, hudVBO, 2, sizeof(HudVertex), offsetof(HudVertex, x));
+    gl_vertex_attrib(hud_vTex, hudVBO, 2, sizeof(HudVertex), offsetof(HudVertex, u));
+    gl_vertex_attrib(hud_vCol, hudVBO, 4, sizeof(HudVertex), offsetof(HudVertex, r));
+    gl_bind_vertex_array(0);
+    gl_bind_buffer(GL_ARRAY_BUFFER, 0);
+}
 
-    //Dresser
-    trans_matrix = translate(-2.45f, -3.6f, -3.395f);
-    rot_matrix = rotate(180.0f, vec3(0.0f, 1.0f, 0.0f));
-    scale_matrix = scale(0.6f, 0.4f, 0.5f);
-    model_matrix = trans_matrix*rot_matrix*scale_matrix;
-    normal_matrix = model_matrix.inverse().transpose();
+void draw_hud( ) {
+    const GLfloat panel_color[4] = {0.0f, 0.0f, 0.0f, 0.6f};
+    const GLfloat text_color[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+    const GLfloat cpu_color[4] = {0.3f, 0.9f, 0.3f, 0.8f};
+    const GLfloat gpu_color[4] = {1.0f, 0.6f, 0.1f, 0.8f};
+    const GLfloat mark_color[4] = {1.0f, 1.0f, 1.0f, 0.4f};
+    const GLfloat scale = 2.0f;
+    const GLfloat line = (HUD_CELL_H + 2)*scale;
+    const GLint num_lines = 10;
+    const GLfloat width = 32*HUD_CELL_W*scale;
+    const GLfloat graph_h = 80.0f;
+    const GLfloat graph_ms = 33.3f;
+
+    // Text panel with the frame time graph below (averages over the graphed frames)
+    char buf[128];
+    GLfloat x = 16.0f;
+    GLfloat y = 16.0f;
+    hud_batch.clear();
+    hud_batch.rect(x - 8.0f, y - 8.0f, width + 16.0f, num_lines*line + graph_h + 16.0f, panel_color);
+
+    GLfloat interval_ms = hud_interval_history.average();
+    snprintf(buf, sizeof(buf), "FPS %5.1f", interval_ms > 0.0f ? 1000.0f/interval_ms : 0.0f);
+    GLfloat tx = hud_batch.text(x, y, scale, buf, text_color);
+    snprintf(buf, sizeof(buf), "  CPU %5.2f", hud_cpu_history.average());
+    tx = hud_batch.text(tx, y, scale, buf, cpu_color);
+    snprintf(buf, sizeof(buf), "  GPU %5.2f MS", hud_gpu_history.average());
+    hud_batch.text(tx, y, scale, buf, gpu_color);
+    y += line;
+
+    snprintf(buf, sizeof(buf), "MIRROR CPU %5.2f  GPU %5.2f", cpu_mirror_ms, gpu_mirror_ms);
+    hud_batch.text(x, y, scale, buf, text_color);
+    y += line;
+    snprintf(buf, sizeof(buf), "MAIN   CPU %5.2f  GPU %5.2f", cpu_main_ms, gpu_main_ms);
+    hud_batch.text(x, y, scale, buf, text_color);
+    y += line;
+    snprintf(buf, sizeof(buf), "DRAWS %u  TRIS %u", frame_stats.draws, frame_stats.triangles);
+    hud_batch.text(x, y, scale, buf, text_color);
+    y += line;
+    const GlCallCounts &calls = gl_call_counts();
+    snprintf(buf, sizeof(buf), "SWITCH PROG %u TEX %u VAO %u", calls.issued[GlProgramCalls],
+             calls.issued[GlTextureCalls], calls.issued[GlVertexArrayCalls]);
+    hud_batch.text(x, y, scale, buf, text_color);
+    y += line;
+    snprintf(buf, sizeof(buf), "GL CALLS %u FILTERED %u", calls.total_issued(), calls.total_filtered());
+    hud_batch.text(x, y, scale, buf, text_color);
+    y += line;
+    snprintf(buf, sizeof(buf), "OCCL Q %u CULLED %u COND %u", frame_stats.occlusion_queries,
+             frame_stats.occlusion_culled, frame_stats.occlusion_conditional);
+    hud_batch.text(x, y, scale, buf, text_color);
+    y += line;
+    snprintf(buf, sizeof(buf), "SCALE %.2f  %dX%d", render_scale, rw, rh);
+    hud_batch.text(x, y, scale, buf, text_color);
+    y += line;
+    snprintf(buf, sizeof(buf), "TEX RES %.1f REQ %.1f MB", texture_budget.resident_bytes()/(1024.0*1024.0),
+             texture_budget.requested_bytes()/(1024.0*1024.0));
+    hud_batch.text(x, y, scale, buf, text_color);
+    y += line;
+    if (selected_instance >= 0) {
+        // File name only so it fits the panel
+        const char *path = scene.string(scene.meshes[scene.instances[selected_instance].mesh].path);
+        const char *name = strrchr(path, '/');
+        snprintf(buf, sizeof(buf), "PICK %d %.16s %.2f", selected_instance, name ? name + 1 : path, selected_distance);
+    } else {
+        snprintf(buf, sizeof(buf), "PICK NONE");
+    }
+    hud_batch.text(x, y, scale, buf, text_color);
+    y += line;
+
+    // CPU and GPU bars overlaid, line at 60 Hz
+    hud_batch.graph(x, y, width, graph_h, hud_cpu_history, graph_ms, cpu_color);
+    hud_batch.graph(x, y, width, graph_h, hud_gpu_history, graph_ms, gpu_color);
+    hud_batch.rect(x, y + graph_h*(1.0f - 16.7f/graph_ms), width, 1.0f, mark_color);
+
+    // Stream this frame's vertices (buffer is orphaned and only grows)
+    GLsizeiptr size = sizeof(HudVertex)*hud_batch.vertices.size();
+    gl_bind_buffer(GL_ARRAY_BUFFER, hudVBO);
+    if (size > hud_vbo_size) {
+        hud_vbo_size = size;
+        register_buffer(hudVBO, ResOtherBuffers, "hud vertices", size);
+    }
+    glBufferData(GL_ARRAY_BUFFER, hud_vbo_size, NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, size, hud_batch.vertices.data());
+    gl_bind_buffer(GL_ARRAY_BUFFER, 0);
+
+    // Draw over the window without depth
+    gl_viewport(0, 0, ww, hh);
+    gl_disable(GL_DEPTH_TEST);
+    gl_use_program(hud_program);
+    gl_uniform_2f(hud_screen_size_loc, (GLfloat)ww, (GLfloat)hh);
+    gl_bind_texture(0, GL_TEXTURE_2D, HudFontTex);
+    note_texture_use(HudFontTex, HUD_ATLAS_W*scale);
+    gl_bind_vertex_array(hudVAO);
+    glDrawArrays(GL_TRIANGLES, 0, (GLsizei)hud_batch.vertices.size());
+    gl_bind_vertex_array(0);
+    gl_enable(GL_DEPTH_TEST);
+}
 
-    draw_mat_object(Drawer, DresserMaterial);
+void build_lightmaps( ) {
+    instanceLightmap.assign(scene.header->num_instances, -1);
+    if (!lightmaps_enabled) {
+        return;
+    }
 
+    // Use the cached bake when it matches this scene and settings, otherwise bake now and cache it
+    string cache_path = string(scene_path) + ".lightmap";
+    uint64_t key = lightmap_key(scene, lightmap_settings);
+    if (rebake || !load_lightmaps(cache_path.c_str(), key, lightmaps)) {
+        GLdouble start = glfwGetTime();
+        if (!bake_lightmaps(scene, scene_dir, lightmap_settings, lightmaps)) {
+            return;
+        }
+        printf("Baked lightmaps %dx%d (%d lights) in %.1f s\n", lightmaps.width, lightmaps.height, lightmaps.layers,
+               glfwGetTime() - start);
+        if (!save_lightmaps(cache_path.c_str(), lightmaps)) {
+            fprintf(stderr, "WARNING: could not write lightmap cache %s\n", cache_path.c_str());
+        }
+    }
+    if (lightmaps.layers != (GLint)numLights) {
+        return;
+    }
 
-    //TV
-    trans_matrix = translate(-2.45f, -1.7f, -3.495f);
-    rot_matrix = rotate(-90.0f, vec3(0.0f, 1.0f, 0.0f));
+    // One array layer per light (half floats keep the range above 1 until the lights are summed)
+    glGenTextures(1, &LightmapTex);
+    gl_edit_texture(GL_TEXTURE_2D_ARRAY, LightmapTex);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB16F, lightmaps.width, lightmaps.height, lightmaps.layers, 0, GL_RGB,
+                 GL_FLOAT, lightmaps.texels.data());
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    gl_edit_texture(GL_TEXTURE_2D_ARRAY, 0);
+    register_texture(LightmapTex, ResTextures, "lightmaps", lightmaps.width, lightmaps.height*lightmaps.layers, "RGB16F", 6, 1);
+    // Atlas size follows texel density, not screen size
+    note_texture_use(LightmapTex, (GLfloat)max(lightmaps.width, lightmaps.height));
+
+    // Lightmap coordinates per baked instance, alongside its mesh's positions
+    lightmapVAOs.resize(lightmaps.instances.size());
+    lightmapBuffers.resize(lightmaps.instances.size());
+    glGenVertexArrays(lightmapVAOs.size(), lightmapVAOs.data());
+    glGenBuffers(lightmapBuffers.size(), lightmapBuffers.data());
+    for (int i = 0; i < lightmaps.instances.size(); i++) {
+        const LightmapInstance &baked = lightmaps.instances[i];
+        if (baked.instance >= scene.header->num_instances) {
+            continue;
+        }
+        GLuint obj = scene.instances[baked.instance].mesh;
+        if (baked.uvs.size() != numVertices[obj]) {
+            continue;
+        }
+        gl_bind_vertex_array(lightmapVAOs[i]);
+        gl_vertex_attrib(baked_vPos, ObjBuffers[obj][PosBuffer], posCoords);
+        gl_bind_buffer(GL_ARRAY_BUFFER, lightmapBuffers[i]);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(vec2)*baked.uvs.size(), baked.uvs.data(), GL_STATIC_DRAW);
+        register_buffer(lightmapBuffers[i], ResMeshBuffers, "lightmap coordinates", sizeof(vec2)*baked.uvs.size());
+        gl_vertex_attrib(baked_vLightmap, lightmapBuffers[i], texCoords);
+        instanceLightmap[baked.instance] = i;
+    }
+    gl_bind_vertex_array(0);
+    gl_bind_buffer(GL_ARRAY_BUFFER, 0);
+}
 
-    scale_matrix = scale(0.45f, 0.45f, 0.45f);
-    model_matrix = trans_matrix*rot_matrix*scale_matrix;
-    normal_matrix = model_matrix.inverse().transpose();
+void build_capture( ) {
+    if (!capture_writer.start(capture_dir, capture_format, capture_threads, CAPTURE_QUEUE)) {
+        return;
+    }
+    for (int i = 0; i < CAPTURE_PBOS; i++) {
+        glGenBuffers(1, &captureSlots[i].pbo);
+        captureSlots[i].size = 0;
+        captureSlots[i].fence = 0;
+    }
+    capture_next = 0;
+}
 
-    draw_mat_object(TV, TVMaterial);
+void capture_frame( ) {
+    // Never wait for the GPU, skip the frame if the whole ring is still in flight
+    CaptureSlot &slot = captureSlots[capture_next];
+    if (slot.fence) {
+        capture_ring_full++;
+        return;
+    }
 
-    //Tv screen
-    trans_matrix = translate(-2.45f, -1.48f, -3.39f);
-    rot_matrix = rotate(90.0f, vec3(0.0f, 0.0f, 1.0f));
-    rot2_matrix = rotate(90.0f, vec3(1.0f, 0.0f, 0.0f));
-    scale_matrix = scale(0.666f, 0.666f, 1.0f);
-    model_matrix = trans_matrix*rot_matrix*rot2_matrix*scale_matrix;
-    normal_matrix = model_matrix.inverse().transpose();
+    // Read into the pack buffer, the copy completes asynchronously behind the fence
+    slot.w = ww;
+    slot.h = hh;
+    slot.frame = frame_number;
+    GLsizeiptr size = (GLsizeiptr)ww*hh*4;
+    gl_bind_buffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+    if (size != slot.size) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+        register_buffer(slot.pbo, ResOtherBuffers, "capture readback", size);
+        slot.size = size;
+    }
+    gl_bind_framebuffer(GL_READ_FRAMEBUFFER, 0);
+    glReadBuffer(GL_BACK);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, ww, hh, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    gl_bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    capture_next = (capture_next + 1) % CAPTURE_PBOS;
+}
 
+void build_scene_bvh( ) {
+    // Instances reference the object trees, animated ones are refit as they move
+    GLuint num_instances = scene.header->num_instances;
+    vector<const Bvh *> meshes(num_instances);
+    vector<mat4> models(num_instances);
+    animatedInstances.clear();
+    for (GLuint i = 0; i < num_instances; i++) {
+        const SceneInstance &inst = scene.instances[i];
+        meshes[i] = &meshBvhs[inst.mesh];
+        models[i] = instance_model_matrix(inst);
+        if (inst.animation != SceneAnimNone) {
+            animatedInstances.push_back(i);
+        }
+    }
+    scene_bvh.build(meshes, models);
 
-    if(channel == 1){
-        draw_tex_object(Painting, Wednesday);
-    }else if(channel == 2){
-        draw_tex_object(Painting, Splatoon);
-    }else if(channel == 3){
-        draw_tex_object(Painting, Coyote);
+    size_t mesh_bytes = 0;
+    for (size_t m = 0; m < meshBvhs.size(); m++) {
+        mesh_bytes += meshBvhs[m].nodes.size()*sizeof(BvhNode) + meshBvhs[m].order.size()*sizeof(GLuint) +
+                      meshBvhs[m].corners.size()*sizeof(vec3);
     }
+    register_host("mesh bvh", mesh_bytes);
+    register_host("instance bvh", scene_bvh.nodes.size()*sizeof(BvhNode) + num_instances*(2*sizeof(mat4) +
+                  sizeof(BvhBox) + sizeof(Bvh *) + sizeof(GLuint)));
+}
 
+void refit_scene_bvh( ) {
+    if (animatedInstances.empty()) {
+        return;
+    }
+    for (size_t i = 0; i < animatedInstances.size(); i++) {
+        GLuint index = animatedInstances[i];
+        scene_bvh.move(index, instance_model_matrix(scene.instances[index]));
+    }
+    scene_bvh.refit();
+}
 
+GLboolean camera_blocked(const vec3 &from, const vec3 &to) {
+    // Rays along the (level) step from the camera and from camera_radius to either side of it, in rows
+    // from just above the floor up to eye height so low furniture (table top, chair seats) blocks too
+    vec3 step = vec3(to[0] - from[0], 0.0f, to[2] - from[2]);
+    GLfloat len = length(step);
+    if (len <= 0.0f) {
+        return false;
+    }
+    vec3 dir = step*(1.0f/len);
+    vec3 side = vec3(-dir[2], 0.0f, dir[0]);
+    GLfloat low = camera_floor_height + 0.1f;
+    int rows = (int)ceil((camera_eye_height - low)/CAMERA_RAY_SPACING) + 1;
+    for (int row = 0; row < rows; row++) {
+        GLfloat y = low + (camera_eye_height - low)*row/(rows - 1);
+        vec3 start = vec3(from[0], y, from[2]);
+        for (int k = -1; k <= 1; k++) {
+            if (scene_bvh.occluded(start + side*(k*camera_radius), dir, 0.0f, len + camera_radius)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
 
+void pick_ray(GLdouble x, GLdouble y, vec3 &origin, vec3 &dir) {
+    // Unproject the cursor (NDC) onto the near and far planes, t in [0, 1] spans the view
+    mat4 proj, camera;
+    main_view(proj, camera);
+    mat4 inverse = (proj*camera).inverse();
+    vec4 near_point = inverse*vec4((GLfloat)x, (GLfloat)y, -1.0f, 1.0f);
+    vec4 far_point = inverse*vec4((GLfloat)x, (GLfloat)y, 1.0f, 1.0f);
+    origin = vec3(near_point[0], near_point[1], near_point[2])*(1.0f/near_point[3]);
+    dir = vec3(far_point[0], far_point[1], far_point[2])*(1.0f/far_point[3]) - origin;
+}
 
-    //soda in cup
-    trans_matrix = translate(0.4f, -3.07f, 0.2f);
-    rot_matrix = rotate(0.0f, vec3(0.0f, 0.0f, 1.0f));
-    scale_matrix = scale(0.175f, 0.13f, 0.175f);
-    model_matrix = trans_matrix*rot_matrix*scale_matrix;
+void apply_present_mode( ) {
+    // Adaptive vsync is a negative swap interval where the driver supports tearing late frames
+    GLint interval = 1;
+    if (present_mode == PresentImmediate) {
+        interval = 0;
+    } else if (present_mode == PresentAdaptive) {
+        if (glfwExtensionSupported("WGL_EXT_swap_control_tear") || glfwExtensionSupported("GLX_EXT_swap_control_tear")) {
+            interval = -1;
+        } else {
+            fprintf(stderr, "WARNING: adaptive vsync is not supported, using vsync\n");
+            present_mode = PresentVsync;
+        }
+    }
+    glfwSwapInterval(interval);
+    printf("present mode: %s\n", present_mode_name(present_mode));
+}
 
-    draw_mat_object(Cup, SodaMaterial);
+void build_latency( ) {
+    for (int i = 0; i < LATENCY_FRAMES; i++) {
+        glGenQueries(1, &latencySlots[i].query);
+        latencySlots[i].fence = 0;
+    }
+    latency_next = 0;
+}
 
+void mark_latency(GLdouble frame_start, GLdouble swap_end) {
+    collect_latency(false);
+    if (frame_inputs.empty()) {
+        return;
+    }
+    for (size_t i = 0; i < frame_inputs.size(); i++) {
+        latency_to_frame.push_back(frame_start - frame_inputs[i]);
+        latency_to_swap.push_back(swap_end - frame_inputs[i]);
+    }
 
+    // GPU side is read back once the frame's commands have finished, skipped if the ring is in flight
+    LatencySlot &slot = latencySlots[latency_next];
+    if (slot.fence) {
+        latency_ring_full++;
+        frame_inputs.clear();
+        return;
+    }
+    glQueryCounter(slot.query, GL_TIMESTAMP);
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.inputs.swap(frame_inputs);
+    frame_inputs.clear();
+    latency_next = (latency_next + 1) % LATENCY_FRAMES;
+}
 
-    //Fruit Bowl
-    trans_matrix = translate(0.0f, -2.95f, -0.2f);
-    rot_matrix = rotate(0.0f, vec3(0.0f, 0.0f, 1.0f));
-    scale_matrix = scale(0.3f, 0.3f, 0.3f);
-    model_matrix = trans_matrix*rot_matrix*scale_matrix;
+void collect_latency(GLboolean wait) {
+    // GPU and CPU clocks drift apart, so the offset between them is refreshed every second
+    GLdouble now = glfwGetTime();
+    if (gpu_clock_time < 0.0 || now - gpu_clock_time >= 1.0) {
+        GLint64 gpu_now = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+        gpu_clock_time = glfwGetTime();
+        gpu_clock_offset = gpu_clock_time - gpu_now/1.0e9;
+    }
 
-    draw_mat_object(Bowl, WhiteMaterial);
+    // Oldest slot first
+    for (int k = 0; k < LATENCY_FRAMES; k++) {
+        LatencySlot &slot = latencySlots[(latency_next + k) % LATENCY_FRAMES];
+        if (!slot.fence) {
+            continue;
+        }
+        GLenum status = glClientWaitSync(slot.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000 : 0);
+        if (status == GL_TIMEOUT_EXPIRED) {
+            break;
+        }
+        glDeleteSync(slot.fence);
+        slot.fence = 0;
+        if (status != GL_WAIT_FAILED) {
+            GLuint64 stamp = 0;
+            glGetQueryObjectui64v(slot.query, GL_QUERY_RESULT, &stamp);
+            GLdouble done = stamp/1.0e9 + gpu_clock_offset;
+            for (size_t i = 0; i < slot.inputs.size(); i++) {
+                latency_to_gpu.push_back(done - slot.inputs[i]);
+            }
+        }
+        slot.inputs.clear();
+    }
+}
 
+void collect_captures(GLboolean wait) {
+    // Oldest slot first, stopping at the first one still in flight so frames reach the writers in order
+    for (int k = 0; k < CAPTURE_PBOS; k++) {
+        CaptureSlot &slot = captureSlots[(capture_next + k) % CAPTURE_PBOS];
+        if (!slot.fence) {
+            continue;
+        }
+        GLenum status = glClientWaitSync(slot.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000 : 0);
+        if (status == GL_TIMEOUT_EXPIRED) {
+            break;
+        }
+        glDeleteSync(slot.fence);
+        slot.fence = 0;
+        if (status == GL_WAIT_FAILED) {
+            continue;
+        }
 
+        CaptureFrame frame;
+        frame.index = slot.frame;
+        capture_writer.acquire(frame, slot.w, slot.h);
+        gl_bind_buffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        void *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, frame.pixels.size(), GL_MAP_READ_BIT);
+        if (pixels) {
+            memcpy(frame.pixels.data(), pixels, frame.pixels.size());
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            capture_writer.submit(frame);
+        }
+        gl_bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+}
 
-    //Window
-    trans_matrix = translate(1.0f, 0.0f, -3.90f);
-    rot_matrix = rotate(90.0f, vec3(1.0f, 0.0f, 0.0f));
-    scale_matrix = scale(1.0f, 1.0f, 1.0f);
-    rot2_matrix = rotate(90.0f, vec3(0.0f, 1.0f, 0.0f));
-    model_matrix = trans_matrix*rot_matrix*scale_matrix*rot2_matrix;
+void finish_capture( ) {
+    if (!capture_writer.running()) {
+        return;
+    }
+    collect_captures(true);
+    capture_writer.finish();
+    printf("capture: %u frames (%.1f MB of pixels) written to %s, %u skipped with readbacks in flight, "
+           "%u dropped with writers behind, %u failed\n", capture_writer.written, capture_writer.bytes/(1024.0*1024.0),
+           capture_dir, capture_ring_full, capture_writer.dropped, capture_writer.failed);
+    if (capture_format == CaptureRaw && capture_writer.raw_w > 0) {
+        printf("capture: encode with ffmpeg -f rawvideo -pixel_format rgba -video_size %dx%d -framerate %g -i %s/capture.rgba "
+               "capture.mp4\n", capture_writer.raw_w, capture_writer.raw_h, 60.0/capture_every, capture_dir);
+    }
+    for (int i = 0; i < CAPTURE_PBOS; i++) {
+        glDeleteBuffers(1, &captureSlots[i].pbo);
+    }
+}
 
-    draw_tex_object(Painting, Window);
+void build_multiview( ) {
+    // View records at the uniform buffer offset alignment (std140 pads the block to 96 bytes)
+    GLint align = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+    multiview_record_size = (96 + align - 1)/align*align;
+    glGenBuffers(1, &MultiviewBuffer);
+    gl_bind_buffer(GL_UNIFORM_BUFFER, MultiviewBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, NumMultiviewRecords*multiview_record_size, NULL, GL_DYNAMIC_DRAW);
+    register_buffer(MultiviewBuffer, ResUniformBuffers, "multiview", NumMultiviewRecords*multiview_record_size);
+    gl_bind_buffer(GL_UNIFORM_BUFFER, 0);
+
+    GLuint programs[] = {default_program, lighting_program, texture_program, multi_tex_program, bump_program, baked_program,
+                         uber_program};
+    for (int i = 0; i < sizeof(programs)/sizeof(programs[0]); i++) {
+        GLuint block = glGetUniformBlockIndex(programs[i], "MultiviewBuffer");
+        if (block != GL_INVALID_INDEX) {
+            glUniformBlockBinding(programs[i], block, MULTIVIEW_BINDING);
+        }
+    }
 
-    //Window frame
-    trans_matrix = translate(0.9f, -1.0f, -3.90f);
-    rot_matrix = rotate(0.0f, vec3(1.0f, 0.0f, 0.0f));
-    scale_matrix = scale(1.4f, 1.2f, 1.5f);
-    rot2_matrix = rotate(90.0f, vec3(0.0f, 1.0f, 0.0f));
-    model_matrix = trans_matrix*rot_matrix*scale_matrix*rot2_matrix;
+    // Layered targets (layer 0 main view, layer 1 mirror view), storage allocated on first use
+    glGenTextures(1, &MultiviewTex);
+    gl_edit_texture(GL_TEXTURE_2D_ARRAY, MultiviewTex);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glGenTextures(1, &MultiviewDepthTex);
+    gl_edit_texture(GL_TEXTURE_2D_ARRAY, MultiviewDepthTex);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    gl_edit_texture(GL_TEXTURE_2D_ARRAY, 0);
+    multiview_w = multiview_h = 0;
+}
 
-    draw_tex_object(Frame, Wood);
+void bind_multiview_record(GLint record) {
+    if (record != multiview_record) {
+        gl_bind_buffer_range(GL_UNIFORM_BUFFER, MULTIVIEW_BINDING, MultiviewBuffer, record*multiview_record_size,
+                             multiview_record_size);
+        multiview_record = record;
+    }
+}
 
-    //Blinds
-    trans_matrix = translate(1.0f, 1.2f, -3.45f);
-    rot_matrix = rotate(-90.0f, vec3(0.0f, 1.0f, 0.0f));
-    scale_matrix = scale(1.0f, blinds_scale, 0.7f);
-    rot2_matrix = rotate(180.0f, vec3(1.0f, 0.0f, 0.0f));
-    model_matrix = trans_matrix*rot_matrix*rot2_matrix*scale_matrix;
+void display_multiview( ) {
+    // Vertex shaders output main view clip space and the geometry shaders reproject it for the mirror
+    main_view(proj_matrix, camera_matrix);
+
+    // Mirror view and the part of it that gets sampled (a main view only record when none is)
+    GLint rect[4] = {0, 0, rw, rh};
+    mat4 mirror_from_main = mat4().identity();
+    if (mirror_visible) {
+        mirror_texel_rect(mirror_uv, rect);
+        mat4 mirror_proj, mirror_camera;
+        mirror_view(mirror_proj, mirror_camera);
+        mirror_from_main = mirror_proj*mirror_camera*(proj_matrix*camera_matrix).inverse();
+    }
+    vector<unsigned char> records(NumMultiviewRecords*multiview_record_size, 0);
+    for (int r = 0; r < NumMultiviewRecords; r++) {
+        MultiviewRecord &record = *(MultiviewRecord *)&records[r*multiview_record_size];
+        memcpy(record.mirror_from_main, (const GLfloat *)mirror_from_main, sizeof(record.mirror_from_main));
+        record.mirror_bounds[0] = 2.0f*rect[0]/rw - 1.0f;
+        record.mirror_bounds[1] = 2.0f*rect[1]/rh - 1.0f;
+        record.mirror_bounds[2] = 2.0f*rect[2]/rw - 1.0f;
+        record.mirror_bounds[3] = 2.0f*rect[3]/rh - 1.0f;
+        record.view_mask = (r == MainViewRecord) ? 1 : (r == MirrorViewRecord) ? 2 : 3;
+    }
+    gl_bind_buffer(GL_UNIFORM_BUFFER, MultiviewBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, records.size(), records.data());
+    gl_bind_buffer(GL_UNIFORM_BUFFER, 0);
+    multiview_record = -1;
+
+    if (!mirror_visible) {
+        // Main view only, straight into the scene targets (cleared by the render graph)
+        bind_multiview_record(MainViewRecord);
+        render_scene();
+        return;
+    }
 
-    normal_matrix = model_matrix.inverse().transpose();
-    draw_mat_object(Blinds, WhiteMaterial);
+    // Layered targets follow the window size like the scene framebuffer
+    if (multiview_w != ww || multiview_h != hh) {
+        gl_edit_texture(GL_TEXTURE_2D_ARRAY, MultiviewTex);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, ww, hh, 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        register_texture(MultiviewTex, ResRenderTargets, "multiview color", ww, 2*hh, "RGBA8", 4, 1);
+        gl_edit_texture(GL_TEXTURE_2D_ARRAY, MultiviewDepthTex);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, ww, hh, 2, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+        register_texture(MultiviewDepthTex, ResRenderTargets, "multiview depth", ww, 2*hh, "DEPTH24", 4, 1);
+        gl_edit_texture(GL_TEXTURE_2D_ARRAY, 0);
+        gl_bind_framebuffer(GL_FRAMEBUFFER, Framebuffers[MultiviewFramebuffer]);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, MultiviewTex, 0);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, MultiviewDepthTex, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            fprintf(stderr, "ERROR: multiview framebuffer is incomplete\n");
+        }
+        multiview_w = ww;
+        multiview_h = hh;
+    }
 
+    // One traversal into both layers (clip distances keep the mirror layer to its sampled rectangle)
+    gl_bind_framebuffer(GL_FRAMEBUFFER, Framebuffers[MultiviewFramebuffer]);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    for (int k = 0; k < 4; k++) {
+        gl_enable(GL_CLIP_DISTANCE0 + k);
+    }
+    multiview_pass = MultiviewLayers;
+    render_scene();
+    multiview_pass = MultiviewOff;
+    for (int k = 0; k < 4; k++) {
+        gl_disable(GL_CLIP_DISTANCE0 + k);
+    }
 
+    // Copy the mirror layer's visible region into the mirror texture
+    gl_bind_framebuffer(GL_READ_FRAMEBUFFER, Framebuffers[MultiviewLayerFramebuffer]);
+    glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, MultiviewTex, 0, 1);
+    size_mirror_texture();
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, rect[0], rect[1], rect[0], rect[1], rect[2] - rect[0], rect[3] - rect[1]);
+
+    // Main layer (color and depth) into the scene framebuffer
+    glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, MultiviewTex, 0, 0);
+    glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, MultiviewDepthTex, 0, 0);
+    gl_bind_framebuffer(GL_DRAW_FRAMEBUFFER, render_graph.target());
+    glBlitFramebuffer(0, 0, rw, rh, 0, 0, rw, rh, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    gl_bind_framebuffer(GL_FRAMEBUFFER, render_graph.target());
+
+    // Then the mirror itself and transparent instances, main view only
+    bind_multiview_record(MainViewRecord);
+    multiview_pass = MultiviewOverlay;
+    render_scene();
+    multiview_pass = MultiviewOff;
+}
 
-    //Painting
-    trans_matrix = translate(3.90f, -0.1f, 0.18f);
-    rot_matrix = rotate(90.0f, vec3(0.0f, 0.0f, 1.0f));
-    scale_matrix = scale(1.0f, 1.0f, 1.0f);
-    model_matrix = trans_matrix*rot_matrix*scale_matrix;
-    normal_matrix = model_matrix.inverse().transpose();
-    //draw_color_obj(Cube, BlueCube);
-    draw_tex_object(Painting, Popeye);
+void build_mirror( ) {
+    // Bind mirror texture (generated with the scene textures)
+    gl_edit_texture(GL_TEXTURE_2D, TextureIDs[MirrorTex]);
+    // TODO: Create empty mirror texture
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, rw, rh, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    register_texture(TextureIDs[MirrorTex], ResRenderTargets, "mirror", rw, rh, "RGBA8", 4, 1);
+    mirror_w = rw;
+    mirror_h = rh;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+}
 
-    //Painting frame
-    trans_matrix = translate(3.85f, -1.2f, 0.1f);
-    rot_matrix = rotate(0.0f, vec3(0.0f, 0.0f, 1.0f));
-    scale_matrix = scale(0.1f, 1.18f, 1.4f);
-    model_matrix = trans_matrix*rot_matrix*scale_matrix;
-    normal_matrix = model_matrix.inverse().transpose();
-    draw_tex_object(Frame, Wood);
+void render_scene( ) {
+    // Start this pass's instance list for occlusion queries
+    begin_occlusion_pass();
 
-    //Mirror
-    if(!mirror) {
-        trans_matrix = translate(mirror_eye);
-        rot_matrix = rotate(-90.0f, vec3(1.0f, 0.0f, 0.0f));
-        scale_matrix = scale(1.2f, 1.2f, 1.2f);
-        rot2_matrix = rotate(0.0f, vec3(1.0f, 0.0f, 0.0f));
-        model_matrix = trans_matrix * rot_matrix * scale_matrix * rot2_matrix;
+    // Draw scene instances in file order (transparent ones are listed last)
+    const SceneInstance *prev = NULL;
+    for (int i = 0; i < scene.header->num_instances; i++) {
+        const SceneInstance &inst = scene.instances[i];
 
-        draw_tex_object(Plane, MirrorTex);
-    }
-    //Mirror Frame
-    trans_matrix = translate(0.0f, -1.7f, 3.93f);
-    rot_matrix = rotate(-90.0f, vec3(0.0f, 1.0f, 0.0f));
-    scale_matrix = scale(0.2f, 1.4f, 1.7f);
-    model_matrix = trans_matrix*rot_matrix*scale_matrix;
-    normal_matrix = model_matrix.inverse().transpose();
-    draw_tex_object(Frame, Wood);
+        // Mirror is not drawn into its own view, TV screens only on their channel
+        if (mirror && (inst.flags & SceneNoMirror)) {
+            continue;
+        }
+        if (inst.channel >= 0 && inst.channel != channel) {
+            continue;
+        }
 
+        // Multiview draws the mirror after its texture has been copied out of the mirror layer,
+        // and transparent instances over it afterwards
+        GLboolean overlay = (i == mirror_instance) || (inst.flags & SceneNoDepthWrite);
+        if (multiview_pass == MultiviewLayers && (i == mirror_instance ||
+                                                  (overlay && (inst.flags & SceneNoMirror)))) {
+            continue;
+        }
+        if (multiview_pass == MultiviewOverlay && !overlay) {
+            continue;
+        }
 
-    //fan
-    trans_matrix = translate(0.0f, 3.0f, 0.0f);
-    rot_matrix = rotate(fan_angle, vec3(0.0f, 1.0f, 0.0f));
-    scale_matrix = scale(0.5f, 0.5f, 0.5f);
-    model_matrix = trans_matrix*rot_matrix*scale_matrix;
-    normal_matrix = model_matrix.inverse().transpose();
-    draw_mat_object(Fan, WhiteMaterial);
+        // Count state switched relative to the previous instance drawn
+        if (!prev || prev->shader != inst.shader) frame_stats.state_changes++;
+        if (!prev || prev->mesh != inst.mesh) frame_stats.state_changes++;
+        if (!prev || prev->material != inst.material) frame_stats.state_changes++;
+        if (!prev || prev->texture != inst.texture) frame_stats.state_changes++;
+        if (!prev || prev->texture2 != inst.texture2) frame_stats.state_changes++;
+        prev = &inst;
+
+        model_matrix = instance_model_matrix(inst);
+        normal_matrix = affine_normal_matrix(model_matrix);
+
+        // Textures load on first use (placeholders are drawn until they arrive)
+        if (inst.texture >= 0 && inst.shader != SceneColorShader && inst.shader != SceneMatShader) {
+            GLint textures[2] = {inst.texture, inst.texture2};
+            for (int k = 0; k < 2 && textures[k] >= 0; k++) {
+                if (textureAssets[textures[k]] >= 0) {
+                    asset_manager.use(textureAssets[textures[k]], rendered_frames + 1);
+                }
+            }
+        }
 
+        // Track the largest on screen size of each texture (the budget counts mirror uses too, not while timing stress steps)
+        if (!stress && inst.texture >= 0 && inst.shader != SceneColorShader && inst.shader != SceneMatShader) {
+            GLfloat screen = (GLfloat)max(ww, hh);
+            GLfloat size = screen_diameter(inst.mesh, hh);
+            size = (size <= 0.0f) ? screen : fmin(size, screen);
+            GLint textures[2] = {inst.texture, inst.texture2};
+            for (int k = 0; k < 2 && textures[k] >= 0; k++) {
+                if (!mirror) {
+                    note_texture_use(TextureIDs[textures[k]], size);
+                }
+                if (budgetTextures[textures[k]] >= 0) {
+                    texture_budget.note_use(budgetTextures[textures[k]], size, rendered_frames + 1);
+                }
+            }
+        }
 
+        // Mirror layer skips instances the mirror doesn't show, main layer waits for transparent ones
+        if (multiview_pass == MultiviewLayers) {
+            if (inst.flags & SceneNoMirror) {
+                bind_multiview_record(MainViewRecord);
+            } else if (inst.flags & SceneNoDepthWrite) {
+                bind_multiview_record(MirrorViewRecord);
+            } else {
+                bind_multiview_record(BothViewsRecord);
+            }
+        }
+        draw_instance(inst, i);
+    }
+    flush_uber_draws();
 
+    // Test this pass's bounding boxes against the finished depth buffer
+    end_occlusion_pass();
+}
 
-    //Door
+void draw_instance(const SceneInstance &inst, GLint index) {
+    // Uber program batches everything but lightmapped instances (opaque ones draw straight away,
+    // transparent ones after the queued draws)
+    GLboolean baked = (inst.shader == SceneMatShader && instanceLightmap[index] >= 0);
+    if (uber && !baked) {
+        queue_uber_draw(inst);
+        return;
+    }
+    if (inst.flags & SceneNoDepthWrite) {
+        flush_uber_draws();
+    }
 
-    trans_matrix = translate(-3.8f, -2.2f, 0.0f);
-    rot_matrix = rotate(180.0f, vec3(0.0f, 1.0f, 0.0f));
-    scale_matrix = scale(2.0f, 2.0f, 2.0f);
-    model_matrix = trans_matrix*rot_matrix*scale_matrix;
+    // Draw with the instance's shader (model and normal matrices are already set)
+    if (inst.flags & SceneNoDepthWrite) {
+        gl_depth_mask(GL_FALSE);
+    }
+    switch (inst.shader) {
+        case SceneColorShader:
+            draw_color_obj(inst.mesh, inst.material);
+            break;
+        case SceneMatShader:
+            if (instanceLightmap[index] >= 0) {
+                draw_baked_object(inst.mesh, instanceLightmap[index], inst.material);
+            } else {
+                draw_mat_object(inst.mesh, inst.material);
+            }
+            break;
+        case SceneTexShader:
+            draw_tex_object(inst.mesh, inst.texture);
+            break;
+        case SceneMultiTexShader:
+            draw_multi_tex_object(inst.mesh, inst.texture, inst.texture2);
+            break;
+        case SceneBumpShader:
+            draw_bump_object(inst.mesh, inst.texture, inst.texture2);
+            break;
+    }
+    if (inst.flags & SceneNoDepthWrite) {
+        gl_depth_mask(GL_TRUE);
+    }
+}
 
-    normal_matrix = model_matrix.inverse().transpose();
-    draw_bump_object(Door, Wood, WoodNorm);
+void build_uber( ) {
+    // Draw records are bound UBER_MAX_DRAWS at a time, at the uniform buffer offset alignment
+    GLint align = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+    uber_chunk_size = (UBER_MAX_DRAWS*sizeof(UberDraw) + align - 1)/align*align;
+    glGenBuffers(1, &UberBuffer);
+}
 
-    //table
-    trans_matrix = translate(0.0f, -4.0f, 0.0f);
-    rot_matrix = rotate(0.0f, vec3(0.0f, 0.0f, 1.0f));
-    scale_matrix = scale(0.75f, 0.75f, 0.75f);
-    model_matrix = trans_matrix*rot_matrix*scale_matrix;
+void queue_uber_draw(const SceneInstance &inst) {
+    // Culled by last frame's query, or left to the GPU in a draw of its own if the result is still out
+    GLint lod = select_lod(inst.mesh);
+    GLuint query = 0;
+    GLint verdict = occlusion ? occlusion_verdict(inst.mesh, query) : OcclusionVisible;
+    if (verdict == OcclusionCulled) {
+        frame_stats.occlusion_culled++;
+        return;
+    }
 
-    normal_matrix = model_matrix.inverse().transpose();
-    draw_bump_object(Table, Wood, WoodNorm);
+    // Surface flags of the instance's shader
+    GLint flags = 0;
+    switch (inst.shader) {
+        case SceneMatShader:
+            flags = UberLit;
+            break;
+        case SceneTexShader:
+            flags = UberBaseTex;
+            break;
+        case SceneMultiTexShader:
+            flags = UberBaseTex | UberDetailTex;
+            break;
+        case SceneBumpShader:
+            flags = UberBaseTex | UberNormalMap | UberLit;
+            break;
+    }
 
+    // Per draw record (model and normal matrices are already set)
+    UberDraw draw;
+    memcpy(draw.model, (const GLfloat *)model_matrix, sizeof(draw.model));
+    memcpy(draw.normal, (const GLfloat *)normal_matrix, sizeof(draw.normal));
+    vec4 color = (inst.shader == SceneColorShader) ? solidColors[inst.material] : vec4(1.0f, 1.0f, 1.0f, 1.0f);
+    memcpy(draw.color, (const GLfloat *)color, sizeof(draw.color));
+    draw.flags = flags;
+    draw.material = inst.material;
+    draw.pad[0] = draw.pad[1] = 0;
+
+    // One batch per draw, merged when flushed
+    GLint texture = (flags & UberBaseTex) ? inst.texture : -1;
+    GLint texture2 = (flags & (UberDetailTex | UberNormalMap)) ? inst.texture2 : -1;
+    GLboolean depth_write = !(inst.flags & SceneNoDepthWrite);
+    UberBatch batch = {inst.mesh, lod, flags, texture, texture2, depth_write, multiview_record, query,
+                       (GLuint)uberDraws.size(), 1};
+    uberDraws.push_back(draw);
+    uberBatches.push_back(batch);
+}
 
-    //chairs
-    trans_matrix = translate(0.0f, -3.55f, 1.0f);
-    rot_matrix = rotate(90.0f, vec3(0.0f, 1.0f, 0.0f));
-    scale_matrix = scale(0.25f, 0.35f, 0.25f);
-    model_matrix = trans_matrix*rot_matrix*scale_matrix;
+bool uber_batch_less(const UberBatch &a, const UberBatch &b) {
+    // Opaque draws by mesh, LOD and textures, transparent ones after them in queue order
+    if (a.depth_write != b.depth_write) {
+        return a.depth_write;
+    }
+    if (!a.depth_write) {
+        return false;
+    }
+    if (a.obj != b.obj) return a.obj < b.obj;
+    if (a.lod != b.lod) return a.lod < b.lod;
+    if (a.texture != b.texture) return a.texture < b.texture;
+    if (a.texture2 != b.texture2) return a.texture2 < b.texture2;
+    if (a.flags != b.flags) return a.flags < b.flags;
+    return a.record < b.record;
+}
 
-    normal_matrix = model_matrix.inverse().transpose();
+void merge_uber_draws( ) {
+    // Sort the queued draws (stable, so equal opaque draws and transparent ones keep their order)
+    std::stable_sort(uberBatches.begin(), uberBatches.end(), uber_batch_less);
+
+    // Extend the previous batch if only the record differs (and it doesn't cross into the next chunk)
+    uberSortedDraws.clear();
+    uberMergedBatches.clear();
+    for (int i = 0; i < uberBatches.size(); i++) {
+        UberBatch b = uberBatches[i];
+        const UberDraw &draw = uberDraws[b.first];
+        if (!uberMergedBatches.empty() && b.query == 0 && uberSortedDraws.size() % UBER_MAX_DRAWS != 0) {
+            UberBatch &last = uberMergedBatches.back();
+            if (last.query == 0 && last.obj == b.obj && last.lod == b.lod && last.flags == b.flags &&
+                last.texture == b.texture && last.texture2 == b.texture2 && last.depth_write == b.depth_write &&
+                last.record == b.record) {
+                uberSortedDraws.push_back(draw);
+                last.count++;
+                continue;
+            }
+        }
+        b.first = (GLuint)uberSortedDraws.size();
+        uberSortedDraws.push_back(draw);
+        uberMergedBatches.push_back(b);
+    }
+    uberDraws.swap(uberSortedDraws);
+    uberBatches.swap(uberMergedBatches);
+}
 
-    draw_bump_object(Chair, Wood, WoodNorm);
+void flush_uber_draws( ) {
+    if (uberBatches.empty()) {
+        return;
+    }
+    merge_uber_draws();
+
+    // Upload the queued records a chunk at a time (orphaned, earlier draws may still be reading)
+    GLuint chunks = (uberDraws.size() + UBER_MAX_DRAWS - 1)/UBER_MAX_DRAWS;
+    size_t bytes = max((size_t)chunks*uber_chunk_size, uber_buffer_size);
+    gl_bind_buffer(GL_UNIFORM_BUFFER, UberBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+    if (bytes != uber_buffer_size) {
+        register_buffer(UberBuffer, ResUniformBuffers, "uber draws", bytes);
+        uber_buffer_size = bytes;
+    }
+    for (GLuint c = 0; c < chunks; c++) {
+        GLuint first = c*UBER_MAX_DRAWS;
+        GLuint count = min((GLuint)uberDraws.size() - first, (GLuint)UBER_MAX_DRAWS);
+        glBufferSubData(GL_UNIFORM_BUFFER, (GLintptr)c*uber_chunk_size, count*sizeof(UberDraw), &uberDraws[first]);
+    }
 
+    // Per pass state (light and material blocks are the lighting program's bindings)
+    gl_use_program(uber_program);
+    gl_uniform_matrix4fv(uber_proj_mat_loc, 1, proj_matrix);
+    gl_uniform_matrix4fv(uber_camera_mat_loc, 1, camera_matrix);
+    gl_uniform_3fv(uber_eye_loc, 1, eye);
+    gl_uniform_1i(uber_num_lights_loc, numLights);
+    gl_uniform_1iv(uber_light_on_loc, numLights, lightOn.data());
+    gl_bind_buffer_range(GL_UNIFORM_BUFFER, 0, LightBuffers[LightBuffer], 0, shader_max_lights*sizeof(LightProperties));
+    gl_bind_buffer_range(GL_UNIFORM_BUFFER, 1, MaterialBuffers[MaterialBuffer], 0,
+                         shader_max_materials*sizeof(MaterialProperties));
+
+    // One instanced draw per batch, attributes the surface flags read
+    GLint record = multiview_record;
+    for (int i = 0; i < uberBatches.size(); i++) {
+        const UberBatch &b = uberBatches[i];
+        gl_bind_buffer_range(GL_UNIFORM_BUFFER, UBER_BINDING, UberBuffer, (b.first/UBER_MAX_DRAWS)*uber_chunk_size,
+                             uber_chunk_size);
+        gl_uniform_1i(uber_draw_base_loc, b.first % UBER_MAX_DRAWS);
+        if (b.texture >= 0) {
+            gl_bind_texture(0, GL_TEXTURE_2D, TextureIDs[b.texture]);
+        }
+        if (b.texture2 >= 0) {
+            gl_bind_texture(1, GL_TEXTURE_2D, TextureIDs[b.texture2]);
+        }
+        gl_bind_vertex_array(VAOs[b.obj]);
+        gl_vertex_attrib(0, ObjBuffers[b.obj][PosBuffer], posCoords);
+        if (b.flags & UberLit) {
+            gl_vertex_attrib(1, ObjBuffers[b.obj][NormBuffer], normCoords);
+        }
+        if (b.flags & UberBaseTex) {
+            gl_vertex_attrib(2, ObjBuffers[b.obj][TexBuffer], texCoords);
+        }
+        if (b.flags & UberNormalMap) {
+            gl_vertex_attrib(3, ObjBuffers[b.obj][TangBuffer], tangCoords);
+        }
+        if (b.record >= 0) {
+            bind_multiview_record(b.record);
+        }
+        gl_depth_mask(b.depth_write);
+
+        GLint lod = b.lod;
+        frame_stats.draws++;
+        frame_stats.triangles += lodCount[b.obj][lod]/3*b.count;
+        if (b.query) {
+            frame_stats.occlusion_conditional++;
+            glBeginConditionalRender(b.query, GL_QUERY_NO_WAIT);
+            glDrawArraysInstanced(GL_TRIANGLES, lodFirst[b.obj][lod], lodCount[b.obj][lod], b.count);
+            glEndConditionalRender();
+        } else {
+            glDrawArraysInstanced(GL_TRIANGLES, lodFirst[b.obj][lod], lodCount[b.obj][lod], b.count);
+        }
+    }
+    gl_depth_mask(GL_TRUE);
+    if (record >= 0) {
+        bind_multiview_record(record);
+    }
+    uberDraws.clear();
+    uberBatches.clear();
+}
 
+mat4 instance_model_matrix(const SceneInstance &inst) {
+    // Instance matrices are stored column-major like mat4
+    mat4 pre, post;
+    memcpy((GLfloat *)pre, inst.pre, sizeof(inst.pre));
+    if (inst.animation == SceneAnimNone) {
+        return pre;
+    }
+    memcpy((GLfloat *)post, inst.post, sizeof(inst.post));
+
+    // Animated transform between the two halves
+    GLfloat value = (inst.animation == SceneAnimFan) ? fan_angle : blinds_scale;
+    const GLfloat *params = inst.anim_params;
+    mat4 anim_matrix;
+    if (inst.anim_op == SceneOpRotate) {
+        anim_matrix = rotate(value, vec3(params[0], params[1], params[2]));
+    } else {
+        GLfloat s[3] = {params[0], params[1], params[2]};
+        s[inst.anim_component] = value;
+        anim_matrix = scale(s[0], s[1], s[2]);
+    }
+    return pre*anim_matrix*post;
+}
 
-    trans_matrix = translate(0.0f, -3.55f, -1.0f);
-    rot_matrix = rotate(-90.0f, vec3(0.0f, 1.0f, 0.0f));
-    scale_matrix = scale(0.25f, 0.35f, 0.25f);
-    model_matrix = trans_matrix*rot_matrix*scale_matrix;
+bool load_scene(const char *path) {
+    // Text scenes are compiled in memory, binary images are mapped and used in place
+    const char *data = NULL;
+    size_t size = 0;
+    size_t len = strlen(path);
+    if (len > 6 && strcmp(path + len - 6, ".scene") == 0) {
+        if (!cook_scene(path, scene_image)) {
+            return false;
+        }
+        data = scene_image.data();
+        size = scene_image.size();
+    } else {
+        if (!scene_file.open(path)) {
+            fprintf(stderr, "ERROR: could not open scene %s\n", path);
+            return false;
+        }
+        data = scene_file.data;
+        size = scene_file.size;
+    }
+    if (!open_scene(data, size, scene)) {
+        fprintf(stderr, "ERROR: %s is not a valid scene\n", path);
+        return false;
+    }
+    register_host("scene image", size);
+
+    // Asset paths are relative to the scene file
+    scene_dir = path;
+    size_t slash = scene_dir.find_last_of("/\\");
+    scene_dir = (slash == string::npos) ? string() : scene_dir.substr(0, slash + 1);
+
+    // Rendered textures go after the loaded ones (mirror shares its scene slot)
+    GLint num_textures = scene.header->num_textures;
+    SceneTex = num_textures;
+    MirrorTex = num_textures + 1;
+    for (int i = 0; i < num_textures; i++) {
+        if (strcmp(scene.string(scene.textures[i].path), "@mirror") == 0) {
+            MirrorTex = i;
+        }
+    }
+    TextureIDs.resize(num_textures + 2);
+    find_mirror_instance();
+
+    // Per mesh objects
+    GLint num_meshes = scene.header->num_meshes;
+    VAOs.resize(num_meshes);
+    ObjBuffers.resize(num_meshes);
+    numVertices.resize(num_meshes);
+    numLods.resize(num_meshes);
+    lodFirst.resize(num_meshes);
+    lodCount.resize(num_meshes);
+    objBounds.resize(num_meshes);
+    meshBvhs.resize(num_meshes);
+    return true;
+}
 
-    normal_matrix = model_matrix.inverse().transpose();
+string scene_file_path(uint32_t path) {
+    return scene_dir + scene.string(path);
+}
 
-    draw_bump_object(Chair, Wood, WoodNorm);
+void find_mirror_instance( ) {
+    // Mirror pass needs the instance showing the mirror texture
+    mirror_instance = -1;
+    for (int i = 0; i < scene.header->num_instances; i++) {
+        const SceneInstance &inst = scene.instances[i];
+        if ((inst.shader == SceneTexShader || inst.shader == SceneMultiTexShader) && inst.texture == MirrorTex) {
+            mirror_instance = i;
+        }
+    }
+}
 
-//fruit
-    trans_matrix = translate(-0.18f, -2.98f, -0.2f);
-    rot_matrix = rotate(0.0f, vec3(0.0f, 0.0f, 1.0f));
-    scale_matrix = scale(0.1f, 0.1f, 0.1f);
-    model_matrix = trans_matrix*rot_matrix*scale_matrix;
+void build_geometry( )
+{
+    // Generate vertex arrays and buffers
+    glGenVertexArrays(VAOs.size(), VAOs.data());
+
+    // Load scene meshes (@quad is the built in textured quad)
+    GLint max_vertices = 0;
+    for (int obj = 0; obj < scene.header->num_meshes; obj++) {
+        const SceneMesh &mesh = scene.meshes[obj];
+        if (strcmp(scene.string(mesh.path), "@quad") == 0) {
+            build_painting(obj);
+        } else if (mesh.flags & SceneMeshBump) {
+            load_bump_object(obj);
+        } else {
+            load_object(obj);
+        }
+        GLint last = numLods[obj] - 1;
+        max_vertices = max(max_vertices, lodFirst[obj][last] + lodCount[obj][last]);
+    }
 
+    // Generate color buffers
+    glGenBuffers(NumColorBuffers, ColorBuffers);
 
-    normal_matrix = model_matrix.inverse().transpose();
-    draw_bump_object(Sphere, Apple, FruitNorm);
 
+    // Build color buffers (long enough for any mesh and its levels)
 
-    trans_matrix = translate(0.16f, -2.97f, -0.2f);
-    rot_matrix = rotate(0.0f, vec3(0.0f, 0.0f, 1.0f));
-    scale_matrix = scale(0.1f, 0.1f, 0.1f);
-    model_matrix = trans_matrix*rot_matrix*scale_matrix;
+    build_solid_color_buffer(max_vertices, solidColors[RedCube], RedCube);
+    build_solid_color_buffer(max_vertices, solidColors[BlueCube], BlueCube);
+    build_solid_color_buffer(max_vertices, solidColors[GreenCube], GreenCube);
+}
 
-    normal_matrix = model_matrix.inverse().transpose();
-    draw_bump_object(Sphere, Apple, FruitNorm);
 
+void build_materials( ) {
+    glGenBuffers(NumMaterialBuffers, MaterialBuffers);
+    update_materials();
+}
 
-    trans_matrix = translate(-0.0f, -2.95f, -0.01f);
-    rot_matrix = rotate(0.0f, vec3(0.0f, 0.0f, 1.0f));
-    scale_matrix = scale(0.1f, 0.1f, 0.1f);
-    model_matrix = trans_matrix*rot_matrix*scale_matrix;
+void update_materials( ) {
+    // Add scene materials to Materials vector (same std140 layout)
+    Materials.resize(min((GLint)scene.header->num_materials, shader_max_materials));
+    if (!Materials.empty()) {
+        memcpy((void *)Materials.data(), scene.materials, Materials.size()*sizeof(MaterialProperties));
+    }
 
-    normal_matrix = model_matrix.inverse().transpose();
-    draw_bump_object(Sphere, Apple, FruitNorm);
+    // Buffer covers the whole shader block, unused entries stay zero
+    size_t bytes = shader_max_materials*sizeof(MaterialProperties);
+    vector<MaterialProperties> block(shader_max_materials);
+    memset((void *)block.data(), 0, bytes);
+    copy(Materials.begin(), Materials.end(), block.begin());
+    gl_bind_buffer(GL_UNIFORM_BUFFER, MaterialBuffers[MaterialBuffer]);
+    glBufferData(GL_UNIFORM_BUFFER, bytes, block.data(), GL_STATIC_DRAW);
+    register_buffer(MaterialBuffers[MaterialBuffer], ResUniformBuffers, "materials", bytes);
+}
 
-    trans_matrix = translate(0.0f, -2.95f, -0.32f);
-    rot_matrix = rotate(0.0f, vec3(0.0f, 0.0f, 1.0f));
-    scale_matrix = scale(0.1f, 0.1f, 0.1f);
-    model_matrix = trans_matrix*rot_matrix*scale_matrix;
+void build_lights( ) {
+    // Create uniform buffer for lights
+    glGenBuffers(NumLightBuffers, LightBuffers);
+    update_lights();
+}
 
-    normal_matrix = model_matrix.inverse().transpose();
-    draw_bump_object(Sphere, Apple, FruitNorm);
+void update_lights( ) {
+    // Add scene lights to Lights vector (same std140 layout)
+    Lights.resize(min((GLint)scene.header->num_lights, shader_max_lights));
+    if (!Lights.empty()) {
+        memcpy((void *)Lights.data(), scene.lights, Lights.size()*sizeof(LightProperties));
+    }
+    // Set numLights
+    numLights = Lights.size();
 
-    //Cup
-    trans_matrix = translate(0.4f, -3.01f, 0.2f);
-    rot_matrix = rotate(0.0f, vec3(0.0f, 0.0f, 1.0f));
-    scale_matrix = scale(0.2f, 0.2f, 0.2f);
-    model_matrix = trans_matrix*rot_matrix*scale_matrix;
+    // Initial light switches from the scene
+    lightOn.assign(scene.light_on, scene.light_on + numLights);
+
+    // Load uniform buffer for lights (whole shader block, unused entries stay zero)
+    size_t bytes = shader_max_lights*sizeof(LightProperties);
+    vector<LightProperties> block(shader_max_lights);
+    memset((void *)block.data(), 0, bytes);
+    copy(Lights.begin(), Lights.end(), block.begin());
+    gl_bind_buffer(GL_UNIFORM_BUFFER, LightBuffers[LightBuffer]);
+    glBufferData(GL_UNIFORM_BUFFER, bytes, block.data(), GL_STATIC_DRAW);
+    register_buffer(LightBuffers[LightBuffer], ResUniformBuffers, "lights", bytes);
+}
+void load_bump_object(GLuint obj) {
+    vector<vec4> vertices;
+    vector<vec2> uvCoords;
+    vector<vec3> normals;
+    vector<vec4> tangents;
 
-    glDepthMask(GL_FALSE);
-    draw_mat_object(Cup, CupMaterial);
-    glDepthMask(GL_TRUE);
+    // Load model and set number of vertices
+    load_obj_fast(scene_file_path(scene.meshes[obj].path).c_str(), vertices, uvCoords, normals);
+    numVertices[obj] = vertices.size();
 
+    // Compute welded tangents with handedness in w (shader rebuilds the bitangent)
+    generate_tangents(vertices, uvCoords, normals, tangents);
 
+    // Append simplified levels after the full mesh
+    append_lods(obj, vertices, uvCoords, normals, &tangents);
 
+    // Create and load object buffers
+    glGenBuffers(NumObjBuffers, ObjBuffers[obj].data());
+    gl_bind_vertex_array(VAOs[obj]);
+    gl_bind_buffer(GL_ARRAY_BUFFER, ObjBuffers[obj][PosBuffer]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*posCoords*vertices.size(), vertices.data(), GL_STATIC_DRAW);
+    gl_bind_buffer(GL_ARRAY_BUFFER, ObjBuffers[obj][NormBuffer]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*normCoords*normals.size(), normals.data(), GL_STATIC_DRAW);
+    gl_bind_buffer(GL_ARRAY_BUFFER, ObjBuffers[obj][TexBuffer]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*texCoords*uvCoords.size(), uvCoords.data(), GL_STATIC_DRAW);
+    gl_bind_buffer(GL_ARRAY_BUFFER, ObjBuffers[obj][TangBuffer]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*tangCoords*tangents.size(), tangents.data(), GL_STATIC_DRAW);
+    gl_bind_buffer(GL_ARRAY_BUFFER, 0);
+    register_mesh_buffers(obj, vertices.size(), true);
 }
 
-void build_geometry( )
-{
-    // Generate vertex arrays and buffers
-    glGenVertexArrays(NumVAOs, VAOs);
-
-    // Load models
-    load_object(Cube);
-    load_object(Cup);
-    load_object(Soda);
-    load_object(Circle);
-    load_object(Bowl);
-    load_object(Blinds);
-    load_object(Fan);
-    load_object(Frame);
-    load_object(Drawer);
-    load_object(TV);
-    load_object(Plane);
+void append_lods(GLuint obj, vector<vec4> &vertices, vector<vec2> &uvCoords, vector<vec3> &normals, vector<vec4> *tangents) {
+    // Bounds of the full mesh are used for screen size of every level
+    compute_bounds(vertices, objBounds[obj]);
 
+    // Collision and picking test the full mesh
+    vector<vec3> corners(vertices.size());
+    for (int i = 0; i < vertices.size(); i++) {
+        corners[i] = vec3(vertices[i][0], vertices[i][1], vertices[i][2]);
+    }
+    meshBvhs[obj].build(corners);
+
+    // Level 0 is the full mesh
+    numLods[obj] = 1;
+    lodFirst[obj][0] = 0;
+    lodCount[obj][0] = vertices.size();
+
+    // Simplify and append each level's corners to the attribute arrays
+    vector<LODLevel> levels;
+    build_lod_chain(vertices, normals, levels, MAX_LODS - 1);
+    for (int l = 0; l < levels.size(); l++) {
+        const vector<unsigned int> &corners = levels[l].corners;
+        lodFirst[obj][numLods[obj]] = vertices.size();
+        lodCount[obj][numLods[obj]] = corners.size();
+        numLods[obj]++;
+        for (int i = 0; i < corners.size(); i++) {
+            vertices.push_back(vertices[corners[i]]);
+            uvCoords.push_back(uvCoords[corners[i]]);
+            normals.push_back(normals[corners[i]]);
+            if (tangents) {
+                tangents->push_back((*tangents)[corners[i]]);
+            }
+        }
+    }
+}
 
+GLint select_lod(GLuint obj) {
+    if (numLods[obj] <= 1) {
+        return 0;
+    }
 
-    load_bump_object(Door);
-    load_bump_object(Chair);
-    load_bump_object(Table);
-    load_bump_object(Sphere);
+    // Camera inside (or touching) the bounds gets full detail
+    GLfloat diameter = screen_diameter(obj, rh);
+    if (diameter <= 0.0f) {
+        return 0;
+    }
 
-    build_painting();
+    // One level coarser each time the projected diameter halves
+    GLint lod = (GLint)floor(log2(lod_pixels/diameter) + lod_bias);
+    if (lod < 0) {
+        lod = 0;
+    } else if (lod >= numLods[obj]) {
+        lod = numLods[obj] - 1;
+    }
+    return lod;
+}
 
-    // Generate color buffers
-    glGenBuffers(NumColorBuffers, ColorBuffers);
+GLfloat screen_diameter(GLuint obj, GLint pixels_high) {
+    // Bounding sphere center in camera space, radius scaled by largest model axis
+    const MeshBounds &b = objBounds[obj];
+    vec4 c = camera_matrix*model_matrix*vec4(b.center, 1.0f);
+    GLfloat max_scale = 0.0f;
+    for (int k = 0; k < 3; k++) {
+        vec3 axis = vec3(model_matrix[k][0], model_matrix[k][1], model_matrix[k][2]);
+        max_scale = fmax(max_scale, length(axis));
+    }
+    GLfloat r = b.radius*max_scale;
 
+    // Projected diameter in pixels (0 when the camera is inside the sphere)
+    GLfloat depth = -c[2];
+    if (depth <= r) {
+        return 0.0f;
+    }
+    return r*proj_matrix[1][1]*pixels_high/depth;
+}
 
-    // Build color buffers
+void draw_object(GLuint obj) {
+    draw_object_lod(obj, select_lod(obj));
+}
 
-    build_solid_color_buffer(numVertices[Cube], vec4(1.0f, 0.0f, 0.0f, 1.0f), RedCube);
-    build_solid_color_buffer(numVertices[Cube], vec4(0.0f, 0.0f, 1.0f, 1.0f), BlueCube);
-    build_solid_color_buffer(numVertices[Cube], vec4(0.0f, 1.0f, 0.0f, 1.0f), GreenCube);
+void draw_object_lod(GLuint obj, GLint lod) {
+    GLuint triangles = lodCount[obj][lod]/3;
+    GLuint query = 0;
+    GLint verdict = occlusion ? occlusion_verdict(obj, query) : OcclusionVisible;
+    if (verdict == OcclusionCulled) {
+        frame_stats.occlusion_culled++;
+        return;
+    }
+    frame_stats.draws++;
+    frame_stats.triangles += triangles;
+    if (verdict == OcclusionPending) {
+        // Result still in flight, let the GPU skip the draw
+        frame_stats.occlusion_conditional++;
+        glBeginConditionalRender(query, GL_QUERY_NO_WAIT);
+        glDrawArrays(GL_TRIANGLES, lodFirst[obj][lod], lodCount[obj][lod]);
+        glEndConditionalRender();
+    } else {
+        glDrawArrays(GL_TRIANGLES, lodFirst[obj][lod], lodCount[obj][lod]);
+    }
 }
 
+GLint occlusion_verdict(GLuint obj, GLuint &query) {
+    // Instances are matched to last frame's queries by draw order within the pass
+    vector<OcclusionSlot> &slots = occlusionSlots[occlusion_pass];
+    if (occlusion_next == slots.size()) {
+        OcclusionSlot slot;
+        slot.obj = obj;
+        glGenQueries(2, slot.queries);
+        slot.issued[0] = slot.issued[1] = false;
+        slots.push_back(slot);
+    }
+    OcclusionSlot &slot = slots[occlusion_next++];
+    if (slot.obj != obj) {
+        // Draw order changed, last result belongs to another object
+        slot.obj = obj;
+        slot.issued[0] = slot.issued[1] = false;
+    }
+    slot.model = model_matrix;
 
-void build_materials( ) {
-    // Add materials to Materials vector
+    // No result from last frame, draw normally
+    GLint prev = 1 - occlusion_parity[occlusion_pass];
+    if (!slot.issued[prev]) {
+        return OcclusionVisible;
+    }
 
-    MaterialProperties walls = {vec4(0.0f, 0.0f, 0.0f, 1.0f), //ambient
-                                       vec4(0.7f, 0.75f, 0.9f, 1.0f), //diffuse
-                                       vec4(1.0f, 1.0f, 1.0f, 1.0f), //specular
-                                       20.0f, //shininess
-                                       {0.0f, 0.0f, 0.0f}  //pad
-    };
+    // Use last frame's result if it has already arrived, otherwise leave it to the GPU
+    GLuint available = 0;
+    glGetQueryObjectuiv(slot.queries[prev], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available) {
+        GLuint passed = 0;
+        glGetQueryObjectuiv(slot.queries[prev], GL_QUERY_RESULT, &passed);
+        return passed ? OcclusionVisible : OcclusionCulled;
+    }
+    query = slot.queries[prev];
+    return OcclusionPending;
+}
 
-    MaterialProperties cup = {vec4(0.5f, 0.5f, 0.5f, 0.3f), //ambient
-                                vec4(0.8f, 0.8f, 0.8f, 0.3f), //diffuse
-                                vec4(1.0f, 1.0f, 1.0f, 0.3f), //specular
-                                20.0f, //shininess
-                                {0.0f, 0.0f, 0.0f}  //pad
-    };
+void build_occlusion( ) {
+    // Conservative queries need GL 4.3 (or ES3 compatibility), exact ones work everywhere
+    if (glewIsSupported("GL_VERSION_4_3") || glewIsSupported("GL_ARB_ES3_compatibility")) {
+        occlusion_target = GL_ANY_SAMPLES_PASSED_CONSERVATIVE;
+    }
 
-    MaterialProperties whiteMaterial = {vec4(0.4f, 0.4f, 0.4f, 1.0f), //ambient
-                              vec4(1.0f, 1.0f, 1.0f, 1.0f), //diffuse
-                              vec4(1.0f, 1.0f, 1.0f, 1.0f), //specular
-                              30.0f, //shininess
-                              {0.0f, 0.0f, 0.0f}  //pad
+    // Unit box [-1,1]^3 as triangles
+    vector<vec4> vertices;
+    GLfloat faces[6][4][3] = {
+            {{1, -1, -1}, {1, 1, -1}, {1, 1, 1}, {1, -1, 1}},
+            {{-1, -1, 1}, {-1, 1, 1}, {-1, 1, -1}, {-1, -1, -1}},
+            {{-1, 1, -1}, {-1, 1, 1}, {1, 1, 1}, {1, 1, -1}},
+            {{-1, -1, 1}, {-1, -1, -1}, {1, -1, -1}, {1, -1, 1}},
+            {{-1, -1, 1}, {1, -1, 1}, {1, 1, 1}, {-1, 1, 1}},
+            {{1, -1, -1}, {-1, -1, -1}, {-1, 1, -1}, {1, 1, -1}},
     };
+    GLint quad[6] = {0, 1, 2, 2, 3, 0};
+    for (int f = 0; f < 6; f++) {
+        for (int k = 0; k < 6; k++) {
+            GLfloat *c = faces[f][quad[k]];
+            vertices.push_back(vec4(c[0], c[1], c[2], 1.0f));
+        }
+    }
 
-    MaterialProperties soda = {
-            vec4(0.1f, 0.0f, 0.0f, 1.0f), //ambient
-            vec4(0.45f, 0.3, 0.1f, 1.0f), //diffuse
-            vec4(0.8f, 0.6f, 0.6f, 1.0f), //specular
-            32.0f, //shininess
-            {0.0f, 0.0f, 0.0f}  //pad
-    };
-    MaterialProperties tv = {
-            vec4(0.0f, 0.0f, 0.0f, 1.0f), //ambient
-            vec4(0.2f, 0.2f, 0.2f, 1.0f), //diffuse
-            vec4(0.8f, 0.6f, 0.6f, 1.0f), //specular
-            32.0f, //shininess
-            {0.0f, 0.0f, 0.0f}  //pad
-    };
+    glGenVertexArrays(1, &occlusionVAO);
+    glGenBuffers(1, &occlusionVBO);
+    gl_bind_vertex_array(occlusionVAO);
+    gl_bind_buffer(GL_ARRAY_BUFFER, occlusionVBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*posCoords*vertices.size(), vertices.data(), GL_STATIC_DRAW);
+    register_buffer(occlusionVBO, ResOtherBuffers, "occlusion box", sizeof(GLfloat)*posCoords*vertices.size());
+    gl_vertex_attrib(occlusion_vPos, occlusionVBO, posCoords);
+    gl_bind_vertex_array(0);
+}
 
-    MaterialProperties dresserMaterial = {
-            vec4(0.0f, 0.0f, 0.0f, 1.0f), //ambient
-            vec4(0.75f, 0.5f, 0.4f, 1.0f), //diffuse
-            vec4(0.8f, 0.6f, 0.6f, 1.0f), //specular
-            32.0f, //shininess
-            {0.0f, 0.0f, 0.0f}  //pad
-    };
+void begin_occlusion_pass( ) {
+    occlusion_pass = mirror ? MirrorPass : MainPass;
+    occlusion_next = 0;
+}
 
-    Materials.push_back(walls);
-    Materials.push_back(cup);
-    Materials.push_back(whiteMaterial);
-    Materials.push_back(soda);
-    Materials.push_back(tv);
-    Materials.push_back(dresserMaterial);
+void end_occlusion_pass( ) {
+    if (!occlusion) {
+        return;
+    }
+    vector<OcclusionSlot> &slots = occlusionSlots[occlusion_pass];
+    GLint cur = occlusion_parity[occlusion_pass];
+
+    // Boxes only test depth (equal passes, so flat objects still see their own surface)
+    gl_use_program(occlusion_program);
+    gl_bind_vertex_array(occlusionVAO);
+    gl_color_mask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    gl_depth_mask(GL_FALSE);
+    glDepthFunc(GL_LEQUAL);
+    gl_disable(GL_CULL_FACE);
+
+    mat4 view_proj = proj_matrix*camera_matrix;
+    for (int i = 0; i < occlusion_next; i++) {
+        OcclusionSlot &slot = slots[i];
+        const MeshBounds &b = objBounds[slot.obj];
+
+        // Object bounds padded slightly so the box is never coplanar with the object
+        vec3 half = (b.max - b.min)*0.5f;
+        GLfloat pad = 0.02f*fmax(half[0], fmax(half[1], half[2])) + 1.0e-4f;
+        mat4 mvp = view_proj*slot.model*translate(b.center)*scale(half[0] + pad, half[1] + pad, half[2] + pad);
+
+        // Box crossing the near plane (camera inside it) can't be tested, keep the object visible
+        GLboolean crosses_near = false;
+        for (int c = 0; c < 8; c++) {
+            vec4 corner = mvp*vec4((c & 1) ? 1.0f : -1.0f, (c & 2) ? 1.0f : -1.0f, (c & 4) ? 1.0f : -1.0f, 1.0f);
+            if (corner[2] < -corner[3]) {
+                crosses_near = true;
+                break;
+            }
+        }
+        if (crosses_near) {
+            slot.issued[cur] = false;
+            continue;
+        }
 
+        gl_uniform_matrix4fv(occlusion_mvp_loc, 1, mvp);
+        glBeginQuery(occlusion_target, slot.queries[cur]);
+        glDrawArrays(GL_TRIANGLES, 0, 36);
+        glEndQuery(occlusion_target);
+        slot.issued[cur] = true;
+        frame_stats.occlusion_queries++;
+    }
 
-    glGenBuffers(NumMaterialBuffers, MaterialBuffers);
-    glBindBuffer(GL_UNIFORM_BUFFER, MaterialBuffers[MaterialBuffer]);
-    glBufferData(GL_UNIFORM_BUFFER, Materials.size()*sizeof(MaterialProperties), Materials.data(), GL_STATIC_DRAW);
-}
+    // Instances not drawn this pass have no result for next frame
+    for (int i = occlusion_next; i < slots.size(); i++) {
+        slots[i].issued[cur] = false;
+    }
 
-void build_lights( ) {
-    // Add lights to Lights vector
-    LightProperties whitePointLight = {
-            POINT, //type
-            {0.0f, 0.0f, 0.0f}, //pad
-            vec4(0.3f, 0.35f, 0.55f, 1.0f), //ambient
-            vec4(1.0f, 1.0f, 1.0f, 1.0f), //diffuse
-            vec4(0.4f, 0.3f, 0.0f, 1.0f), //specular
-            vec4(0.0f, -1.0f, 0.0f, 1.0f),  //position
-            vec4(0.0f, 0.0f, 0.0f, 0.0f), //direction
-            0.0f,   //cutoff
-            0.0f,  //exponent
-            {0.0f, 0.0f}  //pad2
-    };
+    gl_enable(GL_CULL_FACE);
+    glDepthFunc(GL_LESS);
+    gl_depth_mask(GL_TRUE);
+    gl_color_mask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    gl_bind_vertex_array(0);
+    occlusion_parity[occlusion_pass] = 1 - cur;
+}
 
-    LightProperties spotLight = {
-            SPOT, //type
-            {0.0f, 0.0f, 0.0f}, //pad
-            vec4(0.0f, 0.0f, 0.0f, 1.0f), //ambient
-            vec4(0.2f, 0.2f, 0.2f, 1.0f), //diffuse
-            vec4(0.2f, 0.2f, 0.2f, 1.0f), //specular
-            vec4(0.0f, 7.0f, 0.0f, 1.0f),  //position
-            vec4(0.0f, -1.0f, 0.0f, 0.0f), //direction
-            3.0f,   //cutoff
-            2.0f,  //exponent
-            {0.0f, 0.0f}  //pad2
-    };
+void invalidate_occlusion(GLint pass) {
+    // Pass was skipped, its last results are too old to use
+    for (int i = 0; i < occlusionSlots[pass].size(); i++) {
+        occlusionSlots[pass][i].issued[0] = occlusionSlots[pass][i].issued[1] = false;
+    }
+}
 
+void start_stress_step( ) {
+    // Generate this step's scene (seeded by step so runs repeat) and point the renderer at it
+    GLuint count = stress_counts[stress_step];
+    SceneData data;
+    generate_stress_scene(base_scene, count, 1 + stress_step, data);
+    reference_scene_textures(false);
+    build_scene_image(data, stress_image);
+    if (!open_scene(stress_image.data(), stress_image.size(), scene)) {
+        fprintf(stderr, "ERROR: generated stress scene is invalid\n");
+        scene = base_scene;
+    }
+    reference_scene_textures(true);
+    register_host("stress scene image", stress_image.size());
+    find_mirror_instance();
+    build_scene_bvh();
+    // Lightmaps were baked for the loaded scene's instances
+    instanceLightmap.assign(scene.header->num_instances, -1);
+    update_materials();
+    update_lights();
+
+    // Previous step's occlusion results belong to other objects
+    invalidate_occlusion(MirrorPass);
+    invalidate_occlusion(MainPass);
+
+    memset(&stress_sum, 0, sizeof(stress_sum));
+    stress_gpu_samples = 0;
+    stress_frame = 0;
+    printf("stress: %u objects, %u lights\n", scene.header->num_instances, scene.header->num_lights);
+}
 
+void record_stress_frame(GLFWwindow *window, GLdouble cpu_ms) {
+    // First frames of a step only warm up (buffers, occlusion results, GPU timers in flight)
+    stress_frame++;
+    if (stress_frame <= stress_warmup) {
+        return;
+    }
+    stress_sum.cpu_ms += cpu_ms;
+    stress_sum.draws += frame_stats.draws;
+    stress_sum.state_changes += frame_stats.state_changes;
+    stress_sum.culled += frame_stats.occlusion_culled;
+    if (stress_frame < stress_warmup + stress_frames) {
+        return;
+    }
 
-    Lights.push_back(whitePointLight);
-    Lights.push_back(spotLight);
-    // Set numLights
-    numLights = Lights.size();
+    // Step done, keep its averages and move to the next count
+    StressResult r = stress_sum;
+    r.count = scene.header->num_instances;
+    r.uber = uber;
+    r.cpu_ms /= stress_frames;
+    r.gpu_ms = stress_gpu_samples > 0 ? r.gpu_ms/stress_gpu_samples : 0.0;
+    r.draws /= stress_frames;
+    r.state_changes /= stress_frames;
+    r.culled /= stress_frames;
+    stress_results.push_back(r);
+
+    stress_step++;
+    if (stress_step == stress_counts.size() && uber_bench && !uber) {
+        // Same sweep again with the uber program
+        uber = true;
+        stress_step = 0;
+    }
+    if (stress_step < stress_counts.size()) {
+        start_stress_step();
+    } else {
+        report_stress();
+        glfwSetWindowShouldClose(window, true);
+    }
+}
 
-    // Turn all lights on
-    for (int i = 0; i < numLights; i++) {
-        lightOn[i] = 1;
+void report_stress( ) {
+    // Per frame averages (mirror pass included) and submit cost per object
+    printf("\n%10s %9s %12s %12s %10s %10s %10s %14s\n", "objects", "programs", "cpu ms", "gpu ms", "draws", "changes",
+           "culled", "cpu us/object");
+    for (int i = 0; i < stress_results.size(); i++) {
+        const StressResult &r = stress_results[i];
+        printf("%10u %9s %12.3f %12.3f %10.0f %10.0f %10.0f %14.3f\n", r.count, r.uber ? "uber" : "separate", r.cpu_ms,
+               r.gpu_ms, r.draws, r.state_changes, r.culled, r.count > 0 ? 1000.0*r.cpu_ms/r.count : 0.0);
     }
 
-    // Create uniform buffer for lights
-    glGenBuffers(NumLightBuffers, LightBuffers);
-    glBindBuffer(GL_UNIFORM_BUFFER, LightBuffers[LightBuffer]);
-    glBufferData(GL_UNIFORM_BUFFER, Lights.size()*sizeof(LightProperties), Lights.data(), GL_STATIC_DRAW);
+    // Uber program against the separate programs at each count
+    if (uber_bench) {
+        GLuint steps = stress_counts.size();
+        printf("\n%10s %12s %12s %12s\n", "objects", "cpu speedup", "gpu speedup", "draw ratio");
+        for (GLuint i = 0; i + steps < stress_results.size(); i++) {
+            const StressResult &a = stress_results[i];
+            const StressResult &b = stress_results[i + steps];
+            printf("%10u %11.2fx %11.2fx %12.3f\n", a.count, b.cpu_ms > 0.0 ? a.cpu_ms/b.cpu_ms : 0.0,
+                   b.gpu_ms > 0.0 ? a.gpu_ms/b.gpu_ms : 0.0, a.draws > 0.0 ? b.draws/a.draws : 0.0);
+        }
+    }
 }
-void load_bump_object(GLuint obj) {
-    vector<vec4> vertices;
-    vector<vec2> uvCoords;
-    vector<vec3> normals;
-    vector<vec3> tangents;
-    vector<vec3> bitangents;
-
-    // Load model and set number of vertices
-    loadOBJ(objFiles[obj], vertices, uvCoords, normals);
-    numVertices[obj] = vertices.size();
 
-    // TODO: Compute tangents and bitangents
-    computeTangentBasis(vertices, uvCoords, normals, tangents, bitangents);
+void report_memory( ) {
+    // Occlusion slots grow with the number of instances drawn
+    size_t slot_bytes = 0;
+    for (int pass = 0; pass < NumOcclusionPasses; pass++) {
+        slot_bytes += occlusionSlots[pass].capacity()*sizeof(OcclusionSlot);
+    }
+    register_host("occlusion slots", slot_bytes);
+    report_resources(stdout);
+    render_graph.report(stdout);
+
+    // Scene textures against the budget (requested = the levels draws sample)
+    const GLdouble mb = 1024.0*1024.0;
+    char budget[32] = "none (wanted levels)";
+    if (texture_budget.budget > 0) {
+        snprintf(budget, sizeof(budget), "%.1f MB", texture_budget.budget/mb);
+    }
+    printf("texture budget %s: resident %.1f MB, requested %.1f MB, full chains %.1f MB\n",
+           budget, texture_budget.resident_bytes()/mb, texture_budget.requested_bytes()/mb,
+           texture_budget.full_bytes()/mb);
+
+    // Lazy textures by state
+    printf("texture assets: %u resident (%.1f MB at full size), %u loading, %u not loaded, %u failed\n",
+           (GLuint)asset_manager.count(AssetResident), asset_manager.resident_bytes()/mb,
+           (GLuint)(asset_manager.count(AssetLoading) + asset_manager.count(AssetDecoded)),
+           (GLuint)asset_manager.count(AssetUnloaded), (GLuint)asset_manager.count(AssetFailed));
+}
 
-    // Create and load object buffers
-    glGenBuffers(NumObjBuffers, ObjBuffers[obj]);
-    glBindVertexArray(VAOs[obj]);
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[obj][PosBuffer]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*posCoords*numVertices[obj], vertices.data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[obj][NormBuffer]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*normCoords*numVertices[obj], normals.data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[obj][TexBuffer]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*texCoords*numVertices[obj], uvCoords.data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[obj][TangBuffer]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*tangCoords*numVertices[obj], tangents.data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[obj][BiTangBuffer]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*bitangCoords*numVertices[obj], bitangents.data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-}
-
-void build_painting() {
+void build_painting(GLuint obj) {
     // Painting geometry
     vector<vec4> vertices;
     vector<vec2> uvCoords;
     vector<vec3> normals;
 
-    vertices = {
-            vec4(1.0f, 0.0f, 1.0f, 1.0f),
-            vec4(1.0f, 0.0f, -1.0f, 1.0f),
-            vec4(-1.0f, 0.0f, -1.0f, 1.0f),
-            vec4(-1.0f, 0.0f, -1.0f, 1.0f),
-            vec4(-1.0f, 0.0f, 1.0f, 1.0f),
-            vec4(1.0f, 0.0f, 1.0f, 1.0f),
-    };
+    make_quad(vertices, uvCoords, normals);
 
-    normals = {
-            vec3(1.0f, 0.0f, 0.0f),
-            vec3(1.0f, 0.0f, 0.0f),
-            vec3(1.0f, 0.0f, 0.0f),
-            vec3(1.0f, 0.0f, 0.0f),
-            vec3(1.0f, 0.0f, 0.0f),
-            vec3(1.0f, 0.0f, 0.0f),
-    };
-
-    uvCoords = {
-            {1.0f, 1.0f},
-            {0.0f, 1.0f},
-            {0.0f, 0.0f},
-            {0.0f, 0.0f},
-            {1.0f, 0.0f},
-            {1.0f, 1.0f},
-    };
-
-    // Set number of vertices
-    numVertices[Painting] = vertices.size();
+    // Set number of vertices (single level)
+    numVertices[obj] = vertices.size();
+    append_lods(obj, vertices, uvCoords, normals, NULL);
 
     // Create and load object buffers
-    glGenBuffers(NumObjBuffers, ObjBuffers[Painting]);
-    glBindVertexArray(VAOs[Painting]);
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[Painting][PosBuffer]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * posCoords * numVertices[Painting], vertices.data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[Painting][NormBuffer]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * normCoords * numVertices[Painting], normals.data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[Painting][TexBuffer]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * texCoords * numVertices[Painting], uvCoords.data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glGenBuffers(NumObjBuffers, ObjBuffers[obj].data());
+    gl_bind_vertex_array(VAOs[obj]);
+    gl_bind_buffer(GL_ARRAY_BUFFER, ObjBuffers[obj][PosBuffer]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * posCoords * numVertices[obj], vertices.data(), GL_STATIC_DRAW);
+    gl_bind_buffer(GL_ARRAY_BUFFER, ObjBuffers[obj][NormBuffer]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * normCoords * numVertices[obj], normals.data(), GL_STATIC_DRAW);
+    gl_bind_buffer(GL_ARRAY_BUFFER, ObjBuffers[obj][TexBuffer]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * texCoords * numVertices[obj], uvCoords.data(), GL_STATIC_DRAW);
+    gl_bind_buffer(GL_ARRAY_BUFFER, 0);
+    register_mesh_buffers(obj, numVertices[obj], false);
 }
 
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods) {
     // ESC to quit
     if (key == GLFW_KEY_ESCAPE) {
         glfwSetWindowShouldClose(window, true);
+        return;
+    }
+
+    // Live input is ignored while replaying a session
+    if (replay_file) {
+        return;
+    }
+
+    // Log event against the simulation step it is applied in
+    if (record_file) {
+        InputEvent e = {frame_number, key, action};
+        input_log.events.push_back(e);
+    }
+
+    // Time input that changes what is drawn (this event, not one earlier in the frame)
+    GLboolean was_dirty = scene_dirty;
+    scene_dirty = false;
+    apply_key(key, action);
+    if (measure_latency && scene_dirty) {
+        pending_inputs.push_back(glfwGetTime());
+    }
+    scene_dirty = scene_dirty || was_dirty;
+}
+
+void apply_key(int key, int action) {
+    // Camera movement and toggles change the scene
+    if (key == GLFW_KEY_A || key == GLFW_KEY_D || key == GLFW_KEY_Z || key == GLFW_KEY_X ||
+        key == GLFW_KEY_W || key == GLFW_KEY_S) {
+        scene_dirty = true;
     }
 
     // Adjust azimuth
@@ -1045,13 +3079,13 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
         if (azimuth > 360.0) {
             azimuth -= 360.0;
         }
-        eye[1] = -2.5f;
+        eye[1] = camera_eye_height;
         center[0] = eye[0] + cos(azimuth*DEG2RAD);
         center[1] = eye[1] + cos(elevation * DEG2RAD);
         center[2] = eye[2] + sin(azimuth*DEG2RAD);
     } else if (key == GLFW_KEY_D) {
         azimuth += daz;
-        eye[1] = -2.5f;
+        eye[1] = camera_eye_height;
         center[0] = eye[0] + cos(azimuth*DEG2RAD);
         center[1] = eye[1] + cos(elevation * DEG2RAD);
         center[2] = eye[2] + sin(azimuth*DEG2RAD);
@@ -1082,9 +3116,9 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
     {
         vec3 dir = center - eye;
         vec3 eyeTest = eye + (dir * 0.04f);
-        if(eyeTest[0]  <= 2.90 && eyeTest[0]>= -2.90 && eyeTest[2] <= 2.90 && eyeTest[2]>= -2.90){
+        if(!camera_blocked(eye, eyeTest)){
             eye = eye + (dir * 0.04f);
-            eye[1] = -2.5f;
+            eye[1] = camera_eye_height;
             center[0] = eye[0] + cos(azimuth*DEG2RAD);
             center[1] = eye[1] + cos(elevation * DEG2RAD);
             center[2] = eye[2] + sin(azimuth*DEG2RAD);
@@ -1095,25 +3129,49 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
     {
         vec3 dir = center - eye;
         vec3 eyeTest = eye - (dir * 0.04f);
-        if(eyeTest[0]  <= 2.90 && eyeTest[0]>= -2.90 && eyeTest[2] <= 2.90 && eyeTest[2]>= -2.90) {
+        if(!camera_blocked(eye, eyeTest)) {
             eye = eye - (dir * 0.04f);
-            eye[1] = -2.5f;
+            eye[1] = camera_eye_height;
             center[0] = eye[0] + cos(azimuth * DEG2RAD);
             center[1] = eye[1] + cos(elevation * DEG2RAD);
             center[2] = eye[2] + sin(azimuth * DEG2RAD);
         }
     }
 
-    if(key == GLFW_KEY_L && action == GLFW_PRESS){
+    if(key == GLFW_KEY_L && action == GLFW_PRESS && numLights > 1){
         lightOn[1] = !lightOn[1];
+        scene_dirty = true;
     }
 
     if(key == GLFW_KEY_F && action == GLFW_PRESS){
         fan = !fan;
+        scene_dirty = true;
     }
 
     if(key == GLFW_KEY_O && action == GLFW_PRESS){
         blinds = !blinds;
+        scene_dirty = true;
+    }
+
+    if(key == GLFW_KEY_M && action == GLFW_PRESS){
+        report_memory();
+    }
+
+    if(key == GLFW_KEY_H && action == GLFW_PRESS){
+        hud = !hud;
+        scene_dirty = true;
+    }
+
+    if(key == GLFW_KEY_U && action == GLFW_PRESS){
+        uber = !uber;
+        printf("%s\n", uber ? "uber program" : "separate programs");
+        scene_dirty = true;
+    }
+
+    if(key == GLFW_KEY_V && action == GLFW_PRESS){
+        present_mode = (present_mode + 1) % NumPresentModes;
+        apply_present_mode();
+        frame_limiter.next = 0.0;
     }
 
     if(key == GLFW_KEY_C && action == GLFW_PRESS){
@@ -1121,6 +3179,7 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
         if(channel == 4){
             channel = 0;
         }
+        scene_dirty = true;
     }
 
     // Compute updated camera position
@@ -1134,8 +3193,43 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
 
 }
 
-void mouse_callback(GLFWwindow *window, int button, int action, int mods){
+void window_refresh_callback(GLFWwindow *window) {
+    // Window contents were damaged (e.g. uncovered), re-present last frame
+    scene_damaged = true;
+}
 
+void mouse_callback(GLFWwindow *window, int button, int action, int mods){
+    // Left click picks the object under the cursor
+    if (button != GLFW_MOUSE_BUTTON_LEFT || action != GLFW_PRESS) {
+        return;
+    }
+    GLdouble mx, my;
+    GLint width, height;
+    glfwGetCursorPos(window, &mx, &my);
+    glfwGetWindowSize(window, &width, &height);
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+    vec3 origin, dir;
+    pick_ray(2.0*mx/width - 1.0, 1.0 - 2.0*my/height, origin, dir);
+    InstanceHit hit;
+    if (scene_bvh.intersect(origin, dir, 0.0f, 1.0f, hit)) {
+        selected_instance = hit.instance;
+        selected_distance = hit.t*length(dir);
+    } else {
+        selected_instance = -1;
+    }
+    if (print_stats) {
+        if (selected_instance >= 0) {
+            const SceneInstance &inst = scene.instances[selected_instance];
+            printf("picked instance %d (%s) at distance %.2f\n", selected_instance,
+                   scene.string(scene.meshes[inst.mesh].path), selected_distance);
+        } else {
+            printf("picked nothing\n");
+        }
+    }
+    // Re-present so the HUD shows the selection
+    scene_damaged = true;
 }
 
 
@@ -1144,15 +3238,12 @@ unsigned int quadVBO;
 
 void renderQuad(GLuint shader, GLuint tex)
 {
-    // reset viewport
-    glViewport(0, 0, ww, hh);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    // Viewport and clear come from the render graph pass
 
     // render Depth map to quad for visual debugging
     // ---------------------------------------------
-    glUseProgram(shader);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, TextureIDs[tex]);
+    gl_use_program(shader);
+    gl_bind_texture(0, GL_TEXTURE_2D, TextureIDs[tex]);
     if (quadVAO == 0)
     {
         float quadVertices[] = {
@@ -1165,17 +3256,15 @@ void renderQuad(GLuint shader, GLuint tex)
         // setup plane VAO
         glGenVertexArrays(1, &quadVAO);
         glGenBuffers(1, &quadVBO);
-        glBindVertexArray(quadVAO);
-        glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+        gl_bind_vertex_array(quadVAO);
+        gl_bind_buffer(GL_ARRAY_BUFFER, quadVBO);
         glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+        gl_vertex_attrib(0, quadVBO, 3, 5 * sizeof(float), 0);
+        gl_vertex_attrib(1, quadVBO, 2, 5 * sizeof(float), 3 * sizeof(float));
     }
-    glBindVertexArray(quadVAO);
+    gl_bind_vertex_array(quadVAO);
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-    glBindVertexArray(0);
+    gl_bind_vertex_array(0);
 }
 
 #include "utilfuncs.cpp"
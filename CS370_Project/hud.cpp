@@ -0,0 +1,169 @@
+// Performance overlay geometry and built in bitmap font
+
+#include <ctype.h>
+#include "hud.h"
+
+using namespace std;
+
+// Glyph rows for ' '..'_', top row first, bit 4 = leftmost column
+static const unsigned char hud_font[64][HUD_GLYPH_H] = {
+        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},  // space
+        {0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04},  // !
+        {0x0a, 0x0a, 0x00, 0x00, 0x00, 0x00, 0x00},  // "
+        {0x0a, 0x0a, 0x1f, 0x0a, 0x1f, 0x0a, 0x0a},  // #
+        {0x04, 0x0f, 0x14, 0x0e, 0x05, 0x1e, 0x04},  // $
+        {0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03},  // %
+        {0x0c, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0d},  // &
+        {0x04, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00},  // '
+        {0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02},  // (
+        {0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08},  // )
+        {0x00, 0x04, 0x15, 0x0e, 0x15, 0x04, 0x00},  // *
+        {0x00, 0x04, 0x04, 0x1f, 0x04, 0x04, 0x00},  // +
+        {0x00, 0x00, 0x00, 0x00, 0x0c, 0x04, 0x08},  // ,
+        {0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00},  // -
+        {0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c},  // .
+        {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00},  // /
+        {0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e},  // 0
+        {0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e},  // 1
+        {0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f},  // 2
+        {0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e},  // 3
+        {0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02},  // 4
+        {0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e},  // 5
+        {0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e},  // 6
+        {0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08},  // 7
+        {0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e},  // 8
+        {0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c},  // 9
+        {0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00},  // :
+        {0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x04, 0x08},  // ;
+        {0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02},  // <
+        {0x00, 0x00, 0x1f, 0x00, 0x1f, 0x00, 0x00},  // =
+        {0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08},  // >
+        {0x0e, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04},  // ?
+        {0x0e, 0x11, 0x01, 0x0d, 0x15, 0x15, 0x0e},  // @
+        {0x0e, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11},  // A
+        {0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e},  // B
+        {0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e},  // C
+        {0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c},  // D
+        {0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f},  // E
+        {0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10},  // F
+        {0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f},  // G
+        {0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11},  // H
+        {0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e},  // I
+        {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c},  // J
+        {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11},  // K
+        {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f},  // L
+        {0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11},  // M
+        {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11},  // N
+        {0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e},  // O
+        {0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10},  // P
+        {0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d},  // Q
+        {0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11},  // R
+        {0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e},  // S
+        {0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04},  // T
+        {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e},  // U
+        {0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04},  // V
+        {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a},  // W
+        {0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11},  // X
+        {0x11, 0x11, 0x0a, 0x04, 0x04, 0x04, 0x04},  // Y
+        {0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f},  // Z
+        {0x0e, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0e},  // [
+        {0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00},  // backslash
+        {0x0e, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0e},  // ]
+        {0x04, 0x0a, 0x11, 0x00, 0x00, 0x00, 0x00},  // ^
+        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1f},  // _
+};
+
+void HudHistory::clear() {
+    next = 0;
+    count = 0;
+    for (int i = 0; i < HUD_HISTORY; i++) {
+        values[i] = 0.0f;
+    }
+}
+
+void HudHistory::push(float value) {
+    values[next] = value;
+    next = (next + 1) % HUD_HISTORY;
+    if (count < HUD_HISTORY) {
+        count++;
+    }
+}
+
+float HudHistory::at(int i) const {
+    return values[(next - count + i + HUD_HISTORY) % HUD_HISTORY];
+}
+
+float HudHistory::average() const {
+    if (count == 0) {
+        return 0.0f;
+    }
+    float sum = 0.0f;
+    for (int i = 0; i < count; i++) {
+        sum += at(i);
+    }
+    return sum/count;
+}
+
+static void quad(vector<HudVertex> &vertices, float x0, float y0, float x1, float y1,
+                 float u0, float v0, float u1, float v1, const float color[4]) {
+    HudVertex corners[4] = {
+            {x0, y0, u0, v0, color[0], color[1], color[2], color[3]},
+            {x0, y1, u0, v1, color[0], color[1], color[2], color[3]},
+            {x1, y1, u1, v1, color[0], color[1], color[2], color[3]},
+            {x1, y0, u1, v0, color[0], color[1], color[2], color[3]},
+    };
+    int order[6] = {0, 1, 2, 2, 3, 0};
+    for (int k = 0; k < 6; k++) {
+        vertices.push_back(corners[order[k]]);
+    }
+}
+
+void HudBatch::rect(float x, float y, float w, float h, const float color[4]) {
+    quad(vertices, x, y, x + w, y + h, -1.0f, -1.0f, -1.0f, -1.0f, color);
+}
+
+float HudBatch::text(float x, float y, float scale, const char *s, const float color[4]) {
+    for (; *s; s++) {
+        int c = toupper((unsigned char)*s);
+        if (c > ' ' && c <= '_') {
+            // Glyph cell in the atlas
+            int cell = c - ' ';
+            float u0 = (float)((cell % 16)*HUD_CELL_W)/HUD_ATLAS_W;
+            float v0 = (float)((cell/16)*HUD_CELL_H)/HUD_ATLAS_H;
+            float u1 = u0 + (float)HUD_GLYPH_W/HUD_ATLAS_W;
+            float v1 = v0 + (float)HUD_GLYPH_H/HUD_ATLAS_H;
+            quad(vertices, x, y, x + HUD_GLYPH_W*scale, y + HUD_GLYPH_H*scale, u0, v0, u1, v1, color);
+        }
+        x += HUD_CELL_W*scale;
+    }
+    return x;
+}
+
+void HudBatch::graph(float x, float y, float w, float h, const HudHistory &history, float max_value,
+                     const float color[4]) {
+    // Newest sample at the right edge, values above max_value are clamped
+    float bar = w/HUD_HISTORY;
+    for (int i = 0; i < history.count; i++) {
+        float value = history.at(history.count - 1 - i);
+        float bar_h = (value >= max_value) ? h : h*value/max_value;
+        if (bar_h > 0.0f) {
+            float bx = x + w - (i + 1)*bar;
+            rect(bx, y + h - bar_h, bar, bar_h, color);
+        }
+    }
+}
+
+void hud_font_atlas(vector<unsigned char> &pixels) {
+    pixels.assign(HUD_ATLAS_W*HUD_ATLAS_H, 0);
+    for (int cell = 0; cell < 64; cell++) {
+        int x0 = (cell % 16)*HUD_CELL_W;
+        int y0 = (cell/16)*HUD_CELL_H;
+        for (int row = 0; row < HUD_GLYPH_H; row++) {
+            for (int col = 0; col < HUD_GLYPH_W; col++) {
+                if (hud_font[cell][row] & (0x10 >> col)) {
+                    pixels[(y0 + row)*HUD_ATLAS_W + x0 + col] = 255;
+                }
+            }
+        }
+    }
+}
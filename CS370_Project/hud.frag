@@ -0,0 +1,15 @@
+#version 400 core
+// Font coverage atlas (red channel)
+uniform sampler2D fontMap;
+
+out vec4 fragColor;
+
+in vec2 texCoord;
+in vec4 color;
+
+void main()
+{
+    // Quads without texture coordinates (u < 0) are solid
+    float coverage = (texCoord.x < 0.0f) ? 1.0f : texture(fontMap, texCoord).r;
+    fragColor = vec4(color.rgb, color.a*coverage);
+}
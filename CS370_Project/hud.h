@@ -0,0 +1,53 @@
+#ifndef HUD_H
+#define HUD_H
+
+#include <vector>
+
+// Built in 5x7 font for ' '..'_' (lower case is drawn as upper case), packed in a 16x4 atlas of
+// HUD_CELL_W x HUD_CELL_H cells (one texel gap between glyphs)
+#define HUD_GLYPH_W 5
+#define HUD_GLYPH_H 7
+#define HUD_CELL_W 6
+#define HUD_CELL_H 8
+#define HUD_ATLAS_W (16*HUD_CELL_W)
+#define HUD_ATLAS_H (4*HUD_CELL_H)
+
+// Samples kept for the frame time graphs
+#define HUD_HISTORY 120
+
+// Overlay vertex: pixel position (origin top left), font atlas uv (u < 0 = solid color) and color
+struct HudVertex {
+    float x, y;
+    float u, v;
+    float r, g, b, a;
+};
+
+// Rolling history of one frame time series
+struct HudHistory {
+    float values[HUD_HISTORY];
+    int next;
+    int count;
+
+    HudHistory() { clear(); }
+    void clear();
+    void push(float value);
+    float at(int i) const;      // 0 = oldest
+    float average() const;
+};
+
+// Overlay geometry for one frame (quads as triangle pairs)
+struct HudBatch {
+    std::vector<HudVertex> vertices;
+
+    void clear() { vertices.clear(); }
+    void rect(float x, float y, float w, float h, const float color[4]);
+    // Returns the x position after the last character
+    float text(float x, float y, float scale, const char *s, const float color[4]);
+    // One bar per sample, max_value fills the full height
+    void graph(float x, float y, float w, float h, const HudHistory &history, float max_value, const float color[4]);
+};
+
+// 8 bit coverage image of the font (HUD_ATLAS_W x HUD_ATLAS_H, first row at the top)
+void hud_font_atlas(std::vector<unsigned char> &pixels);
+
+#endif
@@ -0,0 +1,19 @@
+#version 400 core
+// Window size in pixels
+uniform vec2 screenSize;
+
+layout(location = 0) in vec2 vPosition;
+layout(location = 1) in vec2 vTexCoord;
+layout(location = 2) in vec4 vColor;
+
+out vec2 texCoord;
+out vec4 color;
+
+void main( )
+{
+    // Pixel position (origin top left) to clip space
+    vec2 ndc = vec2(2.0f*vPosition.x/screenSize.x - 1.0f, 1.0f - 2.0f*vPosition.y/screenSize.y);
+    gl_Position = vec4(ndc, 0.0f, 1.0f);
+    texCoord = vTexCoord;
+    color = vColor;
+}
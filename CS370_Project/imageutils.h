@@ -0,0 +1,46 @@
+#ifndef IMAGEUTILS_H
+#define IMAGEUTILS_H
+
+// Flip an RGBA image vertically in place (stb_image loads top row first, OpenGL expects bottom row first)
+inline void flip_image_rows(unsigned char *image_data, int w, int h) {
+    int width_in_bytes = w * 4;
+    unsigned char *top = NULL;
+    unsigned char *bottom = NULL;
+    unsigned char temp = 0;
+    int half_height = h / 2;
+
+    for ( int row = 0; row < half_height; row++ ) {
+        top = image_data + row * width_in_bytes;
+        bottom = image_data + ( h - row - 1 ) * width_in_bytes;
+        for ( int col = 0; col < width_in_bytes; col++ ) {
+            temp = *top;
+            *top = *bottom;
+            *bottom = temp;
+            top++;
+            bottom++;
+        }
+    }
+}
+
+// Halve an RGBA image in place with a 2x2 box filter (an odd last row or column is averaged with itself)
+inline void downsample_image_half(unsigned char *image_data, int &w, int &h) {
+    int half_w = (w > 1) ? w / 2 : 1;
+    int half_h = (h > 1) ? h / 2 : 1;
+
+    for ( int row = 0; row < half_h; row++ ) {
+        const unsigned char *top = image_data + ( 2 * row ) * w * 4;
+        const unsigned char *bottom = image_data + ( ( 2 * row + 1 < h ) ? 2 * row + 1 : 2 * row ) * w * 4;
+        for ( int col = 0; col < half_w; col++ ) {
+            int left = 2 * col * 4;
+            int right = ( ( 2 * col + 1 < w ) ? 2 * col + 1 : 2 * col ) * 4;
+            unsigned char *out = image_data + ( row * half_w + col ) * 4;
+            for ( int c = 0; c < 4; c++ ) {
+                out[c] = (unsigned char)( ( top[left + c] + top[right + c] + bottom[left + c] + bottom[right + c] + 2 ) / 4 );
+            }
+        }
+    }
+    w = half_w;
+    h = half_h;
+}
+
+#endif
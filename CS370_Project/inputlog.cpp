@@ -0,0 +1,89 @@
+// Input recording/replay files and frame time summaries
+
+#include <stdio.h>
+#include <string.h>
+#include "inputlog.h"
+#include "framepacing.h"
+
+using namespace std;
+
+bool save_input_log(const char *path, const InputLog &log) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "ERROR: could not write input log %s\n", path);
+        return false;
+    }
+    fprintf(file, "# house input log v1\n");
+    fprintf(file, "dt %.17g\n", log.dt);
+    for (size_t i = 0; i < log.events.size(); i++) {
+        const InputEvent &e = log.events[i];
+        fprintf(file, "key %u %d %d\n", e.frame, e.key, e.action);
+    }
+    fprintf(file, "end %u\n", log.end_frame);
+    fclose(file);
+    return true;
+}
+
+bool load_input_log(const char *path, InputLog &log) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "ERROR: could not open input log %s\n", path);
+        return false;
+    }
+    log.dt = 1.0/60.0;
+    log.end_frame = 0;
+    log.events.clear();
+
+    char line[256];
+    int line_number = 0;
+    bool ok = true;
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+        InputEvent e;
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        } else if (sscanf(line, "dt %lf", &log.dt) == 1) {
+            continue;
+        } else if (sscanf(line, "key %u %d %d", &e.frame, &e.key, &e.action) == 3) {
+            if (!log.events.empty() && e.frame < log.events.back().frame) {
+                fprintf(stderr, "ERROR: %s:%d: events out of frame order\n", path, line_number);
+                ok = false;
+                break;
+            }
+            log.events.push_back(e);
+        } else if (sscanf(line, "end %u", &log.end_frame) == 1) {
+            continue;
+        } else {
+            fprintf(stderr, "ERROR: %s:%d: unrecognized line\n", path, line_number);
+            ok = false;
+            break;
+        }
+    }
+    fclose(file);
+
+    // Old or truncated logs run until the last event
+    if (ok && !log.events.empty() && log.end_frame <= log.events.back().frame) {
+        log.end_frame = log.events.back().frame + 1;
+    }
+    return ok;
+}
+
+void report_frame_times(const vector<double> &frame_times, const char *path) {
+    if (frame_times.empty()) {
+        return;
+    }
+
+    if (path) {
+        FILE *file = fopen(path, "w");
+        if (file) {
+            for (size_t i = 0; i < frame_times.size(); i++) {
+                fprintf(file, "%.6f\n", frame_times[i]*1000.0);
+            }
+            fclose(file);
+        } else {
+            fprintf(stderr, "ERROR: could not write frame times %s\n", path);
+        }
+    }
+
+    report_percentiles("Frame times", "frames", frame_times);
+}
@@ -0,0 +1,27 @@
+#ifndef INPUTLOG_H
+#define INPUTLOG_H
+
+#include <vector>
+
+// Key event applied at the start of simulation step frame
+struct InputEvent {
+    unsigned int frame;
+    int key;
+    int action;
+};
+
+// Recorded session: fixed timestep, key events in frame order and number of frames run
+struct InputLog {
+    double dt;
+    unsigned int end_frame;
+    std::vector<InputEvent> events;
+};
+
+// Save/load a session as text (one "key <frame> <key> <action>" line per event)
+bool save_input_log(const char *path, const InputLog &log);
+bool load_input_log(const char *path, InputLog &log);
+
+// Print count, mean and p50/p90/p99/max of frame times (seconds) and optionally write them one per line
+void report_frame_times(const std::vector<double> &frame_times, const char *path = NULL);
+
+#endif
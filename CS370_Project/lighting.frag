@@ -19,12 +19,19 @@ struct MaterialProperties {
      float shininess;
 };
 
-const int MaxLights = 8;
+// Array sizes follow the loaded scene (defined by house before compiling)
+#ifndef MAX_LIGHTS
+#define MAX_LIGHTS 16
+#endif
+const int MaxLights = MAX_LIGHTS;
 layout (std140) uniform LightBuffer {
      LightProperties Lights[MaxLights];
 };
 
-const int MaxMaterials = 8;
+#ifndef MAX_MATERIALS
+#define MAX_MATERIALS 256
+#endif
+const int MaxMaterials = MAX_MATERIALS;
 layout (std140) uniform MaterialBuffer {
      MaterialProperties Materials[MaxMaterials];
 };
@@ -38,9 +45,11 @@ uniform int LightOn[MaxLights];
 
 out vec4 fragColor;
 
-in vec4 Position;
-in vec3 Normal;
-in vec3 View;
+in VertexData {
+     vec4 Position;
+     vec3 Normal;
+     vec3 View;
+};
 
 void main()
 {
@@ -9,9 +9,11 @@ uniform mat4 normal_matrix;
 uniform mat4 model_matrix;
 
 uniform vec3 EyePosition;
-out vec4 Position;
-out vec3 Normal;
-out vec3 View;
+out VertexData {
+    vec4 Position;
+    vec3 Normal;
+    vec3 View;
+};
 
 void main( )
 {
@@ -0,0 +1,631 @@
+// Lightmap baker: planar chart unwrap, shelf packing and a multithreaded path tracer over a BVH
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <thread>
+#include "../common/stb_image.h"
+#include "lightmap.h"
+#include "bvh.h"
+#include "meshtools.h"
+#include "objparser.h"
+
+using namespace vmath;
+using namespace std;
+
+#define LIGHTMAP_MAGIC "HLMP"
+#define LIGHTMAP_VERSION 1
+// Empty texels around each chart (bilinear taps at chart edges stay inside it)
+#define CHART_PADDING 2
+// Ray origin offset from surfaces
+#define RAY_EPSILON 1.0e-3f
+
+// World space triangle of the bake scene
+struct BakeTriangle {
+    vec3 normal;        // face normal on the front side
+    vec3 albedo;        // diffuse reflectance for bounces
+};
+
+// Material of a receiver triangle
+struct ReceiverMaterial {
+    vec3 ambient;
+    vec3 diffuse;
+};
+
+// Surface point a lightmap texel bakes
+struct TexelSample {
+    unsigned int texel;
+    vec3 position;
+    vec3 normal;
+    vec3 ambient;       // receiver material
+    vec3 diffuse;
+};
+
+// Planar group of receiver triangles sharing a lightmap rectangle
+struct Chart {
+    vector<unsigned int> corners;   // receiver corner indices (3 per triangle)
+    vec3 axis_u;
+    vec3 axis_v;
+    float min_u, min_v;
+    int w, h;                       // texels including padding
+    int x, y;                       // position in the atlas
+};
+
+static vec3 xyz(const vec4 &v) {
+    return vec3(v[0], v[1], v[2]);
+}
+
+static vec3 transform_point(const mat4 &m, const vec4 &p) {
+    return xyz(m*vec4(p[0], p[1], p[2], 1.0f));
+}
+
+static mat4 load_matrix(const float *values) {
+    mat4 m;
+    memcpy((void *)&m, values, sizeof(float)*16);
+    return m;
+}
+
+// FNV-1a
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t size) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    for (size_t i = 0; i < size; i++) {
+        h = (h ^ bytes[i])*1099511628211ull;
+    }
+    return h;
+}
+
+uint64_t lightmap_key(const Scene &scene, const LightmapSettings &settings) {
+    uint64_t h = 14695981039346656037ull;
+    h = hash_bytes(h, scene.header, scene.header->file_size);
+    h = hash_bytes(h, &settings.texels_per_unit, sizeof(settings.texels_per_unit));
+    h = hash_bytes(h, &settings.samples, sizeof(settings.samples));
+    h = hash_bytes(h, &settings.bounces, sizeof(settings.bounces));
+    h = hash_bytes(h, &settings.max_size, sizeof(settings.max_size));
+    return h;
+}
+
+// Per thread random numbers (xorshift32), seeded per texel so results don't depend on the thread count
+struct BakeRandom {
+    uint32_t state;
+
+    explicit BakeRandom(uint32_t seed) : state(seed*2654435761u + 0x9e3779b9u) {
+        if (state == 0) state = 1;
+    }
+    float next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return (state >> 8)*(1.0f/16777216.0f);
+    }
+};
+
+// Cosine weighted direction around n
+static vec3 sample_hemisphere(const vec3 &n, BakeRandom &rng) {
+    float r1 = rng.next();
+    float r2 = rng.next();
+    float r = sqrtf(r1);
+    float phi = 2.0f*(float)M_PI*r2;
+    vec3 t = (fabsf(n[0]) > 0.9f) ? vec3(0.0f, 1.0f, 0.0f) : vec3(1.0f, 0.0f, 0.0f);
+    vec3 u = normalize(cross(t, n));
+    vec3 v = cross(n, u);
+    return normalize(u*(r*cosf(phi)) + v*(r*sinf(phi)) + n*sqrtf(fmaxf(0.0f, 1.0f - r1)));
+}
+
+// Same light model as lighting.frag (diffuse part), with shadow rays
+static vec3 direct_light(const SceneLight &light, const Bvh &bvh, const vec3 &p, const vec3 &n) {
+    vec3 to_light;
+    float dist = FLT_MAX;
+    if (light.type == 1) {
+        to_light = -normalize(vec3(light.direction[0], light.direction[1], light.direction[2]));
+    } else if (light.type == 2 || light.type == 3) {
+        vec3 d = vec3(light.position[0], light.position[1], light.position[2]) - p;
+        dist = length(d);
+        if (dist <= 0.0f) {
+            return vec3(0.0f, 0.0f, 0.0f);
+        }
+        to_light = d/dist;
+    } else {
+        return vec3(0.0f, 0.0f, 0.0f);
+    }
+
+    float diff = dot(n, to_light);
+    if (diff <= 0.0f) {
+        return vec3(0.0f, 0.0f, 0.0f);
+    }
+    if (light.type == 3) {
+        float spot_cos = dot(to_light, -normalize(vec3(light.direction[0], light.direction[1], light.direction[2])));
+        if (spot_cos < cosf(light.spotCutoff*(float)M_PI/180.0f)) {
+            return vec3(0.0f, 0.0f, 0.0f);
+        }
+        diff *= powf(spot_cos, light.spotExponent);
+    }
+    if (bvh.occluded(p + n*RAY_EPSILON, to_light, 0.0f, dist - 2.0f*RAY_EPSILON)) {
+        return vec3(0.0f, 0.0f, 0.0f);
+    }
+    return vec3(light.diffuse[0], light.diffuse[1], light.diffuse[2])*diff;
+}
+
+// Average color of a texture (bounce albedo of textured surfaces)
+static vec3 texture_albedo(const string &path) {
+    int w, h, n;
+    unsigned char *data = stbi_load(path.c_str(), &w, &h, &n, 3);
+    if (!data) {
+        return vec3(0.5f, 0.5f, 0.5f);
+    }
+    double sum[3] = {0.0, 0.0, 0.0};
+    size_t pixels = (size_t)w*h;
+    for (size_t i = 0; i < pixels; i++) {
+        for (int k = 0; k < 3; k++) {
+            sum[k] += data[3*i + k];
+        }
+    }
+    stbi_image_free(data);
+    return vec3((float)(sum[0]/(255.0*pixels)), (float)(sum[1]/(255.0*pixels)), (float)(sum[2]/(255.0*pixels)));
+}
+
+// Union-find root with path halving
+static unsigned int find_root(vector<unsigned int> &parent, unsigned int i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+// Group receiver triangles into planar charts through shared edges
+static void build_charts(const vector<vec3> &corners, vector<Chart> &charts) {
+    unsigned int num_triangles = corners.size()/3;
+    vector<unsigned int> parent(num_triangles);
+    for (unsigned int i = 0; i < num_triangles; i++) {
+        parent[i] = i;
+    }
+
+    // Planes of each triangle
+    vector<vec3> normals(num_triangles);
+    vector<float> offsets(num_triangles);
+    for (unsigned int t = 0; t < num_triangles; t++) {
+        vec3 n = cross(corners[3*t + 1] - corners[3*t], corners[3*t + 2] - corners[3*t]);
+        float len = length(n);
+        normals[t] = (len > 0.0f) ? n/len : vec3(0.0f, 1.0f, 0.0f);
+        offsets[t] = dot(normals[t], corners[3*t]);
+    }
+
+    // Edges keyed by quantized endpoints (either direction)
+    map<vector<long long>, unsigned int> edges;
+    for (unsigned int t = 0; t < num_triangles; t++) {
+        for (int e = 0; e < 3; e++) {
+            const vec3 &a = corners[3*t + e];
+            const vec3 &b = corners[3*t + (e + 1) % 3];
+            long long qa[3], qb[3];
+            for (int k = 0; k < 3; k++) {
+                qa[k] = llroundf(a[k]*1.0e4f);
+                qb[k] = llroundf(b[k]*1.0e4f);
+            }
+            bool swap = lexicographical_compare(qb, qb + 3, qa, qa + 3);
+            vector<long long> key(6);
+            for (int k = 0; k < 3; k++) {
+                key[k] = swap ? qb[k] : qa[k];
+                key[3 + k] = swap ? qa[k] : qb[k];
+            }
+            map<vector<long long>, unsigned int>::iterator it = edges.find(key);
+            if (it == edges.end()) {
+                edges[key] = t;
+                continue;
+            }
+            // Same plane, merge the charts
+            unsigned int other = it->second;
+            if (dot(normals[t], normals[other]) > 0.9999f && fabsf(offsets[t] - offsets[other]) < 1.0e-4f) {
+                parent[find_root(parent, t)] = find_root(parent, other);
+            }
+        }
+    }
+
+    map<unsigned int, unsigned int> chart_of_root;
+    for (unsigned int t = 0; t < num_triangles; t++) {
+        unsigned int root = find_root(parent, t);
+        if (!chart_of_root.count(root)) {
+            chart_of_root[root] = charts.size();
+            Chart chart;
+            chart.min_u = chart.min_v = 0.0f;
+            chart.w = chart.h = chart.x = chart.y = 0;
+            const vec3 &n = normals[t];
+            vec3 up = (fabsf(n[1]) < 0.99f) ? vec3(0.0f, 1.0f, 0.0f) : vec3(1.0f, 0.0f, 0.0f);
+            chart.axis_u = normalize(cross(up, n));
+            chart.axis_v = cross(n, chart.axis_u);
+            charts.push_back(chart);
+        }
+        Chart &chart = charts[chart_of_root[root]];
+        for (int c = 0; c < 3; c++) {
+            chart.corners.push_back(3*t + c);
+        }
+    }
+}
+
+// Size charts at the given density and shelf pack them, false if they don't fit in width x width
+static bool pack_charts(const vector<vec3> &corners, vector<Chart> &charts, float density, int width, int &height) {
+    for (size_t i = 0; i < charts.size(); i++) {
+        Chart &chart = charts[i];
+        float min_u = FLT_MAX, min_v = FLT_MAX, max_u = -FLT_MAX, max_v = -FLT_MAX;
+        for (size_t c = 0; c < chart.corners.size(); c++) {
+            const vec3 &p = corners[chart.corners[c]];
+            float u = dot(p, chart.axis_u)*density;
+            float v = dot(p, chart.axis_v)*density;
+            min_u = fminf(min_u, u);
+            min_v = fminf(min_v, v);
+            max_u = fmaxf(max_u, u);
+            max_v = fmaxf(max_v, v);
+        }
+        chart.min_u = min_u;
+        chart.min_v = min_v;
+        chart.w = max(1, (int)ceilf(max_u - min_u)) + 2*CHART_PADDING;
+        chart.h = max(1, (int)ceilf(max_v - min_v)) + 2*CHART_PADDING;
+    }
+
+    // Tallest first onto shelves
+    vector<unsigned int> order(charts.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) { return charts[a].h > charts[b].h; });
+    int x = 0, y = 0, shelf = 0;
+    for (size_t i = 0; i < order.size(); i++) {
+        Chart &chart = charts[order[i]];
+        if (chart.w > width) {
+            return false;
+        }
+        if (x + chart.w > width) {
+            y += shelf;
+            x = 0;
+            shelf = 0;
+        }
+        chart.x = x;
+        chart.y = y;
+        x += chart.w;
+        shelf = max(shelf, chart.h);
+    }
+    height = y + shelf;
+    return height <= width;
+}
+
+// Average covered neighbours into empty texels (repeated to fill the chart padding)
+static void dilate(vector<float> &texels, vector<unsigned char> &covered, int width, int height, int layers) {
+    for (int pass = 0; pass < CHART_PADDING + 1; pass++) {
+        vector<unsigned char> next = covered;
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                unsigned int texel = y*width + x;
+                if (covered[texel]) {
+                    continue;
+                }
+                int count = 0;
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dx = -1; dx <= 1; dx++) {
+                        int nx = x + dx, ny = y + dy;
+                        if (nx < 0 || ny < 0 || nx >= width || ny >= height || !covered[ny*width + nx]) {
+                            continue;
+                        }
+                        for (int l = 0; l < layers; l++) {
+                            for (int k = 0; k < 3; k++) {
+                                texels[3*((size_t)l*width*height + texel) + k] +=
+                                        texels[3*((size_t)l*width*height + ny*width + nx) + k];
+                            }
+                        }
+                        count++;
+                    }
+                }
+                if (count > 0) {
+                    for (int l = 0; l < layers; l++) {
+                        for (int k = 0; k < 3; k++) {
+                            texels[3*((size_t)l*width*height + texel) + k] /= count;
+                        }
+                    }
+                    next[texel] = 1;
+                }
+            }
+        }
+        covered.swap(next);
+    }
+}
+
+bool bake_lightmaps(const Scene &scene, const string &scene_dir, const LightmapSettings &settings, Lightmaps &maps) {
+    const SceneHeader *h = scene.header;
+    bool any_baked = false;
+    for (uint32_t i = 0; i < h->num_instances; i++) {
+        any_baked = any_baked || (scene.instances[i].flags & SceneBaked);
+    }
+    if (!any_baked) {
+        return false;
+    }
+
+    // Meshes (loaded once) and bounce albedo of textures
+    vector<vector<vec4> > mesh_vertices(h->num_meshes);
+    vector<bool> mesh_loaded(h->num_meshes, false);
+    vector<vec3> texture_albedos(h->num_textures, vec3(0.5f, 0.5f, 0.5f));
+    vector<bool> texture_loaded(h->num_textures, false);
+    const vec3 colors[3] = {vec3(1.0f, 0.0f, 0.0f), vec3(0.0f, 0.0f, 1.0f), vec3(0.0f, 1.0f, 0.0f)};
+
+    // Static occluders (everything not animated, switched by channel or see-through) and receivers
+    vector<vec3> occluder_corners;
+    vector<BakeTriangle> occluder_tris;
+    vector<vec3> receiver_corners;
+    vector<ReceiverMaterial> receiver_materials;    // one per receiver triangle
+    vector<pair<uint32_t, uint32_t> > receiver_ranges;   // instance, first receiver corner
+    for (uint32_t i = 0; i < h->num_instances; i++) {
+        const SceneInstance &inst = scene.instances[i];
+        bool baked = (inst.flags & SceneBaked) != 0;
+        if (!baked && (inst.animation != SceneAnimNone || inst.channel >= 0 || (inst.flags & SceneNoDepthWrite))) {
+            continue;
+        }
+        if (!mesh_loaded[inst.mesh]) {
+            string path = scene.string(scene.meshes[inst.mesh].path);
+            vector<vec2> uvs;
+            vector<vec3> normals;
+            if (path == "@quad") {
+                make_quad(mesh_vertices[inst.mesh], uvs, normals);
+            } else if (path[0] != '@' && !load_obj_fast((scene_dir + path).c_str(), mesh_vertices[inst.mesh], uvs, normals)) {
+                fprintf(stderr, "WARNING: lightmap baker could not load %s\n", path.c_str());
+            }
+            mesh_loaded[inst.mesh] = true;
+        }
+
+        vec3 albedo(0.5f, 0.5f, 0.5f);
+        if (inst.shader == SceneColorShader) {
+            albedo = colors[inst.material % 3];
+        } else if (inst.shader == SceneMatShader) {
+            const SceneMaterial &m = scene.materials[inst.material];
+            albedo = vec3(m.diffuse[0], m.diffuse[1], m.diffuse[2]);
+        } else if (inst.texture >= 0) {
+            if (!texture_loaded[inst.texture]) {
+                string path = scene.string(scene.textures[inst.texture].path);
+                if (path[0] != '@') {
+                    texture_albedos[inst.texture] = texture_albedo(scene_dir + path);
+                }
+                texture_loaded[inst.texture] = true;
+            }
+            albedo = texture_albedos[inst.texture];
+        }
+
+        mat4 model = load_matrix(inst.pre);
+        const vector<vec4> &vertices = mesh_vertices[inst.mesh];
+        if (baked) {
+            receiver_ranges.push_back(make_pair(i, (uint32_t)receiver_corners.size()));
+        }
+        for (size_t c = 0; c + 2 < vertices.size(); c += 3) {
+            vec3 p[3];
+            for (int k = 0; k < 3; k++) {
+                p[k] = transform_point(model, vertices[c + k]);
+            }
+            vec3 n = cross(p[1] - p[0], p[2] - p[0]);
+            float len = length(n);
+            BakeTriangle tri;
+            tri.normal = (len > 0.0f) ? n/len : vec3(0.0f, 1.0f, 0.0f);
+            tri.albedo = albedo;
+            for (int k = 0; k < 3; k++) {
+                occluder_corners.push_back(p[k]);
+            }
+            occluder_tris.push_back(tri);
+            if (baked) {
+                const SceneMaterial &m = scene.materials[inst.material];
+                ReceiverMaterial material;
+                material.ambient = vec3(m.ambient[0], m.ambient[1], m.ambient[2]);
+                material.diffuse = vec3(m.diffuse[0], m.diffuse[1], m.diffuse[2]);
+                for (int k = 0; k < 3; k++) {
+                    receiver_corners.push_back(p[k]);
+                }
+                receiver_materials.push_back(material);
+            }
+        }
+    }
+
+    Bvh bvh;
+    bvh.build(occluder_corners);
+
+    // Unwrap and pack, halving the texel density until the charts fit the size limit
+    vector<Chart> charts;
+    build_charts(receiver_corners, charts);
+    float density = settings.texels_per_unit;
+    int width = 64, height = 0;
+    while (!pack_charts(receiver_corners, charts, density, width, height)) {
+        if (width < settings.max_size) {
+            width *= 2;
+        } else {
+            density *= 0.5f;
+        }
+    }
+    height = max(height, 1);
+    if (density < settings.texels_per_unit) {
+        printf("Lightmap texel density reduced to %.2f per unit to fit %dx%d\n", density, width, width);
+    }
+
+    // Lightmap coordinates of each receiver corner
+    vector<vec2> corner_uvs(receiver_corners.size());
+    for (size_t i = 0; i < charts.size(); i++) {
+        const Chart &chart = charts[i];
+        for (size_t c = 0; c < chart.corners.size(); c++) {
+            const vec3 &p = receiver_corners[chart.corners[c]];
+            float u = chart.x + CHART_PADDING + dot(p, chart.axis_u)*density - chart.min_u;
+            float v = chart.y + CHART_PADDING + dot(p, chart.axis_v)*density - chart.min_v;
+            corner_uvs[chart.corners[c]] = vec2(u/width, v/height);
+        }
+    }
+    maps.instances.clear();
+    for (size_t r = 0; r < receiver_ranges.size(); r++) {
+        uint32_t first = receiver_ranges[r].second;
+        uint32_t end = (r + 1 < receiver_ranges.size()) ? receiver_ranges[r + 1].second : (uint32_t)receiver_corners.size();
+        LightmapInstance li;
+        li.instance = receiver_ranges[r].first;
+        li.uvs.assign(corner_uvs.begin() + first, corner_uvs.begin() + end);
+        maps.instances.push_back(li);
+    }
+
+    // Texels whose centers lie inside a receiver triangle
+    vector<TexelSample> samples;
+    vector<unsigned char> covered(width*height, 0);
+    for (size_t t = 0; t < receiver_corners.size()/3; t++) {
+        vec2 q[3];
+        for (int k = 0; k < 3; k++) {
+            q[k] = vec2(corner_uvs[3*t + k][0]*width, corner_uvs[3*t + k][1]*height);
+        }
+        float area = (q[1][0] - q[0][0])*(q[2][1] - q[0][1]) - (q[2][0] - q[0][0])*(q[1][1] - q[0][1]);
+        if (fabsf(area) < 1.0e-8f) {
+            continue;
+        }
+        int x0 = max(0, (int)floorf(fminf(q[0][0], fminf(q[1][0], q[2][0]))));
+        int y0 = max(0, (int)floorf(fminf(q[0][1], fminf(q[1][1], q[2][1]))));
+        int x1 = min(width - 1, (int)ceilf(fmaxf(q[0][0], fmaxf(q[1][0], q[2][0]))));
+        int y1 = min(height - 1, (int)ceilf(fmaxf(q[0][1], fmaxf(q[1][1], q[2][1]))));
+        const vec3 *p = &receiver_corners[3*t];
+        vec3 n = normalize(cross(p[1] - p[0], p[2] - p[0]));
+        for (int y = y0; y <= y1; y++) {
+            for (int x = x0; x <= x1; x++) {
+                float cx = x + 0.5f, cy = y + 0.5f;
+                float b1 = ((cx - q[0][0])*(q[2][1] - q[0][1]) - (q[2][0] - q[0][0])*(cy - q[0][1]))/area;
+                float b2 = ((q[1][0] - q[0][0])*(cy - q[0][1]) - (cx - q[0][0])*(q[1][1] - q[0][1]))/area;
+                float b0 = 1.0f - b1 - b2;
+                unsigned int texel = y*width + x;
+                if (b0 < -1.0e-4f || b1 < -1.0e-4f || b2 < -1.0e-4f || covered[texel]) {
+                    continue;
+                }
+                TexelSample s;
+                s.texel = texel;
+                s.ambient = receiver_materials[t].ambient;
+                s.diffuse = receiver_materials[t].diffuse;
+                s.position = p[0]*b0 + p[1]*b1 + p[2]*b2;
+                s.normal = n;
+                samples.push_back(s);
+                covered[texel] = 1;
+            }
+        }
+    }
+
+    // Path trace the samples in chunks on all threads (every light per path)
+    int layers = h->num_lights;
+    maps.width = width;
+    maps.height = height;
+    maps.layers = layers;
+    maps.texels.assign((size_t)3*width*height*layers, 0.0f);
+    unsigned int num_threads = settings.num_threads ? settings.num_threads : thread::hardware_concurrency();
+    if (num_threads == 0) num_threads = 1;
+    atomic<size_t> next_sample(0);
+    const size_t chunk = 256;
+    auto worker = [&]() {
+        vector<vec3> indirect(layers);
+        for (size_t start = next_sample.fetch_add(chunk); start < samples.size(); start = next_sample.fetch_add(chunk)) {
+            for (size_t i = start; i < min(start + chunk, samples.size()); i++) {
+                const TexelSample &s = samples[i];
+                BakeRandom rng(s.texel);
+                for (int l = 0; l < layers; l++) {
+                    indirect[l] = vec3(0.0f, 0.0f, 0.0f);
+                }
+                for (int k = 0; k < settings.samples; k++) {
+                    vec3 origin = s.position + s.normal*RAY_EPSILON;
+                    vec3 n = s.normal;
+                    vec3 throughput(1.0f, 1.0f, 1.0f);
+                    for (int b = 0; b < settings.bounces; b++) {
+                        vec3 dir = sample_hemisphere(n, rng);
+                        BvhHit hit;
+                        if (!bvh.intersect(origin, dir, 0.0f, FLT_MAX, hit)) {
+                            break;
+                        }
+                        // Light leaving the hit surface toward us (front side of the surface facing the ray)
+                        const BakeTriangle &tri = occluder_tris[hit.triangle];
+                        vec3 q = origin + dir*hit.t;
+                        n = tri.normal;
+                        if (dot(n, dir) > 0.0f) {
+                            n = -n;
+                        }
+                        throughput *= tri.albedo;
+                        for (int l = 0; l < layers; l++) {
+                            indirect[l] += throughput*direct_light(scene.lights[l], bvh, q, n);
+                        }
+                        origin = q + n*RAY_EPSILON;
+                    }
+                }
+
+                for (int l = 0; l < layers; l++) {
+                    const SceneLight &light = scene.lights[l];
+                    vec3 rgb = s.diffuse*(direct_light(light, bvh, s.position, s.normal) + indirect[l]/(float)settings.samples);
+                    if (light.type != 0) {
+                        rgb += s.ambient*vec3(light.ambient[0], light.ambient[1], light.ambient[2]);
+                    }
+                    float *out = &maps.texels[3*((size_t)l*width*height + s.texel)];
+                    for (int c = 0; c < 3; c++) {
+                        out[c] = rgb[c];
+                    }
+                }
+            }
+        }
+    };
+    vector<thread> workers;
+    for (unsigned int t = 1; t < num_threads; t++) {
+        workers.push_back(thread(worker));
+    }
+    worker();
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+
+    dilate(maps.texels, covered, width, height, layers);
+    maps.key = lightmap_key(scene, settings);
+    return true;
+}
+
+bool save_lightmaps(const char *path, const Lightmaps &maps) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+    uint32_t header[6] = {LIGHTMAP_VERSION, (uint32_t)maps.width, (uint32_t)maps.height, (uint32_t)maps.layers,
+                          (uint32_t)maps.instances.size(), 0};
+    bool ok = fwrite(LIGHTMAP_MAGIC, 1, 4, file) == 4 && fwrite(header, sizeof(header), 1, file) == 1 &&
+              fwrite(&maps.key, sizeof(maps.key), 1, file) == 1;
+    for (size_t i = 0; ok && i < maps.instances.size(); i++) {
+        uint32_t info[2] = {maps.instances[i].instance, (uint32_t)maps.instances[i].uvs.size()};
+        ok = fwrite(info, sizeof(info), 1, file) == 1 &&
+             fwrite(maps.instances[i].uvs.data(), sizeof(vec2), info[1], file) == info[1];
+    }
+    ok = ok && fwrite(maps.texels.data(), sizeof(float), maps.texels.size(), file) == maps.texels.size();
+    fclose(file);
+    if (!ok) {
+        remove(path);
+    }
+    return ok;
+}
+
+bool load_lightmaps(const char *path, uint64_t key, Lightmaps &maps) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    char magic[4];
+    uint32_t header[6];
+    uint64_t file_key = 0;
+    bool ok = fread(magic, 1, 4, file) == 4 && memcmp(magic, LIGHTMAP_MAGIC, 4) == 0 &&
+              fread(header, sizeof(header), 1, file) == 1 && header[0] == LIGHTMAP_VERSION &&
+              fread(&file_key, sizeof(file_key), 1, file) == 1 && file_key == key &&
+              header[1] > 0 && header[1] <= 16384 && header[2] > 0 && header[2] <= 16384 && header[3] <= SCENE_MAX_LIGHTS;
+    if (ok) {
+        maps.key = file_key;
+        maps.width = header[1];
+        maps.height = header[2];
+        maps.layers = header[3];
+        maps.instances.resize(header[4]);
+        for (size_t i = 0; ok && i < maps.instances.size(); i++) {
+            uint32_t info[2];
+            ok = fread(info, sizeof(info), 1, file) == 1 && info[1] <= (1u << 26);
+            if (ok) {
+                maps.instances[i].instance = info[0];
+                maps.instances[i].uvs.resize(info[1]);
+                ok = fread(maps.instances[i].uvs.data(), sizeof(vec2), info[1], file) == info[1];
+            }
+        }
+        maps.texels.resize((size_t)3*maps.width*maps.height*maps.layers);
+        ok = ok && fread(maps.texels.data(), sizeof(float), maps.texels.size(), file) == maps.texels.size();
+    }
+    fclose(file);
+    return ok;
+}
@@ -0,0 +1,51 @@
+#ifndef LIGHTMAP_H
+#define LIGHTMAP_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "../common/vmath.h"
+#include "scene.h"
+
+// Baked lighting for static (baked) instances: one RGB layer per scene light in a shared atlas.
+// A layer holds that light's ambient and diffuse contribution (direct with shadows plus path traced
+// bounces) already multiplied by the instance material, so static geometry just sums the layers of
+// the lights that are on. Specular highlights are not baked.
+
+struct LightmapSettings {
+    float texels_per_unit;
+    int samples;                // hemisphere samples per texel
+    int bounces;                // indirect bounces per sample
+    int max_size;               // atlas width limit (texel density is halved until the charts fit)
+    unsigned int num_threads;   // 0 = one per hardware thread
+
+    LightmapSettings() : texels_per_unit(16.0f), samples(64), bounces(2), max_size(2048), num_threads(0) {}
+};
+
+// Lightmap coordinates of one baked instance, one per vertex of its mesh's full detail level
+struct LightmapInstance {
+    uint32_t instance;
+    std::vector<vmath::vec2> uvs;
+};
+
+struct Lightmaps {
+    uint64_t key;
+    int width;
+    int height;
+    int layers;
+    std::vector<float> texels;      // RGB per texel, layer after layer, row 0 at v = 0
+    std::vector<LightmapInstance> instances;
+};
+
+// Cache key of a scene image and bake settings (mesh files are not hashed, rebake after editing them)
+uint64_t lightmap_key(const Scene &scene, const LightmapSettings &settings);
+
+// Bake every baked instance of the scene (meshes and textures are loaded from scene_dir).
+// Returns false if the scene has nothing to bake.
+bool bake_lightmaps(const Scene &scene, const std::string &scene_dir, const LightmapSettings &settings, Lightmaps &maps);
+
+// Cache files (load fails if the file is missing or was baked for another key)
+bool save_lightmaps(const char *path, const Lightmaps &maps);
+bool load_lightmaps(const char *path, uint64_t key, Lightmaps &maps);
+
+#endif
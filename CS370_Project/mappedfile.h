@@ -0,0 +1,91 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <stddef.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only view of a whole file
+struct MappedFile {
+    const char *data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file, mapping;
+#else
+    int fd;
+#endif
+
+#ifdef _WIN32
+    MappedFile() : data(NULL), size(0), file(INVALID_HANDLE_VALUE), mapping(NULL) {}
+#else
+    MappedFile() : data(NULL), size(0), fd(-1) {}
+#endif
+    ~MappedFile() { close(); }
+
+    bool open(const char *path) {
+#ifdef _WIN32
+        file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER len;
+        GetFileSizeEx(file, &len);
+        size = (size_t)len.QuadPart;
+        mapping = NULL;
+        if (size > 0) {
+            mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+            data = mapping ? (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+            return data != NULL;
+        }
+        return true;
+#else
+        fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            return false;
+        }
+        size = (size_t)st.st_size;
+        if (size > 0) {
+            void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                return false;
+            }
+            madvise(p, size, MADV_SEQUENTIAL);
+            data = (const char *)p;
+        }
+        return true;
+#endif
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (data) UnmapViewOfFile(data);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = NULL;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data) munmap((void *)data, size);
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+        data = NULL;
+        size = 0;
+    }
+};
+
+#endif
@@ -0,0 +1,294 @@
+// Quadric error mesh simplification (Garland-Heckbert, half-edge collapses)
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <queue>
+#include "meshlod.h"
+#include "meshtools.h"
+
+using namespace vmath;
+using namespace std;
+
+// Symmetric 4x4 error quadric
+struct Quadric {
+    double a[10];   // a2 ab ac ad b2 bc bd c2 cd d2
+
+    Quadric() { memset(a, 0, sizeof(a)); }
+
+    // Plane n.x + d = 0 with weight w
+    Quadric(double nx, double ny, double nz, double d, double w) {
+        a[0] = w*nx*nx; a[1] = w*nx*ny; a[2] = w*nx*nz; a[3] = w*nx*d;
+        a[4] = w*ny*ny; a[5] = w*ny*nz; a[6] = w*ny*d;
+        a[7] = w*nz*nz; a[8] = w*nz*d;
+        a[9] = w*d*d;
+    }
+
+    Quadric &operator+=(const Quadric &q) {
+        for (int i = 0; i < 10; i++) a[i] += q.a[i];
+        return *this;
+    }
+
+    double error(const vec3 &p) const {
+        double x = p[0], y = p[1], z = p[2];
+        return a[0]*x*x + 2.0*a[1]*x*y + 2.0*a[2]*x*z + 2.0*a[3]*x
+             + a[4]*y*y + 2.0*a[5]*y*z + 2.0*a[6]*y
+             + a[7]*z*z + 2.0*a[8]*z
+             + a[9];
+    }
+};
+
+// Candidate collapse of vertex from into vertex to
+struct Collapse {
+    double cost;
+    unsigned int from, to;
+    unsigned int from_version, to_version;
+
+    bool operator>(const Collapse &o) const { return cost > o.cost; }
+};
+
+struct Simplifier {
+    vector<vec3> pos;                       // unique positions
+    vector<Quadric> quadrics;
+    vector<unsigned int> tris;              // 3 unique vertex ids per triangle
+    vector<unsigned int> tri_corner;        // first source corner of each triangle
+    vector<bool> tri_alive;
+    vector<vector<unsigned int> > vert_tris;
+    vector<unsigned int> version;
+    vector<bool> vert_alive;
+    size_t alive_tris;
+    priority_queue<Collapse, vector<Collapse>, greater<Collapse> > heap;
+
+    vec3 face_normal(unsigned int t, unsigned int replace_from, unsigned int replace_to) const {
+        vec3 p[3];
+        for (int k = 0; k < 3; k++) {
+            unsigned int v = tris[t*3 + k];
+            p[k] = pos[(v == replace_from) ? replace_to : v];
+        }
+        return cross(p[1] - p[0], p[2] - p[0]);
+    }
+
+    bool has_vertex(unsigned int t, unsigned int v) const {
+        return tris[t*3] == v || tris[t*3 + 1] == v || tris[t*3 + 2] == v;
+    }
+
+    // Collapsing from->to must not flip or degenerate any remaining triangle of from
+    bool collapse_ok(unsigned int from, unsigned int to) const {
+        const vector<unsigned int> &ft = vert_tris[from];
+        for (size_t i = 0; i < ft.size(); i++) {
+            unsigned int t = ft[i];
+            if (!tri_alive[t] || has_vertex(t, to)) continue;
+            vec3 before = face_normal(t, from, from);
+            vec3 after = face_normal(t, from, to);
+            float lb = length(before), la = length(after);
+            if (la <= 1.0e-12f || dot(before, after) < 0.2f*lb*la) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void push_edge(unsigned int u, unsigned int v) {
+        Quadric q = quadrics[u];
+        q += quadrics[v];
+        Collapse c;
+        // Keep whichever endpoint is cheaper, so its source attributes stay valid
+        double cu = q.error(pos[u]), cv = q.error(pos[v]);
+        if (cv <= cu) {
+            c.cost = cv; c.from = u; c.to = v;
+        } else {
+            c.cost = cu; c.from = v; c.to = u;
+        }
+        c.from_version = version[c.from];
+        c.to_version = version[c.to];
+        heap.push(c);
+    }
+
+    void collapse(unsigned int from, unsigned int to) {
+        quadrics[to] += quadrics[from];
+        vert_alive[from] = false;
+        version[from]++;
+        version[to]++;
+
+        vector<unsigned int> &ft = vert_tris[from];
+        for (size_t i = 0; i < ft.size(); i++) {
+            unsigned int t = ft[i];
+            if (!tri_alive[t]) continue;
+            if (has_vertex(t, to)) {
+                // Triangle on the collapsed edge disappears
+                tri_alive[t] = false;
+                alive_tris--;
+            } else {
+                for (int k = 0; k < 3; k++) {
+                    if (tris[t*3 + k] == from) tris[t*3 + k] = to;
+                }
+                vert_tris[to].push_back(t);
+            }
+        }
+        ft.clear();
+
+        // Drop dead triangles from to's list and requeue its edges
+        vector<unsigned int> &tt = vert_tris[to];
+        tt.erase(remove_if(tt.begin(), tt.end(), [&](unsigned int t) { return !tri_alive[t]; }), tt.end());
+        for (size_t i = 0; i < tt.size(); i++) {
+            for (int k = 0; k < 3; k++) {
+                unsigned int v = tris[tt[i]*3 + k];
+                if (v != to) push_edge(to, v);
+            }
+        }
+    }
+};
+
+void compute_bounds(const vector<vec4> &vertices, MeshBounds &bounds) {
+    if (vertices.empty()) {
+        bounds.min = bounds.max = bounds.center = vec3(0.0f, 0.0f, 0.0f);
+        bounds.radius = 0.0f;
+        return;
+    }
+    bounds.min = bounds.max = vec3(vertices[0][0], vertices[0][1], vertices[0][2]);
+    for (size_t i = 1; i < vertices.size(); i++) {
+        for (int k = 0; k < 3; k++) {
+            bounds.min[k] = min(bounds.min[k], vertices[i][k]);
+            bounds.max[k] = max(bounds.max[k], vertices[i][k]);
+        }
+    }
+    bounds.center = (bounds.min + bounds.max)*0.5f;
+    float r2 = 0.0f;
+    for (size_t i = 0; i < vertices.size(); i++) {
+        vec3 d = vec3(vertices[i][0], vertices[i][1], vertices[i][2]) - bounds.center;
+        r2 = max(r2, dot(d, d));
+    }
+    bounds.radius = sqrtf(r2);
+}
+
+void build_lod_chain(const vector<vec4> &vertices, const vector<vec3> &normals, vector<LODLevel> &levels,
+                     int max_levels, float ratio, size_t min_tris) {
+    levels.clear();
+    size_t num_corners = vertices.size();
+    size_t num_tris = num_corners/3;
+    if (num_tris/2 < min_tris) {
+        return;
+    }
+
+    // Topology from positions only, so uv seams and hard edges can still collapse
+    vector<vec2> no_uvs(num_corners, vec2(0.0f, 0.0f));
+    vector<vec3> no_normals(num_corners, vec3(0.0f, 0.0f, 0.0f));
+    WeldedMesh welded;
+    weld_vertices(vertices, no_uvs, no_normals, welded);
+
+    Simplifier s;
+    size_t num_verts = welded.first.size();
+    s.pos.resize(num_verts);
+    for (size_t v = 0; v < num_verts; v++) {
+        const vec4 &p = vertices[welded.first[v]];
+        s.pos[v] = vec3(p[0], p[1], p[2]);
+    }
+    s.quadrics.resize(num_verts);
+    s.vert_tris.resize(num_verts);
+    s.version.assign(num_verts, 0);
+    s.vert_alive.assign(num_verts, true);
+
+    // Source corners sharing each unique position (for picking attributes later)
+    vector<vector<unsigned int> > vert_corners(num_verts);
+    for (size_t i = 0; i < num_corners; i++) {
+        vert_corners[welded.indices[i]].push_back((unsigned int)i);
+    }
+
+    // Non-degenerate triangles and their plane quadrics
+    for (size_t t = 0; t < num_tris; t++) {
+        unsigned int a = welded.indices[t*3], b = welded.indices[t*3 + 1], c = welded.indices[t*3 + 2];
+        if (a == b || b == c || a == c) continue;
+        vec3 n = cross(s.pos[b] - s.pos[a], s.pos[c] - s.pos[a]);
+        float area2 = length(n);
+        if (area2 <= 0.0f) continue;
+        n = n/area2;
+        Quadric q(n[0], n[1], n[2], -dot(n, s.pos[a]), 0.5*area2);
+
+        unsigned int id = (unsigned int)(s.tris.size()/3);
+        s.tris.push_back(a); s.tris.push_back(b); s.tris.push_back(c);
+        s.tri_corner.push_back((unsigned int)(t*3));
+        s.quadrics[a] += q; s.quadrics[b] += q; s.quadrics[c] += q;
+        s.vert_tris[a].push_back(id); s.vert_tris[b].push_back(id); s.vert_tris[c].push_back(id);
+    }
+    size_t valid_tris = s.tris.size()/3;
+    s.tri_alive.assign(valid_tris, true);
+    s.alive_tris = valid_tris;
+
+    // Boundary edges get a heavily weighted perpendicular plane so open borders stay put
+    vector<pair<unsigned long long, unsigned int> > edges;
+    edges.reserve(valid_tris*3);
+    for (size_t t = 0; t < valid_tris; t++) {
+        for (int k = 0; k < 3; k++) {
+            unsigned int u = s.tris[t*3 + k], v = s.tris[t*3 + (k + 1) % 3];
+            unsigned long long key = (u < v) ? ((unsigned long long)u << 32 | v) : ((unsigned long long)v << 32 | u);
+            edges.push_back(make_pair(key, (unsigned int)t));
+        }
+    }
+    sort(edges.begin(), edges.end());
+    for (size_t i = 0; i < edges.size(); ) {
+        size_t j = i;
+        while (j < edges.size() && edges[j].first == edges[i].first) j++;
+        unsigned int u = (unsigned int)(edges[i].first >> 32), v = (unsigned int)(edges[i].first & 0xffffffffu);
+        if (j - i == 1) {
+            vec3 fn = s.face_normal(edges[i].second, u, u);
+            vec3 e = s.pos[v] - s.pos[u];
+            vec3 n = cross(e, fn);
+            float len = length(n);
+            if (len > 0.0f) {
+                n = n/len;
+                Quadric q(n[0], n[1], n[2], -dot(n, s.pos[u]), 100.0*dot(e, e));
+                s.quadrics[u] += q;
+                s.quadrics[v] += q;
+            }
+        }
+        s.push_edge(u, v);
+        i = j;
+    }
+
+    // Collapse cheapest edges, snapshotting a level each time the target count is reached
+    size_t target = (size_t)(valid_tris*ratio);
+    double max_error = 0.0;
+    while ((int)levels.size() < max_levels && target >= min_tris) {
+        while (s.alive_tris > target && !s.heap.empty()) {
+            Collapse c = s.heap.top();
+            s.heap.pop();
+            if (!s.vert_alive[c.from] || !s.vert_alive[c.to] ||
+                c.from_version != s.version[c.from] || c.to_version != s.version[c.to]) {
+                continue;
+            }
+            if (!s.collapse_ok(c.from, c.to)) {
+                continue;
+            }
+            if (c.cost > max_error) max_error = c.cost;
+            s.collapse(c.from, c.to);
+        }
+        if (s.alive_tris > target) {
+            // Nothing left that can collapse safely
+            break;
+        }
+
+        // Each output corner reuses the source corner at that position whose normal best matches the new face
+        LODLevel level;
+        level.error = (float)max_error;
+        level.corners.reserve(s.alive_tris*3);
+        for (size_t t = 0; t < valid_tris; t++) {
+            if (!s.tri_alive[t]) continue;
+            vec3 fn = normalize(s.face_normal((unsigned int)t, 0xffffffffu, 0xffffffffu));
+            for (int k = 0; k < 3; k++) {
+                const vector<unsigned int> &vc = vert_corners[s.tris[t*3 + k]];
+                unsigned int best = vc[0];
+                float best_dot = -2.0f;
+                for (size_t i = 0; i < vc.size(); i++) {
+                    float d = dot(normals[vc[i]], fn);
+                    if (d > best_dot) {
+                        best_dot = d;
+                        best = vc[i];
+                    }
+                }
+                level.corners.push_back(best);
+            }
+        }
+        levels.push_back(level);
+        target = (size_t)(target*ratio);
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef MESHLOD_H
+#define MESHLOD_H
+
+#include <vector>
+#include "../common/vmath.h"
+
+// One simplified level of a mesh. Each output corner is the index of the source
+// corner whose attributes (position, normal, uv, tangent) it reuses.
+struct LODLevel {
+    std::vector<unsigned int> corners;
+    float error;    // largest quadric error accepted for this level (object space, squared)
+};
+
+// Object space bounds of a mesh (box and enclosing sphere)
+struct MeshBounds {
+    vmath::vec3 min, max;
+    vmath::vec3 center;
+    float radius;
+};
+
+// Compute box and sphere (box center, farthest vertex) bounds of a vertex list
+void compute_bounds(const std::vector<vmath::vec4> &vertices, MeshBounds &bounds);
+
+// Build a chain of progressively simplified levels of an un-indexed triangle list using
+// quadric error edge collapses. Each level keeps about ratio of the previous level's
+// triangles; the chain stops at max_levels levels or min_tris triangles. Level 0 (the
+// source mesh) is not included.
+void build_lod_chain(const std::vector<vmath::vec4> &vertices, const std::vector<vmath::vec3> &normals,
+                     std::vector<LODLevel> &levels, int max_levels = 4, float ratio = 0.5f, size_t min_tris = 64);
+
+#endif
@@ -0,0 +1,302 @@
+// Mesh welding and tangent space generation
+
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+#include <thread>
+#include "meshtools.h"
+
+using namespace vmath;
+using namespace std;
+
+// Bitwise vertex key for welding
+struct WeldKey {
+    float data[8];
+    signed char sign;
+};
+
+static inline WeldKey make_weld_key(const vector<vec4> &vertices, const vector<vec2> &uvs, const vector<vec3> &normals,
+                                    const vector<signed char> *signs, size_t i) {
+    WeldKey key;
+    key.data[0] = vertices[i][0]; key.data[1] = vertices[i][1]; key.data[2] = vertices[i][2];
+    key.data[3] = normals[i][0]; key.data[4] = normals[i][1]; key.data[5] = normals[i][2];
+    key.data[6] = uvs[i][0]; key.data[7] = uvs[i][1];
+    // Treat -0.0 and 0.0 as the same value
+    for (int k = 0; k < 8; k++) {
+        if (key.data[k] == 0.0f) key.data[k] = 0.0f;
+    }
+    key.sign = signs ? (*signs)[i] : 0;
+    return key;
+}
+
+static inline bool same_key(const WeldKey &a, const WeldKey &b) {
+    return a.sign == b.sign && memcmp(a.data, b.data, sizeof(a.data)) == 0;
+}
+
+static inline uint64_t hash_key(const WeldKey &k) {
+    // Mix the key words (murmur-style finalizer per word)
+    uint32_t words[8];
+    memcpy(words, k.data, sizeof(words));
+    uint64_t h = (uint64_t)(unsigned char)k.sign;
+    for (int i = 0; i < 8; i++) {
+        h ^= words[i];
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+    }
+    return h;
+}
+
+// Number of ranges (threads) worth splitting n items into
+static size_t range_count(size_t n, unsigned int num_threads) {
+    return (n < 16384 || num_threads <= 1) ? 1 : num_threads;
+}
+
+// Run fn(first, last) over [0, n) split into ranges, one thread each
+template <class Fn>
+static void parallel_ranges(size_t n, size_t ranges, Fn fn) {
+    vector<thread> workers;
+    for (size_t i = 1; i < ranges; i++) {
+        workers.push_back(thread(fn, n*i/ranges, n*(i + 1)/ranges));
+    }
+    fn((size_t)0, n/ranges);
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+}
+
+void weld_vertices(const vector<vec4> &vertices, const vector<vec2> &uvs, const vector<vec3> &normals,
+                   WeldedMesh &welded, const vector<signed char> *signs, unsigned int num_threads) {
+    size_t n = vertices.size();
+    welded.indices.resize(n);
+    welded.first.clear();
+    if (num_threads == 0) {
+        num_threads = thread::hardware_concurrency();
+    }
+
+    // Keys and hashes for every corner
+    vector<WeldKey> keys(n);
+    vector<uint64_t> hashes(n);
+    parallel_ranges(n, range_count(n, num_threads), [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            keys[i] = make_weld_key(vertices, uvs, normals, signs, i);
+            hashes[i] = hash_key(keys[i]);
+        }
+    });
+
+    // Each partition of the hash space is welded independently (one per thread). Corners are bucketed
+    // by partition with a counting sort (per range counts, so a bucket keeps corners in index order)
+    size_t parts = range_count(n, num_threads);
+    vector<size_t> part_start(parts + 1, 0);
+    vector<unsigned int> order;
+    if (parts > 1) {
+        vector<size_t> counts(parts*parts, 0);  // corners of range r in partition p at r*parts + p
+        parallel_ranges(parts, parts, [&](size_t first_range, size_t last_range) {
+            for (size_t r = first_range; r < last_range; r++) {
+                for (size_t i = n*r/parts; i < n*(r + 1)/parts; i++) {
+                    counts[r*parts + (hashes[i] >> 40) % parts]++;
+                }
+            }
+        });
+        vector<size_t> offsets(parts*parts);
+        for (size_t part = 0, total = 0; part < parts; part++) {
+            part_start[part] = total;
+            for (size_t r = 0; r < parts; r++) {
+                offsets[r*parts + part] = total;
+                total += counts[r*parts + part];
+            }
+            part_start[part + 1] = total;
+        }
+        order.resize(n);
+        parallel_ranges(parts, parts, [&](size_t first_range, size_t last_range) {
+            for (size_t r = first_range; r < last_range; r++) {
+                for (size_t i = n*r/parts; i < n*(r + 1)/parts; i++) {
+                    order[offsets[r*parts + (hashes[i] >> 40) % parts]++] = (unsigned int)i;
+                }
+            }
+        });
+    } else {
+        part_start[1] = n;
+    }
+
+    vector<vector<unsigned int> > part_first(parts);
+    parallel_ranges(parts, parts, [&](size_t first_part, size_t last_part) {
+        for (size_t part = first_part; part < last_part; part++) {
+            size_t count = part_start[part + 1] - part_start[part];
+
+            // Open addressing table of local vertex ids, at most half full
+            size_t capacity = 16;
+            while (capacity < count*2) capacity *= 2;
+            const unsigned int empty = 0xffffffffu;
+            vector<unsigned int> table(capacity, empty);
+            vector<unsigned int> &unique = part_first[part];
+            unique.reserve(count);
+
+            for (size_t k = part_start[part]; k < part_start[part + 1]; k++) {
+                unsigned int i = order.empty() ? (unsigned int)k : order[k];
+                size_t slot = (size_t)hashes[i] & (capacity - 1);
+                for (;;) {
+                    unsigned int id = table[slot];
+                    if (id == empty) {
+                        id = (unsigned int)unique.size();
+                        table[slot] = id;
+                        unique.push_back(i);
+                        welded.indices[i] = id;
+                        break;
+                    }
+                    if (same_key(keys[unique[id]], keys[i])) {
+                        welded.indices[i] = id;
+                        break;
+                    }
+                    slot = (slot + 1) & (capacity - 1);
+                }
+            }
+        }
+    });
+
+    // Turn local ids into global ones
+    vector<unsigned int> part_offset(parts + 1, 0);
+    for (size_t part = 0; part < parts; part++) {
+        part_offset[part + 1] = part_offset[part] + (unsigned int)part_first[part].size();
+        welded.first.insert(welded.first.end(), part_first[part].begin(), part_first[part].end());
+    }
+    if (parts > 1) {
+        parallel_ranges(n, range_count(n, num_threads), [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; i++) {
+                welded.indices[i] += part_offset[(hashes[i] >> 40) % parts];
+            }
+        });
+    }
+}
+
+static inline vec3 xyz(const vec4 &v) {
+    return vec3(v[0], v[1], v[2]);
+}
+
+// Project v onto the plane perpendicular to unit n
+static inline vec3 project_out(const vec3 &v, const vec3 &n) {
+    return v - n*dot(n, v);
+}
+
+static inline vec3 safe_normalize(const vec3 &v) {
+    float len = length(v);
+    return (len > 1.0e-20f) ? v/len : vec3(0.0f, 0.0f, 0.0f);
+}
+
+// Any unit vector perpendicular to n
+static vec3 any_perpendicular(const vec3 &n) {
+    vec3 axis = (fabsf(n[0]) < 0.9f) ? vec3(1.0f, 0.0f, 0.0f) : vec3(0.0f, 1.0f, 0.0f);
+    return safe_normalize(cross(n, axis));
+}
+
+void generate_tangents(const vector<vec4> &vertices, const vector<vec2> &uvs, const vector<vec3> &normals,
+                       vector<vec4> &tangents, unsigned int num_threads) {
+    size_t n = vertices.size();
+    size_t num_tris = n/3;
+    if (num_threads == 0) {
+        num_threads = thread::hardware_concurrency();
+    }
+
+    // Per-corner weighted tangent/bitangent contributions and uv orientation
+    vector<vec3> corner_t(n), corner_b(n);
+    vector<signed char> corner_sign(n);
+    parallel_ranges(num_tris, range_count(num_tris, num_threads), [&](size_t first, size_t last) {
+        for (size_t t = first; t < last; t++) {
+            size_t i = t*3;
+            vec3 p[3] = {xyz(vertices[i]), xyz(vertices[i + 1]), xyz(vertices[i + 2])};
+            vec3 e1 = p[1] - p[0], e2 = p[2] - p[0];
+            vec2 d1 = uvs[i + 1] - uvs[i], d2 = uvs[i + 2] - uvs[i];
+            float area = d1[0]*d2[1] - d1[1]*d2[0];
+            vec3 tri_t = vec3(0.0f, 0.0f, 0.0f), tri_b = vec3(0.0f, 0.0f, 0.0f);
+            if (fabsf(area) > 1.0e-20f) {
+                tri_t = (e1*d2[1] - e2*d1[1])/area;
+                tri_b = (e2*d1[0] - e1*d2[0])/area;
+            }
+            signed char sign = (area < 0.0f) ? -1 : 1;
+
+            // Unit edges p0->p1, p1->p2, p2->p0 for the corner angle weights
+            vec3 edge[3] = {safe_normalize(e1), safe_normalize(p[2] - p[1]), safe_normalize(p[0] - p[2])};
+            for (int k = 0; k < 3; k++) {
+                // Angle between outgoing edge and reversed incoming edge
+                float c = -dot(edge[k], edge[(k + 2) % 3]);
+                float angle = acosf(c < -1.0f ? -1.0f : (c > 1.0f ? 1.0f : c));
+
+                vec3 nrm = safe_normalize(normals[i + k]);
+                corner_t[i + k] = safe_normalize(project_out(tri_t, nrm))*angle;
+                corner_b[i + k] = safe_normalize(project_out(tri_b, nrm))*angle;
+                corner_sign[i + k] = sign;
+            }
+        }
+    });
+
+    // Weld, keeping mirrored uv regions apart
+    WeldedMesh welded;
+    weld_vertices(vertices, uvs, normals, welded, &corner_sign, num_threads);
+    size_t num_unique = welded.first.size();
+
+    // Corners grouped by welded vertex (counting sort)
+    vector<unsigned int> offsets(num_unique + 1, 0), order(n);
+    for (size_t i = 0; i < n; i++) {
+        offsets[welded.indices[i] + 1]++;
+    }
+    for (size_t v = 0; v < num_unique; v++) {
+        offsets[v + 1] += offsets[v];
+    }
+    vector<unsigned int> cursor(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < n; i++) {
+        order[cursor[welded.indices[i]]++] = (unsigned int)i;
+    }
+
+    // Sum contributions per welded vertex, orthogonalize and write to every corner
+    tangents.resize(n);
+    parallel_ranges(num_unique, range_count(num_unique, num_threads), [&](size_t first, size_t last) {
+        for (size_t v = first; v < last; v++) {
+            vec3 t = vec3(0.0f, 0.0f, 0.0f), b = vec3(0.0f, 0.0f, 0.0f);
+            for (unsigned int j = offsets[v]; j < offsets[v + 1]; j++) {
+                t += corner_t[order[j]];
+                b += corner_b[order[j]];
+            }
+
+            unsigned int c0 = welded.first[v];
+            vec3 nrm = safe_normalize(normals[c0]);
+            vec3 tangent = safe_normalize(project_out(t, nrm));
+            if (dot(tangent, tangent) == 0.0f) {
+                tangent = any_perpendicular(nrm);
+            }
+            float w = (dot(cross(nrm, tangent), b) < 0.0f) ? -1.0f : 1.0f;
+
+            vec4 out = vec4(tangent[0], tangent[1], tangent[2], w);
+            for (unsigned int j = offsets[v]; j < offsets[v + 1]; j++) {
+                tangents[order[j]] = out;
+            }
+        }
+    });
+}
+
+void make_quad(vector<vec4> &vertices, vector<vec2> &uvs, vector<vec3> &normals) {
+    vertices = {
+            vec4(1.0f, 0.0f, 1.0f, 1.0f),
+            vec4(1.0f, 0.0f, -1.0f, 1.0f),
+            vec4(-1.0f, 0.0f, -1.0f, 1.0f),
+            vec4(-1.0f, 0.0f, -1.0f, 1.0f),
+            vec4(-1.0f, 0.0f, 1.0f, 1.0f),
+            vec4(1.0f, 0.0f, 1.0f, 1.0f),
+    };
+
+    normals = {
+            vec3(1.0f, 0.0f, 0.0f),
+            vec3(1.0f, 0.0f, 0.0f),
+            vec3(1.0f, 0.0f, 0.0f),
+            vec3(1.0f, 0.0f, 0.0f),
+            vec3(1.0f, 0.0f, 0.0f),
+            vec3(1.0f, 0.0f, 0.0f),
+    };
+
+    uvs = {
+            {1.0f, 1.0f},
+            {0.0f, 1.0f},
+            {0.0f, 0.0f},
+            {0.0f, 0.0f},
+            {1.0f, 0.0f},
+            {1.0f, 1.0f},
+    };
+}
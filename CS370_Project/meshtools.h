@@ -0,0 +1,31 @@
+#ifndef MESHTOOLS_H
+#define MESHTOOLS_H
+
+#include <vector>
+#include "../common/vmath.h"
+
+// Welded (indexed) view of an un-indexed triangle list
+struct WeldedMesh {
+    std::vector<unsigned int> indices;  // unique vertex of each input corner
+    std::vector<unsigned int> first;    // first input corner of each unique vertex
+};
+
+// Merge corners with identical position, uv and normal (and, if signs is given, identical sign).
+// Large meshes are split by hash over num_threads threads (0 = one per hardware thread).
+void weld_vertices(const std::vector<vmath::vec4> &vertices, const std::vector<vmath::vec2> &uvs,
+                   const std::vector<vmath::vec3> &normals, WeldedMesh &welded,
+                   const std::vector<signed char> *signs = NULL, unsigned int num_threads = 0);
+
+// MikkTSpace-style per-vertex tangents for an un-indexed triangle list.
+// Tangents are angle weighted, averaged over welded vertices (split where the uv mapping is
+// mirrored) and orthogonalized against the normal. The w component holds the handedness so
+// the shader can rebuild the bitangent as w*cross(N, T). Work is split into triangle ranges
+// over num_threads threads (0 = one per hardware thread).
+void generate_tangents(const std::vector<vmath::vec4> &vertices, const std::vector<vmath::vec2> &uvs,
+                       const std::vector<vmath::vec3> &normals, std::vector<vmath::vec4> &tangents,
+                       unsigned int num_threads = 0);
+
+// Two triangle quad spanning x, z in [-1,1] at y = 0 (geometry of @quad meshes)
+void make_quad(std::vector<vmath::vec4> &vertices, std::vector<vmath::vec2> &uvs, std::vector<vmath::vec3> &normals);
+
+#endif
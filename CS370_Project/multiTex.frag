@@ -4,7 +4,9 @@ uniform sampler2D dirtMap;
 
 out vec4 fragColor;
 
-in vec2 texCoord;
+in VertexData {
+    vec2 texCoord;
+};
 
 void main()
 {
@@ -6,8 +6,9 @@ uniform mat4 model_matrix;
 layout(location = 0) in vec4 vPosition;
 layout(location = 1) in vec2 vTexCoord;
 
-out vec2 texCoord;
-out vec4 LightPosition;
+out VertexData {
+    vec2 texCoord;
+};
 
 void main( )
 {
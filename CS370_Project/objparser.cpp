@@ -0,0 +1,355 @@
+// Memory-mapped, multithreaded OBJ parser
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <thread>
+#include <vector>
+#include "objparser.h"
+#include "mappedfile.h"
+
+using namespace vmath;
+using namespace std;
+
+// Per-chunk element counts (pass 1) and output offsets (prefix sums)
+struct ObjChunk {
+    const char *begin, *end;
+    size_t positions, uvs, normals, corners;
+};
+
+// Face corner indices, resolved to 0-based (-1 if absent)
+struct ObjCorner {
+    int32_t v, vt, vn;
+};
+
+static inline bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char *skip_space(const char *p, const char *end) {
+    while (p < end && is_space(*p)) p++;
+    return p;
+}
+
+static inline const char *next_line(const char *p, const char *end) {
+    const char *nl = (p < end) ? (const char *)memchr(p, '\n', (size_t)(end - p)) : NULL;
+    return nl ? nl + 1 : end;
+}
+
+static const double pow10_table[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                     1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// Fast decimal float parser (sign, digits, fraction, exponent); falls back to strtod for anything unusual
+static const char *parse_float(const char *p, const char *end, float &out) {
+    const char *start = p;
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = (*p == '-');
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    bool any = false;
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (digits < 19) {
+            mantissa = mantissa*10 + (uint64_t)(*p - '0');
+            if (mantissa) digits++;
+        } else {
+            exponent++;
+        }
+        any = true;
+        p++;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (digits < 19) {
+                mantissa = mantissa*10 + (uint64_t)(*p - '0');
+                if (mantissa) digits++;
+                exponent--;
+            }
+            any = true;
+            p++;
+        }
+    }
+    if (!any) {
+        // inf/nan or garbage
+        char buf[64];
+        size_t n = 0;
+        while (start + n < end && n < sizeof(buf) - 1 && !is_space(start[n]) && start[n] != '\n') {
+            buf[n] = start[n];
+            n++;
+        }
+        buf[n] = '\0';
+        char *stop = NULL;
+        out = strtof(buf, &stop);
+        return start + (stop - buf);
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        bool eneg = false;
+        if (q < end && (*q == '-' || *q == '+')) {
+            eneg = (*q == '-');
+            q++;
+        }
+        if (q < end && *q >= '0' && *q <= '9') {
+            int e = 0;
+            while (q < end && *q >= '0' && *q <= '9') {
+                if (e < 10000) e = e*10 + (*q - '0');
+                q++;
+            }
+            exponent += eneg ? -e : e;
+            p = q;
+        }
+    }
+
+    double value = (double)mantissa;
+    if (exponent < 0) {
+        while (exponent < -22) {
+            value /= 1e22;
+            exponent += 22;
+        }
+        value /= pow10_table[-exponent];
+    } else if (exponent > 0) {
+        while (exponent > 22) {
+            value *= 1e22;
+            exponent -= 22;
+        }
+        value *= pow10_table[exponent];
+    }
+    out = (float)(neg ? -value : value);
+    return p;
+}
+
+static inline const char *parse_int(const char *p, const char *end, int64_t &out, bool &ok) {
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = (*p == '-');
+        p++;
+    }
+    int64_t v = 0;
+    ok = false;
+    while (p < end && *p >= '0' && *p <= '9') {
+        v = v*10 + (*p - '0');
+        ok = true;
+        p++;
+    }
+    out = neg ? -v : v;
+    return p;
+}
+
+// Number of face corners on an "f" line after triangulation
+static size_t count_face_corners(const char *p, const char *end) {
+    size_t tokens = 0;
+    while (p < end && *p != '\n') {
+        p = skip_space(p, end);
+        if (p >= end || *p == '\n' || *p == '#') break;
+        tokens++;
+        while (p < end && !is_space(*p) && *p != '\n') p++;
+    }
+    return (tokens >= 3) ? (tokens - 2)*3 : 0;
+}
+
+// Pass 1: count elements in a chunk
+static void count_chunk(ObjChunk &c) {
+    c.positions = c.uvs = c.normals = c.corners = 0;
+    const char *p = c.begin;
+    while (p < c.end) {
+        p = skip_space(p, c.end);
+        if (p + 1 < c.end) {
+            if (p[0] == 'v') {
+                if (is_space(p[1])) c.positions++;
+                else if (p[1] == 't' && p + 2 < c.end && is_space(p[2])) c.uvs++;
+                else if (p[1] == 'n' && p + 2 < c.end && is_space(p[2])) c.normals++;
+            } else if (p[0] == 'f' && is_space(p[1])) {
+                c.corners += count_face_corners(p + 2, c.end);
+            }
+        }
+        p = next_line(p, c.end);
+    }
+}
+
+// Resolve a 1-based (or negative, relative) OBJ index to 0-based
+static inline int32_t resolve_index(int64_t idx, size_t count_so_far) {
+    if (idx > 0) return (int32_t)(idx - 1);
+    if (idx < 0) return (int32_t)((int64_t)count_so_far + idx);
+    return -1;
+}
+
+// Pass 2: parse a chunk into the shared arrays at its offsets
+static void parse_chunk(const ObjChunk &c, vector<vec4> &positions, vector<vec2> &uvs, vector<vec3> &normals,
+                        vector<ObjCorner> &corners) {
+    size_t pi = c.positions, ti = c.uvs, ni = c.normals, fi = c.corners;
+    const char *p = c.begin;
+    const char *end = c.end;
+    while (p < end) {
+        p = skip_space(p, end);
+        if (p + 1 < end && p[0] == 'v' && is_space(p[1])) {
+            vec4 &v = positions[pi++];
+            p = parse_float(skip_space(p + 2, end), end, v[0]);
+            p = parse_float(skip_space(p, end), end, v[1]);
+            p = parse_float(skip_space(p, end), end, v[2]);
+            v[3] = 1.0f;
+        } else if (p + 2 < end && p[0] == 'v' && p[1] == 't' && is_space(p[2])) {
+            vec2 &t = uvs[ti++];
+            p = parse_float(skip_space(p + 3, end), end, t[0]);
+            p = parse_float(skip_space(p, end), end, t[1]);
+        } else if (p + 2 < end && p[0] == 'v' && p[1] == 'n' && is_space(p[2])) {
+            vec3 &n = normals[ni++];
+            p = parse_float(skip_space(p + 3, end), end, n[0]);
+            p = parse_float(skip_space(p, end), end, n[1]);
+            p = parse_float(skip_space(p, end), end, n[2]);
+        } else if (p + 1 < end && p[0] == 'f' && is_space(p[1])) {
+            // Parse corners, fan triangulating polygons as we go
+            ObjCorner first = {-1, -1, -1}, prev = {-1, -1, -1};
+            int count = 0;
+            p += 2;
+            for (;;) {
+                p = skip_space(p, end);
+                if (p >= end || *p == '\n' || *p == '#') break;
+                ObjCorner corner = {-1, -1, -1};
+                int64_t idx;
+                bool ok;
+                p = parse_int(p, end, idx, ok);
+                if (ok) corner.v = resolve_index(idx, pi);
+                if (p < end && *p == '/') {
+                    p = parse_int(p + 1, end, idx, ok);
+                    if (ok) corner.vt = resolve_index(idx, ti);
+                    if (p < end && *p == '/') {
+                        p = parse_int(p + 1, end, idx, ok);
+                        if (ok) corner.vn = resolve_index(idx, ni);
+                    }
+                }
+                while (p < end && !is_space(*p) && *p != '\n') p++;
+
+                if (count == 0) {
+                    first = corner;
+                } else if (count >= 2) {
+                    corners[fi++] = first;
+                    corners[fi++] = prev;
+                    corners[fi++] = corner;
+                }
+                prev = corner;
+                count++;
+            }
+        }
+        p = next_line(p, end);
+    }
+}
+
+// Pass 3: expand a range of triangles into the output arrays
+static void resolve_range(size_t first_tri, size_t last_tri, const vector<vec4> &positions, const vector<vec2> &uvs,
+                          const vector<vec3> &normals, const vector<ObjCorner> &corners, vector<vec4> &out_vertices,
+                          vector<vec2> &out_uvs, vector<vec3> &out_normals) {
+    const vec4 origin = vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    for (size_t t = first_tri; t < last_tri; t++) {
+        bool need_normal = false;
+        for (size_t k = t*3; k < t*3 + 3; k++) {
+            const ObjCorner &c = corners[k];
+            out_vertices[k] = (c.v >= 0 && (size_t)c.v < positions.size()) ? positions[c.v] : origin;
+            out_uvs[k] = (c.vt >= 0 && (size_t)c.vt < uvs.size()) ? uvs[c.vt] : vec2(0.0f, 0.0f);
+            if (c.vn >= 0 && (size_t)c.vn < normals.size()) {
+                out_normals[k] = normals[c.vn];
+            } else {
+                need_normal = true;
+            }
+        }
+        if (need_normal) {
+            // Flat face normal for corners without one
+            const vec4 &a = out_vertices[t*3], &b = out_vertices[t*3 + 1], &c = out_vertices[t*3 + 2];
+            vec3 n = cross(vec3(b[0] - a[0], b[1] - a[1], b[2] - a[2]), vec3(c[0] - a[0], c[1] - a[1], c[2] - a[2]));
+            float len = length(n);
+            n = (len > 0.0f) ? n/len : vec3(0.0f, 1.0f, 0.0f);
+            for (size_t k = t*3; k < t*3 + 3; k++) {
+                const ObjCorner &cr = corners[k];
+                if (!(cr.vn >= 0 && (size_t)cr.vn < normals.size())) {
+                    out_normals[k] = n;
+                }
+            }
+        }
+    }
+}
+
+// Run fn(i) for i in [0, n) on up to n threads
+template <class Fn>
+static void parallel_for(size_t n, Fn fn) {
+    if (n <= 1) {
+        if (n == 1) fn((size_t)0);
+        return;
+    }
+    vector<thread> workers;
+    for (size_t i = 1; i < n; i++) {
+        workers.push_back(thread(fn, i));
+    }
+    fn((size_t)0);
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+}
+
+bool load_obj_fast(const char *path, vector<vec4> &out_vertices, vector<vec2> &out_uvs, vector<vec3> &out_normals,
+                   unsigned int num_threads) {
+    MappedFile file;
+    if (!file.open(path)) {
+        fprintf(stderr, "ERROR: could not open %s\n", path);
+        return false;
+    }
+
+    // Small files are not worth the thread start-up
+    const size_t min_chunk_bytes = 256*1024;
+    if (num_threads == 0) {
+        num_threads = thread::hardware_concurrency();
+    }
+    size_t num_chunks = file.size/min_chunk_bytes + 1;
+    if (num_chunks > num_threads) num_chunks = (num_threads > 0) ? num_threads : 1;
+
+    // Split at line boundaries
+    vector<ObjChunk> chunks(num_chunks);
+    const char *file_end = file.data + file.size;
+    const char *p = file.data;
+    for (size_t i = 0; i < num_chunks; i++) {
+        chunks[i].begin = p;
+        if (i + 1 == num_chunks) {
+            p = file_end;
+        } else {
+            const char *target = file.data + file.size*(i + 1)/num_chunks;
+            p = next_line((target > p) ? target : p, file_end);
+        }
+        chunks[i].end = p;
+    }
+
+    // Pass 1: count, then turn counts into output offsets
+    parallel_for(num_chunks, [&](size_t i) { count_chunk(chunks[i]); });
+    size_t num_positions = 0, num_uvs = 0, num_normals = 0, num_corners = 0;
+    for (size_t i = 0; i < num_chunks; i++) {
+        size_t c;
+        c = chunks[i].positions; chunks[i].positions = num_positions; num_positions += c;
+        c = chunks[i].uvs; chunks[i].uvs = num_uvs; num_uvs += c;
+        c = chunks[i].normals; chunks[i].normals = num_normals; num_normals += c;
+        c = chunks[i].corners; chunks[i].corners = num_corners; num_corners += c;
+    }
+
+    // Pass 2: parse into preallocated arrays
+    vector<vec4> positions(num_positions);
+    vector<vec2> uvs(num_uvs);
+    vector<vec3> normals(num_normals);
+    vector<ObjCorner> corners(num_corners);
+    parallel_for(num_chunks, [&](size_t i) { parse_chunk(chunks[i], positions, uvs, normals, corners); });
+    file.close();
+
+    // Pass 3: expand faces into the output arrays
+    size_t num_tris = num_corners/3;
+    out_vertices.resize(num_corners);
+    out_uvs.resize(num_corners);
+    out_normals.resize(num_corners);
+    size_t num_ranges = (num_tris < 65536) ? 1 : num_chunks;
+    parallel_for(num_ranges, [&](size_t i) {
+        resolve_range(num_tris*i/num_ranges, num_tris*(i + 1)/num_ranges, positions, uvs, normals, corners,
+                      out_vertices, out_uvs, out_normals);
+    });
+
+    return true;
+}
@@ -0,0 +1,15 @@
+#ifndef OBJPARSER_H
+#define OBJPARSER_H
+
+#include <vector>
+#include "../common/vmath.h"
+
+// Load an OBJ file into un-indexed triangle arrays (same layout as loadOBJ).
+// The file is memory mapped, split into chunks at line boundaries and parsed on
+// num_threads threads (0 = one per hardware thread). Polygons are fan triangulated,
+// negative indices are supported, and missing uvs/normals are filled in with
+// zero uvs and flat face normals.
+bool load_obj_fast(const char *path, std::vector<vmath::vec4> &out_vertices, std::vector<vmath::vec2> &out_uvs,
+                   std::vector<vmath::vec3> &out_normals, unsigned int num_threads = 0);
+
+#endif
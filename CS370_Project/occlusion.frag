@@ -0,0 +1,8 @@
+#version 400 core
+out vec4 fragColor;
+
+void main()
+{
+    // Color writes are masked off, only samples passed is counted
+    fragColor = vec4(1.0f);
+}
@@ -0,0 +1,10 @@
+#version 400 core
+uniform mat4 mvp_matrix;
+
+layout(location = 0) in vec4 vPosition;
+
+void main( )
+{
+    // Bounding box corner in clip space
+    gl_Position = mvp_matrix*vPosition;
+}
@@ -0,0 +1,24 @@
+#ifndef PERFSTATS_H
+#define PERFSTATS_H
+
+// Per-frame renderer counters (reset at the start of each rendered frame). Program, vertex array
+// and texture binds are counted by the GL state cache (see glstate.h).
+struct FrameStats {
+    unsigned int draws;                 // object draw calls submitted (incl. conditional ones)
+    unsigned int triangles;             // triangles in those draws (selected level of detail)
+    unsigned int occlusion_queries;     // bounding box queries issued
+    unsigned int occlusion_culled;      // draws skipped on the CPU (last query already reported no samples)
+    unsigned int occlusion_conditional; // draws left to conditional render (last query still in flight)
+    unsigned int state_changes;         // shader, mesh, texture or material switches between consecutive instances
+
+    void reset() {
+        draws = 0;
+        triangles = 0;
+        occlusion_queries = 0;
+        occlusion_culled = 0;
+        occlusion_conditional = 0;
+        state_changes = 0;
+    }
+};
+
+#endif
@@ -21,12 +21,19 @@ struct MaterialProperties {
      float shininess;
 };
 
-const int MaxLights = 8;
+// Array sizes follow the loaded scene (defined by house before compiling)
+#ifndef MAX_LIGHTS
+#define MAX_LIGHTS 16
+#endif
+const int MaxLights = MAX_LIGHTS;
 layout (std140) uniform LightBuffer {
      LightProperties Lights[MaxLights];
 };
 
-const int MaxMaterials = 8;
+#ifndef MAX_MATERIALS
+#define MAX_MATERIALS 256
+#endif
+const int MaxMaterials = MAX_MATERIALS;
 layout (std140) uniform MaterialBuffer {
      MaterialProperties Materials[MaxMaterials];
 };
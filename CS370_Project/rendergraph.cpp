@@ -0,0 +1,416 @@
+// Frame render graph (pass scheduling, culling and transient texture aliasing)
+
+#include <algorithm>
+#include <chrono>
+#include <set>
+#include "rendergraph.h"
+#include "glstate.h"
+#include "resources.h"
+
+using namespace std;
+
+struct RgFormat {
+    GLenum format;
+    const char *name;
+    int bytes_per_texel;
+    GLenum pixel_format, pixel_type;    // for allocating without data
+    GLenum attachment;                  // GL_COLOR_ATTACHMENT0 for color formats
+};
+
+static const RgFormat formats[] = {
+    {GL_RGBA8, "RGBA8", 4, GL_RGBA, GL_UNSIGNED_BYTE, GL_COLOR_ATTACHMENT0},
+    {GL_RGBA16F, "RGBA16F", 8, GL_RGBA, GL_FLOAT, GL_COLOR_ATTACHMENT0},
+    {GL_RGBA32F, "RGBA32F", 16, GL_RGBA, GL_FLOAT, GL_COLOR_ATTACHMENT0},
+    {GL_RG16F, "RG16F", 4, GL_RG, GL_FLOAT, GL_COLOR_ATTACHMENT0},
+    {GL_R8, "R8", 1, GL_RED, GL_UNSIGNED_BYTE, GL_COLOR_ATTACHMENT0},
+    {GL_DEPTH_COMPONENT24, "DEPTH24", 4, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, GL_DEPTH_ATTACHMENT},
+    {GL_DEPTH_COMPONENT32F, "DEPTH32F", 4, GL_DEPTH_COMPONENT, GL_FLOAT, GL_DEPTH_ATTACHMENT},
+    {GL_DEPTH24_STENCIL8, "DEPTH24_STENCIL8", 4, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, GL_DEPTH_STENCIL_ATTACHMENT},
+};
+
+static const RgFormat &format_info(GLenum format) {
+    for (size_t i = 0; i < sizeof(formats)/sizeof(formats[0]); i++) {
+        if (formats[i].format == format) {
+            return formats[i];
+        }
+    }
+    return formats[0];
+}
+
+static bool is_color(GLenum format) {
+    return format_info(format).attachment == GL_COLOR_ATTACHMENT0;
+}
+
+static size_t texture_bytes(GLenum format, int w, int h) {
+    return (size_t)w*h*format_info(format).bytes_per_texel;
+}
+
+void RenderGraph::reset() {
+    textures.clear();
+    passes.clear();
+    order.clear();
+}
+
+int RenderGraph::import_texture(const char *name, GLuint id, GLenum format, int w, int h) {
+    RgTexture t;
+    t.name = name;
+    t.format = format;
+    t.width = w;
+    t.height = h;
+    t.id = id;
+    t.imported = true;
+    t.output = false;
+    t.first = t.last = -1;
+    textures.push_back(t);
+    return (int)textures.size() - 1;
+}
+
+int RenderGraph::create_texture(const char *name, GLenum format, int w, int h) {
+    int index = import_texture(name, 0, format, w, h);
+    textures[index].imported = false;
+    return index;
+}
+
+void RenderGraph::output(int texture) {
+    textures[texture].output = true;
+}
+
+int RenderGraph::add_pass(const char *name, function<void()> run) {
+    RgPass p;
+    p.name = name;
+    p.run = run;
+    p.viewport[0] = p.viewport[1] = p.viewport[2] = p.viewport[3] = 0;
+    p.scissor[0] = p.scissor[1] = p.scissor[2] = p.scissor[3] = 0;
+    p.scissored = false;
+    p.culled = false;
+    p.cpu_ms = 0.0;
+    passes.push_back(p);
+    return (int)passes.size() - 1;
+}
+
+void RenderGraph::read(int pass, int texture) {
+    passes[pass].reads.push_back(texture);
+}
+
+void RenderGraph::write(int pass, int texture, bool clear) {
+    passes[pass].writes.push_back(texture);
+    passes[pass].clears.push_back(clear);
+}
+
+void RenderGraph::viewport(int pass, GLint x, GLint y, GLint w, GLint h) {
+    GLint *v = passes[pass].viewport;
+    v[0] = x;
+    v[1] = y;
+    v[2] = w;
+    v[3] = h;
+}
+
+void RenderGraph::scissor(int pass, GLint x, GLint y, GLint w, GLint h) {
+    GLint *s = passes[pass].scissor;
+    s[0] = x;
+    s[1] = y;
+    s[2] = w;
+    s[3] = h;
+    passes[pass].scissored = true;
+}
+
+bool RenderGraph::compile() {
+    size_t num_passes = passes.size();
+    order.clear();
+
+    // Dependencies: each writer after the previous writer of the texture, pure readers after the last one
+    vector<vector<int> > before(num_passes);
+    for (size_t t = 0; t < textures.size(); t++) {
+        int last_writer = -1;
+        for (size_t p = 0; p < num_passes; p++) {
+            if (find(passes[p].writes.begin(), passes[p].writes.end(), (int)t) != passes[p].writes.end()) {
+                if (last_writer >= 0) {
+                    before[p].push_back(last_writer);
+                }
+                last_writer = (int)p;
+            }
+        }
+        for (size_t p = 0; p < num_passes && last_writer >= 0; p++) {
+            const vector<int> &r = passes[p].reads, &w = passes[p].writes;
+            if (find(r.begin(), r.end(), (int)t) != r.end() && find(w.begin(), w.end(), (int)t) == w.end()) {
+                before[p].push_back(last_writer);
+            }
+        }
+    }
+
+    // Keep passes that write outputs and everything they depend on
+    vector<bool> live(num_passes, false);
+    vector<int> stack;
+    for (size_t p = 0; p < num_passes; p++) {
+        for (size_t i = 0; i < passes[p].writes.size(); i++) {
+            if (textures[passes[p].writes[i]].output && !live[p]) {
+                live[p] = true;
+                stack.push_back((int)p);
+            }
+        }
+    }
+    while (!stack.empty()) {
+        int p = stack.back();
+        stack.pop_back();
+        for (size_t i = 0; i < before[p].size(); i++) {
+            if (!live[before[p][i]]) {
+                live[before[p][i]] = true;
+                stack.push_back(before[p][i]);
+            }
+        }
+    }
+
+    // Topological order of the live passes, declaration order among independent ones
+    vector<int> waiting(num_passes, 0);
+    vector<vector<int> > after(num_passes);
+    size_t num_live = 0;
+    for (size_t p = 0; p < num_passes; p++) {
+        passes[p].culled = !live[p];
+        passes[p].cpu_ms = 0.0;
+        if (!live[p]) {
+            continue;
+        }
+        num_live++;
+        for (size_t i = 0; i < before[p].size(); i++) {
+            after[before[p][i]].push_back((int)p);
+            waiting[p]++;
+        }
+    }
+    set<int> ready;
+    for (size_t p = 0; p < num_passes; p++) {
+        if (live[p] && waiting[p] == 0) {
+            ready.insert((int)p);
+        }
+    }
+    while (!ready.empty()) {
+        int p = *ready.begin();
+        ready.erase(ready.begin());
+        order.push_back(p);
+        for (size_t i = 0; i < after[p].size(); i++) {
+            if (--waiting[after[p][i]] == 0) {
+                ready.insert(after[p][i]);
+            }
+        }
+    }
+    if (order.size() != num_live) {
+        fprintf(stderr, "ERROR: render graph passes depend on each other in a cycle\n");
+        order.clear();
+        return false;
+    }
+
+    // Lifetimes in schedule positions
+    for (size_t i = 0; i < order.size(); i++) {
+        const RgPass &p = passes[order[i]];
+        for (int pass_list = 0; pass_list < 2; pass_list++) {
+            const vector<int> &used = pass_list ? p.writes : p.reads;
+            for (size_t k = 0; k < used.size(); k++) {
+                RgTexture &t = textures[used[k]];
+                if (t.first < 0) {
+                    t.first = (int)i;
+                }
+                t.last = (int)i;
+            }
+        }
+    }
+
+    // Transients in order of first use, each into pool storage of its format and size that is free by then
+    for (size_t i = 0; i < pool.size(); i++) {
+        pool[i].busy_until = -1;
+    }
+    vector<int> transients;
+    for (size_t t = 0; t < textures.size(); t++) {
+        if (!textures[t].imported && textures[t].first >= 0) {
+            transients.push_back((int)t);
+        }
+    }
+    stable_sort(transients.begin(), transients.end(),
+                [&](int a, int b) { return textures[a].first < textures[b].first; });
+    for (size_t i = 0; i < transients.size(); i++) {
+        textures[transients[i]].id = allocate(textures[transients[i]]);
+    }
+
+    // Storage nothing has used for a while goes (e.g. sizes from before a resize)
+    for (size_t i = pool.size(); i-- > 0;) {
+        if (pool[i].busy_until >= 0) {
+            pool[i].idle_frames = 0;
+        } else if (++pool[i].idle_frames > keep_frames) {
+            delete_pool_texture(i);
+        }
+    }
+    return true;
+}
+
+GLuint RenderGraph::allocate(const RgTexture &texture) {
+    for (size_t i = 0; i < pool.size(); i++) {
+        PoolTexture &p = pool[i];
+        if (p.format == texture.format && p.width == texture.width && p.height == texture.height &&
+            p.busy_until < texture.first) {
+            p.busy_until = texture.last;
+            return p.id;
+        }
+    }
+    const RgFormat &f = format_info(texture.format);
+    PoolTexture p;
+    glGenTextures(1, &p.id);
+    gl_edit_texture(GL_TEXTURE_2D, p.id);
+    glTexImage2D(GL_TEXTURE_2D, 0, texture.format, texture.width, texture.height, 0, f.pixel_format, f.pixel_type, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    register_texture(p.id, ResRenderTargets, "render graph pool", texture.width, texture.height, f.name,
+                     f.bytes_per_texel, 1);
+    p.format = texture.format;
+    p.width = texture.width;
+    p.height = texture.height;
+    p.busy_until = texture.last;
+    p.idle_frames = 0;
+    pool.push_back(p);
+    return p.id;
+}
+
+void RenderGraph::delete_pool_texture(size_t index) {
+    GLuint id = pool[index].id;
+    for (map<vector<GLuint>, GLuint>::iterator it = framebuffers.begin(); it != framebuffers.end();) {
+        if (find(it->first.begin(), it->first.end(), id) != it->first.end()) {
+            glDeleteFramebuffers(1, &it->second);
+            framebuffers.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+    glDeleteTextures(1, &id);
+    unregister_resource(ResTexture, id);
+    pool.erase(pool.begin() + index);
+    // Deleted objects may still be in the binding cache
+    gl_state_reset();
+}
+
+GLuint RenderGraph::framebuffer(const RgPass &pass) {
+    vector<GLuint> key;
+    for (size_t i = 0; i < pass.writes.size(); i++) {
+        key.push_back(textures[pass.writes[i]].id);
+    }
+    map<vector<GLuint>, GLuint>::iterator it = framebuffers.find(key);
+    if (it != framebuffers.end()) {
+        return it->second;
+    }
+
+    GLuint fbo;
+    glGenFramebuffers(1, &fbo);
+    gl_bind_framebuffer(GL_FRAMEBUFFER, fbo);
+    vector<GLenum> draw_buffers;
+    for (size_t i = 0; i < pass.writes.size(); i++) {
+        const RgTexture &t = textures[pass.writes[i]];
+        GLenum attachment = format_info(t.format).attachment;
+        if (attachment == GL_COLOR_ATTACHMENT0) {
+            attachment = GL_COLOR_ATTACHMENT0 + (GLenum)draw_buffers.size();
+            draw_buffers.push_back(attachment);
+        }
+        glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, t.id, 0);
+    }
+    if (draw_buffers.empty()) {
+        glDrawBuffer(GL_NONE);
+    } else {
+        glDrawBuffers((GLsizei)draw_buffers.size(), draw_buffers.data());
+    }
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "ERROR: render graph framebuffer for pass %s is incomplete\n", pass.name);
+    }
+    framebuffers[key] = fbo;
+    return fbo;
+}
+
+void RenderGraph::execute() {
+    for (size_t i = 0; i < order.size(); i++) {
+        RgPass &p = passes[order[i]];
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+        if (!p.writes.empty()) {
+            current = framebuffer(p);
+            gl_bind_framebuffer(GL_FRAMEBUFFER, current);
+            const RgTexture &first = textures[p.writes[0]];
+            if (p.viewport[2] > 0 && p.viewport[3] > 0) {
+                gl_viewport(p.viewport[0], p.viewport[1], p.viewport[2], p.viewport[3]);
+            } else {
+                gl_viewport(0, 0, first.width, first.height);
+            }
+            if (p.scissored) {
+                gl_enable(GL_SCISSOR_TEST);
+                glScissor(p.scissor[0], p.scissor[1], p.scissor[2], p.scissor[3]);
+            } else {
+                gl_disable(GL_SCISSOR_TEST);
+            }
+
+            // Clear only what the pass asked for (the scissor limits clears too)
+            GLint color_index = 0;
+            for (size_t k = 0; k < p.writes.size(); k++) {
+                bool color = is_color(textures[p.writes[k]].format);
+                if (p.clears[k] && color) {
+                    gl_color_mask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+                    glClearBufferfv(GL_COLOR, color_index, clear_color);
+                } else if (p.clears[k]) {
+                    gl_depth_mask(GL_TRUE);
+                    glClearBufferfv(GL_DEPTH, 0, &clear_depth);
+                }
+                if (color) {
+                    color_index++;
+                }
+            }
+        }
+
+        p.run();
+        if (p.scissored) {
+            gl_disable(GL_SCISSOR_TEST);
+        }
+        p.cpu_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+    current = 0;
+}
+
+GLuint RenderGraph::target() const {
+    return current;
+}
+
+size_t RenderGraph::pool_bytes() const {
+    size_t bytes = 0;
+    for (size_t i = 0; i < pool.size(); i++) {
+        bytes += texture_bytes(pool[i].format, pool[i].width, pool[i].height);
+    }
+    return bytes;
+}
+
+size_t RenderGraph::transient_bytes() const {
+    size_t bytes = 0;
+    for (size_t t = 0; t < textures.size(); t++) {
+        if (!textures[t].imported && textures[t].first >= 0) {
+            bytes += texture_bytes(textures[t].format, textures[t].width, textures[t].height);
+        }
+    }
+    return bytes;
+}
+
+void RenderGraph::report(FILE *out) const {
+    const double mb = 1024.0*1024.0;
+    size_t num_transients = 0;
+    for (size_t t = 0; t < textures.size(); t++) {
+        if (!textures[t].imported && textures[t].first >= 0) {
+            num_transients++;
+        }
+    }
+    fprintf(out, "render graph: %u of %u passes scheduled, %u transients in %u pool textures (%.1f MB, %.1f MB unshared)\n",
+            (unsigned int)order.size(), (unsigned int)passes.size(), (unsigned int)num_transients,
+            (unsigned int)pool.size(), pool_bytes()/mb, transient_bytes()/mb);
+    for (size_t p = 0; p < passes.size(); p++) {
+        const RgPass &pass = passes[p];
+        fprintf(out, "  %-14s %s", pass.name, pass.culled ? "culled " : "");
+        for (size_t i = 0; i < pass.reads.size(); i++) {
+            fprintf(out, "%s%s", i ? ", " : "reads ", textures[pass.reads[i]].name);
+        }
+        for (size_t i = 0; i < pass.writes.size(); i++) {
+            fprintf(out, "%s%s%s", i ? ", " : (pass.reads.empty() ? "writes " : "; writes "),
+                    textures[pass.writes[i]].name, pass.clears[i] ? " (clear)" : "");
+        }
+        fprintf(out, "\n");
+    }
+}
@@ -0,0 +1,97 @@
+#ifndef RENDERGRAPH_H
+#define RENDERGRAPH_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <functional>
+#include <map>
+#include <vector>
+#include "../common/vgl.h"
+
+// Frame render graph. Each frame the renderer declares its passes and the textures they read and
+// write, compile() orders the passes by those dependencies, drops passes whose results nothing uses
+// and places transient textures in a shared pool (transients whose lifetimes don't overlap share
+// storage). execute() binds each pass's attachments (framebuffers are cached per attachment set),
+// sets its viewport and scissor, clears the attachments it asked to have cleared and runs it.
+//
+// Writers of a texture run in the order they were declared, passes that only read a texture run
+// after all of its writers.
+
+struct RgTexture {
+    const char *name;
+    GLenum format;              // internal format, e.g. GL_RGBA8 or GL_DEPTH_COMPONENT24
+    int width, height;
+    GLuint id;                  // imported texture, or pool storage once compiled (0 = not used this frame)
+    bool imported;
+    bool output;                // used after the graph runs, so its writers are never culled
+    int first, last;            // first and last position in the schedule using it (-1 = unused)
+};
+
+struct RgPass {
+    const char *name;
+    std::function<void()> run;
+    std::vector<int> reads;
+    std::vector<int> writes;    // attachments, color in declaration order then depth
+    std::vector<bool> clears;   // per write
+    GLint viewport[4];          // zero size = size of the first written texture
+    GLint scissor[4];
+    bool scissored;
+    bool culled;
+    double cpu_ms;              // submit time of the last execute (0 when culled)
+};
+
+struct RenderGraph {
+    std::vector<RgTexture> textures;
+    std::vector<RgPass> passes;
+    std::vector<int> order;     // scheduled passes
+    unsigned int keep_frames;   // pool storage unused for longer than this is deleted
+    GLfloat clear_color[4];
+    GLfloat clear_depth;
+
+    RenderGraph() : keep_frames(60), clear_depth(1.0f), current(0) {
+        clear_color[0] = clear_color[1] = clear_color[2] = clear_color[3] = 0.0f;
+    }
+
+    // Forget the last frame's declarations (pool storage and framebuffers are kept)
+    void reset();
+    // Texture owned by the renderer / texture that only lives while the graph runs
+    int import_texture(const char *name, GLuint id, GLenum format, int w, int h);
+    int create_texture(const char *name, GLenum format, int w, int h);
+    void output(int texture);
+
+    int add_pass(const char *name, std::function<void()> run);
+    void read(int pass, int texture);
+    void write(int pass, int texture, bool clear);
+    void viewport(int pass, GLint x, GLint y, GLint w, GLint h);
+    void scissor(int pass, GLint x, GLint y, GLint w, GLint h);
+
+    // Order, cull and allocate, false (with a message) if the dependencies form a cycle
+    bool compile();
+    void execute();
+    // Framebuffer of the running pass (for passes that blit into their own target)
+    GLuint target() const;
+    bool culled(int pass) const { return passes[pass].culled; }
+
+    // Pool storage, and what the transients of the last compile would need without sharing
+    size_t pool_bytes() const;
+    size_t transient_bytes() const;
+    void report(FILE *out) const;
+
+private:
+    struct PoolTexture {
+        GLuint id;
+        GLenum format;
+        int width, height;
+        int busy_until;         // last schedule position of its current user (-1 = free)
+        unsigned int idle_frames;
+    };
+    std::vector<PoolTexture> pool;
+    std::map<std::vector<GLuint>, GLuint> framebuffers;
+    GLuint current;
+
+    GLuint allocate(const RgTexture &texture);
+    GLuint framebuffer(const RgPass &pass);
+    void delete_pool_texture(size_t index);
+};
+
+#endif
@@ -0,0 +1,175 @@
+// GL resource registry and memory reports
+
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+#include "resources.h"
+
+using namespace std;
+
+// Texture counts as oversized when it is this many times larger than its largest on screen use
+#define OVERSIZED_RATIO 4.0f
+
+static map<pair<int, unsigned int>, ResourceInfo> gl_resources;
+static map<string, ResourceInfo> host_resources;
+
+static const char *category_names[NumResourceCategories] = {"mesh buffers", "color buffers", "uniform buffers",
+                                                            "other buffers", "textures", "render targets", "host data"};
+
+static ResourceInfo &entry(ResourceKind kind, unsigned int id, ResourceCategory category, const char *owner) {
+    ResourceInfo &info = gl_resources[make_pair((int)kind, id)];
+    if (info.allocations == 0) {
+        info.kind = kind;
+        info.id = id;
+        info.format = "";
+        info.width = info.height = info.mips = 0;
+        info.bytes = 0;
+        info.max_screen_size = 0.0f;
+    }
+    info.category = category;
+    info.owner = owner;
+    info.allocations++;
+    return info;
+}
+
+static double megabytes(size_t bytes) {
+    return bytes/(1024.0*1024.0);
+}
+
+void register_buffer(unsigned int id, ResourceCategory category, const char *owner, size_t bytes) {
+    ResourceInfo &info = entry(ResBuffer, id, category, owner);
+    info.bytes = bytes;
+}
+
+void register_texture(unsigned int id, ResourceCategory category, const char *owner, int w, int h, const char *format,
+                      int bytes_per_texel, int mips) {
+    ResourceInfo &info = entry(ResTexture, id, category, owner);
+    info.format = format;
+    info.width = w;
+    info.height = h;
+    info.mips = mips;
+    info.bytes = 0;
+    for (int level = 0; level < mips; level++) {
+        info.bytes += (size_t)max(w >> level, 1)*max(h >> level, 1)*bytes_per_texel;
+    }
+}
+
+void register_renderbuffer(unsigned int id, const char *owner, int w, int h, const char *format, int bytes_per_texel) {
+    ResourceInfo &info = entry(ResRenderbuffer, id, ResRenderTargets, owner);
+    info.format = format;
+    info.width = w;
+    info.height = h;
+    info.mips = 1;
+    info.bytes = (size_t)w*h*bytes_per_texel;
+}
+
+void register_host(const char *owner, size_t bytes) {
+    ResourceInfo &info = host_resources[owner];
+    info.kind = ResHost;
+    info.id = 0;
+    info.category = ResHostData;
+    info.owner = owner;
+    info.format = "";
+    info.width = info.height = info.mips = 0;
+    info.bytes = bytes;
+    info.allocations++;
+    info.max_screen_size = 0.0f;
+}
+
+void unregister_resource(ResourceKind kind, unsigned int id) {
+    gl_resources.erase(make_pair((int)kind, id));
+}
+
+int full_mip_count(int w, int h) {
+    int mips = 1;
+    for (int size = max(w, h); size > 1; size >>= 1) {
+        mips++;
+    }
+    return mips;
+}
+
+void note_texture_use(unsigned int id, float screen_size) {
+    map<pair<int, unsigned int>, ResourceInfo>::iterator it = gl_resources.find(make_pair((int)ResTexture, id));
+    if (it != gl_resources.end() && screen_size > it->second.max_screen_size) {
+        it->second.max_screen_size = screen_size;
+    }
+}
+
+static bool larger(const ResourceInfo *a, const ResourceInfo *b) {
+    return a->bytes > b->bytes;
+}
+
+void report_resources(FILE *out) {
+    // Totals by category
+    size_t counts[NumResourceCategories] = {0};
+    size_t bytes[NumResourceCategories] = {0};
+    vector<const ResourceInfo *> all;
+    map<pair<int, unsigned int>, ResourceInfo>::const_iterator it;
+    for (it = gl_resources.begin(); it != gl_resources.end(); ++it) {
+        all.push_back(&it->second);
+    }
+    map<string, ResourceInfo>::const_iterator host;
+    for (host = host_resources.begin(); host != host_resources.end(); ++host) {
+        all.push_back(&host->second);
+    }
+    size_t gpu_total = 0;
+    for (size_t i = 0; i < all.size(); i++) {
+        counts[all[i]->category]++;
+        bytes[all[i]->category] += all[i]->bytes;
+        if (all[i]->kind != ResHost) {
+            gpu_total += all[i]->bytes;
+        }
+    }
+
+    fprintf(out, "Memory by category:\n");
+    for (int c = 0; c < NumResourceCategories; c++) {
+        fprintf(out, "  %-16s %5zu %10.2f MB\n", category_names[c], counts[c], megabytes(bytes[c]));
+    }
+    fprintf(out, "  %-16s %5s %10.2f MB\n", "GPU total", "", megabytes(gpu_total));
+    fprintf(out, "  %-16s %5s %10.2f MB\n", "host total", "", megabytes(bytes[ResHostData]));
+
+    // Largest single resources
+    sort(all.begin(), all.end(), larger);
+    fprintf(out, "Largest resources:\n");
+    for (size_t i = 0; i < all.size() && i < 10; i++) {
+        const ResourceInfo &r = *all[i];
+        fprintf(out, "  %10.2f MB  %-16s %s", megabytes(r.bytes), category_names[r.category], r.owner.c_str());
+        if (r.width > 0) {
+            fprintf(out, " (%dx%d %s, %d mips)", r.width, r.height, r.format, r.mips);
+        }
+        if (r.allocations > 1) {
+            fprintf(out, " [allocated %u times]", r.allocations);
+        }
+        fprintf(out, "\n");
+    }
+
+    // Textures whose top mip levels are never sampled at the sizes they were drawn
+    bool header = false;
+    for (size_t i = 0; i < all.size(); i++) {
+        const ResourceInfo &r = *all[i];
+        if (r.kind != ResTexture || r.category != ResTextures) {
+            continue;
+        }
+        int size = max(r.width, r.height);
+        if (r.max_screen_size > 0.0f && size <= OVERSIZED_RATIO*r.max_screen_size) {
+            continue;
+        }
+        if (!header) {
+            fprintf(out, "Oversized textures (more than %.0fx their largest on screen size):\n", OVERSIZED_RATIO);
+            header = true;
+        }
+        if (r.max_screen_size == 0.0f) {
+            fprintf(out, "  %s %dx%d (%.2f MB): never drawn\n", r.owner.c_str(), r.width, r.height, megabytes(r.bytes));
+            continue;
+        }
+        // Smallest power of two at least as large as the screen use
+        int fit = 1;
+        while (fit < r.max_screen_size) {
+            fit <<= 1;
+        }
+        double fit_bytes = (double)r.bytes*((double)fit*fit)/((double)size*size);
+        fprintf(out, "  %s %dx%d (%.2f MB): at most %.0f px on screen, %d would do (saves %.2f MB)\n", r.owner.c_str(),
+                r.width, r.height, megabytes(r.bytes), r.max_screen_size, fit, megabytes((size_t)(r.bytes - fit_bytes)));
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef RESOURCES_H
+#define RESOURCES_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string>
+
+// Registry of GL allocations (and large CPU side copies) for memory reports. Sizes are what
+// the data needs (mip chains included); drivers may pad or keep their own copies.
+
+enum ResourceKind {ResBuffer, ResTexture, ResRenderbuffer, ResHost};
+enum ResourceCategory {ResMeshBuffers, ResColorBuffers, ResUniformBuffers, ResOtherBuffers, ResTextures, ResRenderTargets,
+                       ResHostData, NumResourceCategories};
+
+struct ResourceInfo {
+    ResourceKind kind;
+    unsigned int id;            // GL name (0 for host data)
+    ResourceCategory category;
+    std::string owner;          // mesh/texture file, or what the resource is for
+    const char *format;         // textures and renderbuffers, e.g. "RGBA8"
+    int width, height, mips;
+    size_t bytes;
+    unsigned int allocations;   // times (re)allocated
+    float max_screen_size;      // textures: largest on screen size drawn (pixels), 0 = never drawn
+};
+
+// Record (or update, when reallocated) an allocation
+void register_buffer(unsigned int id, ResourceCategory category, const char *owner, size_t bytes);
+void register_texture(unsigned int id, ResourceCategory category, const char *owner, int w, int h, const char *format,
+                      int bytes_per_texel, int mips);
+void register_renderbuffer(unsigned int id, const char *owner, int w, int h, const char *format, int bytes_per_texel);
+void register_host(const char *owner, size_t bytes);
+// Drop a deleted GL allocation
+void unregister_resource(ResourceKind kind, unsigned int id);
+
+// Full mip chain length for a w x h texture
+int full_mip_count(int w, int h);
+
+// Texture was drawn covering about screen_size pixels across
+void note_texture_use(unsigned int id, float screen_size);
+
+// Totals by category, largest resources and textures much larger than their on screen use
+void report_resources(FILE *out);
+
+#endif
@@ -0,0 +1,454 @@
+// Text scene parser and flat binary scene images
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include "scene.h"
+#include "../common/vmath.h"
+
+using namespace vmath;
+using namespace std;
+
+uint32_t SceneData::add_string(const char *s) {
+    uint32_t offset = (uint32_t)strings.size();
+    strings.insert(strings.end(), s, s + strlen(s) + 1);
+    return offset;
+}
+
+// Line-by-line tokenizer with error reporting
+struct SceneParser {
+    const char *path;
+    int line_number;
+    vector<string> tokens;
+    size_t next;
+    bool ok;
+
+    void error(const char *message, const string &detail = "") {
+        fprintf(stderr, "ERROR: %s:%d: %s%s%s\n", path, line_number, message, detail.empty() ? "" : " ", detail.c_str());
+        ok = false;
+    }
+
+    bool more() const { return next < tokens.size(); }
+
+    string word() {
+        if (!more()) {
+            error("unexpected end of line");
+            return "";
+        }
+        return tokens[next++];
+    }
+
+    float number() {
+        string w = word();
+        char *end = NULL;
+        float v = strtof(w.c_str(), &end);
+        if (!ok || w.empty() || *end != '\0') {
+            if (ok) error("expected a number, got", w);
+            return 0.0f;
+        }
+        return v;
+    }
+
+    void numbers(float *out, int n) {
+        for (int i = 0; i < n; i++) {
+            out[i] = number();
+        }
+    }
+
+    // Keyword followed by n numbers (e.g. "ambient r g b a")
+    void field(const char *keyword, float *out, int n) {
+        string w = word();
+        if (ok && w != keyword) {
+            error("expected", keyword);
+            return;
+        }
+        numbers(out, n);
+    }
+};
+
+static bool lookup(SceneParser &p, const map<string, uint32_t> &names, const string &name, const char *kind, int32_t &index) {
+    map<string, uint32_t>::const_iterator it = names.find(name);
+    if (it == names.end()) {
+        p.error((string("unknown ") + kind).c_str(), name);
+        return false;
+    }
+    index = (int32_t)it->second;
+    return true;
+}
+
+static void store_matrix(const mat4 &m, float *out) {
+    memcpy(out, (const float *)m, 16*sizeof(float));
+}
+
+bool parse_scene(const char *path, SceneData &data) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "ERROR: could not open scene %s\n", path);
+        return false;
+    }
+
+    SceneParser p;
+    p.path = path;
+    p.line_number = 0;
+    p.ok = true;
+    map<string, uint32_t> meshes, textures, materials, lights;
+
+    // Instance being read (between "instance" and "end")
+    bool in_instance = false;
+    SceneInstance inst;
+    mat4 pre, post;
+    bool animated = false;
+
+    char line[1024];
+    while (p.ok && fgets(line, sizeof(line), file)) {
+        p.line_number++;
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+        p.tokens.clear();
+        p.next = 0;
+        for (char *t = strtok(line, " \t\r\n"); t; t = strtok(NULL, " \t\r\n")) {
+            p.tokens.push_back(t);
+        }
+        if (p.tokens.empty()) {
+            continue;
+        }
+        string keyword = p.word();
+
+        if (in_instance) {
+            // Transform operations, one may use an animation variable
+            mat4 op = mat4().identity();
+            bool split = false;
+            if (keyword == "end") {
+                if (animated && (inst.flags & SceneBaked)) p.error("baked instance can't be animated");
+                if (!animated) store_matrix(pre, inst.pre);
+                store_matrix(post, inst.post);
+                data.instances.push_back(inst);
+                in_instance = false;
+            } else if (keyword == "translate") {
+                float t[3];
+                p.numbers(t, 3);
+                op = translate(t[0], t[1], t[2]);
+            } else if (keyword == "rotate" || keyword == "scale") {
+                float v[4];
+                int count = (keyword == "rotate") ? 4 : 3;
+                int variable = -1;
+                uint32_t animation = SceneAnimNone;
+                for (int i = 0; i < count && p.ok; i++) {
+                    string w = p.more() ? p.tokens[p.next] : "";
+                    if (w == "$fan" || w == "$blinds") {
+                        p.next++;
+                        if (variable >= 0 || animated) {
+                            p.error("only one animated value per instance");
+                        }
+                        variable = i;
+                        animation = (w == "$fan") ? SceneAnimFan : SceneAnimBlinds;
+                        v[i] = 1.0f;
+                    } else {
+                        v[i] = p.number();
+                    }
+                }
+                if (keyword == "rotate" && variable > 0) {
+                    p.error("only the rotate angle can be animated");
+                }
+                if (variable >= 0) {
+                    // Split transform around the animated operation
+                    animated = true;
+                    inst.animation = animation;
+                    if (keyword == "rotate") {
+                        inst.anim_op = SceneOpRotate;
+                        inst.anim_component = 0;
+                        inst.anim_params[0] = v[1]; inst.anim_params[1] = v[2]; inst.anim_params[2] = v[3];
+                    } else {
+                        inst.anim_op = SceneOpScale;
+                        inst.anim_component = variable;
+                        inst.anim_params[0] = v[0]; inst.anim_params[1] = v[1]; inst.anim_params[2] = v[2];
+                    }
+                    inst.anim_params[3] = 0.0f;
+                    store_matrix(pre, inst.pre);
+                    split = true;
+                } else {
+                    op = (keyword == "rotate") ? rotate(v[0], vec3(v[1], v[2], v[3])) : scale(v[0], v[1], v[2]);
+                }
+            } else {
+                p.error("expected translate, rotate, scale or end, got", keyword);
+                break;
+            }
+            if (split || keyword == "end") {
+                // Nothing to multiply
+            } else if (animated) {
+                post = post*op;
+            } else {
+                pre = pre*op;
+            }
+
+        } else if (keyword == "mesh") {
+            string name = p.word();
+            string file_path = p.word();
+            SceneMesh mesh;
+            mesh.flags = 0;
+            while (p.ok && p.more()) {
+                string flag = p.word();
+                if (flag == "bump") mesh.flags |= SceneMeshBump;
+                else p.error("unknown mesh flag", flag);
+            }
+            if (!p.ok) break;
+            if (meshes.count(name)) p.error("duplicate mesh", name);
+            mesh.path = data.add_string(file_path.c_str());
+            meshes[name] = data.meshes.size();
+            data.meshes.push_back(mesh);
+
+        } else if (keyword == "texture") {
+            string name = p.word();
+            string file_path = p.word();
+            if (!p.ok) break;
+            if (textures.count(name)) p.error("duplicate texture", name);
+            SceneTexture texture;
+            texture.path = data.add_string(file_path.c_str());
+            textures[name] = data.textures.size();
+            data.textures.push_back(texture);
+
+        } else if (keyword == "material") {
+            string name = p.word();
+            SceneMaterial m;
+            memset(&m, 0, sizeof(m));
+            p.field("ambient", m.ambient, 4);
+            p.field("diffuse", m.diffuse, 4);
+            p.field("specular", m.specular, 4);
+            p.field("shininess", &m.shininess, 1);
+            if (!p.ok) break;
+            if (materials.count(name)) p.error("duplicate material", name);
+            if (data.materials.size() >= SCENE_MAX_MATERIALS) p.error("too many materials (shader limit is 256)");
+            materials[name] = data.materials.size();
+            data.materials.push_back(m);
+
+        } else if (keyword == "light") {
+            string name = p.word();
+            string type = p.word();
+            SceneLight l;
+            memset(&l, 0, sizeof(l));
+            // Same values as LightType
+            if (type == "off") l.type = 0;
+            else if (type == "directional") l.type = 1;
+            else if (type == "point") l.type = 2;
+            else if (type == "spot") l.type = 3;
+            else p.error("unknown light type", type);
+            p.field("ambient", l.ambient, 4);
+            p.field("diffuse", l.diffuse, 4);
+            p.field("specular", l.specular, 4);
+            p.field("position", l.position, 4);
+            p.field("direction", l.direction, 4);
+            p.field("cutoff", &l.spotCutoff, 1);
+            p.field("exponent", &l.spotExponent, 1);
+            int32_t on = 1;
+            if (p.ok && p.more()) {
+                string flag = p.word();
+                if (flag == "disabled") on = 0;
+                else p.error("unknown light flag", flag);
+            }
+            if (!p.ok) break;
+            if (lights.count(name)) p.error("duplicate light", name);
+            if (data.lights.size() >= SCENE_MAX_LIGHTS) p.error("too many lights (shader limit is 16)");
+            lights[name] = data.lights.size();
+            data.lights.push_back(l);
+            data.light_on.push_back(on);
+
+        } else if (keyword == "instance") {
+            memset(&inst, 0, sizeof(inst));
+            inst.material = inst.texture = inst.texture2 = inst.channel = -1;
+            int32_t mesh = 0;
+            if (!lookup(p, meshes, p.word(), "mesh", mesh)) break;
+            inst.mesh = mesh;
+            string shader = p.word();
+            if (shader == "color") inst.shader = SceneColorShader;
+            else if (shader == "mat") inst.shader = SceneMatShader;
+            else if (shader == "tex") inst.shader = SceneTexShader;
+            else if (shader == "multitex") inst.shader = SceneMultiTexShader;
+            else if (shader == "bump") inst.shader = SceneBumpShader;
+            else p.error("unknown shader", shader);
+
+            while (p.ok && p.more()) {
+                string option = p.word();
+                if (option == "material") {
+                    lookup(p, materials, p.word(), "material", inst.material);
+                } else if (option == "texture") {
+                    lookup(p, textures, p.word(), "texture", inst.texture);
+                } else if (option == "texture2") {
+                    lookup(p, textures, p.word(), "texture", inst.texture2);
+                } else if (option == "color") {
+                    // Same order as Color_Buffer_IDs
+                    string color = p.word();
+                    if (color == "red") inst.material = 0;
+                    else if (color == "blue") inst.material = 1;
+                    else if (color == "green") inst.material = 2;
+                    else p.error("unknown color", color);
+                } else if (option == "channel") {
+                    inst.channel = (int32_t)p.number();
+                } else if (option == "nomirror") {
+                    inst.flags |= SceneNoMirror;
+                } else if (option == "nodepthwrite") {
+                    inst.flags |= SceneNoDepthWrite;
+                } else if (option == "room") {
+                    inst.flags |= SceneRoom;
+                } else if (option == "baked") {
+                    inst.flags |= SceneBaked;
+                } else {
+                    p.error("unknown instance option", option);
+                }
+            }
+            if (!p.ok) break;
+
+            // Check the shader has what it samples
+            bool needs_material = inst.shader == SceneColorShader || inst.shader == SceneMatShader;
+            bool needs_texture2 = inst.shader == SceneMultiTexShader || inst.shader == SceneBumpShader;
+            if (needs_material && inst.material < 0) p.error("instance needs a material (or color)");
+            if (!needs_material && inst.texture < 0) p.error("instance needs a texture");
+            if (needs_texture2 && inst.texture2 < 0) p.error("instance needs texture2");
+            if (inst.shader == SceneBumpShader && !(data.meshes[inst.mesh].flags & SceneMeshBump)) {
+                p.error("bump instance of a mesh loaded without the bump flag");
+            }
+            if ((inst.flags & SceneBaked) && inst.shader != SceneMatShader) {
+                p.error("only mat instances can be baked");
+            }
+            pre = mat4().identity();
+            post = mat4().identity();
+            animated = false;
+            in_instance = true;
+
+        } else {
+            p.error("unknown statement", keyword);
+        }
+        if (p.ok && p.more()) {
+            p.error("unexpected", p.tokens[p.next]);
+        }
+    }
+    fclose(file);
+
+    if (p.ok && in_instance) {
+        p.error("missing end of instance");
+    }
+    return p.ok;
+}
+
+// Append an array at a 16 byte aligned offset
+template <typename T>
+static uint32_t append_array(vector<char> &image, const T *items, size_t count) {
+    size_t offset = (image.size() + 15) & ~(size_t)15;
+    image.resize(offset + count*sizeof(T));
+    if (count) {
+        memcpy(&image[offset], items, count*sizeof(T));
+    }
+    return (uint32_t)offset;
+}
+
+void build_scene_image(const SceneData &data, vector<char> &image) {
+    SceneHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SCENE_MAGIC, 4);
+    header.version = SCENE_VERSION;
+    header.num_meshes = data.meshes.size();
+    header.num_textures = data.textures.size();
+    header.num_materials = data.materials.size();
+    header.num_lights = data.lights.size();
+    header.num_instances = data.instances.size();
+
+    image.assign(sizeof(SceneHeader), 0);
+    header.meshes = append_array(image, data.meshes.data(), data.meshes.size());
+    header.textures = append_array(image, data.textures.data(), data.textures.size());
+    header.materials = append_array(image, data.materials.data(), data.materials.size());
+    header.lights = append_array(image, data.lights.data(), data.lights.size());
+    header.light_on = append_array(image, data.light_on.data(), data.light_on.size());
+    header.instances = append_array(image, data.instances.data(), data.instances.size());
+    // String table always has at least the empty string
+    static const char empty_strings[1] = {'\0'};
+    bool no_strings = data.strings.empty();
+    header.strings = append_array(image, no_strings ? empty_strings : data.strings.data(), no_strings ? 1 : data.strings.size());
+    header.strings_size = no_strings ? 1 : data.strings.size();
+    header.file_size = image.size();
+    memcpy(&image[0], &header, sizeof(header));
+}
+
+bool cook_scene(const char *path, vector<char> &image) {
+    SceneData data;
+    if (!parse_scene(path, data)) {
+        return false;
+    }
+    build_scene_image(data, image);
+    return true;
+}
+
+bool open_scene(const char *data, size_t size, Scene &scene) {
+    if (size < sizeof(SceneHeader)) {
+        fprintf(stderr, "ERROR: scene image too small\n");
+        return false;
+    }
+    const SceneHeader *h = (const SceneHeader *)data;
+    if (memcmp(h->magic, SCENE_MAGIC, 4) != 0 || h->version != SCENE_VERSION || h->file_size != size) {
+        fprintf(stderr, "ERROR: not a version %d scene image (or truncated)\n", SCENE_VERSION);
+        return false;
+    }
+
+    // Every array must lie inside the image
+    struct Range { uint32_t offset; uint64_t bytes; } ranges[] = {
+            {h->meshes, (uint64_t)h->num_meshes*sizeof(SceneMesh)},
+            {h->textures, (uint64_t)h->num_textures*sizeof(SceneTexture)},
+            {h->materials, (uint64_t)h->num_materials*sizeof(SceneMaterial)},
+            {h->lights, (uint64_t)h->num_lights*sizeof(SceneLight)},
+            {h->light_on, (uint64_t)h->num_lights*sizeof(int32_t)},
+            {h->instances, (uint64_t)h->num_instances*sizeof(SceneInstance)},
+            {h->strings, (uint64_t)h->strings_size},
+    };
+    for (int i = 0; i < 7; i++) {
+        if (ranges[i].offset % 4 != 0 || ranges[i].offset + ranges[i].bytes > size) {
+            fprintf(stderr, "ERROR: scene image has an array outside the file\n");
+            return false;
+        }
+    }
+    if (h->num_materials > SCENE_MAX_MATERIALS || h->num_lights > SCENE_MAX_LIGHTS) {
+        fprintf(stderr, "ERROR: scene has more than %d materials or %d lights\n", SCENE_MAX_MATERIALS, SCENE_MAX_LIGHTS);
+        return false;
+    }
+
+    scene.header = h;
+    scene.meshes = (const SceneMesh *)(data + h->meshes);
+    scene.textures = (const SceneTexture *)(data + h->textures);
+    scene.materials = (const SceneMaterial *)(data + h->materials);
+    scene.lights = (const SceneLight *)(data + h->lights);
+    scene.light_on = (const int32_t *)(data + h->light_on);
+    scene.instances = (const SceneInstance *)(data + h->instances);
+    scene.strings = data + h->strings;
+
+    // Strings must be terminated and references in range
+    if (h->strings_size == 0 || scene.strings[h->strings_size - 1] != '\0') {
+        fprintf(stderr, "ERROR: scene image has a bad string table\n");
+        return false;
+    }
+    for (uint32_t i = 0; i < h->num_meshes; i++) {
+        if (scene.meshes[i].path >= h->strings_size) {
+            fprintf(stderr, "ERROR: scene mesh %u has a bad path\n", i);
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < h->num_textures; i++) {
+        if (scene.textures[i].path >= h->strings_size) {
+            fprintf(stderr, "ERROR: scene texture %u has a bad path\n", i);
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < h->num_instances; i++) {
+        const SceneInstance &inst = scene.instances[i];
+        bool is_color = inst.shader == SceneColorShader;
+        bool needs_material = is_color || inst.shader == SceneMatShader;
+        bool needs_texture2 = inst.shader == SceneMultiTexShader || inst.shader == SceneBumpShader;
+        if (inst.mesh >= h->num_meshes || inst.shader > SceneBumpShader ||
+            inst.material >= (int32_t)(is_color ? 3 : h->num_materials) || (needs_material && inst.material < 0) ||
+            inst.texture >= (int32_t)h->num_textures || (!needs_material && inst.texture < 0) ||
+            inst.texture2 >= (int32_t)h->num_textures || (needs_texture2 && inst.texture2 < 0) ||
+            inst.animation > SceneAnimBlinds || inst.anim_op > SceneOpScale || inst.anim_component > 2) {
+            fprintf(stderr, "ERROR: scene instance %u is out of range\n", i);
+            return false;
+        }
+    }
+    return true;
+}
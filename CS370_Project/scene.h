@@ -0,0 +1,134 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Text scenes (one statement per line, '#' comments, paths relative to the scene file):
+//
+//   mesh <name> <path.obj | @quad> [bump]
+//   texture <name> <path | @mirror>
+//   material <name> ambient r g b a diffuse r g b a specular r g b a shininess s
+//   light <name> <off|directional|point|spot> ambient r g b a diffuse r g b a specular r g b a
+//         position x y z w direction x y z w cutoff c exponent e [disabled]
+//   instance <mesh> <color|mat|tex|multitex|bump> [material m] [texture t] [texture2 t2] [color red|green|blue]
+//            [channel n] [nomirror] [nodepthwrite] [room] [baked]
+//       translate x y z | rotate angle x y z | scale x y z     (multiplied left to right)
+//   end
+//
+// One value of an instance's transform may be an animation variable ($fan rotate angle or a
+// $blinds scale component). cook_scene() compiles this into a flat binary image that
+// open_scene() can use in place (e.g. straight from a mapped file).
+
+#define SCENE_MAGIC "HSCN"
+#define SCENE_VERSION 1
+#define SCENE_MAX_MATERIALS 256
+#define SCENE_MAX_LIGHTS 16
+
+enum SceneShader {SceneColorShader, SceneMatShader, SceneTexShader, SceneMultiTexShader, SceneBumpShader};
+enum SceneMeshFlags {SceneMeshBump = 1};
+// room: shell/wall fixtures, not furniture; baked: static, lit from lightmaps (see lightmap.h)
+enum SceneInstanceFlags {SceneNoMirror = 1, SceneNoDepthWrite = 2, SceneRoom = 4, SceneBaked = 8};
+enum SceneAnimation {SceneAnimNone, SceneAnimFan, SceneAnimBlinds};
+enum SceneAnimOp {SceneOpRotate, SceneOpScale};
+
+// File header, all offsets are bytes from the start of the image
+struct SceneHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t file_size;
+    uint32_t num_meshes, num_textures, num_materials, num_lights, num_instances;
+    uint32_t meshes, textures, materials, lights, light_on, instances;
+    uint32_t strings, strings_size;
+};
+
+struct SceneMesh {
+    uint32_t path;      // string table offset
+    uint32_t flags;
+};
+
+struct SceneTexture {
+    uint32_t path;
+};
+
+// Same std140 layout as MaterialProperties
+struct SceneMaterial {
+    float ambient[4];
+    float diffuse[4];
+    float specular[4];
+    float shininess;
+    float pad[3];
+};
+
+// Same std140 layout as LightProperties
+struct SceneLight {
+    int32_t type;
+    float pad1[3];
+    float ambient[4];
+    float diffuse[4];
+    float specular[4];
+    float position[4];
+    float direction[4];
+    float spotCutoff;
+    float spotExponent;
+    float pad2[2];
+};
+
+// Model matrix is pre * op(animation value) * post (column-major), or just pre when not animated
+struct SceneInstance {
+    uint32_t mesh;
+    uint32_t shader;
+    int32_t material;       // material index (color buffer index for the color shader)
+    int32_t texture;
+    int32_t texture2;
+    int32_t channel;        // drawn only on this TV channel, -1 = always
+    uint32_t flags;
+    uint32_t animation;
+    uint32_t anim_op;
+    uint32_t anim_component;
+    float anim_params[4];   // rotate: axis, scale: base scale
+    float pre[16];
+    float post[16];
+};
+
+// View of a validated scene image
+struct Scene {
+    const SceneHeader *header;
+    const SceneMesh *meshes;
+    const SceneTexture *textures;
+    const SceneMaterial *materials;
+    const SceneLight *lights;
+    const int32_t *light_on;
+    const SceneInstance *instances;
+    const char *strings;
+
+    const char *string(uint32_t offset) const { return strings + offset; }
+};
+
+// Scene contents before flattening (parsed text or generated)
+struct SceneData {
+    std::vector<SceneMesh> meshes;
+    std::vector<SceneTexture> textures;
+    std::vector<SceneMaterial> materials;
+    std::vector<SceneLight> lights;
+    std::vector<int32_t> light_on;
+    std::vector<SceneInstance> instances;
+    std::vector<char> strings;
+
+    uint32_t add_string(const char *s);
+};
+
+// Parse a text scene (errors are printed with file:line)
+bool parse_scene(const char *path, SceneData &data);
+
+// Flatten scene data into a binary image
+void build_scene_image(const SceneData &data, std::vector<char> &image);
+
+// Parse and flatten a text scene
+bool cook_scene(const char *path, std::vector<char> &image);
+
+// Check a binary image (header, offsets, indices) and point scene into it
+bool open_scene(const char *data, size_t size, Scene &scene);
+
+#endif
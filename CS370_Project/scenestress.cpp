@@ -0,0 +1,122 @@
+// Procedural stress scenes (room furniture tiled over a grid)
+
+#include <string.h>
+#include <math.h>
+#include <random>
+#include "scenestress.h"
+#include "../common/vmath.h"
+
+using namespace vmath;
+using namespace std;
+
+// Random materials added to the base ones and cell size (one room)
+#define STRESS_MATERIALS 64
+#define STRESS_CELL_SIZE 8.0f
+
+static mat4 load_matrix(const float *m) {
+    mat4 result;
+    memcpy((float *)result, m, 16*sizeof(float));
+    return result;
+}
+
+static void store_matrix(const mat4 &m, float *out) {
+    memcpy(out, (const float *)m, 16*sizeof(float));
+}
+
+void generate_stress_scene(const Scene &base, unsigned int count, unsigned int seed, SceneData &out) {
+    const SceneHeader *h = base.header;
+    mt19937 rng(seed);
+    uniform_real_distribution<float> unit(0.0f, 1.0f);
+    out = SceneData();
+
+    // Same meshes and textures, so loaded GL objects stay valid
+    for (uint32_t i = 0; i < h->num_meshes; i++) {
+        SceneMesh mesh = base.meshes[i];
+        mesh.path = out.add_string(base.string(mesh.path));
+        out.meshes.push_back(mesh);
+    }
+    for (uint32_t i = 0; i < h->num_textures; i++) {
+        SceneTexture texture = base.textures[i];
+        texture.path = out.add_string(base.string(texture.path));
+        out.textures.push_back(texture);
+    }
+
+    // Base materials plus random diffuse colors
+    out.materials.assign(base.materials, base.materials + h->num_materials);
+    while (out.materials.size() < STRESS_MATERIALS && out.materials.size() < SCENE_MAX_MATERIALS) {
+        SceneMaterial m;
+        memset(&m, 0, sizeof(m));
+        for (int k = 0; k < 3; k++) {
+            m.ambient[k] = 0.1f*unit(rng);
+            m.diffuse[k] = 0.2f + 0.8f*unit(rng);
+            m.specular[k] = 0.5f;
+        }
+        m.ambient[3] = m.diffuse[3] = m.specular[3] = 1.0f;
+        m.shininess = 8.0f + 56.0f*unit(rng);
+        out.materials.push_back(m);
+    }
+
+    // Furniture to copy
+    vector<uint32_t> furniture;
+    for (uint32_t i = 0; i < h->num_instances; i++) {
+        if (!(base.instances[i].flags & SceneRoom) && base.instances[i].channel < 0) {
+            furniture.push_back(i);
+        }
+    }
+    uint32_t cells = furniture.empty() ? 0 : (count + furniture.size() - 1)/furniture.size();
+    uint32_t side = (uint32_t)ceil(sqrt((double)cells));
+    float origin = -0.5f*(side - 1)*STRESS_CELL_SIZE;
+
+    // Base lights plus point lights over random cells, each randomly switched on or off
+    out.lights.assign(base.lights, base.lights + h->num_lights);
+    out.light_on.assign(base.light_on, base.light_on + h->num_lights);
+    while (cells > 0 && out.lights.size() < SCENE_MAX_LIGHTS) {
+        SceneLight l;
+        memset(&l, 0, sizeof(l));
+        l.type = 2;     // point (LightType POINT)
+        for (int k = 0; k < 3; k++) {
+            l.diffuse[k] = 0.3f + 0.4f*unit(rng);
+            l.specular[k] = 0.2f;
+        }
+        l.ambient[3] = l.diffuse[3] = l.specular[3] = 1.0f;
+        uint32_t cell = rng() % cells;
+        l.position[0] = origin + (cell % side)*STRESS_CELL_SIZE;
+        l.position[1] = 1.0f;
+        l.position[2] = origin + (cell / side)*STRESS_CELL_SIZE;
+        l.position[3] = 1.0f;
+        out.lights.push_back(l);
+        out.light_on.push_back(unit(rng) < 0.5f ? 1 : 0);
+    }
+
+    // Objects fill the cells in order, one full furniture set per cell
+    out.instances.reserve(count);
+    mat4 cell_matrix;
+    for (uint32_t k = 0; k < count && !furniture.empty(); k++) {
+        uint32_t cell = k / furniture.size();
+        if (k % furniture.size() == 0) {
+            float turn = 90.0f*(rng() % 4);
+            cell_matrix = translate(origin + (cell % side)*STRESS_CELL_SIZE, 0.0f, origin + (cell / side)*STRESS_CELL_SIZE)*
+                          rotate(turn, 0.0f, 1.0f, 0.0f);
+        }
+
+        SceneInstance inst = base.instances[furniture[k % furniture.size()]];
+
+        // Small offset along the floor and uniform scale in the object's own space
+        mat4 jitter = translate(unit(rng) - 0.5f, 0.0f, unit(rng) - 0.5f);
+        float s = 0.8f + 0.4f*unit(rng);
+        if (inst.animation == SceneAnimNone) {
+            store_matrix(cell_matrix*jitter*load_matrix(inst.pre)*scale(s, s, s), inst.pre);
+        } else {
+            store_matrix(cell_matrix*jitter*load_matrix(inst.pre), inst.pre);
+            store_matrix(load_matrix(inst.post)*scale(s, s, s), inst.post);
+        }
+
+        // Random material (or solid color) for untextured objects
+        if (inst.shader == SceneMatShader) {
+            inst.material = rng() % out.materials.size();
+        } else if (inst.shader == SceneColorShader) {
+            inst.material = rng() % 3;
+        }
+        out.instances.push_back(inst);
+    }
+}
@@ -0,0 +1,13 @@
+#ifndef SCENESTRESS_H
+#define SCENESTRESS_H
+
+#include "scene.h"
+
+// Build a stress scene with count objects: copies of the base scene's furniture (instances
+// not marked room and not tied to a TV channel) tiled over a grid of room sized cells around
+// the origin. Each cell gets a random quarter turn, each object a small random offset and
+// scale and (for material shaders) a random material. Extra point lights are spread over the
+// grid with random on/off switches. Same seed gives the same scene.
+void generate_stress_scene(const Scene &base, unsigned int count, unsigned int seed, SceneData &out);
+
+#endif
@@ -0,0 +1,161 @@
+// Texture memory budget (mip base level selection with least recently used eviction)
+
+#include <math.h>
+#include <algorithm>
+#include "texbudget.h"
+
+using namespace std;
+
+int TextureBudget::add(int width, int height, int bytes_per_texel) {
+    BudgetTexture t;
+    t.width = width;
+    t.height = height;
+    t.bytes_per_texel = bytes_per_texel;
+    t.levels = 1;
+    for (int size = max(width, height); size > 1; size >>= 1) {
+        t.levels++;
+    }
+    // Never drawn textures want nothing finer than they have to keep
+    t.wanted = 0;
+    t.wanted_frame = 0;
+    t.last_used = 0;
+    t.resident = 0;
+    t.target = 0;
+    t.loaded = true;
+    textures.push_back(t);
+    int index = (int)textures.size() - 1;
+    textures[index].wanted = max_level(index);
+    return index;
+}
+
+void TextureBudget::unload(int index) {
+    BudgetTexture &t = textures[index];
+    t.loaded = false;
+    t.resident = t.target = 0;
+}
+
+void TextureBudget::reload(int index, int base) {
+    BudgetTexture &t = textures[index];
+    t.loaded = true;
+    t.resident = t.target = base;
+}
+
+int TextureBudget::max_level(int index) const {
+    const BudgetTexture &t = textures[index];
+    int level = 0;
+    while (level + 1 < t.levels && (max(t.width, t.height) >> (level + 1)) >= min_size) {
+        level++;
+    }
+    return level;
+}
+
+void TextureBudget::note_use(int index, float screen_size, unsigned int frame) {
+    BudgetTexture &t = textures[index];
+    t.last_used = frame;
+
+    // Finest level whose size still covers the screen use
+    int size = max(t.width, t.height);
+    int level = 0;
+    if (screen_size > 0.0f) {
+        while (level < max_level(index) && (size >> (level + 1)) >= screen_size) {
+            level++;
+        }
+    }
+
+    // Finer requests apply at once, coarser ones once the finer one is older than the window
+    if (level <= t.wanted || frame - t.wanted_frame > window) {
+        t.wanted = level;
+        t.wanted_frame = frame;
+    }
+}
+
+size_t TextureBudget::chain_bytes(int index, int base) const {
+    const BudgetTexture &t = textures[index];
+    size_t bytes = 0;
+    for (int level = base; level < t.levels; level++) {
+        size_t w = max(1, t.width >> level);
+        size_t h = max(1, t.height >> level);
+        bytes += w*h*t.bytes_per_texel;
+    }
+    return bytes;
+}
+
+// Eviction order: least recently used first, the larger of equally old textures first
+struct EvictionOrder {
+    const TextureBudget *budget;
+
+    bool operator()(int a, int b) const {
+        const BudgetTexture &ta = budget->textures[a];
+        const BudgetTexture &tb = budget->textures[b];
+        if (ta.last_used != tb.last_used) {
+            return ta.last_used < tb.last_used;
+        }
+        return budget->chain_bytes(a, ta.target) > budget->chain_bytes(b, tb.target);
+    }
+};
+
+void TextureBudget::update(vector<int> &changed) {
+    changed.clear();
+    size_t total = 0;
+    for (size_t i = 0; i < textures.size(); i++) {
+        if (textures[i].loaded) {
+            textures[i].target = textures[i].wanted;
+            total += chain_bytes(i, textures[i].target);
+        }
+    }
+
+    // Over budget: take levels from textures in eviction order, each down to its floor before the next
+    if (budget > 0 && total > budget) {
+        vector<int> order(textures.size());
+        for (size_t i = 0; i < textures.size(); i++) {
+            order[i] = (int)i;
+        }
+        EvictionOrder less_recent = {this};
+        sort(order.begin(), order.end(), less_recent);
+        for (size_t k = 0; k < order.size() && total > budget; k++) {
+            BudgetTexture &t = textures[order[k]];
+            if (!t.loaded) {
+                continue;
+            }
+            int floor_level = max_level(order[k]);
+            while (t.target < floor_level && total > budget) {
+                total -= chain_bytes(order[k], t.target) - chain_bytes(order[k], t.target + 1);
+                t.target++;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < textures.size(); i++) {
+        if (textures[i].target != textures[i].resident) {
+            changed.push_back((int)i);
+        }
+    }
+}
+
+size_t TextureBudget::resident_bytes() const {
+    size_t bytes = 0;
+    for (size_t i = 0; i < textures.size(); i++) {
+        if (textures[i].loaded) {
+            bytes += chain_bytes(i, textures[i].resident);
+        }
+    }
+    return bytes;
+}
+
+size_t TextureBudget::requested_bytes() const {
+    size_t bytes = 0;
+    for (size_t i = 0; i < textures.size(); i++) {
+        if (textures[i].loaded) {
+            bytes += chain_bytes(i, textures[i].wanted);
+        }
+    }
+    return bytes;
+}
+
+size_t TextureBudget::full_bytes() const {
+    size_t bytes = 0;
+    for (size_t i = 0; i < textures.size(); i++) {
+        bytes += chain_bytes(i, 0);
+    }
+    return bytes;
+}
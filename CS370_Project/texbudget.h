@@ -0,0 +1,54 @@
+#ifndef TEXBUDGET_H
+#define TEXBUDGET_H
+
+#include <stddef.h>
+#include <vector>
+
+// Texture memory budget. Each texture keeps only the mip levels from its base level down. A
+// texture wants the base level that its largest recent on screen use samples; when the wanted
+// levels don't fit the budget, the least recently used textures give up levels first (down to
+// min_size). The renderer reallocates textures whose target differs from what is resident.
+
+struct BudgetTexture {
+    int width, height;          // source size (level 0)
+    int bytes_per_texel;
+    int levels;                 // full mip chain length
+    int wanted;                 // finest level sampled within the last window frames
+    unsigned int wanted_frame;  // frame wanted was last set
+    unsigned int last_used;     // frame last drawn (0 = never)
+    int resident;               // base level allocated now
+    int target;                 // base level chosen by the last update
+    bool loaded;                // storage allocated (unloaded textures count toward nothing)
+};
+
+struct TextureBudget {
+    size_t budget;              // bytes, 0 = no limit (textures follow their wanted level)
+    int min_size;               // largest side a texture is never shrunk below
+    unsigned int window;        // frames a finer wanted level is held before it may coarsen
+
+    std::vector<BudgetTexture> textures;
+
+    TextureBudget() : budget(0), min_size(32), window(120) {}
+
+    // Track a texture allocated with its full chain, returns its index
+    int add(int width, int height, int bytes_per_texel);
+    // Texture storage released, or allocated again with the chain from a base level down
+    void unload(int index);
+    void reload(int index, int base);
+    // Texture was drawn covering about screen_size pixels across
+    void note_use(int index, float screen_size, unsigned int frame);
+    // Pick target levels, changed gets the textures whose target differs from the resident level
+    void update(std::vector<int> &changed);
+
+    // Bytes of a texture's chain from a base level down
+    size_t chain_bytes(int index, int base) const;
+    // Coarsest base level allowed (min_size)
+    int max_level(int index) const;
+
+    // Totals: what is allocated, what the wanted levels of loaded textures need, and everything at full size
+    size_t resident_bytes() const;
+    size_t requested_bytes() const;
+    size_t full_bytes() const;
+};
+
+#endif
@@ -3,7 +3,9 @@ uniform sampler2D tex;
 
 out vec4 fragColor;
 
-in vec2 texCoord;
+in VertexData {
+    vec2 texCoord;
+};
 
 
 void main()
@@ -6,8 +6,9 @@ uniform mat4 model_matrix;
 layout(location = 0) in vec4 vPosition;
 layout(location = 1) in vec2 vTexCoord;
 
-out vec4 Position;
-out vec2 texCoord;
+out VertexData {
+    vec2 texCoord;
+};
 
 void main( )
 {
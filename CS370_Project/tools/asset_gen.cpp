@@ -0,0 +1,46 @@
+// Write synthetic assets for load scaling tests
+//
+//   asset_gen obj <out.obj> <triangles> [--no-uvs] [--no-normals]
+//   asset_gen tga <out.tga> <width> <height>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../assetgen.h"
+
+int main(int argc, char **argv) {
+    if (argc >= 4 && strcmp(argv[1], "obj") == 0) {
+        bool uvs = true, normals = true;
+        for (int i = 4; i < argc; i++) {
+            if (strcmp(argv[i], "--no-uvs") == 0) {
+                uvs = false;
+            } else if (strcmp(argv[i], "--no-normals") == 0) {
+                normals = false;
+            } else {
+                fprintf(stderr, "ERROR: unknown option %s\n", argv[i]);
+                return 2;
+            }
+        }
+        unsigned long long triangles = write_synthetic_obj(argv[2], strtoull(argv[3], NULL, 10), uvs, normals);
+        if (!triangles) {
+            return 1;
+        }
+        printf("%s: %llu triangles\n", argv[2], triangles);
+        return 0;
+    } else if (argc == 5 && strcmp(argv[1], "tga") == 0) {
+        int w = atoi(argv[3]), h = atoi(argv[4]);
+        if (w <= 0 || h <= 0 || w > 65535 || h > 65535) {
+            fprintf(stderr, "ERROR: image size must be 1..65535\n");
+            return 2;
+        }
+        if (!write_synthetic_tga(argv[2], w, h)) {
+            return 1;
+        }
+        printf("%s: %dx%d\n", argv[2], w, h);
+        return 0;
+    }
+
+    fprintf(stderr, "usage: %s obj <out.obj> <triangles> [--no-uvs] [--no-normals]\n"
+                    "       %s tga <out.tga> <width> <height>\n", argv[0], argv[0]);
+    return 2;
+}
@@ -0,0 +1,92 @@
+// Bake a scene's lightmaps ahead of time (house bakes on first run when the cache is missing)
+//
+//   lightmap_bake <scene> [--samples n] [--bounces n] [--density texels_per_unit] [--threads n] [--out file]
+//
+// The cache is written next to the scene (<scene>.lightmap) unless --out is given. House only
+// uses it when it runs with the same settings (see --bake-samples).
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../../common/stb_image.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "../scene.h"
+#include "../lightmap.h"
+
+using namespace std;
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <scene> [--samples n] [--bounces n] [--density texels_per_unit] [--threads n]"
+                        " [--out file]\n", argv[0]);
+        return 2;
+    }
+    const char *scene_path = argv[1];
+    string out_path = string(scene_path) + ".lightmap";
+    LightmapSettings settings;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) {
+            settings.samples = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--bounces") == 0 && i + 1 < argc) {
+            settings.bounces = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--density") == 0 && i + 1 < argc) {
+            settings.texels_per_unit = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            settings.num_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        } else {
+            fprintf(stderr, "ERROR: unknown option %s\n", argv[i]);
+            return 2;
+        }
+    }
+
+    // Text scenes are cooked the same way house loads them
+    vector<char> image;
+    size_t len = strlen(scene_path);
+    if (len > 6 && strcmp(scene_path + len - 6, ".scene") == 0) {
+        if (!cook_scene(scene_path, image)) {
+            return 1;
+        }
+    } else {
+        FILE *file = fopen(scene_path, "rb");
+        if (!file) {
+            fprintf(stderr, "ERROR: could not open scene %s\n", scene_path);
+            return 1;
+        }
+        fseek(file, 0, SEEK_END);
+        image.resize(ftell(file));
+        fseek(file, 0, SEEK_SET);
+        size_t read = fread(image.data(), 1, image.size(), file);
+        fclose(file);
+        if (read != image.size()) {
+            fprintf(stderr, "ERROR: could not read %s\n", scene_path);
+            return 1;
+        }
+    }
+    Scene scene;
+    if (!open_scene(image.data(), image.size(), scene)) {
+        return 1;
+    }
+    string scene_dir = scene_path;
+    size_t slash = scene_dir.find_last_of("/\\");
+    scene_dir = (slash == string::npos) ? string() : scene_dir.substr(0, slash + 1);
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    Lightmaps maps;
+    if (!bake_lightmaps(scene, scene_dir, settings, maps)) {
+        fprintf(stderr, "%s has no baked instances\n", scene_path);
+        return 1;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (!save_lightmaps(out_path.c_str(), maps)) {
+        fprintf(stderr, "ERROR: could not write %s\n", out_path.c_str());
+        return 1;
+    }
+    printf("%s: %dx%d, %d light layers, %u instances (%.2f s)\n", out_path.c_str(), maps.width, maps.height,
+           maps.layers, (unsigned int)maps.instances.size(), seconds);
+    return 0;
+}
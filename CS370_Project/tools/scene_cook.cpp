@@ -0,0 +1,42 @@
+// Compile a text scene into a binary scene image that house maps directly
+//
+//   scene_cook <in.scene> <out.hscn>
+//
+// Paths inside the scene stay relative, so write the image next to the text scene.
+
+#include <stdio.h>
+#include <vector>
+#include "../scene.h"
+
+using namespace std;
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <in.scene> <out.hscn>\n", argv[0]);
+        return 2;
+    }
+
+    vector<char> image;
+    if (!cook_scene(argv[1], image)) {
+        return 1;
+    }
+
+    // Check the image the same way the renderer will
+    Scene scene;
+    if (!open_scene(image.data(), image.size(), scene)) {
+        return 1;
+    }
+
+    FILE *file = fopen(argv[2], "wb");
+    if (!file || fwrite(image.data(), 1, image.size(), file) != image.size()) {
+        fprintf(stderr, "ERROR: could not write %s\n", argv[2]);
+        if (file) fclose(file);
+        return 1;
+    }
+    fclose(file);
+
+    printf("%s: %u meshes, %u textures, %u materials, %u lights, %u instances (%u bytes)\n", argv[2],
+           scene.header->num_meshes, scene.header->num_textures, scene.header->num_materials,
+           scene.header->num_lights, scene.header->num_instances, (unsigned int)image.size());
+    return 0;
+}
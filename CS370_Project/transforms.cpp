@@ -0,0 +1,219 @@
+// Batched TRS transform and normal matrix kernels
+
+#include <math.h>
+#include "transforms.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRANSFORMS_SSE2
+#endif
+
+#define DEG2RAD (M_PI/180.0)
+
+using namespace vmath;
+using namespace std;
+
+void TRSBatch::resize(size_t n) {
+    tx.resize(n); ty.resize(n); tz.resize(n);
+    qx.resize(n); qy.resize(n); qz.resize(n); qw.resize(n, 1.0f);
+    sx.resize(n, 1.0f); sy.resize(n, 1.0f); sz.resize(n, 1.0f);
+}
+
+void TRSBatch::set(size_t i, const vec3 &t, float angle, const vec3 &axis, const vec3 &s) {
+    tx[i] = t[0]; ty[i] = t[1]; tz[i] = t[2];
+    sx[i] = s[0]; sy[i] = s[1]; sz[i] = s[2];
+
+    // Axis-angle to quaternion
+    float len = sqrtf(axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2]);
+    float half = (float)(0.5*angle*DEG2RAD);
+    float sn = (len > 0.0f) ? sinf(half)/len : 0.0f;
+    qx[i] = axis[0]*sn; qy[i] = axis[1]*sn; qz[i] = axis[2]*sn;
+    qw[i] = (len > 0.0f) ? cosf(half) : 1.0f;
+}
+
+void MatrixBatch::resize(size_t n) {
+    for (int e = 0; e < 16; e++) {
+        m[e].resize(n);
+    }
+}
+
+mat4 MatrixBatch::get(size_t i) const {
+    mat4 r;
+    for (int c = 0; c < 4; c++) {
+        for (int e = 0; e < 4; e++) {
+            r[c][e] = m[c*4 + e][i];
+        }
+    }
+    return r;
+}
+
+// Lane types so one kernel serves the scalar, SSE2 and AVX paths
+struct ScalarLane {
+    typedef float reg;
+    static const int width = 1;
+    static reg load(const float *p) { return *p; }
+    static void store(float *p, reg v) { *p = v; }
+    static reg set1(float f) { return f; }
+    static reg add(reg a, reg b) { return a + b; }
+    static reg sub(reg a, reg b) { return a - b; }
+    static reg mul(reg a, reg b) { return a * b; }
+    static reg div(reg a, reg b) { return a / b; }
+};
+
+#if defined(__AVX__)
+struct SimdLane {
+    typedef __m256 reg;
+    static const int width = 8;
+    static reg load(const float *p) { return _mm256_loadu_ps(p); }
+    static void store(float *p, reg v) { _mm256_storeu_ps(p, v); }
+    static reg set1(float f) { return _mm256_set1_ps(f); }
+    static reg add(reg a, reg b) { return _mm256_add_ps(a, b); }
+    static reg sub(reg a, reg b) { return _mm256_sub_ps(a, b); }
+    static reg mul(reg a, reg b) { return _mm256_mul_ps(a, b); }
+    static reg div(reg a, reg b) { return _mm256_div_ps(a, b); }
+};
+#elif defined(TRANSFORMS_SSE2)
+struct SimdLane {
+    typedef __m128 reg;
+    static const int width = 4;
+    static reg load(const float *p) { return _mm_loadu_ps(p); }
+    static void store(float *p, reg v) { _mm_storeu_ps(p, v); }
+    static reg set1(float f) { return _mm_set1_ps(f); }
+    static reg add(reg a, reg b) { return _mm_add_ps(a, b); }
+    static reg sub(reg a, reg b) { return _mm_sub_ps(a, b); }
+    static reg mul(reg a, reg b) { return _mm_mul_ps(a, b); }
+    static reg div(reg a, reg b) { return _mm_div_ps(a, b); }
+};
+#else
+typedef ScalarLane SimdLane;
+#endif
+
+// Compose instances [first, last) in steps of L::width
+template <class L>
+static size_t compose_range(const TRSBatch &trs, MatrixBatch &model, MatrixBatch &normal, size_t first, size_t last) {
+    typedef typename L::reg reg;
+    const reg zero = L::set1(0.0f);
+    const reg one = L::set1(1.0f);
+    const reg two = L::set1(2.0f);
+
+    size_t i = first;
+    for (; i + L::width <= last; i += L::width) {
+        reg x = L::load(&trs.qx[i]), y = L::load(&trs.qy[i]), z = L::load(&trs.qz[i]), w = L::load(&trs.qw[i]);
+        reg sx = L::load(&trs.sx[i]), sy = L::load(&trs.sy[i]), sz = L::load(&trs.sz[i]);
+
+        // Rotation matrix from quaternion
+        reg xx = L::mul(x, x), yy = L::mul(y, y), zz = L::mul(z, z);
+        reg xy = L::mul(x, y), xz = L::mul(x, z), yz = L::mul(y, z);
+        reg wx = L::mul(w, x), wy = L::mul(w, y), wz = L::mul(w, z);
+        reg r00 = L::sub(one, L::mul(two, L::add(yy, zz)));
+        reg r10 = L::mul(two, L::add(xy, wz));
+        reg r20 = L::mul(two, L::sub(xz, wy));
+        reg r01 = L::mul(two, L::sub(xy, wz));
+        reg r11 = L::sub(one, L::mul(two, L::add(xx, zz)));
+        reg r21 = L::mul(two, L::add(yz, wx));
+        reg r02 = L::mul(two, L::add(xz, wy));
+        reg r12 = L::mul(two, L::sub(yz, wx));
+        reg r22 = L::sub(one, L::mul(two, L::add(xx, yy)));
+
+        // Model matrix columns R*S, translation in column 3
+        L::store(&model.m[0][i], L::mul(r00, sx));
+        L::store(&model.m[1][i], L::mul(r10, sx));
+        L::store(&model.m[2][i], L::mul(r20, sx));
+        L::store(&model.m[3][i], zero);
+        L::store(&model.m[4][i], L::mul(r01, sy));
+        L::store(&model.m[5][i], L::mul(r11, sy));
+        L::store(&model.m[6][i], L::mul(r21, sy));
+        L::store(&model.m[7][i], zero);
+        L::store(&model.m[8][i], L::mul(r02, sz));
+        L::store(&model.m[9][i], L::mul(r12, sz));
+        L::store(&model.m[10][i], L::mul(r22, sz));
+        L::store(&model.m[11][i], zero);
+        L::store(&model.m[12][i], L::load(&trs.tx[i]));
+        L::store(&model.m[13][i], L::load(&trs.ty[i]));
+        L::store(&model.m[14][i], L::load(&trs.tz[i]));
+        L::store(&model.m[15][i], one);
+
+        // Inverse-transpose of R*S is R*S^-1 (the 3x3 cofactor matrix divided by the determinant)
+        reg isx = L::div(one, sx), isy = L::div(one, sy), isz = L::div(one, sz);
+        L::store(&normal.m[0][i], L::mul(r00, isx));
+        L::store(&normal.m[1][i], L::mul(r10, isx));
+        L::store(&normal.m[2][i], L::mul(r20, isx));
+        L::store(&normal.m[3][i], zero);
+        L::store(&normal.m[4][i], L::mul(r01, isy));
+        L::store(&normal.m[5][i], L::mul(r11, isy));
+        L::store(&normal.m[6][i], L::mul(r21, isy));
+        L::store(&normal.m[7][i], zero);
+        L::store(&normal.m[8][i], L::mul(r02, isz));
+        L::store(&normal.m[9][i], L::mul(r12, isz));
+        L::store(&normal.m[10][i], L::mul(r22, isz));
+        L::store(&normal.m[11][i], zero);
+        L::store(&normal.m[12][i], zero);
+        L::store(&normal.m[13][i], zero);
+        L::store(&normal.m[14][i], zero);
+        L::store(&normal.m[15][i], one);
+    }
+    return i;
+}
+
+void compose_trs(const TRSBatch &trs, MatrixBatch &model, MatrixBatch &normal) {
+    size_t n = trs.size();
+    model.resize(n);
+    normal.resize(n);
+
+    // Vector body, scalar tail
+    size_t done = compose_range<SimdLane>(trs, model, normal, 0, n);
+    compose_range<ScalarLane>(trs, model, normal, done, n);
+}
+
+mat4 affine_normal_matrix(const mat4 &model) {
+    // Columns of the upper 3x3
+    vec3 a0 = vec3(model[0][0], model[0][1], model[0][2]);
+    vec3 a1 = vec3(model[1][0], model[1][1], model[1][2]);
+    vec3 a2 = vec3(model[2][0], model[2][1], model[2][2]);
+
+    // Cofactor columns are cross products of the other two columns
+    vec3 c0 = cross(a1, a2);
+    vec3 c1 = cross(a2, a0);
+    vec3 c2 = cross(a0, a1);
+    float det = dot(a0, c0);
+    float inv_det = (det != 0.0f) ? 1.0f/det : 0.0f;
+
+    mat4 n = mat4().identity();
+    for (int r = 0; r < 3; r++) {
+        n[0][r] = c0[r]*inv_det;
+        n[1][r] = c1[r]*inv_det;
+        n[2][r] = c2[r]*inv_det;
+    }
+    return n;
+}
+
+mat4 oblique_near_plane(const mat4 &proj, const vec4 &clip_plane) {
+    // Clip space corner opposite the plane, taken back to view space
+    float sx = (clip_plane[0] > 0.0f) ? 1.0f : ((clip_plane[0] < 0.0f) ? -1.0f : 0.0f);
+    float sy = (clip_plane[1] > 0.0f) ? 1.0f : ((clip_plane[1] < 0.0f) ? -1.0f : 0.0f);
+    vec4 q = proj.inverse()*vec4(sx, sy, 1.0f, 1.0f);
+
+    // Scale plane so the far plane still passes through q, then replace the third row
+    float qdot = dot(clip_plane, q);
+    if (qdot == 0.0f) {
+        return proj;
+    }
+    vec4 c = clip_plane*(2.0f/qdot);
+    mat4 m = proj;
+    for (int i = 0; i < 4; i++) {
+        m[i][2] = c[i] - m[i][3];
+    }
+    return m;
+}
+
+const char *transform_simd_path() {
+#if defined(__AVX__)
+    return "avx";
+#elif defined(TRANSFORMS_SSE2)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,43 @@
+#ifndef TRANSFORMS_H
+#define TRANSFORMS_H
+
+#include <vector>
+#include <stddef.h>
+#include "../common/vmath.h"
+
+// Translate/rotate/scale components for a batch of instances (structure of arrays). Only the
+// benchmarks use the batch kernel: scene instances are general matrix chains, not T*R*S
+struct TRSBatch {
+    std::vector<float> tx, ty, tz;      // translation
+    std::vector<float> qx, qy, qz, qw;  // rotation (unit quaternion)
+    std::vector<float> sx, sy, sz;      // scale
+
+    void resize(size_t n);
+    size_t size() const { return tx.size(); }
+    // Set instance i from translate(t)*rotate(angle, axis)*scale(s) (angle in degrees like vmath::rotate)
+    void set(size_t i, const vmath::vec3 &t, float angle, const vmath::vec3 &axis, const vmath::vec3 &s);
+};
+
+// 4x4 matrices for a batch of instances, one array per (column-major) element
+struct MatrixBatch {
+    std::vector<float> m[16];
+
+    void resize(size_t n);
+    size_t size() const { return m[0].size(); }
+    vmath::mat4 get(size_t i) const;
+};
+
+// Compose model matrices T*R*S and their normal matrices (inverse-transpose of the upper 3x3)
+void compose_trs(const TRSBatch &trs, MatrixBatch &model, MatrixBatch &normal);
+
+// Normal matrix of an affine model matrix via 3x3 cofactors (replaces model.inverse().transpose())
+vmath::mat4 affine_normal_matrix(const vmath::mat4 &model);
+
+// Replace the near plane of a perspective projection with clip_plane (view space, a*x+b*y+c*z+d, kept side
+// positive) so geometry behind it is clipped without a user clip distance (Lengyel oblique frustum)
+vmath::mat4 oblique_near_plane(const vmath::mat4 &proj, const vmath::vec4 &clip_plane);
+
+// Name of the instruction set compose_trs was built for ("avx", "sse2" or "scalar")
+const char *transform_simd_path();
+
+#endif
@@ -0,0 +1,215 @@
+#version 400 core
+// Every scene surface type in one program: the draw's flags pick the terms the separate
+// programs computed (color, texture, multi texture, material lighting, normal mapping)
+uniform sampler2D baseMap;
+uniform sampler2D detailMap;
+uniform sampler2D normalMap;
+
+// Light structure
+struct LightProperties {
+    int type;
+    vec4 ambient;
+    vec4 diffuse;
+    vec4 specular;
+    vec4 position;
+    vec4 direction;
+    float spotCutoff;
+    float spotExponent;
+};
+
+// Material structure
+struct MaterialProperties {
+    vec4 ambient;
+    vec4 diffuse;
+    vec4 specular;
+    float shininess;
+};
+
+// Per draw record (see uber.vert)
+struct DrawData {
+    mat4 model_matrix;
+    mat4 normal_matrix;
+    vec4 color;
+    ivec4 info;             // flags, material
+};
+
+// Array sizes follow the loaded scene (defined by house before compiling)
+#ifndef MAX_LIGHTS
+#define MAX_LIGHTS 16
+#endif
+const int MaxLights = MAX_LIGHTS;
+layout (std140) uniform LightBuffer {
+    LightProperties Lights[MaxLights];
+};
+
+#ifndef MAX_MATERIALS
+#define MAX_MATERIALS 256
+#endif
+const int MaxMaterials = MAX_MATERIALS;
+layout (std140) uniform MaterialBuffer {
+    MaterialProperties Materials[MaxMaterials];
+};
+
+const int MaxDraws = 64;
+layout (std140) uniform DrawBuffer {
+    DrawData Draws[MaxDraws];
+};
+
+// Surface flags (Uber_Flags in house.cpp)
+const int UberBaseTex = 1;
+const int UberDetailTex = 2;
+const int UberNormalMap = 4;
+const int UberLit = 8;
+
+// Number of lights
+uniform int NumLights;
+uniform int LightOn[MaxLights];
+
+out vec4 fragColor;
+
+in VertexData {
+    vec4 Position;
+    vec2 texCoord;
+    vec3 Normal;
+    vec3 Tangent;
+    vec3 BiTangent;
+    vec3 View;
+    flat int draw;
+};
+
+// Lights only, per pixel normal from the normal map (as bumpTex.frag)
+vec3 bump_lighting()
+{
+    vec3 rgb = vec3(0.0f);
+    vec3 NormView = normalize(View);
+
+    // Retrieve normal from normal map
+    vec4 BumpCol = texture(normalMap, texCoord);
+    vec3 BumpNorm = normalize(2.0f*BumpCol.rgb - 1.0f);
+
+    // Convert view vector to tangent space
+    vec3 TangView = normalize(vec3(dot(Tangent, NormView),dot(BiTangent, NormView),dot(Normal, NormView)));
+
+    for (int i = 0; i < NumLights; i++) {
+        // If light is not off
+        if (LightOn[i] != 0) {
+            // add ambient component
+            if (Lights[i].type != 0) {
+                rgb += vec3(Lights[i].ambient);
+            }
+            // Directional and point lights
+            if (Lights[i].type == 1 || Lights[i].type == 2) {
+                vec3 LightDir = (Lights[i].type == 1) ? -normalize(vec3(Lights[i].direction))
+                                                      : normalize(vec3(Lights[i].position - Position));
+                // Light vector in tangent space
+                vec3 LightDirection = vec3(dot(Tangent, LightDir), dot(BiTangent, LightDir), dot(Normal, LightDir));
+                LightDirection = normalize(LightDirection);
+                vec3 HalfVector = normalize(LightDirection + TangView);
+                // Diffuse
+                float diff = max(0.0f, dot(BumpNorm, LightDirection));
+                rgb += diff*vec3(Lights[i].diffuse);
+                if (diff > 0.0) {
+                    float spec = max(0.0f, dot(BumpNorm, HalfVector));
+                    rgb += spec*vec3(Lights[i].specular);
+                }
+            }
+            // Spot light
+            if (Lights[i].type == 3) {
+                vec3 LightDir = normalize(vec3(Lights[i].position - Position));
+                vec3 LightDirection = vec3(dot(Tangent, LightDir), dot(BiTangent, LightDir), dot(Normal, LightDir));
+                LightDirection = normalize(LightDirection);
+                // Compute amount inside cone
+                float spotCos = dot(LightDir, -normalize(vec3(Lights[i].direction)));
+                float coneCos = cos(radians(Lights[i].spotCutoff));
+                if (spotCos >= coneCos) {
+                    vec3 HalfVector = normalize(LightDirection + TangView);
+                    float attenuation = pow(spotCos, Lights[i].spotExponent);
+                    // Diffuse
+                    float diff = max(0.0f, dot(BumpNorm, LightDirection))*attenuation;
+                    rgb += diff*vec3(Lights[i].diffuse);
+                    if (diff > 0.0) {
+                        // Specular term
+                        float spec = max(0.0f, dot(Normal, HalfVector))*attenuation;
+                        rgb += spec*vec3(Lights[i].specular);
+                    }
+                }
+            }
+        }
+    }
+    return rgb;
+}
+
+// Lights times the draw's material (as lighting.frag)
+vec3 material_lighting(int Material)
+{
+    vec3 rgb = vec3(0.0f);
+    vec3 NormNormal = normalize(Normal);
+    vec3 NormView = normalize(View);
+
+    for (int i = 0; i < NumLights; i++) {
+        // If light is not off
+        if (LightOn[i] != 0) {
+            // add ambient component
+            if (Lights[i].type != 0) {
+                rgb += vec3(Lights[i].ambient*Materials[Material].ambient);
+            }
+            // Directional and point lights
+            if (Lights[i].type == 1 || Lights[i].type == 2) {
+                vec3 LightDirection = (Lights[i].type == 1) ? -normalize(vec3(Lights[i].direction))
+                                                            : normalize(vec3(Lights[i].position - Position));
+                vec3 HalfVector = normalize(LightDirection + NormView);
+                // Diffuse
+                float diff = max(0.0f, dot(NormNormal, LightDirection));
+                rgb += diff*vec3(Lights[i].diffuse*Materials[Material].diffuse);
+                if (diff > 0.0) {
+                    // Specular term
+                    float spec = pow(max(0.0f, dot(Normal, HalfVector)), Materials[Material].shininess);
+                    rgb += spec*vec3(Lights[i].specular*Materials[Material].specular);
+                }
+            }
+            // Spot light
+            if (Lights[i].type == 3) {
+                vec3 LightDirection = normalize(vec3(Lights[i].position - Position));
+                // Determine if inside cone
+                float spotCos = dot(LightDirection, -normalize(vec3(Lights[i].direction)));
+                float coneCos = cos(radians(Lights[i].spotCutoff));
+                if (spotCos >= coneCos) {
+                    vec3 HalfVector = normalize(LightDirection + NormView);
+                    float attenuation = pow(spotCos, Lights[i].spotExponent);
+                    // Diffuse
+                    float diff = max(0.0f, dot(NormNormal, LightDirection))*attenuation;
+                    rgb += diff*vec3(Lights[i].diffuse*Materials[Material].diffuse);
+                    if (diff > 0.0) {
+                        // Specular term
+                        float spec = pow(max(0.0f, dot(Normal, HalfVector)), Materials[Material].shininess)*attenuation;
+                        rgb += spec*vec3(Lights[i].specular*Materials[Material].specular);
+                    }
+                }
+            }
+        }
+    }
+    return min(rgb, vec3(1.0));
+}
+
+void main()
+{
+    int flags = Draws[draw].info.x;
+    int Material = Draws[draw].info.y;
+
+    // Lighting (or the draw's flat color when unlit)
+    vec4 color = Draws[draw].color;
+    if ((flags & UberNormalMap) != 0) {
+        color = vec4(bump_lighting(), 1.0);
+    } else if ((flags & UberLit) != 0) {
+        color = vec4(material_lighting(Material), Materials[Material].ambient.a);
+    }
+
+    // Base texture, then the detail (dirt) texture on top
+    if ((flags & UberBaseTex) != 0) {
+        color *= texture(baseMap, texCoord);
+    }
+    if ((flags & UberDetailTex) != 0) {
+        color *= texture(detailMap, texCoord);
+    }
+    fragColor = color;
+}
@@ -0,0 +1,64 @@
+#version 400 core
+uniform mat4 proj_matrix;
+uniform mat4 camera_matrix;
+uniform vec3 EyePosition;
+
+// First record of this draw in DrawBuffer (instances take the records after it)
+uniform int DrawBase;
+
+// Per draw record (the surface flags are read by the fragment shader)
+struct DrawData {
+    mat4 model_matrix;
+    mat4 normal_matrix;
+    vec4 color;
+    ivec4 info;             // flags, material
+};
+
+const int MaxDraws = 64;
+layout (std140) uniform DrawBuffer {
+    DrawData Draws[MaxDraws];
+};
+
+const int UberNormalMap = 4;
+
+layout(location = 0) in vec4 vPosition;
+layout(location = 1) in vec3 vNormal;
+layout(location = 2) in vec2 vTexCoord;
+layout(location = 3) in vec4 vTangent;
+
+out VertexData {
+    vec4 Position;
+    vec2 texCoord;
+    vec3 Normal;
+    vec3 Tangent;
+    vec3 BiTangent;
+    vec3 View;
+    flat int draw;
+};
+
+void main( )
+{
+    draw = DrawBase + gl_InstanceID;
+    mat4 model_matrix = Draws[draw].model_matrix;
+    mat4 normal_matrix = Draws[draw].normal_matrix;
+
+    // Compute transformed vertex position in view space
+    gl_Position = proj_matrix*(camera_matrix*(model_matrix*vPosition));
+
+    // Compute vertex position in world coordinates and v (passed to fragment shader)
+    Position = model_matrix*vPosition;
+    View = normalize(EyePosition - Position.xyz);
+
+    // Pass texture coordinate to frag shader
+    texCoord = vTexCoord;
+
+    // Normal (lit surfaces) and tangent space (normal mapped surfaces)
+    Normal = vec3(normalize(normal_matrix*normalize(vec4(vNormal, 0.0))));
+    Tangent = vec3(0.0);
+    BiTangent = vec3(0.0);
+    if ((Draws[draw].info.x & UberNormalMap) != 0) {
+        // Bitangent is rebuilt from the tangent handedness (w)
+        Tangent = vec3(normalize(normal_matrix*normalize(vec4(vTangent.xyz, 0.0))));
+        BiTangent = cross(Normal, Tangent)*vTangent.w;
+    }
+}
@@ -0,0 +1,28 @@
+#version 400 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+// Scene rendered into the lower left uvScale portion of sceneTex
+uniform sampler2D sceneTex;
+uniform vec2 uvScale;
+uniform vec2 texelSize;
+uniform float sharpness;
+
+vec3 scene(vec2 uv)
+{
+    // Keep bilinear taps inside the rendered region
+    uv = clamp(uv, 0.5f*texelSize, uvScale - 0.5f*texelSize);
+    return texture(sceneTex, uv).rgb;
+}
+
+void main()
+{
+    vec2 uv = TexCoords*uvScale;
+    vec3 center = scene(uv);
+
+    // Unsharp mask with the 4 neighbours to restore detail lost to bilinear upsampling
+    vec3 blur = 0.25f*(scene(uv + vec2(texelSize.x, 0.0f)) + scene(uv - vec2(texelSize.x, 0.0f)) +
+                       scene(uv + vec2(0.0f, texelSize.y)) + scene(uv - vec2(0.0f, texelSize.y)));
+    FragColor = vec4(clamp(center + sharpness*(center - blur), 0.0f, 1.0f), 1.0f);
+}
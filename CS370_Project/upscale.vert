@@ -0,0 +1,11 @@
+#version 400 core
+
+out vec2 TexCoords;
+
+void main( )
+{
+    // Full screen triangle from vertex id (no vertex buffers)
+    vec2 pos = vec2((gl_VertexID == 1) ? 3.0f : -1.0f, (gl_VertexID == 2) ? 3.0f : -1.0f);
+    TexCoords = pos*0.5f + 0.5f;
+    gl_Position = vec4(pos, 0.0f, 1.0f);
+}
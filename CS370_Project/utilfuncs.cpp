@@ -5,318 +5,473 @@ void build_solid_color_buffer(GLuint num_vertices, vec4 color, GLuint buffer) {
         obj_colors.push_back(color);
     }
 
-    glBindBuffer(GL_ARRAY_BUFFER, ColorBuffers[buffer]);
+    gl_bind_buffer(GL_ARRAY_BUFFER, ColorBuffers[buffer]);
     glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*colCoords*num_vertices, obj_colors.data(), GL_STATIC_DRAW);
+    const char *names[NumColorBuffers] = {"red color", "blue color", "green color"};
+    register_buffer(ColorBuffers[buffer], ResColorBuffers, names[buffer], sizeof(GLfloat)*colCoords*num_vertices);
 }
 
 void build_textures( ) {
-    int w, h, n;
-    int force_channels = 4;
-    unsigned char *image_data;
-
-    // Create textures and activate unit 0
-    glGenTextures( texFiles.size(),  TextureIDs);
-    glActiveTexture( GL_TEXTURE0 );
+    // Create textures (including rendered ones)
+    glGenTextures( TextureIDs.size(),  TextureIDs.data());
+    budgetTextures.assign(scene.header->num_textures, -1);
+    textureAssets.assign(scene.header->num_textures, -1);
+
+    // Normal maps get a flat normal placeholder, everything else mid gray
+    normalMapTextures.assign(scene.header->num_textures, false);
+    for (int i = 0; i < scene.header->num_instances; i++) {
+        const SceneInstance &inst = scene.instances[i];
+        if (inst.shader == SceneBumpShader && inst.texture2 >= 0) {
+            normalMapTextures[inst.texture2] = true;
+        }
+    }
 
-    for (int i = 0; i < texFiles.size(); i++) {
-        // Load image from file
+    // Set maximum anisotropic filtering for system
+    GLfloat max_aniso = 0.0f;
+    glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &max_aniso);
 
-        image_data = stbi_load(texFiles[i], &w, &h, &n, force_channels);
-        if (!image_data) {
-            fprintf(stderr, "ERROR: could not load %s\n", texFiles[i]);
-        }
-        // NPOT check for power of 2 dimensions
-        if ((w & (w - 1)) != 0 || (h & (h - 1)) != 0) {
-            //fprintf(stderr, "WARNING: texture %s is not power-of-2 dimensions\n",
-                   // texFiles[i]);
-        }
-        int width_in_bytes = w * 4;
-        unsigned char *top = NULL;
-        unsigned char *bottom = NULL;
-        unsigned char temp = 0;
-        int half_height = h / 2;
-
-        for ( int row = 0; row < half_height; row++ ) {
-            top = image_data + row * width_in_bytes;
-            bottom = image_data + ( h - row - 1 ) * width_in_bytes;
-            for ( int col = 0; col < width_in_bytes; col++ ) {
-                temp = *top;
-                *top = *bottom;
-                *bottom = temp;
-                top++;
-                bottom++;
-            }
+    for (int i = 0; i < scene.header->num_textures; i++) {
+        // Rendered textures (@mirror) are allocated by their pass
+        const char *name = scene.string(scene.textures[i].path);
+        if (name[0] == '@') {
+            continue;
         }
 
-        // Bind current texture id
-        glBindTexture(GL_TEXTURE_2D, TextureIDs[i]);
-        // Load image data into texture
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE,
-                     image_data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        // Files are loaded by the asset manager when a draw first uses them
+        string path = scene_file_path(scene.textures[i].path);
+        textureAssets[i] = asset_manager.add(path.c_str());
+        assetOwners.push_back(i);
+        upload_placeholder(i);
+
         // Set scaling modes
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
         // Set wrapping modes
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        // Set maximum anisotropic filtering for system
-        GLfloat max_aniso = 0.0f;
-        glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &max_aniso);
         // set the maximum!
         glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, max_aniso);
     }
 }
 
+void upload_placeholder(GLint texture) {
+    // Single texel (levels a loaded image left behind are emptied so their storage is released)
+    const GLubyte gray[4] = {128, 128, 128, 255};
+    const GLubyte flat_normal[4] = {128, 128, 255, 255};
+    const TextureAsset &asset = asset_manager.assets[textureAssets[texture]];
+    string path = scene_file_path(scene.textures[texture].path);
+    gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    gl_edit_texture(GL_TEXTURE_2D, TextureIDs[texture]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                 normalMapTextures[texture] ? flat_normal : gray);
+    for (int level = 1; level < full_mip_count(asset.width, asset.height); level++) {
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    }
+    register_texture(TextureIDs[texture], ResTextures, path.c_str(), 1, 1, "RGBA8", 4, 1);
+}
+
+void reference_scene_textures(GLboolean acquire) {
+    // Each instance holds a reference to the textures it draws with
+    for (int i = 0; i < scene.header->num_instances; i++) {
+        const SceneInstance &inst = scene.instances[i];
+        if (inst.shader == SceneColorShader || inst.shader == SceneMatShader) {
+            continue;
+        }
+        GLint textures[2] = {inst.texture, inst.texture2};
+        for (int k = 0; k < 2 && textures[k] >= 0; k++) {
+            GLint handle = textureAssets[textures[k]];
+            if (handle < 0) {
+                continue;
+            }
+            if (acquire) {
+                asset_manager.acquire(handle);
+            } else {
+                asset_manager.release(handle);
+            }
+        }
+    }
+}
+
+void update_assets(size_t max_uploads) {
+    // Upload decoded textures with their full chains (the budget may shrink them later), or the
+    // chain from the base level a budget reload asked for
+    asset_manager.collect(assets_ready, max_uploads);
+    for (int k = 0; k < assets_ready.size(); k++) {
+        TextureAsset &asset = asset_manager.assets[assets_ready[k]];
+        GLint texture = assetOwners[assets_ready[k]];
+        gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        gl_edit_texture(GL_TEXTURE_2D, TextureIDs[texture]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, asset.image.w, asset.image.h, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                     asset.image.pixels.data());
+        glGenerateMipmap(GL_TEXTURE_2D);
+        register_texture(TextureIDs[texture], ResTextures, asset.path.c_str(), asset.image.w, asset.image.h, "RGBA8", 4,
+                         full_mip_count(asset.image.w, asset.image.h));
+        if (budgetTextures[texture] < 0) {
+            budgetTextures[texture] = texture_budget.add(asset.image.w, asset.image.h, 4);
+            budgetOwners.push_back(texture);
+        } else {
+            texture_budget.reload(budgetTextures[texture], asset.image.level);
+        }
+        asset_manager.uploaded(assets_ready[k]);
+        scene_dirty = true;
+    }
+
+    // Textures nothing references, or not drawn for a while, go back to their placeholder
+    asset_manager.evictions(rendered_frames + 1, assets_evicted);
+    for (int k = 0; k < assets_evicted.size(); k++) {
+        GLint texture = assetOwners[assets_evicted[k]];
+        upload_placeholder(texture);
+        if (budgetTextures[texture] >= 0) {
+            texture_budget.unload(budgetTextures[texture]);
+        }
+    }
+}
+
+void preload_scene_textures( ) {
+    // Decode every referenced texture and upload them all before the first frame
+    for (int handle = 0; handle < asset_manager.assets.size(); handle++) {
+        if (asset_manager.assets[handle].refs > 0) {
+            asset_manager.use(handle, rendered_frames + 1);
+        }
+    }
+    asset_manager.wait();
+    update_assets(asset_manager.assets.size());
+}
+
+void apply_texture_budget( ) {
+    // Reallocate textures whose base level moved (BASE_LEVEL alone would keep the storage). Without
+    // a budget textures still drop the levels finer than their largest recent on screen use
+    texture_budget.update(budget_changed);
+    for (int k = 0; k < budget_changed.size(); k++) {
+        BudgetTexture &t = texture_budget.textures[budget_changed[k]];
+        GLint tex = budgetOwners[budget_changed[k]];
+        if (t.target < t.resident) {
+            // Grow: decoded again in the background, update_assets() uploads it when it is ready
+            asset_manager.reload(textureAssets[tex], t.target);
+            continue;
+        }
+
+        // Shrink: the level that becomes the new base is already in the chain, copy it out and back
+        // on the GPU (through the scratch texture, the reallocation drops the old levels)
+        int w = max(1, t.width >> t.target);
+        int h = max(1, t.height >> t.target);
+        if (!budget_scratch_tex) {
+            glGenTextures(1, &budget_scratch_tex);
+        }
+        gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        gl_bind_framebuffer(GL_READ_FRAMEBUFFER, Framebuffers[BudgetFramebuffer]);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, TextureIDs[tex],
+                               t.target - t.resident);
+        gl_edit_texture(GL_TEXTURE_2D, budget_scratch_tex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, w, h);
+
+        // Replace the storage (filtering and wrap parameters stay with the texture)
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, budget_scratch_tex, 0);
+        gl_edit_texture(GL_TEXTURE_2D, TextureIDs[tex]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, w, h);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+        gl_bind_framebuffer(GL_READ_FRAMEBUFFER, 0);
+
+        // Scratch storage is only needed for the copy
+        gl_edit_texture(GL_TEXTURE_2D, budget_scratch_tex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+        string path = scene_file_path(scene.textures[tex].path);
+        register_texture(TextureIDs[tex], ResTextures, path.c_str(), w, h, "RGBA8", 4, full_mip_count(w, h));
+        t.resident = t.target;
+        scene_dirty = true;
+    }
+}
+
 void load_object(GLuint obj) {
     vector<vec4> vertices;
     vector<vec2> uvCoords;
     vector<vec3> normals;
 
     // Load model and set number of vertices
-    loadOBJ(objFiles[obj], vertices, uvCoords, normals);
+    load_obj_fast(scene_file_path(scene.meshes[obj].path).c_str(), vertices, uvCoords, normals);
     numVertices[obj] = vertices.size();
 
+    // Append simplified levels after the full mesh
+    append_lods(obj, vertices, uvCoords, normals, NULL);
+
     // Create and load object buffers
-    glGenBuffers(NumObjBuffers, ObjBuffers[obj]);
-    glBindVertexArray(VAOs[obj]);
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[obj][PosBuffer]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*posCoords*numVertices[obj], vertices.data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[obj][NormBuffer]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*normCoords*numVertices[obj], normals.data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[obj][TexBuffer]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*texCoords*numVertices[obj], uvCoords.data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glGenBuffers(NumObjBuffers, ObjBuffers[obj].data());
+    gl_bind_vertex_array(VAOs[obj]);
+    gl_bind_buffer(GL_ARRAY_BUFFER, ObjBuffers[obj][PosBuffer]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*posCoords*vertices.size(), vertices.data(), GL_STATIC_DRAW);
+    gl_bind_buffer(GL_ARRAY_BUFFER, ObjBuffers[obj][NormBuffer]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*normCoords*normals.size(), normals.data(), GL_STATIC_DRAW);
+    gl_bind_buffer(GL_ARRAY_BUFFER, ObjBuffers[obj][TexBuffer]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*texCoords*uvCoords.size(), uvCoords.data(), GL_STATIC_DRAW);
+    gl_bind_buffer(GL_ARRAY_BUFFER, 0);
+    register_mesh_buffers(obj, vertices.size(), false);
 
 }
 
+// Record an object's attribute buffers (tangents only for bump mapped objects)
+void register_mesh_buffers(GLuint obj, GLuint num_vertices, GLboolean tangents) {
+    const char *owner = scene.string(scene.meshes[obj].path);
+    register_buffer(ObjBuffers[obj][PosBuffer], ResMeshBuffers, owner, sizeof(GLfloat)*posCoords*num_vertices);
+    register_buffer(ObjBuffers[obj][NormBuffer], ResMeshBuffers, owner, sizeof(GLfloat)*normCoords*num_vertices);
+    register_buffer(ObjBuffers[obj][TexBuffer], ResMeshBuffers, owner, sizeof(GLfloat)*texCoords*num_vertices);
+    if (tangents) {
+        register_buffer(ObjBuffers[obj][TangBuffer], ResMeshBuffers, owner, sizeof(GLfloat)*tangCoords*num_vertices);
+    }
+}
+
 // Draw object with color
 void draw_color_obj(GLuint obj, GLuint color) {
 
     // Select default shader program
-    glUseProgram(default_program);
+    gl_use_program(default_program);
 
     // Pass projection matrix to default shader
-    glUniformMatrix4fv(default_proj_mat_loc, 1, GL_FALSE, proj_matrix);
+    gl_uniform_matrix4fv(default_proj_mat_loc, 1, proj_matrix);
 
     // Pass camera matrix to default shader
-    glUniformMatrix4fv(default_cam_mat_loc, 1, GL_FALSE, camera_matrix);
+    gl_uniform_matrix4fv(default_cam_mat_loc, 1, camera_matrix);
 
     // Pass model matrix to default shader
-    glUniformMatrix4fv(default_model_mat_loc, 1, GL_FALSE, model_matrix);
+    gl_uniform_matrix4fv(default_model_mat_loc, 1, model_matrix);
 
     // Bind vertex array
-    glBindVertexArray(VAOs[obj]);
-
-    // Bind position object buffer and set attributes for default shader
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[obj][PosBuffer]);
-    glVertexAttribPointer(default_vPos, posCoords, GL_FLOAT, GL_FALSE, 0, NULL);
-    glEnableVertexAttribArray(default_vPos);
+    gl_bind_vertex_array(VAOs[obj]);
 
-    // Bind color buffer and set attributes for default shader
-    glBindBuffer(GL_ARRAY_BUFFER, ColorBuffers[color]);
-    glVertexAttribPointer(default_vCol, colCoords, GL_FLOAT, GL_FALSE, 0, NULL);
-    glEnableVertexAttribArray(default_vCol);
+    // Position and color attributes for default shader
+    gl_vertex_attrib(default_vPos, ObjBuffers[obj][PosBuffer], posCoords);
+    gl_vertex_attrib(default_vCol, ColorBuffers[color], colCoords);
 
-    // Draw object
-    glDrawArrays(GL_TRIANGLES, 0, numVertices[obj]);
+    // Draw object at the level of detail for its screen size, unless occluded last frame
+    draw_object(obj);
 }
 void draw_bump_object(GLuint obj, GLuint base_texture, GLuint normal_map){
-    // Select shader program
-    glUseProgram(bump_program);
+    // Select shader program (light block and sampler units are set at link time)
+    gl_use_program(bump_program);
 
     // Pass projection and camera matrices to shader
-    glUniformMatrix4fv(bump_proj_mat_loc, 1, GL_FALSE, proj_matrix);
-    glUniformMatrix4fv(bump_camera_mat_loc, 1, GL_FALSE, camera_matrix);
+    gl_uniform_matrix4fv(bump_proj_mat_loc, 1, proj_matrix);
+    gl_uniform_matrix4fv(bump_camera_mat_loc, 1, camera_matrix);
 
     // Bind lights
-    glUniformBlockBinding(bump_program, bump_lights_block_idx, 0);
-    glBindBufferRange(GL_UNIFORM_BUFFER, 0, LightBuffers[LightBuffer], 0, Lights.size() * sizeof(LightProperties));
+    gl_bind_buffer_range(GL_UNIFORM_BUFFER, 0, LightBuffers[LightBuffer], 0, shader_max_lights*sizeof(LightProperties));
 
     // Set camera position
-    glUniform3fv(bump_eye_loc, 1, eye);
+    gl_uniform_3fv(bump_eye_loc, 1, eye);
 
     // Set num lights and lightOn
-    glUniform1i(bump_num_lights_loc, numLights);
-    glUniform1iv(bump_light_on_loc, numLights, lightOn);
+    gl_uniform_1i(bump_num_lights_loc, numLights);
+    gl_uniform_1iv(bump_light_on_loc, numLights, lightOn.data());
 
     // Pass model matrix and normal matrix to shader
-    glUniformMatrix4fv(bump_model_mat_loc, 1, GL_FALSE, model_matrix);
-    glUniformMatrix4fv(bump_norm_mat_loc, 1, GL_FALSE, normal_matrix);
-
-    // Set base texture to texture unit 0 and make it active
-    glUniform1i(bump_base_loc, 0);
-    glActiveTexture(GL_TEXTURE0);
-    // Bind base texture (to unit 0)
-    glBindTexture(GL_TEXTURE_2D, TextureIDs[base_texture]);
+    gl_uniform_matrix4fv(bump_model_mat_loc, 1, model_matrix);
+    gl_uniform_matrix4fv(bump_norm_mat_loc, 1, normal_matrix);
 
-    //    // Set normal map texture to texture unit 1 and make it active
-    glUniform1i(bump_norm_loc, 1);
-    glActiveTexture(GL_TEXTURE1);
-    // Bind normal map texture (to unit 1)
-    glBindTexture(GL_TEXTURE_2D, TextureIDs[normal_map]);
+    // Bind base texture to unit 0 and normal map to unit 1
+    gl_bind_texture(0, GL_TEXTURE_2D, TextureIDs[base_texture]);
+    gl_bind_texture(1, GL_TEXTURE_2D, TextureIDs[normal_map]);
 
     // Bind vertex array
-    glBindVertexArray(VAOs[obj]);
-
-    // Bind position object buffer and set attributes
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[obj][PosBuffer]);
-    glVertexAttribPointer(bump_vPos, posCoords, GL_FLOAT, GL_FALSE, 0, NULL);
-    glEnableVertexAttribArray(bump_vPos);
-
-    // Bind normal object buffer and set attributes
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[obj][NormBuffer]);
-    glVertexAttribPointer(bump_vNorm, normCoords, GL_FLOAT, GL_FALSE, 0, NULL);
-    glEnableVertexAttribArray(bump_vNorm);
-
-    // Bind texture object buffer and set attributes
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[obj][TexBuffer]);
-    glVertexAttribPointer(bump_vTex, texCoords, GL_FLOAT, GL_FALSE, 0, NULL);
-    glEnableVertexAttribArray(bump_vTex);
-
-    // Bind tangent object buffer and set attributes
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[obj][TangBuffer]);
-    glVertexAttribPointer(bump_vTang, tangCoords, GL_FLOAT, GL_FALSE, 0, NULL);
-    glEnableVertexAttribArray(bump_vTang);
-
-    // Bind bitangent object buffer and set attributes
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[obj][BiTangBuffer]);
-    glVertexAttribPointer(bump_vBiTang, bitangCoords, GL_FLOAT, GL_FALSE, 0, NULL);
-    glEnableVertexAttribArray(bump_vBiTang);
-
-    // Draw object
-    glDrawArrays(GL_TRIANGLES, 0, numVertices[obj]);
+    gl_bind_vertex_array(VAOs[obj]);
+
+    // Position, normal, texture and tangent attributes
+    gl_vertex_attrib(bump_vPos, ObjBuffers[obj][PosBuffer], posCoords);
+    gl_vertex_attrib(bump_vNorm, ObjBuffers[obj][NormBuffer], normCoords);
+    gl_vertex_attrib(bump_vTex, ObjBuffers[obj][TexBuffer], texCoords);
+    gl_vertex_attrib(bump_vTang, ObjBuffers[obj][TangBuffer], tangCoords);
+
+    // Draw object at the level of detail for its screen size, unless occluded last frame
+    draw_object(obj);
 }
 
 void draw_mat_object(GLuint obj, GLuint material){
-    // Select shader program
-    glUseProgram(lighting_program);
+    // Select shader program (light and material blocks are set at link time)
+    gl_use_program(lighting_program);
 
     // Pass projection and camera matrices to shader
-    glUniformMatrix4fv(lighting_proj_mat_loc, 1, GL_FALSE, proj_matrix);
-    glUniformMatrix4fv(lighting_camera_mat_loc, 1, GL_FALSE, camera_matrix);
+    gl_uniform_matrix4fv(lighting_proj_mat_loc, 1, proj_matrix);
+    gl_uniform_matrix4fv(lighting_camera_mat_loc, 1, camera_matrix);
 
     // Bind lights
-    glUniformBlockBinding(lighting_program, lighting_lights_block_idx, 0);
-    glBindBufferRange(GL_UNIFORM_BUFFER, 0, LightBuffers[LightBuffer], 0, Lights.size()*sizeof(LightProperties));
+    gl_bind_buffer_range(GL_UNIFORM_BUFFER, 0, LightBuffers[LightBuffer], 0, shader_max_lights*sizeof(LightProperties));
 
     // Bind materials
-    glUniformBlockBinding(lighting_program, lighting_materials_block_idx, 1);
-    glBindBufferRange(GL_UNIFORM_BUFFER, 1, MaterialBuffers[MaterialBuffer], 0, Materials.size()*sizeof(MaterialProperties));
+    gl_bind_buffer_range(GL_UNIFORM_BUFFER, 1, MaterialBuffers[MaterialBuffer], 0, shader_max_materials*sizeof(MaterialProperties));
 
     // Set camera position
-    glUniform3fv(lighting_eye_loc, 1, eye);
+    gl_uniform_3fv(lighting_eye_loc, 1, eye);
 
     // Set num lights and lightOn
-    glUniform1i(lighting_num_lights_loc, numLights);
-    glUniform1iv(lighting_light_on_loc, numLights, lightOn);
+    gl_uniform_1i(lighting_num_lights_loc, numLights);
+    gl_uniform_1iv(lighting_light_on_loc, numLights, lightOn.data());
 
     // Pass model matrix and normal matrix to shader
-    glUniformMatrix4fv(lighting_model_mat_loc, 1, GL_FALSE, model_matrix);
-    glUniformMatrix4fv(lighting_norm_mat_loc, 1, GL_FALSE, normal_matrix);
+    gl_uniform_matrix4fv(lighting_model_mat_loc, 1, model_matrix);
+    gl_uniform_matrix4fv(lighting_norm_mat_loc, 1, normal_matrix);
 
     // Pass material index to shader
-    glUniform1i(lighting_material_loc, material);
+    gl_uniform_1i(lighting_material_loc, material);
 
     // Bind vertex array
-    glBindVertexArray(VAOs[obj]);
+    gl_bind_vertex_array(VAOs[obj]);
 
-    // Bind position object buffer and set attributes
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[obj][PosBuffer]);
-    glVertexAttribPointer(lighting_vPos, posCoords, GL_FLOAT, GL_FALSE, 0, NULL);
-    glEnableVertexAttribArray(lighting_vPos);
+    // Position and normal attributes
+    gl_vertex_attrib(lighting_vPos, ObjBuffers[obj][PosBuffer], posCoords);
+    gl_vertex_attrib(lighting_vNorm, ObjBuffers[obj][NormBuffer], normCoords);
 
-    // Bind normal object buffer and set attributes
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[obj][NormBuffer]);
-    glVertexAttribPointer(lighting_vNorm, normCoords, GL_FLOAT, GL_FALSE, 0, NULL);
-    glEnableVertexAttribArray(lighting_vNorm);
-
-    // Draw object
-    glDrawArrays(GL_TRIANGLES, 0, numVertices[obj]);
+    // Draw object at the level of detail for its screen size, unless occluded last frame
+    draw_object(obj);
 }
 
 
+void draw_baked_object(GLuint obj, GLuint baked, GLuint material){
+    // Select shader program (lightmap sampler unit is set at link time)
+    gl_use_program(baked_program);
+
+    // Pass projection, camera and model matrices to shader
+    gl_uniform_matrix4fv(baked_proj_mat_loc, 1, proj_matrix);
+    gl_uniform_matrix4fv(baked_camera_mat_loc, 1, camera_matrix);
+    gl_uniform_matrix4fv(baked_model_mat_loc, 1, model_matrix);
+
+    // Set num lights and lightOn (picks the baked layers to sum)
+    gl_uniform_1i(baked_num_lights_loc, numLights);
+    gl_uniform_1iv(baked_light_on_loc, numLights, lightOn.data());
+    gl_uniform_1f(baked_alpha_loc, Materials[material].ambient[3]);
+
+    // Bind lightmaps to texture unit 0
+    gl_bind_texture(0, GL_TEXTURE_2D_ARRAY, LightmapTex);
+
+    // Bind the instance's vertex array (mesh positions plus its lightmap coordinates)
+    gl_bind_vertex_array(lightmapVAOs[baked]);
+
+    // Lightmap coordinates only exist for the full detail mesh
+    draw_object_lod(obj, 0);
+}
+
 void draw_multi_tex_object(GLuint obj, GLuint texture1, GLuint texture2){
-    // Select shader program
-    glUseProgram(multi_tex_program);
+    // Select shader program (sampler units are set at link time)
+    gl_use_program(multi_tex_program);
 
     // Pass projection matrix to shader
-    glUniformMatrix4fv(multi_tex_proj_mat_loc, 1, GL_FALSE, proj_matrix);
+    gl_uniform_matrix4fv(multi_tex_proj_mat_loc, 1, proj_matrix);
 
     // Pass camera matrix to shader
-    glUniformMatrix4fv(multi_tex_camera_mat_loc, 1, GL_FALSE, camera_matrix);
+    gl_uniform_matrix4fv(multi_tex_camera_mat_loc, 1, camera_matrix);
 
     // Pass model matrix to shader
-    glUniformMatrix4fv(multi_tex_model_mat_loc, 1, GL_FALSE, model_matrix);
+    gl_uniform_matrix4fv(multi_tex_model_mat_loc, 1, model_matrix);
 
-    // Set base texture to texture unit 0 and make it active
-    glUniform1i(multi_tex_base_loc, 0);
-    glActiveTexture(GL_TEXTURE0);
-    // Bind base texture (to unit 0)
-    glBindTexture(GL_TEXTURE_2D, TextureIDs[texture1]);
-
-    // Set second texture to texture unit 1 and make it active
-    glUniform1i(multi_tex_dirt_loc, 1);
-    glActiveTexture(GL_TEXTURE1);
-    // Bind second texture (to unit 1)
-    glBindTexture(GL_TEXTURE_2D, TextureIDs[texture2]);
+    // Bind base texture to unit 0 and second texture to unit 1
+    gl_bind_texture(0, GL_TEXTURE_2D, TextureIDs[texture1]);
+    gl_bind_texture(1, GL_TEXTURE_2D, TextureIDs[texture2]);
 
     // Bind vertex array
-    glBindVertexArray(VAOs[obj]);
-
-    // Bind position object buffer and set attributes
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[obj][PosBuffer]);
-    glVertexAttribPointer(multi_tex_vPos, posCoords, GL_FLOAT, GL_FALSE, 0, NULL);
-    glEnableVertexAttribArray(multi_tex_vPos);
+    gl_bind_vertex_array(VAOs[obj]);
 
-    // Bind texture object buffer and set attributes
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[obj][TexBuffer]);
-    glVertexAttribPointer(multi_tex_vTex, texCoords, GL_FLOAT, GL_FALSE, 0, NULL);
-    glEnableVertexAttribArray(multi_tex_vTex);
+    // Position and texture attributes
+    gl_vertex_attrib(multi_tex_vPos, ObjBuffers[obj][PosBuffer], posCoords);
+    gl_vertex_attrib(multi_tex_vTex, ObjBuffers[obj][TexBuffer], texCoords);
 
-    // Draw object
-    glDrawArrays(GL_TRIANGLES, 0, numVertices[obj]);
+    // Draw object at the level of detail for its screen size, unless occluded last frame
+    draw_object(obj);
 }
 void draw_tex_object(GLuint obj, GLuint texture){
     // Select shader program
-    glUseProgram(texture_program);
+    gl_use_program(texture_program);
 
     // Pass projection matrix to shader
-    glUniformMatrix4fv(texture_proj_mat_loc, 1, GL_FALSE, proj_matrix);
+    gl_uniform_matrix4fv(texture_proj_mat_loc, 1, proj_matrix);
 
     // Pass camera matrix to shader
-    glUniformMatrix4fv(texture_camera_mat_loc, 1, GL_FALSE, camera_matrix);
+    gl_uniform_matrix4fv(texture_camera_mat_loc, 1, camera_matrix);
 
     // Pass model matrix to shader
-    glUniformMatrix4fv(texture_model_mat_loc, 1, GL_FALSE, model_matrix);
+    gl_uniform_matrix4fv(texture_model_mat_loc, 1, model_matrix);
 
     // Bind texture
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, TextureIDs[texture]);
+    gl_bind_texture(0, GL_TEXTURE_2D, TextureIDs[texture]);
 
     // Bind vertex array
-    glBindVertexArray(VAOs[obj]);
+    gl_bind_vertex_array(VAOs[obj]);
 
-    // Bind position object buffer and set attributes
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[obj][PosBuffer]);
-    glVertexAttribPointer(texture_vPos, posCoords, GL_FLOAT, GL_FALSE, 0, NULL);
-    glEnableVertexAttribArray(texture_vPos);
+    // Position and texture attributes
+    gl_vertex_attrib(texture_vPos, ObjBuffers[obj][PosBuffer], posCoords);
+    gl_vertex_attrib(texture_vTex, ObjBuffers[obj][TexBuffer], texCoords);
 
-    // Bind texture object buffer and set attributes
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[obj][TexBuffer]);
-    glVertexAttribPointer(texture_vTex, texCoords, GL_FLOAT, GL_FALSE, 0, NULL);
-    glEnableVertexAttribArray(texture_vTex);
-
-    // Draw object
-    glDrawArrays(GL_TRIANGLES, 0, numVertices[obj]);
+    // Draw object at the level of detail for its screen size, unless occluded last frame
+    draw_object(obj);
 }
 
 
 
 void framebuffer_size_callback(GLFWwindow *window, int width, int height) {
-    glViewport(0, 0, width, height);
+    gl_viewport(0, 0, width, height);
 
     ww = width;
     hh = height;
+
+    // Resize offscreen scene and redraw
+    update_render_size();
+    resize_scene_framebuffer();
+    scene_dirty = true;
 }
 
+
+GLuint load_sized_shaders(ShaderInfo *shaders) {
+    // Like LoadShaders, with the shader light and material array sizes defined after the #version line
+    char defines[96];
+    snprintf(defines, sizeof(defines), "#define MAX_LIGHTS %d\n#define MAX_MATERIALS %d\n", shader_max_lights,
+             shader_max_materials);
+    GLuint program = glCreateProgram();
+    for (ShaderInfo *info = shaders; info->type != GL_NONE; info++) {
+        FILE *file = fopen(info->filename, "rb");
+        if (!file) {
+            fprintf(stderr, "ERROR: could not open shader %s\n", info->filename);
+            glDeleteProgram(program);
+            return 0;
+        }
+        string source;
+        char buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+            source.append(buf, n);
+        }
+        fclose(file);
+        size_t line_end = source.find('\n');
+        source.insert((line_end == string::npos) ? source.size() : line_end + 1, defines);
+
+        GLuint shader = glCreateShader(info->type);
+        const GLchar *text = source.c_str();
+        glShaderSource(shader, 1, &text, NULL);
+        glCompileShader(shader);
+        GLint compiled;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+        if (!compiled) {
+            GLchar log[1024];
+            glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+            fprintf(stderr, "ERROR: %s failed to compile:\n%s\n", info->filename, log);
+            glDeleteShader(shader);
+            glDeleteProgram(program);
+            return 0;
+        }
+        // Freed with the program
+        glAttachShader(program, shader);
+        glDeleteShader(shader);
+        info->shader = shader;
+    }
+
+    glLinkProgram(program);
+    GLint linked;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        GLchar log[1024];
+        glGetProgramInfoLog(program, sizeof(log), NULL, log);
+        fprintf(stderr, "ERROR: shader program failed to link:\n%s\n", log);
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}